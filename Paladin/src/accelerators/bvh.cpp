@@ -36,11 +36,42 @@ inline uint32_t LeftShift3(uint32_t x) {
     return x;
 }
 
+/**
+ * 包围盒从b0线性插值到b1的过程中，表面积对时间的平均值
+ * 插值包围盒的表面积是t的二次函数，辛普森公式可以精确求出
+ * 静止时b0与b1相同，结果就是表面积
+ */
+inline Float motionSurfaceArea(const AABB3f &b0, const AABB3f &b1) {
+    AABB3f bMid(.5f * (b0.pMin + b1.pMin), .5f * (b0.pMax + b1.pMax));
+    return (b0.surfaceArea() + 4 * bMid.surfaceArea() + b1.surfaceArea()) / 6;
+}
+
 AABB3f BVHAccel::worldBound() const {
-    return _nodes ? _nodes[0].bounds : AABB3f();
+    if (!_nodes) {
+        return AABB3f();
+    }
+    // 插值结果一定在两个端点包围盒的并集之内
+    return _nodeBounds1
+            ? unionSet(_nodes[0].bounds, _nodeBounds1[0])
+            : _nodes[0].bounds;
 }
 
 bool BVHAccel::intersect(const paladin::Ray &ray, paladin::SurfaceInteraction *isect) const {
+    HitRecord record;
+    if (!intersectHit(ray, &record, isect)) {
+        return false;
+    }
+    // 遍历过程中只记录了最近交点的参数，这里构造一次完整的交点
+    finishHit(ray, record, isect);
+    return true;
+}
+
+/**
+ * 遍历过程与intersect相同，但对图元调用intersectHit，
+ * 支持延迟构造的图元在遍历过程中只更新record，不写isect
+ */
+bool BVHAccel::intersectHit(const Ray &ray, HitRecord *record,
+                            SurfaceInteraction *isect) const {
     if (!_nodes) {
         return false;
     }
@@ -48,17 +79,18 @@ bool BVHAccel::intersect(const paladin::Ray &ray, paladin::SurfaceInteraction *i
     bool hit = false;
     Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    Float dt = motionFraction(ray.time);
 
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
     while (true) {
         const LinearBVHNode *node = &_nodes[currentNodeIndex];
 
-        if (node->bounds.intersectP(ray, invDir, dirIsNeg)) {
+        if (intersectNode(currentNodeIndex, dt, ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
      
                 for (int i = 0; i < node->nPrimitives; ++i)
-                    if (_primitives[node->primitivesOffset + i]->intersect(ray, isect)) {
+                    if (_primitives[node->primitivesOffset + i]->intersectHit(ray, record, isect)) {
                         hit = true;
                     }
                 if (toVisitOffset == 0) {
@@ -86,7 +118,76 @@ bool BVHAccel::intersect(const paladin::Ray &ray, paladin::SurfaceInteraction *i
 }
 
 BVHAccel::~BVHAccel() {
-    
+    freeAligned(_nodes);
+    freeAligned(_nodeBounds1);
+}
+
+/**
+ * 遍历过程与intersectP相同，但找到交点之后不提前返回，也不缩短光线
+ * 同一个图元上可能有多个交点，例如球体的入射点与出射点，
+ * 所以从交点处继续向终点发射光线，直到没有交点为止
+ */
+int BVHAccel::intersectAll(const Ray &ray, MemoryArena &arena,
+                           IntersectionChain **chain) const {
+    if (!_nodes) {
+        return 0;
+    }
+    Vector3f invDir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    Float dt = motionFraction(ray.time);
+    Point3f pEnd = ray.at(ray.tMax);
+
+    int nFound = 0;
+    // 没有命中的节点留给下一个图元使用，避免浪费arena的内存
+    IntersectionChain *spare = nullptr;
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &_nodes[currentNodeIndex];
+        if (intersectNode(currentNodeIndex, dt, ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                for (int i = 0; i < node->nPrimitives; ++i) {
+                    const Primitive *prim = _primitives[node->primitivesOffset + i].get();
+                    Ray r = ray;
+                    while (true) {
+                        if (spare == nullptr) {
+                            spare = ARENA_ALLOC(arena, IntersectionChain)();
+                        }
+                        if (!prim->intersect(r, &spare->si)) {
+                            break;
+                        }
+                        IntersectionChain *hit = spare;
+                        spare = nullptr;
+                        hit->next = *chain;
+                        *chain = hit;
+                        ++nFound;
+                        r = hit->si.spawnRayTo(pEnd);
+                        if (r.dir == Vector3f(0, 0, 0)) {
+                            break;
+                        }
+                    }
+                }
+                if (toVisitOffset == 0) {
+                    break;
+                }
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return nFound;
 }
 
 /*
@@ -102,6 +203,7 @@ bool BVHAccel::intersectP(const paladin::Ray &ray) const {
     }
     Vector3f invDir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    Float dt = motionFraction(ray.time);
 
     // 即将访问的节点，栈结构
     int nodesToVisit[64];
@@ -115,7 +217,7 @@ bool BVHAccel::intersectP(const paladin::Ray &ray) const {
     // 从根节点开始遍历
     while (true) {
         const LinearBVHNode *node = &_nodes[currentNodeIndex];
-        if (node->bounds.intersectP(ray, invDir, dirIsNeg)) {
+        if (intersectNode(currentNodeIndex, dt, ray, invDir, dirIsNeg)) {
             
             if (node->nPrimitives > 0) {
                 // 叶子节点
@@ -158,7 +260,8 @@ bool BVHAccel::intersectP(const paladin::Ray &ray) const {
 }
 
 BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
-                   int maxPrimsInNode, SplitMethod splitMethod)
+                   int maxPrimsInNode, SplitMethod splitMethod,
+                   bool motionBlur)
 : _maxPrimsInNode(std::min(255, maxPrimsInNode)),
 _splitMethod(splitMethod),
 _primitives(std::move(p)) {
@@ -171,9 +274,33 @@ _primitives(std::move(p)) {
     
     std::vector<BVHPrimitiveInfo> _primitiveInfo(_primitives.size());
 
+    // 所有运动图元的时间区间的并集
+    bool hasMotion = false;
+    if (motionBlur) {
+        _time0 = Infinity;
+        _time1 = -Infinity;
+        for (const auto &prim : _primitives) {
+            Float t0, t1;
+            if (prim->getMotionRange(&t0, &t1)) {
+                _time0 = std::min(_time0, t0);
+                _time1 = std::max(_time1, t1);
+            }
+        }
+        hasMotion = _time1 > _time0;
+        if (!hasMotion) {
+            _time0 = _time1 = 0;
+        }
+    }
+
     // 储存每个aabb的中心以及索引
     for (size_t i = 0; i < _primitives.size(); ++i) {
-        _primitiveInfo[i] = {i, _primitives[i]->worldBound()};
+        if (hasMotion) {
+            AABB3f b0, b1;
+            _primitives[i]->motionBounds(_time0, _time1, &b0, &b1);
+            _primitiveInfo[i] = {i, b0, b1};
+        } else {
+            _primitiveInfo[i] = {i, _primitives[i]->worldBound()};
+        }
     }
 
     // 先使用内存池分配指定大小空间，函数运行结束之后自动释放
@@ -197,6 +324,10 @@ _primitives(std::move(p)) {
     
     
     _nodes = allocAligned<LinearBVHNode>(totalNodes);
+    if (hasMotion) {
+        _nodeBounds1 = allocAligned<AABB3f>(totalNodes);
+        _invTimeRange = 1 / (_time1 - _time0);
+    }
     int offset = 0;
     // 将二叉树结构的bvh转换成连续储存结构
     flattenBVHTree(root, &offset);
@@ -205,9 +336,10 @@ _primitives(std::move(p)) {
 
 BVHBuildNode * BVHAccel::recursiveBuild(paladin::MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end, int *totalNodes, std::vector<std::shared_ptr<Primitive> > &orderedPrims) {
     BVHBuildNode *node = ARENA_ALLOC(arena, BVHBuildNode);
-    AABB3f bounds;
+    AABB3f bounds0, bounds1;
     for (int i = start; i < end; ++ i) {
-        bounds = unionSet(bounds, primitiveInfo[i].bounds);
+        bounds0 = unionSet(bounds0, primitiveInfo[i].bounds0);
+        bounds1 = unionSet(bounds1, primitiveInfo[i].bounds1);
     }
     (*totalNodes)++;
     int numPrimitives = end - start;
@@ -216,7 +348,7 @@ BVHBuildNode * BVHAccel::recursiveBuild(paladin::MemoryArena &arena, std::vector
         int firstPrimOffset = orderedPrims.size();
         int primNum = primitiveInfo[start].primitiveNumber;
         orderedPrims.push_back(_primitives[primNum]);
-        node->initLeaf(firstPrimOffset, numPrimitives, bounds);
+        node->initLeaf(firstPrimOffset, numPrimitives, bounds0, bounds1);
         return node;
     } else {
         AABB3f centroidBounds;
@@ -233,7 +365,7 @@ BVHBuildNode * BVHAccel::recursiveBuild(paladin::MemoryArena &arena, std::vector
                 int primNum = primitiveInfo[i].primitiveNumber;
                 orderedPrims.push_back(_primitives[primNum]);
             }
-            node->initLeaf(firstPrimOffset, numPrimitives, bounds);
+            node->initLeaf(firstPrimOffset, numPrimitives, bounds0, bounds1);
             return node;
         } else {
             switch (_splitMethod) {
@@ -292,71 +424,113 @@ BVHBuildNode * BVHAccel::recursiveBuild(paladin::MemoryArena &arena, std::vector
                     } else {
                         // 在范围最广的维度上等距离添加n-1个平面
                         // 把空间分为n个部分，可以理解为n个桶
+                        // 运动场景中光线与节点相交的概率正比于插值包围盒的平均表面积
+                        // 所以记录t0,t1两个时刻的包围盒
                         struct BucketInfo {
                             int count = 0;
-                            AABB3f bounds;
+                            AABB3f bounds0, bounds1;
                         };
                         // 默认12个桶
                         CONSTEXPR int nBuckets = 12;
-                        BucketInfo buckets[nBuckets];
-                        // 统计每个桶中的bounds以及片元数量
-                        for (int i = start; i < end; ++i) {
-                            int b = nBuckets * centroidBounds.offset(primitiveInfo[i].centroid)[maxDim];
-                            if (b == nBuckets) {
-                                b = nBuckets - 1;
-                            }
-                            buckets[b].count++;
-                            buckets[b].bounds = unionSet(buckets[b].bounds, primitiveInfo[i].bounds);
-                        }
+                        auto spatialBucket = [=](const BVHPrimitiveInfo &pi) {
+                            int b = nBuckets * centroidBounds.offset(pi.centroid)[maxDim];
+                            return b == nBuckets ? nBuckets - 1 : b;
+                        };
                         
                         // 找出最优的分割方式，目前假设12个桶，则分割方式有11种
                         // 1与11，2与10，3与9，等等11个组合，估计出每个组合的计算耗时
                         // 从而找出最优的分割方式
-                        Float cost[nBuckets - 1];
-                        for (int i = 0; i < nBuckets - 1; ++i) {
-                            AABB3f b0, b1;
-                            int count0 = 0, count1 = 0;
-                            // 计算第一部分
-                            for (int j = 0; j <= i; ++j) {
-                                b0 = unionSet(b0, buckets[j].bounds);
-                                count0 += buckets[j].count;
+                        auto findBestSplit = [&](const BucketInfo *buckets, Float *minCost, int *minCostSplitBucket) {
+                            Float cost[nBuckets - 1];
+                            for (int i = 0; i < nBuckets - 1; ++i) {
+                                AABB3f b0t0, b0t1, b1t0, b1t1;
+                                int count0 = 0, count1 = 0;
+                                // 计算第一部分
+                                for (int j = 0; j <= i; ++j) {
+                                    b0t0 = unionSet(b0t0, buckets[j].bounds0);
+                                    b0t1 = unionSet(b0t1, buckets[j].bounds1);
+                                    count0 += buckets[j].count;
+                                }
+                                // 计算第二部分
+                                for (int j = i + 1; j < nBuckets; ++j) {
+                                    b1t0 = unionSet(b1t0, buckets[j].bounds0);
+                                    b1t1 = unionSet(b1t1, buckets[j].bounds1);
+                                    count1 += buckets[j].count;
+                                }
+                                
+                                // 参见公式  C(A,B) = t1 + p(A) * C(A) + p(B) * C(B)
+                                // p(A) = S(A) / S, p(B) = S(B) / S
+                                // 概率与表面积成正比，耗时与片元个数成，
+                                // 假设C(A) = count(A)
+                                // 则可以写成以下形式
+                                
+                                // 第一部分的总面积
+                                Float s0 = count0 * motionSurfaceArea(b0t0, b0t1);
+                                // 第二部分的总面积
+                                Float s1 = count1 * motionSurfaceArea(b1t0, b1t1);
+                                // pbrt最新代码把0.125改成了1
+                                cost[i] = 1 + (s0 + s1) / motionSurfaceArea(bounds0, bounds1);
                             }
-                            // 计算第二部分
-                            for (int j = i + 1; j < nBuckets; ++j) {
-                                b1 = unionSet(b1, buckets[j].bounds);
-                                count1 += buckets[j].count;
+                            
+                            // 找到最小耗时的分割方式
+                            *minCost = cost[0];
+                            *minCostSplitBucket = 0;
+                            for (int i = 1; i < nBuckets - 1; ++i) {
+                                if (cost[i] < *minCost) {
+                                    *minCost = cost[i];
+                                    *minCostSplitBucket = i;
+                                }
                             }
-
-                            // 参见公式  C(A,B) = t1 + p(A) * C(A) + p(B) * C(B)
-                            // p(A) = S(A) / S, p(B) = S(B) / S
-                            // 概率与表面积成正比，耗时与片元个数成，
-                            // 假设C(A) = count(A)
-                            // 则可以写成以下形式
-
-                            // 第一部分的总面积
-                            Float s0 = count0 * b0.surfaceArea();
-                            // 第二部分的总面积
-                            Float s1 = count1 * b1.surfaceArea();
-                            // pbrt最新代码把0.125改成了1
-                            cost[i] = 1 + (s0 + s1) / bounds.surfaceArea();
+                        };
+                        
+                        BucketInfo buckets[nBuckets];
+                        // 统计每个桶中的bounds以及片元数量
+                        for (int i = start; i < end; ++i) {
+                            int b = spatialBucket(primitiveInfo[i]);
+                            buckets[b].count++;
+                            buckets[b].bounds0 = unionSet(buckets[b].bounds0, primitiveInfo[i].bounds0);
+                            buckets[b].bounds1 = unionSet(buckets[b].bounds1, primitiveInfo[i].bounds1);
                         }
+                        Float minCost;
+                        int minCostSplitBucket;
+                        findBestSplit(buckets, &minCost, &minCostSplitBucket);
                         
-                        // 找到最小耗时的分割方式
-                        Float minCost = cost[0];
-                        int minCostSplitBucket = 0;
-                        for (int i = 1; i < nBuckets - 1; ++i) {
-                            if (cost[i] < minCost) {
-                                minCost = cost[i];
-                                minCostSplitBucket = i;
+                        // 运动场景中再尝试按照运动距离划分
+                        // 快速运动的图元中间时刻的位置与附近的静止图元相同，按空间位置划分分不开，
+                        // 与静止图元放在同一个节点会把节点在t0,t1时刻的包围盒拉大
+                        bool splitByMotion = false;
+                        Float motionMin = Infinity, motionMax = -Infinity;
+                        if (_time1 > _time0) {
+                            for (int i = start; i < end; ++i) {
+                                motionMin = std::min(motionMin, primitiveInfo[i].motion);
+                                motionMax = std::max(motionMax, primitiveInfo[i].motion);
+                            }
+                        }
+                        auto motionBucket = [=](const BVHPrimitiveInfo &pi) {
+                            int b = nBuckets * (pi.motion - motionMin) / (motionMax - motionMin);
+                            return b == nBuckets ? nBuckets - 1 : b;
+                        };
+                        if (motionMax > motionMin) {
+                            BucketInfo motionBuckets[nBuckets];
+                            for (int i = start; i < end; ++i) {
+                                int b = motionBucket(primitiveInfo[i]);
+                                motionBuckets[b].count++;
+                                motionBuckets[b].bounds0 = unionSet(motionBuckets[b].bounds0, primitiveInfo[i].bounds0);
+                                motionBuckets[b].bounds1 = unionSet(motionBuckets[b].bounds1, primitiveInfo[i].bounds1);
+                            }
+                            Float motionCost;
+                            int motionSplitBucket;
+                            findBestSplit(motionBuckets, &motionCost, &motionSplitBucket);
+                            if (motionCost < minCost) {
+                                minCost = motionCost;
+                                minCostSplitBucket = motionSplitBucket;
+                                splitByMotion = true;
                             }
                         }
                         // 假设叶子节点的求交耗时等于片元个数
                         Float leafCost = numPrimitives;
                         auto func = [=](const BVHPrimitiveInfo &pi) {
-                            int b = nBuckets * centroidBounds.offset(pi.centroid)[maxDim];
-                            if (b == nBuckets) {
-                                b = nBuckets - 1;
-                            }
+                            int b = splitByMotion ? motionBucket(pi) : spatialBucket(pi);
                             CHECK_GE(b, 0);
                             CHECK_LT(b, nBuckets);
                             return b <= minCostSplitBucket;
@@ -376,7 +550,7 @@ BVHBuildNode * BVHAccel::recursiveBuild(paladin::MemoryArena &arena, std::vector
                                 int primNum = primitiveInfo[i].primitiveNumber;
                                 orderedPrims.push_back(_primitives[primNum]);
                             }
-                            node->initLeaf(firstPrimOffset, numPrimitives, bounds);
+                            node->initLeaf(firstPrimOffset, numPrimitives, bounds0, bounds1);
                             return node;
                         }
                     }
@@ -412,6 +586,11 @@ BVHBuildNode * BVHAccel::emitLBVH(paladin::BVHBuildNode *&buildNodes, const std:
 int BVHAccel::flattenBVHTree(paladin::BVHBuildNode *node, int *offset) {
     LinearBVHNode *linearNode = &_nodes[*offset];
     linearNode->bounds = node->bounds;
+    linearNode->moving = 0;
+    if (_nodeBounds1) {
+        _nodeBounds1[*offset] = node->bounds1;
+        linearNode->moving = node->bounds != node->bounds1;
+    }
     int myOffset = (*offset)++;
     if (node->nPrimitives > 0) {
         // 初始化叶子节点
@@ -432,8 +611,11 @@ int BVHAccel::flattenBVHTree(paladin::BVHBuildNode *node, int *offset) {
 
 //"param" : {
 //    "maxPrimsInNode" : 1,
-//    "splitMethod" : "SAH"
+//    "splitMethod" : "SAH",
+//    "motionBlur" : true
 //}
+// motionBlur为true时，如果场景中有运动图元，则构建运动模糊的BVH
+// 为false时运动图元用整个运动过程扫过的包围盒构建静态BVH
 shared_ptr<BVHAccel> createBVH(const nloJson &param, const vector<shared_ptr<Primitive>> &prims) {
     int maxPrimsInNode = param.value("maxPrimsInNode", 1);
     BVHAccel::SplitMethod splitMethod;
@@ -445,7 +627,8 @@ shared_ptr<BVHAccel> createBVH(const nloJson &param, const vector<shared_ptr<Pri
     } else if (sm == "EqualCounts") {
         splitMethod = BVHAccel::SplitMethod::EqualCounts;
     }
-    return make_shared<BVHAccel>(prims, maxPrimsInNode, splitMethod);
+    bool motionBlur = param.value("motionBlur", true);
+    return make_shared<BVHAccel>(prims, maxPrimsInNode, splitMethod, motionBlur);
 }
 
 
@@ -19,30 +19,53 @@ struct BVHPrimitiveInfo {
     BVHPrimitiveInfo(size_t primitiveNumber, const AABB3f &bounds)
     : primitiveNumber(primitiveNumber),
     bounds(bounds),
-    centroid(.5f * bounds.pMin + .5f * bounds.pMax) {}
+    bounds0(bounds),
+    bounds1(bounds),
+    centroid(.5f * bounds.pMin + .5f * bounds.pMax),
+    motion(0) {}
+    
+    // 运动图元，b0,b1分别为t0,t1时刻的包围盒
+    // 划分时使用中间时刻的包围盒，快速运动的图元不会因为扫过的范围很大而拖累SAH
+    BVHPrimitiveInfo(size_t primitiveNumber, const AABB3f &b0, const AABB3f &b1)
+    : primitiveNumber(primitiveNumber),
+    bounds(.5f * (b0.pMin + b1.pMin), .5f * (b0.pMax + b1.pMax)),
+    bounds0(b0),
+    bounds1(b1),
+    centroid(.5f * bounds.pMin + .5f * bounds.pMax),
+    motion(distance(.5f * (b0.pMin + b0.pMax), .5f * (b1.pMin + b1.pMax))) {}
     size_t primitiveNumber;
+    // 用于划分的包围盒
     AABB3f bounds;
+    // t0,t1时刻的包围盒，静止图元与bounds相同
+    AABB3f bounds0, bounds1;
     Point3f centroid;
+    // t0到t1中心移动的距离，用于把快速运动的图元与静止图元分开
+    Float motion;
 };
 
 // bvh可以理解为一个二叉树
 // 这是构建二叉树时的节点对象
 // 构建完毕之后会转成连续内存的储存方式
 struct BVHBuildNode {
-    void initLeaf(int first, int n, const AABB3f &b) {
+    void initLeaf(int first, int n, const AABB3f &b0, const AABB3f &b1) {
         firstPrimOffset = first;
         nPrimitives = n;
-        bounds = b;
+        bounds = b0;
+        bounds1 = b1;
         children[0] = children[1] = nullptr;
     }
     void initInterior(int axis, BVHBuildNode *c0, BVHBuildNode *c1) {
         children[0] = c0;
         children[1] = c1;
         bounds = unionSet(c0->bounds, c1->bounds);
+        bounds1 = unionSet(c0->bounds1, c1->bounds1);
         splitAxis = axis;
         nPrimitives = 0;
     }
+    // t0时刻的包围盒，静止场景中就是节点的包围盒
     AABB3f bounds;
+    // t1时刻的包围盒
+    AABB3f bounds1;
     // 二叉树的两个子节点
     BVHBuildNode *children[2];
     // 分割的坐标轴
@@ -85,9 +108,18 @@ struct LinearBVHNode {
     };
     uint16_t nPrimitives;  // 图元数量
     uint8_t axis;          // interior node: xyz
-    uint8_t pad[1];        // 确保32个字节为一个对象，提高缓存命中率
+    uint8_t moving;        // 运动模糊BVH中t0,t1时刻包围盒不同的节点为1
+                           // 同时确保32个字节为一个对象，提高缓存命中率
 };
 
+/*
+ 运动模糊的BVH(MSBVH)
+ 每个节点保存t0,t1两个时刻的包围盒，遍历时按照ray.time线性插值
+ 子节点插值结果一定在父节点插值结果之内，所以遍历逻辑与静态BVH相同
+ t1时刻的包围盒单独储存，静态场景不分配，LinearBVHNode仍然是32字节
+ 两个时刻包围盒相同的节点标记为静止，遍历时跳过插值
+ */
+
 
 /*
  根据对象划分
@@ -98,7 +130,8 @@ public:
     
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH,
+             bool motionBlur = true);
     
     virtual AABB3f worldBound() const override;
     
@@ -110,8 +143,17 @@ public:
     
     virtual bool intersect(const Ray &ray, SurfaceInteraction *isect) const override;
     
+    virtual bool intersectHit(const Ray &ray, HitRecord *record,
+                              SurfaceInteraction *isect) const override;
+    
     virtual bool intersectP(const Ray &ray) const override;
     
+    /**
+     * 找出光线在[0, tMax]范围内的所有交点，插入到chain的头部，返回交点个数
+     * 交点没有按照距离排序
+     */
+    int intersectAll(const Ray &ray, MemoryArena &arena, IntersectionChain **chain) const;
+    
 private:
     BVHBuildNode *recursiveBuild(
                                  MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
@@ -136,10 +178,42 @@ private:
     
     int flattenBVHTree(BVHBuildNode *node, int *offset);
     
+    /**
+     * 光线在ray.time时刻是否与节点相交
+     * dt为ray.time在[t0,t1]中的归一化位置
+     */
+    bool intersectNode(int nodeIndex, Float dt, const Ray &ray,
+                       const Vector3f &invDir, const int dirIsNeg[3]) const {
+        const LinearBVHNode &node = _nodes[nodeIndex];
+        if (!node.moving) {
+            // 静止的子树不需要插值，也不用访问_nodeBounds1
+            return node.bounds.intersectP(ray, invDir, dirIsNeg);
+        }
+        const AABB3f &b1 = _nodeBounds1[nodeIndex];
+        AABB3f b(node.bounds.pMin + dt * (b1.pMin - node.bounds.pMin),
+                 node.bounds.pMax + dt * (b1.pMax - node.bounds.pMax));
+        return b.intersectP(ray, invDir, dirIsNeg);
+    }
+    
+    /**
+     * ray.time归一化到[0,1]，超出运动区间的图元保持在端点的位置
+     */
+    Float motionFraction(Float time) const {
+        return _nodeBounds1
+                ? clamp((time - _time0) * _invTimeRange, 0, 1)
+                : 0;
+    }
+    
     const int _maxPrimsInNode;
     const SplitMethod _splitMethod;
     std::vector<std::shared_ptr<Primitive>> _primitives;
     LinearBVHNode *_nodes = nullptr;
+    // 各个节点在t1时刻的包围盒，与_nodes一一对应，场景中没有运动图元时为空
+    AABB3f *_nodeBounds1 = nullptr;
+    // 运动的时间区间
+    Float _time0 = 0;
+    Float _time1 = 0;
+    Float _invTimeRange = 0;
 };
 
 shared_ptr<BVHAccel> createBVH(const nloJson &param, const vector<shared_ptr<Primitive>> &prims);
@@ -0,0 +1,488 @@
+//
+//  curvebvh.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/8.
+//
+
+#include "curvebvh.hpp"
+#include "core/material.hpp"
+#include "core/paladin.hpp"
+#include "tools/fileio.hpp"
+
+PALADIN_BEGIN
+
+CurveBVH::CurveBVH(const shared_ptr<const CurveSet> &curves,
+                   const shared_ptr<const Material> &material,
+                   const MediumInterface &mediumInterface,
+                   int splitDepth,
+                   int maxCurvesInNode)
+: _curves(curves),
+_material(material),
+_mediumInterface(mediumInterface),
+_nPieces(1 << clamp(splitDepth, 0, 7)),
+_invPieces(1.f / _nPieces),
+_maxCurvesInNode(clamp(maxCurvesInNode, 1, 255)),
+_id(allocatePrimitiveId()) {
+    int nRefs = _curves->nSegments() * _nPieces;
+    if (nRefs == 0) {
+        return;
+    }
+
+    // 引用编号为 seg * _nPieces + piece
+    std::vector<BVHPrimitiveInfo> primitiveInfo(nRefs);
+    for (int seg = 0; seg < _curves->nSegments(); ++seg) {
+        for (int piece = 0; piece < _nPieces; ++piece) {
+            size_t ref = seg * _nPieces + piece;
+            primitiveInfo[ref] = {ref, _curves->bound(seg, piece * _invPieces,
+                                                      (piece + 1) * _invPieces)};
+        }
+    }
+
+    MemoryArena arena(1024 * 1024);
+    int totalNodes = 0;
+    std::vector<int> orderedRefs;
+    orderedRefs.reserve(nRefs);
+    BVHBuildNode *root = recursiveBuild(arena, primitiveInfo, 0, nRefs,
+                                        &totalNodes, orderedRefs);
+
+    _refSegments.resize(nRefs);
+    _refPieces.resize(nRefs);
+    for (int i = 0; i < nRefs; ++i) {
+        _refSegments[i] = orderedRefs[i] / _nPieces;
+        _refPieces[i] = orderedRefs[i] % _nPieces;
+    }
+
+    _nodes = allocAligned<LinearBVHNode>(totalNodes);
+    int offset = 0;
+    flattenBVHTree(root, &offset);
+    CHECK_EQ(totalNodes, offset);
+}
+
+CurveBVH::~CurveBVH() {
+    freeAligned(_nodes);
+}
+
+BVHBuildNode * CurveBVH::recursiveBuild(MemoryArena &arena,
+                                        std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                                        int start, int end, int *totalNodes,
+                                        std::vector<int> &orderedRefs) {
+    BVHBuildNode *node = ARENA_ALLOC(arena, BVHBuildNode);
+    (*totalNodes)++;
+    AABB3f bounds;
+    AABB3f centroidBounds;
+    for (int i = start; i < end; ++i) {
+        bounds = unionSet(bounds, primitiveInfo[i].bounds);
+        centroidBounds = unionSet(centroidBounds, primitiveInfo[i].centroid);
+    }
+    int numRefs = end - start;
+    auto createLeafNode = [&]() {
+        int firstRefOffset = (int)orderedRefs.size();
+        for (int i = start; i < end; ++i) {
+            orderedRefs.push_back((int)primitiveInfo[i].primitiveNumber);
+        }
+        node->initLeaf(firstRefOffset, numRefs, bounds, bounds);
+        return node;
+    };
+    int dim = centroidBounds.maximumExtent();
+    if (numRefs == 1) {
+        return createLeafNode();
+    }
+    if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
+        // 所有中心重合，无法按位置分割，一般直接创建叶子
+        // 但LinearBVHNode的nPrimitives为uint16_t，超过上限时只能按数量对半分
+        if (numRefs <= std::numeric_limits<uint16_t>::max()) {
+            return createLeafNode();
+        }
+        int mid = (start + end) / 2;
+        node->initInterior(dim,
+                           recursiveBuild(arena, primitiveInfo, start, mid,
+                                          totalNodes, orderedRefs),
+                           recursiveBuild(arena, primitiveInfo, mid, end,
+                                          totalNodes, orderedRefs));
+        return node;
+    }
+
+    // 与BVHAccel相同的分桶SAH
+    CONSTEXPR int nBuckets = 12;
+    struct BucketInfo {
+        int count = 0;
+        AABB3f bounds;
+    };
+    BucketInfo buckets[nBuckets];
+    auto bucketIndex = [&](const BVHPrimitiveInfo &pi) {
+        int b = nBuckets * centroidBounds.offset(pi.centroid)[dim];
+        return b == nBuckets ? nBuckets - 1 : b;
+    };
+    for (int i = start; i < end; ++i) {
+        int b = bucketIndex(primitiveInfo[i]);
+        buckets[b].count++;
+        buckets[b].bounds = unionSet(buckets[b].bounds, primitiveInfo[i].bounds);
+    }
+
+    // 从左往右，从右往左各扫一遍，得到每种分割方式两边的面积与数量
+    Float leftArea[nBuckets - 1], rightArea[nBuckets - 1];
+    int leftCount[nBuckets - 1], rightCount[nBuckets - 1];
+    AABB3f b;
+    int count = 0;
+    for (int i = 0; i < nBuckets - 1; ++i) {
+        b = unionSet(b, buckets[i].bounds);
+        count += buckets[i].count;
+        leftArea[i] = count > 0 ? b.surfaceArea() : 0;
+        leftCount[i] = count;
+    }
+    b = AABB3f();
+    count = 0;
+    for (int i = nBuckets - 1; i > 0; --i) {
+        b = unionSet(b, buckets[i].bounds);
+        count += buckets[i].count;
+        rightArea[i - 1] = count > 0 ? b.surfaceArea() : 0;
+        rightCount[i - 1] = count;
+    }
+    Float minCost = Infinity;
+    int minCostSplitBucket = -1;
+    Float invArea = 1 / bounds.surfaceArea();
+    for (int i = 0; i < nBuckets - 1; ++i) {
+        if (leftCount[i] == 0 || rightCount[i] == 0) {
+            continue;
+        }
+        Float cost = 1 + (leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i]) * invArea;
+        if (cost < minCost) {
+            minCost = cost;
+            minCostSplitBucket = i;
+        }
+    }
+
+    // 数量不超过maxCurvesInNode，并且SAH认为叶子更划算时创建叶子
+    Float leafCost = numRefs;
+    if (numRefs <= _maxCurvesInNode
+        && (minCostSplitBucket < 0 || leafCost <= minCost)) {
+        return createLeafNode();
+    }
+
+    int mid;
+    if (minCostSplitBucket >= 0) {
+        BVHPrimitiveInfo *pmid = std::partition(&primitiveInfo[start],
+                                                &primitiveInfo[end - 1] + 1,
+                                                [&](const BVHPrimitiveInfo &pi) {
+                                                    return bucketIndex(pi) <= minCostSplitBucket;
+                                                });
+        mid = (int)(pmid - &primitiveInfo[0]);
+    } else {
+        // 所有图元落在同一个桶里，按数量对半分
+        mid = (start + end) / 2;
+        std::nth_element(&primitiveInfo[start], &primitiveInfo[mid],
+                         &primitiveInfo[end - 1] + 1,
+                         [dim](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+    }
+    node->initInterior(dim,
+                       recursiveBuild(arena, primitiveInfo, start, mid,
+                                      totalNodes, orderedRefs),
+                       recursiveBuild(arena, primitiveInfo, mid, end,
+                                      totalNodes, orderedRefs));
+    return node;
+}
+
+CurveLeaf CurveBVH::createLeaf(int refOffset, int nRefs, const AABB3f &aabb) const {
+    CurveLeaf leaf;
+    leaf.refOffset = refOffset;
+    leaf.frame = Frame(Vector3f(1, 0, 0), Vector3f(0, 1, 0), Vector3f(0, 0, 1));
+    leaf.bounds = aabb;
+
+    // 叶子中曲线的平均走向
+    Vector3f axis(0, 0, 0);
+    for (int i = refOffset; i < refOffset + nRefs; ++i) {
+        int seg;
+        Float u0, u1;
+        getRef(i, &seg, &u0, &u1);
+        Point3f cp[4];
+        _curves->getControlPoints(seg, u0, u1, cp);
+        Vector3f d = cp[3] - cp[0];
+        axis += dot(d, axis) < 0 ? -d : d;
+    }
+    if (axis.lengthSquared() == 0) {
+        return leaf;
+    }
+
+    // 控制点的凸包在旋转之后依然包含曲线，所以局部坐标系中的包围盒同样保守
+    Frame frame(normalize(axis));
+    AABB3f localBounds;
+    for (int i = refOffset; i < refOffset + nRefs; ++i) {
+        int seg;
+        Float u0, u1;
+        getRef(i, &seg, &u0, &u1);
+        Point3f cp[4];
+        _curves->getControlPoints(seg, u0, u1, cp);
+        AABB3f b;
+        for (int j = 0; j < 4; ++j) {
+            Vector3f p = frame.toLocal(Vector3f(cp[j].x, cp[j].y, cp[j].z));
+            b = unionSet(b, Point3f(p.x, p.y, p.z));
+        }
+        Float width = std::max(_curves->getWidth(seg, u0), _curves->getWidth(seg, u1));
+        localBounds = unionSet(localBounds, expand(b, width * 0.5f));
+    }
+    if (localBounds.surfaceArea() < aabb.surfaceArea()) {
+        leaf.frame = frame;
+        leaf.bounds = localBounds;
+    }
+    return leaf;
+}
+
+int CurveBVH::flattenBVHTree(BVHBuildNode *node, int *offset) {
+    LinearBVHNode *linearNode = &_nodes[*offset];
+    linearNode->bounds = node->bounds;
+    linearNode->moving = 0;
+    int myOffset = (*offset)++;
+    if (node->nPrimitives > 0) {
+        DCHECK(!node->children[0] && !node->children[1]);
+        // 叶子节点的primitivesOffset指向_leaves
+        linearNode->primitivesOffset = (int)_leaves.size();
+        linearNode->nPrimitives = node->nPrimitives;
+        _leaves.push_back(createLeaf(node->firstPrimOffset, node->nPrimitives,
+                                     node->bounds));
+    } else {
+        linearNode->axis = node->splitAxis;
+        linearNode->nPrimitives = 0;
+        flattenBVHTree(node->children[0], offset);
+        linearNode->secondChildOffset = flattenBVHTree(node->children[1], offset);
+    }
+    return myOffset;
+}
+
+bool CurveBVH::intersect(const Ray &ray, SurfaceInteraction *isect) const {
+    if (!_nodes) {
+        return false;
+    }
+    bool hit = false;
+    Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &_nodes[currentNodeIndex];
+        if (node->nPrimitives > 0) {
+            // 叶子节点只检测OBB
+            const CurveLeaf &leaf = _leaves[node->primitivesOffset];
+            if (intersectLeafBounds(leaf, ray)) {
+                for (int i = 0; i < node->nPrimitives; ++i) {
+                    int seg;
+                    Float u0, u1, tHit;
+                    getRef(leaf.refOffset + i, &seg, &u0, &u1);
+                    if (_curves->intersect(seg, u0, u1, ray, &tHit, isect)) {
+                        ray.tMax = tHit;
+                        hit = true;
+                    }
+                }
+            }
+            if (toVisitOffset == 0) {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        } else if (node->bounds.intersectP(ray, invDir, dirIsNeg)) {
+            if (dirIsNeg[node->axis]) {
+                nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                currentNodeIndex = node->secondChildOffset;
+            } else {
+                nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                currentNodeIndex = currentNodeIndex + 1;
+            }
+        } else {
+            if (toVisitOffset == 0) {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    if (hit) {
+        isect->primitive = this;
+        if (_mediumInterface.isMediumTransition()){
+            isect->mediumInterface = _mediumInterface;
+        } else {
+            isect->mediumInterface = MediumInterface(ray.medium);
+        }
+    }
+    return hit;
+}
+
+bool CurveBVH::intersectP(const Ray &ray) const {
+    if (!_nodes) {
+        return false;
+    }
+    Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &_nodes[currentNodeIndex];
+        if (node->nPrimitives > 0) {
+            const CurveLeaf &leaf = _leaves[node->primitivesOffset];
+            if (intersectLeafBounds(leaf, ray)) {
+                for (int i = 0; i < node->nPrimitives; ++i) {
+                    int seg;
+                    Float u0, u1;
+                    getRef(leaf.refOffset + i, &seg, &u0, &u1);
+                    if (_curves->intersect(seg, u0, u1, ray, nullptr, nullptr)) {
+                        return true;
+                    }
+                }
+            }
+            if (toVisitOffset == 0) {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        } else if (node->bounds.intersectP(ray, invDir, dirIsNeg)) {
+            if (dirIsNeg[node->axis]) {
+                nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                currentNodeIndex = node->secondChildOffset;
+            } else {
+                nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                currentNodeIndex = currentNodeIndex + 1;
+            }
+        } else {
+            if (toVisitOffset == 0) {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
+
+void CurveBVH::computeScatteringFunctions(SurfaceInteraction *isect,
+                                          MemoryArena &arena, TransportMode mode,
+                                          bool allowMultipleLobes) const {
+    if (_material) {
+        _material->computeScatteringFunctions(isect, arena, mode,
+                                              allowMultipleLobes);
+    }
+    CHECK_GE(dot(isect->normal, isect->shading.normal), 0.);
+}
+
+/**
+ * 根据一条曲线的参数填充宽度，可以是一个值(整条曲线等宽)，
+ * 两个值(从根部到末端线性变化)，或者每个段端点一个值
+ */
+static bool getStrandWidths(const nloJson &data, int nSeg, vector<Float> *widths) {
+    vector<Float> w;
+    if (data.is_number()) {
+        w.push_back(data);
+    } else if (data.is_array()) {
+        for (const auto &v : data) {
+            w.push_back(v);
+        }
+    }
+    widths->resize(nSeg + 1);
+    if (w.size() == 1) {
+        std::fill(widths->begin(), widths->end(), w[0]);
+    } else if (w.size() == 2) {
+        for (int i = 0; i <= nSeg; ++i) {
+            (*widths)[i] = lerp(Float(i) / nSeg, w[0], w[1]);
+        }
+    } else if (w.size() == size_t(nSeg + 1)) {
+        *widths = w;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//data : {
+//    "type" : "curves",
+//    "name" : "hair",
+//    "param" : {
+//        "transform" : {
+//            "type" : "translate",
+//            "param" : [0,0,0]
+//        },
+//        "curveType" : "flat",
+//        "splitDepth" : 3,
+//        "maxCurvesInNode" : 4,
+//        "width" : [0.02, 0.005],
+//        "strands" : [
+//            {
+//                "points" : [
+//                    0,0,0,
+//                    0,0.1,0,
+//                    0.05,0.2,0,
+//                    0.1,0.3,0
+//                ],
+//                "width" : [0.02, 0.005],
+//                "normals" : [
+//                    0,0,1,
+//                    0,0,1
+//                ]
+//            }
+//        ]
+//    },
+//    "mediumInterface" : [null, "fog"],
+//    "material" : "matte1"
+//}
+// param也可以是一个json文件名，文件内容为上述param对象，用于较大的头发资源
+// curveType可选flat，cylinder，ribbon
+// points为3n+1个控制点，组成n段三次贝塞尔曲线
+// width为世界空间中的宽度，可以写在每条曲线中，也可以写在param中作为默认值
+// normals为n+1个段端点处的法线，ribbon类型需要
+shared_ptr<CurveBVH> createCurvesPrimitive(const nloJson &data,
+                                           const shared_ptr<const Material> &mat,
+                                           const MediumInterface &mediumInterface) {
+    nloJson param = data.value("param", nloJson::object());
+    if (param.is_string()) {
+        string fn = param;
+        param = createJsonFromFile(Paladin::getInstance()->getBasePath() + fn);
+    }
+    unique_ptr<Transform> o2w(createTransform(param.value("transform", nloJson())));
+    string typeStr = param.value("curveType", "flat");
+    CurveType type = CurveType::Flat;
+    if (typeStr == "cylinder") {
+        type = CurveType::Cylinder;
+    } else if (typeStr == "ribbon") {
+        type = CurveType::Ribbon;
+    }
+    nloJson defaultWidth = param.value("width", nloJson(0.01f));
+
+    auto curves = make_shared<CurveSet>(type);
+    nloJson strands = param.value("strands", nloJson::array());
+    for (const auto &strand : strands) {
+        nloJson points = strand.value("points", nloJson::array());
+        int nPoints = (int)points.size() / 3;
+        if (nPoints < 4 || (nPoints - 1) % 3 != 0) {
+            COUT << "curve strand must have 3n+1 control points, skipped";
+            continue;
+        }
+        int nSeg = (nPoints - 1) / 3;
+        vector<Point3f> cp(nPoints);
+        for (int i = 0; i < nPoints; ++i) {
+            Point3f p(points[3 * i], points[3 * i + 1], points[3 * i + 2]);
+            cp[i] = o2w->exec(p);
+        }
+        vector<Float> widths;
+        if (!getStrandWidths(strand.value("width", defaultWidth), nSeg, &widths)) {
+            COUT << "curve strand width count mismatch, skipped";
+            continue;
+        }
+        vector<Normal3f> normals;
+        if (type == CurveType::Ribbon) {
+            nloJson normalData = strand.value("normals", nloJson::array());
+            if (normalData.size() != size_t(3 * (nSeg + 1))) {
+                COUT << "ribbon curve needs n+1 normals, skipped";
+                continue;
+            }
+            for (int i = 0; i <= nSeg; ++i) {
+                Normal3f n(normalData[3 * i], normalData[3 * i + 1], normalData[3 * i + 2]);
+                normals.push_back(normalize(o2w->exec(n)));
+            }
+        }
+        curves->addStrand(cp, widths, normals);
+    }
+    if (curves->nSegments() == 0) {
+        return nullptr;
+    }
+    int splitDepth = param.value("splitDepth", 3);
+    int maxCurvesInNode = param.value("maxCurvesInNode", 4);
+    return make_shared<CurveBVH>(curves, mat, mediumInterface,
+                                 splitDepth, maxCurvesInNode);
+}
+
+PALADIN_END
@@ -0,0 +1,126 @@
+//
+//  curvebvh.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/8.
+//
+
+#ifndef curvebvh_hpp
+#define curvebvh_hpp
+
+#include "core/header.h"
+#include "core/primitive.hpp"
+#include "accelerators/bvh.hpp"
+#include "shapes/curve.hpp"
+#include "math/frame.hpp"
+
+PALADIN_BEGIN
+
+/*
+ 曲线BVH的叶子节点，一个节点刚好64字节
+ 头发，草等细长的曲线大多与坐标轴成斜角，AABB会包含大量空白区域
+ 以叶子中曲线的平均走向为z轴建立局部坐标系，在局部坐标系中求包围盒，
+ 也就是有向包围盒(OBB)，比AABB小时才使用，否则局部坐标系就是世界坐标系
+ */
+struct CurveLeaf {
+    Frame frame;
+    // 局部坐标系中的包围盒
+    AABB3f bounds;
+    // 第一个曲线段在引用列表中的偏移量，数量储存在LinearBVHNode中
+    int refOffset;
+};
+
+/*
+ 专门用于曲线的BVH，作为一个图元放入场景的BVH中
+ 每段曲线先均匀切分成2^splitDepth(最多128)小段，每一小段为一个引用，
+ 引用只记录曲线段索引以及小段编号，用SoA储存，每个引用5个字节
+ 不需要为每段曲线创建Shape以及GeometricPrimitive对象，
+ 内部节点使用AABB，叶子节点使用OBB
+ */
+class CurveBVH : public Primitive {
+public:
+    CurveBVH(const shared_ptr<const CurveSet> &curves,
+             const shared_ptr<const Material> &material,
+             const MediumInterface &mediumInterface,
+             int splitDepth = 3,
+             int maxCurvesInNode = 4);
+
+    virtual ~CurveBVH();
+
+    virtual AABB3f worldBound() const override {
+        return _nodes ? _nodes[0].bounds : AABB3f();
+    }
+
+    virtual bool intersect(const Ray &r, SurfaceInteraction *isect) const override;
+
+    virtual bool intersectP(const Ray &r) const override;
+
+    // 暂时不支持发光的曲线
+    virtual const AreaLight *getAreaLight() const override {
+        return nullptr;
+    }
+
+    virtual const Material *getMaterial() const override {
+        return _material.get();
+    }
+
+    virtual int getId() const override {
+        return _id;
+    }
+
+    virtual void computeScatteringFunctions(SurfaceInteraction *isect,
+                                            MemoryArena &arena, TransportMode mode,
+                                            bool allowMultipleLobes) const override;
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
+private:
+
+    void getRef(int refIndex, int *seg, Float *u0, Float *u1) const {
+        *seg = _refSegments[refIndex];
+        *u0 = _refPieces[refIndex] * _invPieces;
+        *u1 = (_refPieces[refIndex] + 1) * _invPieces;
+    }
+
+    BVHBuildNode *recursiveBuild(MemoryArena &arena,
+                                 std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                                 int start, int end, int *totalNodes,
+                                 std::vector<int> &orderedRefs);
+
+    int flattenBVHTree(BVHBuildNode *node, int *offset);
+
+    /**
+     * 计算叶子的OBB
+     */
+    CurveLeaf createLeaf(int refOffset, int nRefs, const AABB3f &aabb) const;
+
+    bool intersectLeafBounds(const CurveLeaf &leaf, const Ray &ray) const {
+        Vector3f o = leaf.frame.toLocal(Vector3f(ray.ori.x, ray.ori.y, ray.ori.z));
+        Ray localRay(Point3f(o.x, o.y, o.z), leaf.frame.toLocal(ray.dir), ray.tMax);
+        return leaf.bounds.intersectP(localRay);
+    }
+
+    shared_ptr<const CurveSet> _curves;
+    shared_ptr<const Material> _material;
+    MediumInterface _mediumInterface;
+    // 每段曲线切分的小段数量
+    const int _nPieces;
+    const Float _invPieces;
+    const int _maxCurvesInNode;
+    // 按照BVH叶子顺序排列的引用，SoA
+    std::vector<int> _refSegments;
+    std::vector<uint8_t> _refPieces;
+    LinearBVHNode *_nodes = nullptr;
+    std::vector<CurveLeaf> _leaves;
+    const int _id;
+};
+
+shared_ptr<CurveBVH> createCurvesPrimitive(const nloJson &data,
+                                           const shared_ptr<const Material> &mat,
+                                           const MediumInterface &mediumInterface);
+
+PALADIN_END
+
+#endif /* curvebvh_hpp */
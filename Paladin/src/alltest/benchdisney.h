@@ -0,0 +1,310 @@
+//
+//  benchdisney.h
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/12.
+//
+
+#ifndef benchdisney_h
+#define benchdisney_h
+
+#include "core/header.h"
+#include "core/interaction.hpp"
+#include "materials/disney/disney.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+#include "materials/bxdfs/lambert.hpp"
+#include "materials/bxdfs/microfacet/reflection.hpp"
+#include "materials/bxdfs/microfacet/transmission.hpp"
+#include "math/rng.h"
+#include "math/sampling.hpp"
+#include <chrono>
+
+PALADIN_BEGIN
+
+USING_STD;
+
+/**
+ * 以下为每个波瓣一个BxDF的迪士尼材质，与pbrt-v3的实现方式相同，
+ * 只用于与合并之后的DisneyBxDF对比性能以及结果
+ */
+class StackedDisneyDiffuse : public BxDF {
+public:
+    StackedDisneyDiffuse(const Spectrum &R)
+    : BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE)), _R(R) {
+
+    }
+
+    virtual Spectrum f(const Vector3f &wo, const Vector3f &wi) const override {
+        Float Fo = schlickWeight(absCosTheta(wo)), Fi = schlickWeight(absCosTheta(wi));
+        return _R * (InvPi * (1 - Fo / 2) * (1 - Fi / 2));
+    }
+
+    virtual std::string toString() const override {
+        return "[ StackedDisneyDiffuse ]";
+    }
+
+private:
+    Spectrum _R;
+};
+
+class StackedDisneyRetro : public BxDF {
+public:
+    StackedDisneyRetro(const Spectrum &R, Float roughness)
+    : BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE)), _R(R), _roughness(roughness) {
+
+    }
+
+    virtual Spectrum f(const Vector3f &wo, const Vector3f &wi) const override {
+        Vector3f wh = wi + wo;
+        if (wh.x == 0 && wh.y == 0 && wh.z == 0) {
+            return Spectrum(0.f);
+        }
+        wh = normalize(wh);
+        Float cosThetaD = dot(wi, wh);
+        Float Fo = schlickWeight(absCosTheta(wo)), Fi = schlickWeight(absCosTheta(wi));
+        Float Rr = 2 * _roughness * cosThetaD * cosThetaD;
+        return _R * (InvPi * Rr * (Fo + Fi + Fo * Fi * (Rr - 1)));
+    }
+
+    virtual std::string toString() const override {
+        return "[ StackedDisneyRetro ]";
+    }
+
+private:
+    Spectrum _R;
+    Float _roughness;
+};
+
+class StackedDisneySheen : public BxDF {
+public:
+    StackedDisneySheen(const Spectrum &R)
+    : BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE)), _R(R) {
+
+    }
+
+    virtual Spectrum f(const Vector3f &wo, const Vector3f &wi) const override {
+        Vector3f wh = wi + wo;
+        if (wh.x == 0 && wh.y == 0 && wh.z == 0) {
+            return Spectrum(0.f);
+        }
+        wh = normalize(wh);
+        return _R * schlickWeight(dot(wi, wh));
+    }
+
+    virtual std::string toString() const override {
+        return "[ StackedDisneySheen ]";
+    }
+
+private:
+    Spectrum _R;
+};
+
+class StackedDisneyClearcoat : public BxDF {
+public:
+    StackedDisneyClearcoat(Float weight, Float gloss)
+    : BxDF(BxDFType(BSDF_REFLECTION | BSDF_GLOSSY)), _weight(weight), _gloss(gloss) {
+
+    }
+
+    virtual Spectrum f(const Vector3f &wo, const Vector3f &wi) const override {
+        Vector3f wh = wi + wo;
+        if (wh.x == 0 && wh.y == 0 && wh.z == 0) {
+            return Spectrum(0.f);
+        }
+        wh = normalize(wh);
+        Float Dr = GTR1(absCosTheta(wh), _gloss);
+        Float Fr = frSchlick(.04f, dot(wo, wh));
+        Float Gr = smithG_GGX(absCosTheta(wo), .25f) * smithG_GGX(absCosTheta(wi), .25f);
+        return Spectrum(_weight * Gr * Fr * Dr / 4);
+    }
+
+    virtual Float pdfDir(const Vector3f &wo, const Vector3f &wi) const override {
+        if (!sameHemisphere(wo, wi)) {
+            return 0;
+        }
+        Vector3f wh = wi + wo;
+        if (wh.x == 0 && wh.y == 0 && wh.z == 0) {
+            return 0;
+        }
+        wh = normalize(wh);
+        Float Dr = GTR1(absCosTheta(wh), _gloss);
+        return Dr * absCosTheta(wh) / (4 * dot(wo, wh));
+    }
+
+    virtual std::string toString() const override {
+        return "[ StackedDisneyClearcoat ]";
+    }
+
+private:
+    Float _weight, _gloss;
+};
+
+class StackedDisneyFresnel : public Fresnel {
+public:
+    StackedDisneyFresnel(const Spectrum &R0, Float metallic, Float eta)
+    : _R0(R0), _metallic(metallic), _eta(eta) {
+
+    }
+
+    virtual Spectrum evaluate(Float cosI) const override {
+        return disneyFresnel(_R0, _metallic, _eta, cosI);
+    }
+
+    virtual std::string toString() const override {
+        return "[ StackedDisneyFresnel ]";
+    }
+
+private:
+    Spectrum _R0;
+    Float _metallic, _eta;
+};
+
+class StackedDisneyDistribution : public GGXDistribution {
+public:
+    StackedDisneyDistribution(Float alphax, Float alphay)
+    : GGXDistribution(alphax, alphay, true) {
+
+    }
+
+    virtual Float G(const Vector3f &wo, const Vector3f &wi) const override {
+        return G1(wo) * G1(wi);
+    }
+};
+
+/**
+ * 与DisneyMaterial::computeScatteringFunctions相同的参数，每个波瓣分配一个BxDF
+ */
+inline BSDF * createStackedDisney(const SurfaceInteraction &si, const DisneyLobes &lobes,
+                                  Float ax, Float ay, Float tax, Float tay,
+                                  MemoryArena &arena) {
+    BSDF *bsdf = ARENA_ALLOC(arena, BSDF)(si);
+    bsdf->add(ARENA_ALLOC(arena, StackedDisneyDiffuse)(lobes.diffuse));
+    bsdf->add(ARENA_ALLOC(arena, StackedDisneyRetro)(lobes.retro, lobes.roughness));
+    bsdf->add(ARENA_ALLOC(arena, StackedDisneySheen)(lobes.sheen));
+    auto distrib = ARENA_ALLOC(arena, StackedDisneyDistribution)(ax, ay);
+    auto fresnel = ARENA_ALLOC(arena, StackedDisneyFresnel)(lobes.specR0, lobes.metallic, lobes.eta);
+    bsdf->add(ARENA_ALLOC(arena, MicrofacetReflection)(Spectrum(1.f), distrib, fresnel));
+    bsdf->add(ARENA_ALLOC(arena, StackedDisneyClearcoat)(lobes.clearcoat,
+                                                         lerp(lobes.clearcoatGloss, .1f, .001f)));
+    auto transDistrib = ARENA_ALLOC(arena, StackedDisneyDistribution)(tax, tay);
+    bsdf->add(ARENA_ALLOC(arena, MicrofacetTransmission)(lobes.specTrans, transDistrib,
+                                                         1.f, lobes.eta, TransportMode::Radiance));
+    return bsdf;
+}
+
+/**
+ * 随机方向对上BSDF求值与采样的吞吐量，单位为百万次每秒
+ * 两者选择波瓣的策略不同，采样时同时输出f * cos / pdf的方差，
+ * 用 1 / (方差 * 耗时) 衡量采样的效率
+ */
+inline void benchDisney(int nDirs = 1000000, int nRounds = 10) {
+    RNG rng(0);
+    // 法线为z轴，世界空间与局部空间相同
+    SurfaceInteraction si(Point3f(0, 0, 0), Vector3f(0, 0, 0), Point2f(0, 0),
+                          Vector3f(0, 0, 1), Vector3f(1, 0, 0), Vector3f(0, 1, 0),
+                          Normal3f(0, 0, 0), Normal3f(0, 0, 0), 0, nullptr);
+
+    DisneyLobes lobes;
+    Spectrum c(0.f);
+    c[0] = 0.8f;
+    c[1] = 0.4f;
+    c[2] = 0.2f;
+    Float metallic = 0.3f, strans = 0.2f, rough = 0.4f;
+    Float diffuseWeight = (1 - metallic) * (1 - strans);
+    lobes.roughness = rough;
+    lobes.metallic = metallic;
+    lobes.eta = 1.5f;
+    lobes.diffuse = c * diffuseWeight;
+    lobes.retro = c * diffuseWeight;
+    lobes.sheen = Spectrum(0.5f * diffuseWeight);
+    lobes.specR0 = lerp(metallic, Spectrum(schlickR0FromEta(lobes.eta)), c);
+    lobes.specTrans = Sqrt(c) * strans;
+    lobes.clearcoat = 0.5f;
+    lobes.clearcoatGloss = 0.8f;
+    Float ax = rough * rough, ay = rough * rough;
+
+    MemoryArena arena;
+    BSDF *fused = ARENA_ALLOC(arena, BSDF)(si);
+    fused->add(ARENA_ALLOC(arena, DisneyBxDF)(lobes, ax, ay, ax, ay, TransportMode::Radiance));
+    BSDF *stacked = createStackedDisney(si, lobes, ax, ay, ax, ay, arena);
+
+    vector<Vector3f> wos, wis;
+    vector<Point2f> us;
+    for (int i = 0; i < nDirs; ++i) {
+        wos.push_back(uniformSampleSphere(Point2f(rng.uniformFloat(), rng.uniformFloat())));
+        wis.push_back(uniformSampleSphere(Point2f(rng.uniformFloat(), rng.uniformFloat())));
+        us.push_back(Point2f(rng.uniformFloat(), rng.uniformFloat()));
+    }
+
+    // 两者的函数值应该一致
+    // MicrofacetTransmission没有排除微表面法线背向wo或wi的情况，这部分方向跳过
+    auto validTransmission = [&](const Vector3f &wo, const Vector3f &wi) {
+        Float eta = cosTheta(wo) > 0 ? lobes.eta : 1 / lobes.eta;
+        Vector3f wh = normalize(wo + wi * eta);
+        if (wh.z < 0) {
+            wh = -wh;
+        }
+        return dot(wo, wh) * cosTheta(wo) > 0 && dot(wi, wh) * cosTheta(wi) > 0;
+    };
+    Float maxDiff = 0;
+    for (int i = 0; i < nDirs; ++i) {
+        if (!sameHemisphere(wos[i], wis[i]) && !validTransmission(wos[i], wis[i])) {
+            continue;
+        }
+        Spectrum a = fused->f(wos[i], wis[i]), b = stacked->f(wos[i], wis[i]);
+        for (int c = 0; c < Spectrum::nSamples; ++c) {
+            maxDiff = std::max(maxDiff, std::abs(a[c] - b[c]) / (1 + std::abs(b[c])));
+        }
+    }
+    cout << "max relative difference " << maxDiff << endl;
+
+    auto benchF = [&](const char *name, const BSDF *bsdf) {
+        double sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < nRounds; ++r) {
+            for (int i = 0; i < nDirs; ++i) {
+                sink += bsdf->f(wos[i], wis[i])[0];
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double meval = nRounds * (double)nDirs / seconds * 1e-6;
+        cout << name << " f : " << meval << " Meval/s (sink " << sink << ")" << endl;
+        return meval;
+    };
+
+    auto benchSample = [&](const char *name, const BSDF *bsdf) {
+        double sum = 0, sum2 = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < nRounds; ++r) {
+            for (int i = 0; i < nDirs; ++i) {
+                Vector3f wi;
+                Float pdf;
+                Spectrum f = bsdf->sample_f(wos[i], &wi, us[i], &pdf);
+                if (pdf > 0) {
+                    double v = f.y() * absDot(wi, si.shading.normal) / pdf;
+                    sum += v;
+                    sum2 += v * v;
+                }
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double n = nRounds * (double)nDirs;
+        double meval = n / seconds * 1e-6;
+        double variance = sum2 / n - (sum / n) * (sum / n);
+        double efficiency = 1 / (variance * seconds);
+        cout << name << " sample_f : " << meval << " Meval/s mean " << sum / n
+             << " variance " << variance << endl;
+        return efficiency;
+    };
+
+    double s = benchF("stacked", stacked);
+    double f = benchF("fused", fused);
+    cout << "f speedup " << f / s << endl;
+    s = benchSample("stacked", stacked);
+    f = benchSample("fused", fused);
+    cout << "sample_f efficiency ratio " << f / s << endl;
+}
+
+PALADIN_END
+
+#endif /* benchdisney_h */
@@ -0,0 +1,143 @@
+//
+//  benchintersect.h
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/8.
+//
+
+#ifndef benchintersect_h
+#define benchintersect_h
+
+#include "core/header.h"
+#include "core/primitive.hpp"
+#include "shapes/trianglemesh.hpp"
+#include "accelerators/bvh.hpp"
+#include "math/rng.h"
+#include "math/sampling.hpp"
+#include <chrono>
+
+PALADIN_BEGIN
+
+USING_STD;
+
+/**
+ * 只转发intersect，不实现intersectHit，
+ * 遍历时每个候选交点都会立即构造SurfaceInteraction，用于对比延迟构造的效果
+ */
+class EagerPrimitive : public Primitive {
+public:
+    EagerPrimitive(const shared_ptr<Primitive> &prim) : _prim(prim) {
+
+    }
+
+    virtual AABB3f worldBound() const override {
+        return _prim->worldBound();
+    }
+
+    virtual bool intersect(const Ray &r, SurfaceInteraction *isect) const override {
+        return _prim->intersect(r, isect);
+    }
+
+    virtual bool intersectP(const Ray &r) const override {
+        return _prim->intersectP(r);
+    }
+
+    virtual const AreaLight *getAreaLight() const override {
+        return nullptr;
+    }
+
+    virtual const Material *getMaterial() const override {
+        return nullptr;
+    }
+
+    virtual void computeScatteringFunctions(SurfaceInteraction *isect,
+                                            MemoryArena &arena, TransportMode mode,
+                                            bool allowMultipleLobes) const override {
+
+    }
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
+private:
+    shared_ptr<Primitive> _prim;
+};
+
+/**
+ * 返回每秒求交的光线数，单位为百万
+ */
+inline double benchIntersectRays(const char *name, const Aggregate &accel,
+                                 const vector<Ray> &rays) {
+    double sink = 0;
+    int nHits = 0;
+    auto start = chrono::steady_clock::now();
+    for (const Ray &ray : rays) {
+        Ray r = ray;
+        SurfaceInteraction isect;
+        if (accel.intersect(r, &isect)) {
+            ++nHits;
+            sink += isect.pos.x + isect.uv.x;
+        }
+    }
+    auto end = chrono::steady_clock::now();
+    double seconds = chrono::duration<double>(end - start).count();
+    double mrays = rays.size() / seconds * 1e-6;
+    // 输出sink，防止整个循环被编译器优化掉
+    cout << name << " : " << mrays << " Mrays/s, "
+        << nHits << " hits (sink " << sink << ")" << endl;
+    return mrays;
+}
+
+/**
+ * 单位立方体内随机分布的三角形，光线起点也在立方体内，方向随机
+ * 三角形互相穿插，每条光线在BVH遍历过程中会遇到多个候选交点，
+ * 对比立即构造交点与延迟构造交点的吞吐量
+ */
+inline void benchIntersect(int nTriangles = 100000, int nRays = 1000000) {
+    RNG rng(0);
+    vector<Point3f> points;
+    vector<int> indices;
+    vector<Point2f> uvs;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f center(rng.uniformFloat(), rng.uniformFloat(), rng.uniformFloat());
+        for (int j = 0; j < 3; ++j) {
+            Vector3f offset(rng.uniformFloat() - 0.5f, rng.uniformFloat() - 0.5f,
+                            rng.uniformFloat() - 0.5f);
+            points.push_back(center + offset * 0.05f);
+            uvs.push_back(Point2f(rng.uniformFloat(), rng.uniformFloat()));
+            indices.push_back(3 * i + j);
+        }
+    }
+    auto o2w = make_shared<const Transform>();
+    shared_ptr<const Transform> w2o(o2w->getInverse_ptr());
+    auto mesh = createTriMesh(o2w, nTriangles, &indices[0], (int)points.size(),
+                              &points[0], &uvs[0]);
+    vector<shared_ptr<Primitive>> prims, eagerPrims;
+    for (int i = 0; i < nTriangles; ++i) {
+        auto tri = createTri(o2w, w2o, false, mesh, i);
+        auto prim = GeometricPrimitive::create(tri, nullptr, nullptr, nullptr);
+        prims.push_back(prim);
+        eagerPrims.push_back(make_shared<EagerPrimitive>(prim));
+    }
+    auto deferred = createBVH(nloJson::object(), prims);
+    auto eager = createBVH(nloJson::object(), eagerPrims);
+
+    vector<Ray> rays;
+    rays.reserve(nRays);
+    for (int i = 0; i < nRays; ++i) {
+        Point3f ori(rng.uniformFloat(), rng.uniformFloat(), rng.uniformFloat());
+        Vector3f dir = uniformSampleSphere(Point2f(rng.uniformFloat(), rng.uniformFloat()));
+        rays.push_back(Ray(ori, dir));
+    }
+
+    cout << "sizeof(SurfaceInteraction) " << sizeof(SurfaceInteraction)
+        << ", sizeof(HitRecord) " << sizeof(HitRecord) << endl;
+    double e = benchIntersectRays("eager interaction", *eager, rays);
+    double d = benchIntersectRays("deferred interaction", *deferred, rays);
+    cout << "speedup " << d / e << endl;
+}
+
+PALADIN_END
+
+#endif /* benchintersect_h */
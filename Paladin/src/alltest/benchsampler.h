@@ -0,0 +1,170 @@
+//
+//  benchsampler.h
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/7.
+//
+
+#ifndef benchsampler_h
+#define benchsampler_h
+
+#include "core/header.h"
+#include "samplers/halton.hpp"
+#include "samplers/sobol.hpp"
+#include "samplers/zsobol.hpp"
+#include <chrono>
+
+PALADIN_BEGIN
+
+USING_STD;
+
+/**
+ * 用采样器估计两个已知积分值的积分，统计所有像素的均方根误差
+ *     圆盘的指示函数，不连续，用前两个维度(像素内偏移)，积分值为π*0.16
+ *     4维光滑函数，用第4到第7个维度，积分值为1
+ */
+inline void benchSamplerConvergence(const char *name, Sampler &sampler, int nPixels) {
+    int spp = sampler.samplesPerPixel;
+    double err2D = 0, err4D = 0;
+    for (int y = 0; y < nPixels; ++y) {
+        for (int x = 0; x < nPixels; ++x) {
+            sampler.startPixel(Point2i(x, y));
+            double sum2D = 0, sum4D = 0;
+            do {
+                Point2f p0 = sampler.get2D();
+                sampler.get2D();
+                Point2f p2 = sampler.get2D();
+                Point2f p3 = sampler.get2D();
+                Float dx = p0.x - 0.5f, dy = p0.y - 0.5f;
+                sum2D += (dx * dx + dy * dy < 0.16f) ? 1 : 0;
+                sum4D += 6 * p2.x * p2.x * p2.y * (std::cos(Pi * p3.x) + 1)
+                        * std::exp(p3.y) / (std::exp(1.0) - 1);
+            } while (sampler.startNextSample());
+            double e2D = sum2D / spp - Pi * 0.16;
+            double e4D = sum4D / spp - 1;
+            err2D += e2D * e2D;
+            err4D += e4D * e4D;
+        }
+    }
+    int n = nPixels * nPixels;
+    cout << name << " spp " << spp << " : disk rmse " << std::sqrt(err2D / n)
+        << ", 4D rmse " << std::sqrt(err4D / n) << endl;
+}
+
+/**
+ * 返回每个维度的平均耗时，单位为纳秒
+ */
+inline double benchSamplerOverhead(const char *name, Sampler &sampler, int nPixels, int nDims) {
+    double sink = 0;
+    int64_t count = 0;
+    auto start = chrono::steady_clock::now();
+    for (int y = 0; y < nPixels; ++y) {
+        for (int x = 0; x < nPixels; ++x) {
+            sampler.startPixel(Point2i(x, y));
+            do {
+                for (int i = 0; i < nDims / 2; ++i) {
+                    Point2f p = sampler.get2D();
+                    sink += p.x + p.y;
+                }
+                count += nDims;
+            } while (sampler.startNextSample());
+        }
+    }
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration<double, nano>(end - start).count() / count;
+    // 输出sink，防止整个循环被编译器优化掉
+    cout << name << " : " << ns << " ns/dimension (sink " << sink << ")" << endl;
+    return ns;
+}
+
+/**
+ * 低spp时误差在屏幕空间的分布
+ * 每个像素估计一个软阴影的可见度，遮挡物的边界随像素位置变化，积分值已知
+ * 输出误差图的均方根误差，以及高斯模糊(σ=1.5像素)之后的均方根误差
+ * 后者近似人眼感知到的误差，蓝噪声分布的误差经过模糊之后会大幅降低
+ */
+inline void benchSamplerScreenSpace(const char *name, Sampler &sampler, int res) {
+    int spp = sampler.samplesPerPixel;
+    vector<double> err(res * res);
+    double sumErr2 = 0;
+    for (int y = 0; y < res; ++y) {
+        for (int x = 0; x < res; ++x) {
+            double edge = 0.3 + 0.4 * x / res;
+            double penumbra = 0.2 + 0.6 * y / res;
+            sampler.startPixel(Point2i(x, y));
+            double sum = 0;
+            do {
+                sampler.get2D();
+                Point2f u = sampler.get2D();
+                sum += (u.x < edge ? 1 : 0) * (u.y < penumbra ? 1 : 0.5);
+            } while (sampler.startNextSample());
+            double e = sum / spp - edge * (penumbra + 0.5 * (1 - penumbra));
+            err[y * res + x] = e;
+            sumErr2 += e * e;
+        }
+    }
+    // 可分离的高斯模糊，边界截断
+    const int r = 3;
+    double kernel[2 * r + 1], kernelSum = 0;
+    for (int i = -r; i <= r; ++i) {
+        kernel[i + r] = std::exp(-i * i / (2 * 1.5 * 1.5));
+        kernelSum += kernel[i + r];
+    }
+    vector<double> tmp(res * res), blurred(res * res);
+    for (int y = 0; y < res; ++y) {
+        for (int x = 0; x < res; ++x) {
+            double v = 0;
+            for (int i = -r; i <= r; ++i) {
+                v += kernel[i + r] * err[y * res + clamp(x + i, 0, res - 1)];
+            }
+            tmp[y * res + x] = v / kernelSum;
+        }
+    }
+    double sumBlurred2 = 0;
+    for (int y = 0; y < res; ++y) {
+        for (int x = 0; x < res; ++x) {
+            double v = 0;
+            for (int i = -r; i <= r; ++i) {
+                v += kernel[i + r] * tmp[clamp(y + i, 0, res - 1) * res + x];
+            }
+            v /= kernelSum;
+            sumBlurred2 += v * v;
+        }
+    }
+    int n = res * res;
+    cout << name << " spp " << spp << " : rmse " << std::sqrt(sumErr2 / n)
+        << ", blurred rmse " << std::sqrt(sumBlurred2 / n) << endl;
+}
+
+/**
+ * sobol采样器与halton采样器的收敛速度与单个样本开销的对比
+ * 以及zsobol采样器在低spp时误差的蓝噪声分布
+ */
+void benchSampler(int nPixels = 32) {
+    AABB2i bounds(Point2i(0, 0), Point2i(256, 256));
+    for (int spp = 4; spp <= 1024; spp *= 4) {
+        HaltonSampler halton(spp, bounds);
+        SobolSampler sobol(spp);
+        benchSamplerConvergence("halton", halton, nPixels);
+        benchSamplerConvergence("sobol", sobol, nPixels);
+    }
+    HaltonSampler halton(64, bounds);
+    SobolSampler sobol(64);
+    benchSamplerOverhead("halton", halton, 2 * nPixels, 32);
+    benchSamplerOverhead("sobol", sobol, 2 * nPixels, 32);
+    
+    int res = 4 * nPixels;
+    AABB2i screen(Point2i(0, 0), Point2i(res, res));
+    for (int spp = 1; spp <= 16; spp *= 2) {
+        SobolSampler sobol(spp);
+        ZSobolSampler zsobol(spp, screen);
+        benchSamplerScreenSpace("sobol", sobol, res);
+        benchSamplerScreenSpace("zsobol", zsobol, res);
+    }
+    ZSobolSampler zsobol(64, bounds);
+    benchSamplerOverhead("zsobol", zsobol, 2 * nPixels, 32);
+}
+
+PALADIN_END
+
+#endif /* benchsampler_h */
@@ -0,0 +1,90 @@
+//
+//  benchspectrum.h
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/4.
+//
+
+#ifndef benchspectrum_h
+#define benchspectrum_h
+
+#include "core/header.h"
+#include "core/spectrum.hpp"
+#include "math/rng.h"
+#include <chrono>
+
+PALADIN_BEGIN
+
+USING_STD;
+
+/**
+ * 模拟PathTracer::Li中每次反射的光谱运算
+ *     beta *= f * cos / pdf
+ *     L += beta * Le
+ *     IsBlack判断是否结束
+ *     MaxComponentValue俄罗斯轮盘
+ *     y()统计亮度
+ * 返回每次反射的平均耗时，单位为纳秒
+ */
+template <typename SpectrumType>
+double benchSpectrumBounce(const char *name, int nPaths, int nBounces) {
+    RNG rng(0);
+    // 预先生成数据，避免计时中包含随机数生成
+    const int nData = 1024;
+    vector<SpectrumType> f(nData), Le(nData);
+    vector<Float> cosPdf(nData);
+    for (int i = 0; i < nData; ++i) {
+        for (int j = 0; j < SpectrumType::nSamples; ++j) {
+            f[i][j] = 0.2f + 0.6f * rng.uniformFloat();
+            Le[i][j] = rng.uniformFloat() < 0.1f ? rng.uniformFloat() : 0.f;
+        }
+        cosPdf[i] = 0.5f + rng.uniformFloat();
+    }
+
+    double sink = 0;
+    int index = 0;
+    auto start = chrono::steady_clock::now();
+    for (int p = 0; p < nPaths; ++p) {
+        SpectrumType L(0.f), beta(1.f);
+        for (int b = 0; b < nBounces; ++b) {
+            L += beta * Le[index];
+            beta *= f[index] * cosPdf[index];
+            index = (index + 1) & (nData - 1);
+            if (beta.IsBlack()) {
+                break;
+            }
+            if (beta.MaxComponentValue() < 0.01f) {
+                break;
+            }
+        }
+        sink += L.y();
+    }
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration<double, nano>(end - start).count();
+    double nsPerBounce = ns / (double(nPaths) * nBounces);
+    // 输出sink，防止整个循环被编译器优化掉
+    cout << name << " : " << nsPerBounce << " ns/bounce (sink " << sink << ")" << endl;
+    return nsPerBounce;
+}
+
+/**
+ * 光谱运算的微基准测试
+ * 分别用默认参数与 -DPALADIN_NO_SIMD 编译，对比两次的输出即可得到SIMD的加速比
+ * 加上 -mavx2 编译可以测试60个分量的AVX版本
+ */
+void benchSpectrum(int nPaths = 1 << 20, int nBounces = 8) {
+#if defined(PALADIN_SIMD_AVX)
+    cout << "spectrum simd : AVX" << endl;
+#elif defined(PALADIN_SIMD_SSE)
+    cout << "spectrum simd : SSE" << endl;
+#else
+    cout << "spectrum simd : none" << endl;
+#endif
+    SampledSpectrum::Init();
+    benchSpectrumBounce<RGBSpectrum>("RGBSpectrum(3)", nPaths, nBounces);
+    benchSpectrumBounce<SampledSpectrum>("SampledSpectrum(60)", nPaths, nBounces);
+}
+
+PALADIN_END
+
+#endif /* benchspectrum_h */
@@ -0,0 +1,116 @@
+//
+//  benchtexture.h
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/16.
+//
+
+#ifndef benchtexture_h
+#define benchtexture_h
+
+#include "core/header.h"
+#include "core/mipmap.h"
+#include "math/rng.h"
+#include <chrono>
+
+PALADIN_BEGIN
+
+USING_STD;
+
+/**
+ * 对同一组查询分别用三种过滤方式计时，返回每次查询的平均耗时，单位为纳秒
+ * 查询的偏导数模拟掠射角下的地板
+ */
+template <typename T>
+double benchTextureFilter(const char *name, const MIPMap<T> &mipmap,
+                          const vector<Point2f> &st,
+                          const vector<Vector2f> &dst0,
+                          const vector<Vector2f> &dst1,
+                          int nRounds, vector<T> *result) {
+    result->resize(st.size());
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < nRounds; ++r) {
+        for (size_t i = 0; i < st.size(); ++i) {
+            (*result)[i] = mipmap.lookup(st[i], dst0[i], dst1[i]);
+        }
+    }
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration<double, nano>(end - start).count();
+    double nsPerLookup = ns / (double(nRounds) * st.size());
+    cout << name << " : " << nsPerLookup << " ns/lookup" << endl;
+    return nsPerLookup;
+}
+
+/**
+ * 纹理过滤的微基准测试
+ * EWA分别用默认参数与 -DPALADIN_NO_SIMD 编译，对比两次的输出即可得到SIMD的加速比
+ * 同时输出Anisotropic与EWA结果的平均差异，用于评估近似的质量
+ */
+void benchTexture(int nLookups = 1 << 16, int nRounds = 10, int res = 1024) {
+#if defined(PALADIN_SIMD_SSE)
+    cout << "texture filter simd : SSE" << endl;
+#else
+    cout << "texture filter simd : none" << endl;
+#endif
+    RNG rng(0);
+    // 带有高频细节的棋盘格，过滤不足的时候差异比较明显
+    vector<RGBSpectrum> texels(res * res);
+    for (int t = 0; t < res; ++t) {
+        for (int s = 0; s < res; ++s) {
+            Float rgb[3];
+            Float checker = ((s >> 3) + (t >> 3)) & 1 ? 0.9f : 0.1f;
+            rgb[0] = checker;
+            rgb[1] = 0.5f * checker + 0.5f * rng.uniformFloat();
+            rgb[2] = Float(s) / res;
+            texels[t * res + s] = RGBSpectrum::FromRGB(rgb);
+        }
+    }
+    Point2i resolution(res, res);
+    MIPMap<RGBSpectrum> trilinear(resolution, texels.data(), MIPFilter::Trilinear);
+    MIPMap<RGBSpectrum> ewa(resolution, texels.data(), MIPFilter::EWA);
+    MIPMap<RGBSpectrum> aniso(resolution, texels.data(), MIPFilter::Anisotropic);
+
+    // 按扫描线顺序生成查询，模拟透视投影下的地板
+    // 屏幕坐标(x, y)，y为到地平线的距离，地板上的点为 (x / y, 1 / y)，
+    // y越小越接近掠射角，椭圆越细长
+    vector<Point2f> st;
+    vector<Vector2f> dst0, dst1;
+    int width = 256, height = nLookups / width;
+    Float texScale = 0.05f;
+    Float pixel = 2.f / width;
+    auto floorST = [&](Float x, Float y) {
+        return Point2f(texScale * x / y, texScale / y);
+    };
+    for (int py = 0; py < height; ++py) {
+        for (int px = 0; px < width; ++px) {
+            Float x = (px + 0.5f) * pixel - 1;
+            Float y = 0.02f + (py + 0.5f) / height;
+            Point2f p = floorST(x, y);
+            st.push_back(p);
+            dst0.push_back(floorST(x + pixel, y) - p);
+            dst1.push_back(floorST(x, y + pixel) - p);
+        }
+    }
+    nLookups = (int)st.size();
+
+    vector<RGBSpectrum> triResult, ewaResult, anisoResult;
+    benchTextureFilter("trilinear", trilinear, st, dst0, dst1, nRounds, &triResult);
+    benchTextureFilter("ewa", ewa, st, dst0, dst1, nRounds, &ewaResult);
+    benchTextureFilter("anisotropic", aniso, st, dst0, dst1, nRounds, &anisoResult);
+
+    // 以EWA为参考，比较两种近似的平均绝对误差
+    double triErr = 0, anisoErr = 0;
+    for (int i = 0; i < nLookups; ++i) {
+        for (int c = 0; c < RGBSpectrum::nSamples; ++c) {
+            triErr += std::abs(triResult[i][c] - ewaResult[i][c]);
+            anisoErr += std::abs(anisoResult[i][c] - ewaResult[i][c]);
+        }
+    }
+    int n = nLookups * RGBSpectrum::nSamples;
+    cout << "mean difference from ewa, trilinear : " << triErr / n
+         << " anisotropic : " << anisoErr / n << endl;
+}
+
+PALADIN_END
+
+#endif /* benchtexture_h */
@@ -0,0 +1,69 @@
+//
+//  aov.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/5.
+//
+
+#include "core/aov.hpp"
+
+PALADIN_BEGIN
+
+std::vector<std::string> AOVDesc::channelNames() const {
+    switch (type) {
+        case AOVType::Albedo:
+        case AOVType::LightGroup:
+            return {"R", "G", "B"};
+        case AOVType::Normal:
+            return {"X", "Y", "Z"};
+        case AOVType::Depth:
+            return {"Z"};
+        default:
+            return {"id"};
+    }
+}
+
+bool parseAOVType(const std::string &name, AOVType *type) {
+    if (name == "albedo") {
+        *type = AOVType::Albedo;
+    } else if (name == "normal") {
+        *type = AOVType::Normal;
+    } else if (name == "depth") {
+        *type = AOVType::Depth;
+    } else if (name == "primitiveId") {
+        *type = AOVType::PrimitiveId;
+    } else if (name == "materialId") {
+        *type = AOVType::MaterialId;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void AOVSample::getValue(const AOVDesc &desc, Float *value) const {
+    switch (desc.type) {
+        case AOVType::Albedo:
+            albedo.ToRGB(value);
+            break;
+        case AOVType::Normal:
+            value[0] = normal.x;
+            value[1] = normal.y;
+            value[2] = normal.z;
+            break;
+        case AOVType::Depth:
+            value[0] = depth;
+            break;
+        case AOVType::PrimitiveId:
+            value[0] = primitiveId;
+            break;
+        case AOVType::MaterialId:
+            value[0] = materialId;
+            break;
+        case AOVType::LightGroup:
+            DCHECK(desc.lightGroup < nLightGroups);
+            lightGroups[desc.lightGroup].ToRGB(value);
+            break;
+    }
+}
+
+PALADIN_END
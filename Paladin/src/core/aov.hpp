@@ -0,0 +1,136 @@
+//
+//  aov.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/5.
+//
+
+#ifndef aov_hpp
+#define aov_hpp
+
+#include "core/header.h"
+#include "core/spectrum.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * AOV(arbitrary output variables)，与beauty在同一趟渲染中输出的辅助图层
+ * 用于后期合成与降噪
+ *
+ *     albedo      : 第一个非高光交点的反照率ρhd(wo)
+ *     normal      : 第一个非高光交点的着色法线，世界空间
+ *     depth       : 相机光线第一个交点到相机的距离，没有交点为0
+ *     primitiveId : 相机光线第一个交点的几何图元ID，没有交点为0
+ *     materialId  : 相机光线第一个交点的材质ID，没有交点或没有材质为0
+ *     lightGroup  : 指定光源分组的光照贡献，所有分组之和加上未分组光源的贡献等于beauty
+ *
+ * 前三种与光照分组跟beauty一样经过filter加权平均，
+ * ID不能做插值，每个像素保留filter权重最大的样本的值
+ */
+enum class AOVType {
+    Albedo,
+    Normal,
+    Depth,
+    PrimitiveId,
+    MaterialId,
+    LightGroup
+};
+
+struct AOVDesc {
+    AOVType type;
+    // 图层名，写入exr时通道名为 name.channel
+    std::string name;
+    // 光照分组的索引，只有LightGroup类型有效
+    int lightGroup = -1;
+
+    AOVDesc(AOVType type, const std::string &name, int lightGroup = -1)
+    : type(type),
+    name(name),
+    lightGroup(lightGroup) {
+
+    }
+
+    int nChannels() const {
+        return (type == AOVType::Depth || isId()) ? 1 : 3;
+    }
+
+    // ID类型不经过filter加权，只保留权重最大的样本
+    bool isId() const {
+        return type == AOVType::PrimitiveId || type == AOVType::MaterialId;
+    }
+
+    std::vector<std::string> channelNames() const;
+};
+
+/**
+ * 根据名称解析AOV类型，支持的名称见AOVType的注释
+ */
+bool parseAOVType(const std::string &name, AOVType *type);
+
+/**
+ * 所有AOV在像素缓冲中的布局，FilmTile与Film共用
+ * 每个像素的AOV数据连续存放，长度为stride
+ * 加权类型占nChannels个Float，储存的是filter加权之后的和，
+ * 解析时与beauty一样除以像素的filter权重之和
+ * ID类型占2个Float，分别是ID值与该样本的filter权重
+ */
+struct AOVLayout {
+    std::vector<AOVDesc> descs;
+    // 每个AOV在像素数据中的偏移
+    std::vector<int> offsets;
+    int stride = 0;
+
+    void add(const AOVDesc &desc) {
+        descs.push_back(desc);
+        offsets.push_back(stride);
+        stride += desc.isId() ? 2 : desc.nChannels();
+    }
+
+    bool empty() const {
+        return descs.empty();
+    }
+
+    size_t size() const {
+        return descs.size();
+    }
+};
+
+/**
+ * 一个相机样本的AOV数据，由积分器填充，由FilmTile累加
+ * 与样本的其他临时数据一样在MemoryArena中分配
+ */
+struct AOVSample {
+    // 是否已经记录了第一个非高光交点
+    bool surfaceRecorded = false;
+    // 是否已经记录了相机光线的第一个交点
+    bool primaryRecorded = false;
+    Spectrum albedo = 0.f;
+    Normal3f normal;
+    Float depth = 0;
+    int primitiveId = 0;
+    int materialId = 0;
+    // 每个光照分组的贡献，长度为nLightGroups
+    Spectrum *lightGroups = nullptr;
+    int nLightGroups = 0;
+
+    void addLight(int group, const Spectrum &L) {
+        if (group >= 0 && group < nLightGroups) {
+            lightGroups[group] += L;
+        }
+    }
+
+    void clearLightGroups() {
+        for (int i = 0; i < nLightGroups; ++i) {
+            lightGroups[i] = Spectrum(0.f);
+        }
+    }
+
+    /**
+     * 把desc对应的值写入value，长度为desc.nChannels()
+     */
+    void getValue(const AOVDesc &desc, Float *value) const;
+};
+
+PALADIN_END
+
+#endif /* aov_hpp */
@@ -0,0 +1,255 @@
+//
+//  denoiser.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/6.
+//
+
+#include "core/denoiser.hpp"
+#include "math/simd.h"
+#include "tools/parallel.hpp"
+
+PALADIN_BEGIN
+
+namespace {
+
+// 反照率小于该值的通道不做demodulation，例如没有交点的背景
+CONSTEXPR Float minAlbedo = 0.01f;
+
+// 相对差值分母的下限
+CONSTEXPR Float relativeEpsilon = 1e-4f;
+
+inline int roundUp4(int n) {
+    return (n + 3) & ~3;
+}
+
+#ifdef PALADIN_SIMD_SSE
+
+/**
+ * 4路exp(x)，x <= 0
+ * exp(x) = 2^(x·log2(e))，整数部分直接写入浮点数的指数位，
+ * 小数部分f∈[0,1)用5阶泰勒展开近似2^f，相对误差小于2e-4，对滤波权重来说足够了
+ */
+inline __m128 expNeg4(__m128 x) {
+    x = _mm_max_ps(x, _mm_set1_ps(-87.f));
+    __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+    // SSE2没有floor，先向0截断，负数再减1
+    __m128i i = _mm_cvttps_epi32(t);
+    __m128 fi = _mm_cvtepi32_ps(i);
+    __m128 adjust = _mm_cmpgt_ps(fi, t);
+    i = _mm_add_epi32(i, _mm_castps_si128(adjust));
+    fi = _mm_sub_ps(fi, _mm_and_ps(adjust, _mm_set1_ps(1.f)));
+    __m128 f = _mm_sub_ps(t, fi);
+    __m128 p = _mm_set1_ps(1.33335581e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.f));
+    __m128i e = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(e));
+}
+
+inline Float horizontalSum(__m128 v) {
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(v);
+}
+
+#endif
+
+/**
+ * 带边界的单通道平面
+ * 左右上下各留radius个像素的边界，右侧再多留3个像素，
+ * 这样窗口的每一行都可以按4个像素一组读取，不需要判断越界
+ * 边界像素的valid为0，不参与滤波
+ */
+enum Plane {
+    ColorR, ColorG, ColorB,
+    AlbedoR, AlbedoG, AlbedoB,
+    NormalX, NormalY, NormalZ,
+    Depth,
+    Valid,
+    PlaneNum
+};
+
+} // namespace
+
+void CrossBilateralDenoiser::denoise(const DenoiserInput &input, Float *output) const {
+    const int width = input.width;
+    const int height = input.height;
+    const int r = _radius;
+    const int kernelWidth = 2 * r + 1;
+    const int kernelStride = roundUp4(kernelWidth);
+    const int planeWidth = width + 2 * r + 3;
+    const int planeHeight = height + 2 * r;
+    const size_t planeSize = (size_t)planeWidth * planeHeight;
+
+    // 转换为SoA，顺便做demodulation
+    std::vector<Float> planes(planeSize * PlaneNum, 0.f);
+    auto plane = [&](int index) {
+        return &planes[planeSize * index];
+    };
+    // 用于乘回反照率，与demodulation时的除数相同
+    std::vector<Float> modulation(3 * (size_t)width * height, 1.f);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t src = (size_t)y * width + x;
+            size_t dst = (size_t)(y + r) * planeWidth + (x + r);
+            for (int c = 0; c < 3; ++c) {
+                Float a = input.albedo ? input.albedo[3 * src + c] : 1;
+                Float m = a > minAlbedo ? a : 1;
+                modulation[3 * src + c] = m;
+                plane(ColorR + c)[dst] = input.color[3 * src + c] / m;
+                plane(AlbedoR + c)[dst] = input.albedo ? a : 0;
+                plane(NormalX + c)[dst] = input.normal ? input.normal[3 * src + c] : 0;
+            }
+            plane(Depth)[dst] = input.depth ? input.depth[src] : 0;
+            plane(Valid)[dst] = 1;
+        }
+    }
+
+    // 空间权重表，超出窗口的分量为0，用于屏蔽按4对齐之后多读的像素
+    std::vector<Float> spatial((size_t)kernelWidth * kernelStride, 0.f);
+    Float invSpatial = 1 / (2 * _sigmaSpatial * _sigmaSpatial);
+    for (int dy = -r; dy <= r; ++dy) {
+        for (int dx = -r; dx <= r; ++dx) {
+            spatial[(dy + r) * kernelStride + (dx + r)] = std::exp(-(dx * dx + dy * dy) * invSpatial);
+        }
+    }
+
+    Float invAlbedo = _sigmaAlbedo > 0 && input.albedo ? 1 / (2 * _sigmaAlbedo * _sigmaAlbedo) : 0;
+    Float invNormal = _sigmaNormal > 0 && input.normal ? 1 / (2 * _sigmaNormal * _sigmaNormal) : 0;
+    Float invDepth = _sigmaDepth > 0 && input.depth ? 1 / (2 * _sigmaDepth * _sigmaDepth) : 0;
+    Float invColor = _sigmaColor > 0 ? 1 / (2 * _sigmaColor * _sigmaColor) : 0;
+
+    auto filterPixel = [&](int x, int y) {
+        size_t center = (size_t)(y + r) * planeWidth + (x + r);
+        Float pv[PlaneNum];
+        for (int i = 0; i < PlaneNum; ++i) {
+            pv[i] = plane(i)[center];
+        }
+        // 相对差值的系数与中心像素有关
+        Float colorScale = invColor / (pv[ColorR] * pv[ColorR] + pv[ColorG] * pv[ColorG]
+                                       + pv[ColorB] * pv[ColorB] + relativeEpsilon);
+        Float depthScale = invDepth / std::max(pv[Depth] * pv[Depth], relativeEpsilon);
+
+        Float sumW = 0, sumR = 0, sumG = 0, sumB = 0;
+#ifdef PALADIN_SIMD_SSE
+        __m128 pr = _mm_set1_ps(pv[ColorR]), pg = _mm_set1_ps(pv[ColorG]), pb = _mm_set1_ps(pv[ColorB]);
+        __m128 par = _mm_set1_ps(pv[AlbedoR]), pag = _mm_set1_ps(pv[AlbedoG]), pab = _mm_set1_ps(pv[AlbedoB]);
+        __m128 pnx = _mm_set1_ps(pv[NormalX]), pny = _mm_set1_ps(pv[NormalY]), pnz = _mm_set1_ps(pv[NormalZ]);
+        __m128 pd = _mm_set1_ps(pv[Depth]);
+        __m128 kColor = _mm_set1_ps(colorScale), kAlbedo = _mm_set1_ps(invAlbedo);
+        __m128 kNormal = _mm_set1_ps(invNormal), kDepth = _mm_set1_ps(depthScale);
+        __m128 accW = _mm_setzero_ps(), accR = _mm_setzero_ps();
+        __m128 accG = _mm_setzero_ps(), accB = _mm_setzero_ps();
+        auto sqDiff3 = [](__m128 a0, __m128 a1, __m128 a2, const Float *p0,
+                          const Float *p1, const Float *p2, __m128 &q0, __m128 &q1, __m128 &q2) {
+            q0 = _mm_loadu_ps(p0);
+            q1 = _mm_loadu_ps(p1);
+            q2 = _mm_loadu_ps(p2);
+            __m128 d0 = _mm_sub_ps(q0, a0), d1 = _mm_sub_ps(q1, a1), d2 = _mm_sub_ps(q2, a2);
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)), _mm_mul_ps(d2, d2));
+        };
+#endif
+        for (int dy = -r; dy <= r; ++dy) {
+            // 窗口这一行最左侧像素的下标
+            size_t row = (size_t)(y + r + dy) * planeWidth + x;
+            const Float *sw = &spatial[(dy + r) * kernelStride];
+#ifdef PALADIN_SIMD_SSE
+            for (int k = 0; k < kernelStride; k += 4) {
+                size_t q = row + k;
+                __m128 cr, cg, cb, t0, t1, t2;
+                __m128 e = _mm_mul_ps(sqDiff3(pr, pg, pb, plane(ColorR) + q, plane(ColorG) + q,
+                                              plane(ColorB) + q, cr, cg, cb), kColor);
+                e = _mm_add_ps(e, _mm_mul_ps(sqDiff3(par, pag, pab, plane(AlbedoR) + q, plane(AlbedoG) + q,
+                                                     plane(AlbedoB) + q, t0, t1, t2), kAlbedo));
+                e = _mm_add_ps(e, _mm_mul_ps(sqDiff3(pnx, pny, pnz, plane(NormalX) + q, plane(NormalY) + q,
+                                                     plane(NormalZ) + q, t0, t1, t2), kNormal));
+                __m128 dd = _mm_sub_ps(_mm_loadu_ps(plane(Depth) + q), pd);
+                e = _mm_add_ps(e, _mm_mul_ps(_mm_mul_ps(dd, dd), kDepth));
+                __m128 w = _mm_mul_ps(expNeg4(_mm_sub_ps(_mm_setzero_ps(), e)),
+                                      _mm_mul_ps(_mm_loadu_ps(sw + k), _mm_loadu_ps(plane(Valid) + q)));
+                accW = _mm_add_ps(accW, w);
+                accR = _mm_add_ps(accR, _mm_mul_ps(w, cr));
+                accG = _mm_add_ps(accG, _mm_mul_ps(w, cg));
+                accB = _mm_add_ps(accB, _mm_mul_ps(w, cb));
+            }
+#else
+            for (int k = 0; k < kernelWidth; ++k) {
+                size_t q = row + k;
+                if (plane(Valid)[q] == 0) {
+                    continue;
+                }
+                Float qv[PlaneNum];
+                for (int i = 0; i < PlaneNum; ++i) {
+                    qv[i] = plane(i)[q];
+                }
+                auto sqDiff3 = [&](int index) {
+                    Float d0 = qv[index] - pv[index];
+                    Float d1 = qv[index + 1] - pv[index + 1];
+                    Float d2 = qv[index + 2] - pv[index + 2];
+                    return d0 * d0 + d1 * d1 + d2 * d2;
+                };
+                Float dd = qv[Depth] - pv[Depth];
+                Float e = sqDiff3(ColorR) * colorScale + sqDiff3(AlbedoR) * invAlbedo
+                        + sqDiff3(NormalX) * invNormal + dd * dd * depthScale;
+                Float w = sw[k] * std::exp(-e);
+                sumW += w;
+                sumR += w * qv[ColorR];
+                sumG += w * qv[ColorG];
+                sumB += w * qv[ColorB];
+            }
+#endif
+        }
+#ifdef PALADIN_SIMD_SSE
+        sumW = horizontalSum(accW);
+        sumR = horizontalSum(accR);
+        sumG = horizontalSum(accG);
+        sumB = horizontalSum(accB);
+#endif
+        size_t index = (size_t)y * width + x;
+        // 中心像素的权重为1，sumW不会为0
+        Float invW = 1 / sumW;
+        output[3 * index] = sumR * invW * modulation[3 * index];
+        output[3 * index + 1] = sumG * invW * modulation[3 * index + 1];
+        output[3 * index + 2] = sumB * invW * modulation[3 * index + 2];
+    };
+
+    const int tileSize = 16;
+    Point2i nTile((width + tileSize - 1) / tileSize, (height + tileSize - 1) / tileSize);
+    parallelFor2D([&](Point2i tile) {
+        int x0 = tile.x * tileSize, x1 = std::min(x0 + tileSize, width);
+        int y0 = tile.y * tileSize, y1 = std::min(y0 + tileSize, height);
+        for (int y = y0; y < y1; ++y) {
+            for (int x = x0; x < x1; ++x) {
+                filterPixel(x, y);
+            }
+        }
+    }, nTile);
+}
+
+std::unique_ptr<Denoiser> createDenoiser(const nloJson &param) {
+    if (!param.is_object()) {
+        return nullptr;
+    }
+    std::string type = param.value("type", "bilateral");
+    if (type == "none") {
+        return nullptr;
+    }
+    if (type != "bilateral") {
+        COUT << "unknown denoiser " << type << ", disabled";
+        return nullptr;
+    }
+    int radius = param.value("radius", 6);
+    Float sigmaSpatial = param.value("sigmaSpatial", 3.f);
+    Float sigmaColor = param.value("sigmaColor", 0.6f);
+    Float sigmaAlbedo = param.value("sigmaAlbedo", 0.1f);
+    Float sigmaNormal = param.value("sigmaNormal", 0.2f);
+    Float sigmaDepth = param.value("sigmaDepth", 0.05f);
+    return std::unique_ptr<Denoiser>(new CrossBilateralDenoiser(radius, sigmaSpatial, sigmaColor,
+                                                                sigmaAlbedo, sigmaNormal, sigmaDepth));
+}
+
+PALADIN_END
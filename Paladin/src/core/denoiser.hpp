@@ -0,0 +1,120 @@
+//
+//  denoiser.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/6.
+//
+
+#ifndef denoiser_hpp
+#define denoiser_hpp
+
+#include "core/header.h"
+
+PALADIN_BEGIN
+
+/**
+ * 降噪器的输入，所有数据按行存储，长度为 width * height * 通道数
+ * 引导图层来自于同一趟渲染中累加的AOV，见aov.hpp
+ */
+struct DenoiserInput {
+    int width = 0;
+    int height = 0;
+    // 带噪声的beauty，rgb
+    const Float *color = nullptr;
+    // 反照率，rgb
+    const Float *albedo = nullptr;
+    // 着色法线，xyz
+    const Float *normal = nullptr;
+    // 深度，单通道
+    const Float *depth = nullptr;
+};
+
+/**
+ * 胶片输出之前的降噪后处理
+ * 在像素解析之后，写文件之前执行，只作用于beauty图层
+ */
+class Denoiser {
+public:
+    virtual ~Denoiser() {
+
+    }
+
+    /**
+     * 对input.color降噪，结果写入output，长度为 3 * width * height
+     * 需要在渲染的主线程中调用(内部使用parallelFor)
+     */
+    virtual void denoise(const DenoiserInput &input, Float *output) const = 0;
+};
+
+/**
+ * 以AOV为引导的交叉双边滤波(cross bilateral filter)
+ *
+ * 参考资料
+ * Eisemann & Durand. Flash Photography Enhancement via Intrinsic Relighting (2004)
+ * Dammertz et al. Edge-Avoiding À-Trous Wavelet Transform for fast Global Illumination Filtering (2010)
+ *
+ * 普通的双边滤波用像素自身的颜色判断边缘，低spp时颜色里全是噪声，边缘判断不可靠
+ * 交叉双边滤波的权重由噪声很小的引导图层决定
+ *
+ *     w(p,q) = exp(-(Es + Ea + En + Ed + Ec))
+ *
+ *     Es = |p-q|² / 2σs²                       空间距离
+ *     Ea = |a(p)-a(q)|² / 2σa²                 反照率
+ *     En = |n(p)-n(q)|² / 2σn²                 法线
+ *     Ed = (d(p)-d(q))² / (2σd² d(p)²)         深度
+ *     Ec = |c(p)-c(q)|² / (2σc² (|c(p)|²+ε))   颜色
+ *
+ *     I'(p) = ∑w(p,q)I(q) / ∑w(p,q)
+ *
+ * 深度用相对差值，与场景尺度无关，颜色也用相对差值，亮部与暗部的容忍度相同
+ *
+ * 滤波之前先除以反照率(demodulation)，只对光照部分滤波，滤波之后再乘回反照率，
+ * 这样纹理细节不会被抹掉，光照本身通常是低频的，可以用较大的半径
+ *
+ * 实现上，所有图层先转换为带边界的单通道平面(SoA)，邻域的每一行是连续的内存，
+ * 每次用SIMD处理一行中相邻的4个像素的权重，超出窗口与图像范围的像素权重为0，
+ * 整张图片按16x16的块并行
+ */
+class CrossBilateralDenoiser : public Denoiser {
+public:
+    CrossBilateralDenoiser(int radius, Float sigmaSpatial, Float sigmaColor,
+                           Float sigmaAlbedo, Float sigmaNormal, Float sigmaDepth)
+    : _radius(std::max(1, radius)),
+    _sigmaSpatial(sigmaSpatial),
+    _sigmaColor(sigmaColor),
+    _sigmaAlbedo(sigmaAlbedo),
+    _sigmaNormal(sigmaNormal),
+    _sigmaDepth(sigmaDepth) {
+
+    }
+
+    virtual void denoise(const DenoiserInput &input, Float *output) const override;
+
+private:
+    // 滤波窗口的半径，窗口大小为 (2r+1) * (2r+1)
+    const int _radius;
+    const Float _sigmaSpatial;
+    // 小于等于0时不使用对应的项
+    const Float _sigmaColor;
+    const Float _sigmaAlbedo;
+    const Float _sigmaNormal;
+    const Float _sigmaDepth;
+};
+
+/**
+ * 根据胶片参数创建降噪器，param为空或者type为"none"时返回空
+ * param : {
+ *     "type" : "bilateral",
+ *     "radius" : 6,
+ *     "sigmaSpatial" : 3,
+ *     "sigmaColor" : 0.6,
+ *     "sigmaAlbedo" : 0.1,
+ *     "sigmaNormal" : 0.2,
+ *     "sigmaDepth" : 0.05
+ * }
+ */
+std::unique_ptr<Denoiser> createDenoiser(const nloJson &param);
+
+PALADIN_END
+
+#endif /* denoiser_hpp */
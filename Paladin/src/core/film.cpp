@@ -7,6 +7,8 @@
 
 #include "film.hpp"
 #include "tools/fileio.hpp"
+#include "tools/parallel.hpp"
+#include <fstream>
 
 PALADIN_BEGIN
 
@@ -66,7 +68,8 @@ std::unique_ptr<FilmTile> Film::getFilmTile(const AABB2i &sampleBounds) {
                                   filter->radius,
                                   _filterTable,
                                   _filterTableWidth,
-                                  _maxSampleLuminance);
+                                  _maxSampleLuminance,
+                                  &_aovLayout);
     return std::unique_ptr<FilmTile>(pRet);
 }
 
@@ -81,7 +84,45 @@ void Film::mergeFilmTile(std::unique_ptr<FilmTile> tile) {
             mergePixel.xyz[i] += xyz[i];
         }
         mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+        
+        if (tile->hasAOVs()) {
+            const Float *tileData = tile->getAOVData(pixel);
+            Float *mergeData = getAOVData(pixel);
+            for (size_t i = 0; i < _aovLayout.size(); ++i) {
+                const AOVDesc &desc = _aovLayout.descs[i];
+                int offset = _aovLayout.offsets[i];
+                if (desc.isId()) {
+                    // 相邻tile会覆盖同一个像素，同样保留filter权重最大的样本
+                    if (tileData[offset + 1] > mergeData[offset + 1]) {
+                        mergeData[offset] = tileData[offset];
+                        mergeData[offset + 1] = tileData[offset + 1];
+                    }
+                } else {
+                    for (int c = 0; c < desc.nChannels(); ++c) {
+                        mergeData[offset + c] += tileData[offset + c];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Film::setAOVs(const std::vector<std::string> &aovs,
+                   const std::vector<std::string> &lightGroups) {
+    _aovLayout = AOVLayout();
+    for (const std::string &name : aovs) {
+        AOVType type;
+        if (!parseAOVType(name, &type)) {
+            COUT << "unknown aov " << name << ", ignored";
+            continue;
+        }
+        _aovLayout.add(AOVDesc(type, name));
     }
+    _lightGroups = lightGroups;
+    for (size_t i = 0; i < _lightGroups.size(); ++i) {
+        _aovLayout.add(AOVDesc(AOVType::LightGroup, "light_" + _lightGroups[i], (int)i));
+    }
+    _aovData = std::vector<Float>((size_t)croppedPixelBounds.area() * _aovLayout.stride, 0.f);
 }
 
 void Film::setImage(const Spectrum *img) const {
@@ -94,11 +135,11 @@ void Film::setImage(const Spectrum *img) const {
     }
 }
 
-void Film::addSplat(const Point2f &p, Spectrum v) {
+void Film::addSplat(const Point2f &p, Spectrum v, bool clampLuminance) {
     if (!insideExclusive((Point2i)p, croppedPixelBounds)) {
         return;
     }
-    if (v.y() > _maxSampleLuminance) {
+    if (clampLuminance && v.y() > _maxSampleLuminance) {
         v *= _maxSampleLuminance / v.y();
     }
     Float xyz[3];
@@ -109,42 +150,197 @@ void Film::addSplat(const Point2f &p, Spectrum v) {
     }
 }
 
+void Film::resolvePixel(const Float xyz[3], Float filterWeightSum,
+                        const Float splatXYZ[3], Float splatScale, Float *rgb) const {
+    // 将xyz转成rgb
+    XYZToRGB(xyz, rgb);
+    
+    // I(x,y) = (∑f(x-xi,y-yi)w(xi,yi)L(xi,yi)) / (∑f(x-xi,y-yi))
+    // 再列一遍过滤表达式
+    if (filterWeightSum != 0) {
+        Float invWeight = (Float)1 / filterWeightSum;
+        rgb[0] = std::max((Float)0, rgb[0] * invWeight);
+        rgb[1] = std::max((Float)0, rgb[1] * invWeight);
+        rgb[2] = std::max((Float)0, rgb[2] * invWeight);
+    }
+    
+    // 这里splat是双向方法用的，暂时不理
+    Float splatRGB[3];
+    XYZToRGB(splatXYZ, splatRGB);
+    
+    rgb[0] += splatScale * splatRGB[0];
+    rgb[1] += splatScale * splatRGB[1];
+    rgb[2] += splatScale * splatRGB[2];
+    
+    rgb[0] *= _scale;
+    rgb[1] *= _scale;
+    rgb[2] *= _scale;
+}
+
+void Film::resolveAOVs(const Float *data, Float filterWeightSum,
+                       std::vector<ImageLayer> &layers, int index) const {
+    // 加权类型除以beauty的filter权重之和，ID类型直接输出
+    // splat只用于双向方法，不参与AOV
+    Float invWeight = filterWeightSum != 0 ? 1 / filterWeightSum : 0;
+    for (size_t i = 0; i < _aovLayout.size(); ++i) {
+        const AOVDesc &desc = _aovLayout.descs[i];
+        const Float *value = data + _aovLayout.offsets[i];
+        int nChannels = desc.nChannels();
+        Float *out = &layers[i + 1].data[index * nChannels];
+        if (desc.isId()) {
+            out[0] = value[0];
+            continue;
+        }
+        // 光照分组是radiance，与beauty做同样的缩放
+        Float scale = desc.type == AOVType::LightGroup ? invWeight * _scale : invWeight;
+        for (int c = 0; c < nChannels; ++c) {
+            out[c] = value[c] * scale;
+        }
+    }
+}
+
+void Film::resolveImage(Float *rgb, Float splatScale, bool parallel) {
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    // 每个像素的解析互相独立，按行划分任务
+    auto resolveRow = [&](int64_t row) {
+        int y = croppedPixelBounds.pMin.y + (int)row;
+        for (int x = croppedPixelBounds.pMin.x; x < croppedPixelBounds.pMax.x; ++x) {
+            int offset = (int)row * width + (x - croppedPixelBounds.pMin.x);
+            const Pixel &pixel = getPixel(Point2i(x, y));
+            Float splatXYZ[3] = {pixel.splatXYZ[0],
+                                pixel.splatXYZ[1],
+                                pixel.splatXYZ[2]};
+            resolvePixel(pixel.xyz, pixel.filterWeightSum, splatXYZ,
+                         splatScale, &rgb[3 * offset]);
+        }
+    };
+    if (parallel) {
+        parallelFor(resolveRow, height, 16);
+    } else {
+        for (int row = 0; row < height; ++row) {
+            resolveRow(row);
+        }
+    }
+}
+
+std::vector<ImageLayer> Film::createLayers() const {
+    std::vector<ImageLayer> layers;
+    layers.emplace_back("", std::vector<std::string>{"R", "G", "B"}, croppedPixelBounds.area());
+    for (const AOVDesc &desc : _aovLayout.descs) {
+        layers.emplace_back(desc.name, desc.channelNames(), croppedPixelBounds.area());
+    }
+    return layers;
+}
+
+std::vector<ImageLayer> Film::resolveLayers(Float splatScale, bool parallel) {
+    std::vector<ImageLayer> layers = createLayers();
+    resolveImage(layers[0].data.data(), splatScale, parallel);
+    if (_aovLayout.empty()) {
+        return layers;
+    }
+    
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    auto resolveRow = [&](int64_t row) {
+        int y = croppedPixelBounds.pMin.y + (int)row;
+        for (int x = croppedPixelBounds.pMin.x; x < croppedPixelBounds.pMax.x; ++x) {
+            int index = (int)row * width + (x - croppedPixelBounds.pMin.x);
+            Point2i p(x, y);
+            resolveAOVs(getAOVData(p), getPixel(p).filterWeightSum, layers, index);
+        }
+    };
+    if (parallel) {
+        parallelFor(resolveRow, height, 16);
+    } else {
+        for (int row = 0; row < height; ++row) {
+            resolveRow(row);
+        }
+    }
+    return layers;
+}
+
+void Film::denoiseLayers(std::vector<ImageLayer> &layers) const {
+    DenoiserInput input;
+    input.width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    input.height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    input.color = layers[0].data.data();
+    // 第i个AOV对应第i+1个图层
+    for (size_t i = 0; i < _aovLayout.size(); ++i) {
+        const Float *data = layers[i + 1].data.data();
+        switch (_aovLayout.descs[i].type) {
+            case AOVType::Albedo:
+                input.albedo = data;
+                break;
+            case AOVType::Normal:
+                input.normal = data;
+                break;
+            case AOVType::Depth:
+                input.depth = data;
+                break;
+            default:
+                break;
+        }
+    }
+    std::vector<Float> denoised(layers[0].data.size());
+    _denoiser->denoise(input, denoised.data());
+    
+    ImageLayer noisy("noisy", layers[0].channels, 0);
+    noisy.data.swap(layers[0].data);
+    layers[0].data.swap(denoised);
+    layers.push_back(std::move(noisy));
+}
+
+void Film::outputLayers(const std::vector<std::string> &fileNames,
+                        std::vector<ImageLayer> layers) {
+    if (_asyncWrite) {
+        AsyncImageWriter::getInstance()->submit(fileNames, std::move(layers),
+                                                croppedPixelBounds, fullResolution);
+        return;
+    }
+    for (const std::string &fileName : fileNames) {
+        writeImageLayers(fileName, layers, croppedPixelBounds, fullResolution);
+    }
+}
+
 void Film::writeImage(Float splatScale/* = 1*/) {
-    std::unique_ptr<Float[]> rgb(new Float[3 * croppedPixelBounds.area()]);
-    int offset = 0;
-    for (Point2i p : croppedPixelBounds) {
-        // 将xyz转成rgb
-        Pixel &pixel = getPixel(p);
-        XYZToRGB(pixel.xyz, &rgb[3 * offset]);
-        
-        // I(x,y) = (∑f(x-xi,y-yi)w(xi,yi)L(xi,yi)) / (∑f(x-xi,y-yi))
-        // 再列一遍过滤表达式
-        Float filterWeightNum = pixel.filterWeightSum;
-        if (filterWeightNum != 0) {
-            Float invWeight = (Float)1 / filterWeightNum;
-            rgb[3 * offset] = std::max((Float)0, rgb[3 * offset] * invWeight);
-            rgb[3 * offset + 1] = std::max((Float)0, rgb[3 * offset + 1] * invWeight);
-            rgb[3 * offset + 2] = std::max((Float)0, rgb[3 * offset + 2] * invWeight);
+    std::vector<ImageLayer> layers = resolveLayers(splatScale, true);
+    if (_denoiser) {
+        denoiseLayers(layers);
+    }
+    outputLayers(_outputs.empty() ? std::vector<std::string>{filename} : _outputs,
+                 std::move(layers));
+}
+
+void Film::writeSnapshot(const std::string &fileName, Float splatScale/* = 1*/) {
+    int nPixels = croppedPixelBounds.area();
+    std::vector<PixelSnapshot> pixels(nPixels);
+    std::vector<Float> aovData;
+    {
+        // 只在拷贝像素数据的时候持有锁，此时合并tile的线程会短暂等待
+        // 解析，编码与写文件都比较慢，在锁外面完成，不影响渲染线程
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (int i = 0; i < nPixels; ++i) {
+            const Pixel &pixel = _pixels[i];
+            for (int c = 0; c < 3; ++c) {
+                pixels[i].xyz[c] = pixel.xyz[c];
+                pixels[i].splatXYZ[c] = pixel.splatXYZ[c];
+            }
+            pixels[i].filterWeightSum = pixel.filterWeightSum;
+        }
+        aovData = _aovData;
+    }
+    // 快照线程不是工作线程，不能调用parallelFor，所以串行解析
+    std::vector<ImageLayer> layers = createLayers();
+    for (int i = 0; i < nPixels; ++i) {
+        const PixelSnapshot &pixel = pixels[i];
+        resolvePixel(pixel.xyz, pixel.filterWeightSum, pixel.splatXYZ,
+                     splatScale, &layers[0].data[3 * i]);
+        if (!_aovLayout.empty()) {
+            resolveAOVs(&aovData[i * _aovLayout.stride], pixel.filterWeightSum, layers, i);
         }
-        
-        // 这里splat是双向方法用的，暂时不理
-        Float splatRGB[3];
-        Float splatXYZ[3] = {pixel.splatXYZ[0],
-                            pixel.splatXYZ[1],
-                            pixel.splatXYZ[2]};
-        XYZToRGB(splatXYZ, splatRGB);
-
-        rgb[3 * offset] += splatScale * splatRGB[0];
-        rgb[3 * offset + 1] += splatScale * splatRGB[1];
-        rgb[3 * offset + 2] += splatScale * splatRGB[2];
-        
-        rgb[3 * offset] *= _scale;
-        rgb[3 * offset + 1] *= _scale;
-        rgb[3 * offset + 2] *= _scale;
-        ++offset;
     }
-    // 最后保存文件，todo
-    paladin::writeImage(filename, rgb.get(), croppedPixelBounds, fullResolution);
+    outputLayers({fileName}, std::move(layers));
 }
 
 void Film::clear() {
@@ -155,6 +351,166 @@ void Film::clear() {
         }
         pixel.filterWeightSum = 0;
     }
+    std::fill(_aovData.begin(), _aovData.end(), Float(0));
+}
+
+// 检查点文件头，AOV布局紧跟在文件头之后
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t floatSize;
+    int32_t resolution[2];
+    int32_t pixelBounds[4];
+    int64_t sampleStart;
+    int64_t sampleEnd;
+    uint32_t aovStride;
+    uint32_t nAOVs;
+};
+
+static const char kCheckpointMagic[8] = {'P', 'L', 'D', 'N', 'C', 'K', 'P', 'T'};
+static const uint32_t kCheckpointVersion = 1;
+// 每个像素在检查点中的Float个数
+static const int kCheckpointPixelFloats = 7;
+
+bool Film::writeCheckpoint(const std::string &fileName, int64_t sampleStart, int64_t sampleEnd) const {
+    std::ofstream out(fileName, std::ios::binary);
+    if (!out) {
+        COUT << "can not open checkpoint " << fileName;
+        return false;
+    }
+    CheckpointHeader header;
+    memcpy(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+    header.version = kCheckpointVersion;
+    header.floatSize = sizeof(Float);
+    header.resolution[0] = fullResolution.x;
+    header.resolution[1] = fullResolution.y;
+    header.pixelBounds[0] = croppedPixelBounds.pMin.x;
+    header.pixelBounds[1] = croppedPixelBounds.pMin.y;
+    header.pixelBounds[2] = croppedPixelBounds.pMax.x;
+    header.pixelBounds[3] = croppedPixelBounds.pMax.y;
+    header.sampleStart = sampleStart;
+    header.sampleEnd = sampleEnd;
+    header.aovStride = _aovLayout.stride;
+    header.nAOVs = (uint32_t)_aovLayout.size();
+    out.write((const char *)&header, sizeof(header));
+    for (const AOVDesc &desc : _aovLayout.descs) {
+        int32_t aovDesc[2] = {(int32_t)desc.type, desc.lightGroup};
+        out.write((const char *)aovDesc, sizeof(aovDesc));
+    }
+    
+    int nPixels = croppedPixelBounds.area();
+    std::vector<Float> pixelData(kCheckpointPixelFloats * nPixels);
+    for (int i = 0; i < nPixels; ++i) {
+        const Pixel &pixel = _pixels[i];
+        Float *dst = &pixelData[kCheckpointPixelFloats * i];
+        for (int c = 0; c < 3; ++c) {
+            dst[c] = pixel.xyz[c];
+            dst[4 + c] = pixel.splatXYZ[c];
+        }
+        dst[3] = pixel.filterWeightSum;
+    }
+    out.write((const char *)pixelData.data(), pixelData.size() * sizeof(Float));
+    out.write((const char *)_aovData.data(), _aovData.size() * sizeof(Float));
+    if (!out) {
+        COUT << "failed to write checkpoint " << fileName;
+        return false;
+    }
+    COUT << StringPrintf("checkpoint %s written, samples [%lld, %lld)", fileName.c_str(),
+                         (long long)sampleStart, (long long)sampleEnd);
+    return true;
+}
+
+bool Film::mergeCheckpoints(const std::vector<std::string> &fileNames) {
+    // 先读取并校验所有文件头，再按样本区间排序
+    std::vector<std::pair<CheckpointHeader, std::string>> checkpoints;
+    for (const std::string &fileName : fileNames) {
+        std::ifstream in(fileName, std::ios::binary);
+        CheckpointHeader header;
+        if (!in.read((char *)&header, sizeof(header))
+            || memcmp(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0
+            || header.version != kCheckpointVersion) {
+            COUT << "invalid checkpoint " << fileName;
+            return false;
+        }
+        bool match = header.floatSize == sizeof(Float)
+                    && header.resolution[0] == fullResolution.x
+                    && header.resolution[1] == fullResolution.y
+                    && header.pixelBounds[0] == croppedPixelBounds.pMin.x
+                    && header.pixelBounds[1] == croppedPixelBounds.pMin.y
+                    && header.pixelBounds[2] == croppedPixelBounds.pMax.x
+                    && header.pixelBounds[3] == croppedPixelBounds.pMax.y
+                    && header.aovStride == (uint32_t)_aovLayout.stride
+                    && header.nAOVs == (uint32_t)_aovLayout.size();
+        for (uint32_t i = 0; match && i < header.nAOVs; ++i) {
+            int32_t desc[2];
+            in.read((char *)desc, sizeof(desc));
+            match = in && desc[0] == (int32_t)_aovLayout.descs[i].type
+                    && desc[1] == _aovLayout.descs[i].lightGroup;
+        }
+        if (!match) {
+            COUT << "checkpoint " << fileName << " does not match the film";
+            return false;
+        }
+        checkpoints.emplace_back(header, fileName);
+    }
+    std::sort(checkpoints.begin(), checkpoints.end(), [](const std::pair<CheckpointHeader, std::string> &a,
+                                                         const std::pair<CheckpointHeader, std::string> &b) {
+        return a.first.sampleStart < b.first.sampleStart;
+    });
+    for (size_t i = 1; i < checkpoints.size(); ++i) {
+        if (checkpoints[i].first.sampleStart < checkpoints[i - 1].first.sampleEnd) {
+            COUT << "checkpoint " << checkpoints[i].second << " overlaps "
+                << checkpoints[i - 1].second;
+            return false;
+        }
+    }
+    
+    clear();
+    int nPixels = croppedPixelBounds.area();
+    std::vector<Float> pixelData(kCheckpointPixelFloats * nPixels);
+    std::vector<Float> aovData(_aovData.size());
+    for (const auto &checkpoint : checkpoints) {
+        const CheckpointHeader &header = checkpoint.first;
+        std::ifstream in(checkpoint.second, std::ios::binary);
+        in.seekg(sizeof(CheckpointHeader) + header.nAOVs * 2 * sizeof(int32_t));
+        in.read((char *)pixelData.data(), pixelData.size() * sizeof(Float));
+        in.read((char *)aovData.data(), aovData.size() * sizeof(Float));
+        if (!in) {
+            COUT << "checkpoint " << checkpoint.second << " is truncated";
+            return false;
+        }
+        for (int i = 0; i < nPixels; ++i) {
+            Pixel &pixel = _pixels[i];
+            const Float *src = &pixelData[kCheckpointPixelFloats * i];
+            for (int c = 0; c < 3; ++c) {
+                pixel.xyz[c] += src[c];
+                pixel.splatXYZ[c] = pixel.splatXYZ[c] + src[4 + c];
+            }
+            pixel.filterWeightSum += src[3];
+        }
+        for (size_t i = 0; i < _aovLayout.size(); ++i) {
+            const AOVDesc &desc = _aovLayout.descs[i];
+            int offset = _aovLayout.offsets[i];
+            for (int p = 0; p < nPixels; ++p) {
+                const Float *src = &aovData[(size_t)p * _aovLayout.stride + offset];
+                Float *dst = &_aovData[(size_t)p * _aovLayout.stride + offset];
+                if (desc.isId()) {
+                    // 与mergeFilmTile相同，保留filter权重最大的样本
+                    if (src[1] > dst[1]) {
+                        dst[0] = src[0];
+                        dst[1] = src[1];
+                    }
+                } else {
+                    for (int c = 0; c < desc.nChannels(); ++c) {
+                        dst[c] += src[c];
+                    }
+                }
+            }
+        }
+        COUT << StringPrintf("checkpoint %s merged, samples [%lld, %lld)", checkpoint.second.c_str(),
+                             (long long)header.sampleStart, (long long)header.sampleEnd);
+    }
+    return true;
 }
 
 nloJson Film::toJson() const {
@@ -165,6 +521,21 @@ nloJson Film::toJson() const {
 //    "resolution" : [500, 500],
 //    "cropWindow" : [0,0,1,1],
 //    "fileName" : "paladin.png",
+//    // 可选，同时输出多个文件，为空时只输出fileName
+//    "outputs" : ["paladin.exr", "paladin.png"],
+//    // 是否在后台线程编码输出文件
+//    "asyncWrite" : true,
+//    // 可选，与beauty同一趟渲染输出的AOV，只有exr格式会写入
+//    // 可选值为 albedo normal depth primitiveId materialId
+//    "aovs" : ["albedo", "normal", "depth"],
+//    // 可选，光照分组，每个分组输出一个AOV图层，光源通过lightGroup指定所属分组
+//    "lightGroups" : ["key", "fill"],
+//    // 可选，输出之前对beauty降噪，会自动添加albedo，normal，depth三个AOV作为引导
+//    // 降噪之前的beauty在exr中保存为noisy图层，参数见denoiser.hpp
+//    "denoiser" : {
+//        "type" : "bilateral",
+//        "radius" : 6
+//    },
 //    "diagonal" : null,
 //    "scale" : 1
 //}
@@ -194,6 +565,31 @@ CObject_ptr createFilm(const nloJson &param, const Arguments &lst) {
     Float scale = param.value("scale", 1.f);
     
     Film * film = new Film(resolution, cropWindow, move(ufilter), diagonal, fileName, scale);
+    
+    std::vector<std::string> outputs;
+    for (const auto &output : param.value("outputs", nloJson::array())) {
+        outputs.push_back(output.get<std::string>());
+    }
+    film->setOutputs(outputs);
+    film->setAsyncWrite(param.value("asyncWrite", true));
+    
+    std::vector<std::string> aovs, lightGroups;
+    for (const auto &aov : param.value("aovs", nloJson::array())) {
+        aovs.push_back(aov.get<std::string>());
+    }
+    for (const auto &group : param.value("lightGroups", nloJson::array())) {
+        lightGroups.push_back(group.get<std::string>());
+    }
+    std::unique_ptr<Denoiser> denoiser = createDenoiser(param.value("denoiser", nloJson()));
+    if (denoiser) {
+        for (const char *guide : {"albedo", "normal", "depth"}) {
+            if (std::find(aovs.begin(), aovs.end(), guide) == aovs.end()) {
+                aovs.push_back(guide);
+            }
+        }
+        film->setDenoiser(std::move(denoiser));
+    }
+    film->setAOVs(aovs, lightGroups);
     return film;
 }
 
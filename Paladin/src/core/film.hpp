@@ -13,15 +13,50 @@
 #include "core/filter.h"
 #include "tools/parallel.hpp"
 #include "core/cobject.h"
+#include "tools/fileio.hpp"
+#include "core/aov.hpp"
+#include "core/denoiser.hpp"
 
 PALADIN_BEGIN
 
 /**
  * 用于储存像素的radiance值跟filter函数权重
+ * 另外用Welford算法在线统计该像素样本亮度的均值与方差，供自适应采样使用
+ * Welford算法只需要一趟遍历，且数值稳定，递推式如下
+ *     n = n + 1
+ *     δ = x - mean
+ *     mean = mean + δ / n
+ *     M2 = M2 + δ * (x - mean)
+ * 样本方差为 M2 / (n - 1)，均值估计的方差为 M2 / (n * (n - 1))
  */
 struct FilmTilePixel {
     Spectrum contribSum = 0.f;
     Float filterWeightSum = 0.f;
+    // 已统计的样本数
+    int nSamples = 0;
+    // 样本亮度的均值
+    Float meanY = 0.f;
+    // 样本亮度与均值之差的平方和
+    Float M2 = 0.f;
+    
+    void addStatistic(Float y) {
+        ++nSamples;
+        Float delta = y - meanY;
+        meanY += delta / nSamples;
+        M2 += delta * (y - meanY);
+    }
+    
+    /**
+     * 像素估计值的相对误差，即均值的标准差除以均值
+     * 分母加了下限，避免暗部像素由于均值接近0而永远无法收敛
+     */
+    Float relativeError() const {
+        if (nSamples < 2) {
+            return Infinity;
+        }
+        Float variance = M2 / (Float(nSamples) * (nSamples - 1));
+        return std::sqrt(variance) / std::max(meanY, Float(1e-2));
+    }
 };
 
 /**
@@ -33,14 +68,19 @@ public:
     
     FilmTile(const AABB2i &pixelBounds, const Vector2f &filterRadius,
              const Float *filterTable, int filterTableSize,
-             Float maxSampleLuminance)
+             Float maxSampleLuminance,
+             const AOVLayout *aovLayout = nullptr)
     : _pixelBounds(pixelBounds),
     _filterRadius(filterRadius),
     _invFilterRadius(1 / filterRadius.x, 1 / filterRadius.y),
     _filterTable(filterTable),
     _filterTableSize(filterTableSize),
-    _maxSampleLuminance(maxSampleLuminance) {
+    _maxSampleLuminance(maxSampleLuminance),
+    _aovLayout(aovLayout && !aovLayout->empty() ? aovLayout : nullptr) {
         _pixels = std::vector<FilmTilePixel>(std::max(0, _pixelBounds.area()));
+        if (_aovLayout) {
+            _aovData = std::vector<Float>(_pixels.size() * _aovLayout->stride, 0.f);
+        }
     }
     
     /**
@@ -48,12 +88,33 @@ public:
      * @param pFilm        胶片像素上的点
      * @param L            radiance值
      * @param sampleWeight 采样权重(来自于相机)
+     * @param aov          样本的AOV数据，为空时不累加AOV
      */
-    void addSample(const Point2f &pFilm, Spectrum L, Float sampleWeight = 1.) {
+    void addSample(const Point2f &pFilm, Spectrum L, Float sampleWeight = 1.,
+                   const AOVSample *aov = nullptr) {
         // todo 这里没有理解，为何要这样限制亮度，这样限制亮度会不会造成原有数据的改变？
         // 为何不是所有像素按照整体比例去缩放？
+        Float luminanceScale = 1;
         if (L.y() > _maxSampleLuminance) {
-            L *= _maxSampleLuminance / L.y();
+            luminanceScale = _maxSampleLuminance / L.y();
+            L *= luminanceScale;
+        }
+        
+        // 先取出样本的AOV值，布局与像素中的AOV数据相同
+        // 光照分组与beauty做同样的亮度限制，保证所有分组之和不超过beauty
+        Float *aovValue = nullptr;
+        if (aov && _aovLayout) {
+            aovValue = ALLOCA(Float, _aovLayout->stride);
+            for (size_t i = 0; i < _aovLayout->size(); ++i) {
+                const AOVDesc &desc = _aovLayout->descs[i];
+                Float *v = aovValue + _aovLayout->offsets[i];
+                aov->getValue(desc, v);
+                if (desc.type == AOVType::LightGroup) {
+                    for (int c = 0; c < desc.nChannels(); ++c) {
+                        v[c] *= luminanceScale;
+                    }
+                }
+            }
         }
 
         // 找到受此样本影响范围内的像素
@@ -95,10 +156,25 @@ public:
                 FilmTilePixel &pixel = getPixel(Point2i(x, y));
                 pixel.contribSum += L * sampleWeight * filterWeight;
                 pixel.filterWeightSum += filterWeight;
+                
+                if (aovValue) {
+                    addAOV(getAOVData(Point2i(x, y)), aovValue, sampleWeight, filterWeight);
+                }
             }
         }
     }
     
+    /**
+     * 更新pixel像素的方差统计量，与addSample不同
+     * 只统计落在该像素内的样本，不经过filter扩散到相邻像素
+     * @param pixel 像素坐标
+     * @param L     radiance值
+     */
+    void addStatistic(const Point2i &pixel, const Spectrum &L) {
+        Float y = std::min(L.y(), _maxSampleLuminance);
+        getPixel(pixel).addStatistic(y);
+    }
+    
     FilmTilePixel &getPixel(const Point2i &p) {
         DCHECK(insideExclusive(p, _pixelBounds));
         int width = _pixelBounds.pMax.x - _pixelBounds.pMin.x;
@@ -117,7 +193,54 @@ public:
         return _pixelBounds;
     }
     
+    /**
+     * p像素的AOV数据，长度为布局的stride
+     */
+    const Float *getAOVData(const Point2i &p) const {
+        DCHECK(_aovLayout != nullptr);
+        return &_aovData[pixelIndex(p) * _aovLayout->stride];
+    }
+    
+    Float *getAOVData(const Point2i &p) {
+        DCHECK(_aovLayout != nullptr);
+        return &_aovData[pixelIndex(p) * _aovLayout->stride];
+    }
+    
+    bool hasAOVs() const {
+        return _aovLayout != nullptr;
+    }
+    
 private:
+    
+    int pixelIndex(const Point2i &p) const {
+        DCHECK(insideExclusive(p, _pixelBounds));
+        int width = _pixelBounds.pMax.x - _pixelBounds.pMin.x;
+        return (p.x - _pixelBounds.pMin.x) + (p.y - _pixelBounds.pMin.y) * width;
+    }
+    
+    /**
+     * 把一个样本的AOV值累加到像素数据中
+     * 加权类型与beauty一样累加 值 * 采样权重 * filter权重
+     * ID类型保留filter权重最大的样本
+     */
+    void addAOV(Float *data, const Float *value, Float sampleWeight, Float filterWeight) {
+        for (size_t i = 0; i < _aovLayout->size(); ++i) {
+            const AOVDesc &desc = _aovLayout->descs[i];
+            int offset = _aovLayout->offsets[i];
+            if (desc.isId()) {
+                if (filterWeight > data[offset + 1]) {
+                    data[offset] = value[offset];
+                    data[offset + 1] = filterWeight;
+                }
+            } else {
+                for (int c = 0; c < desc.nChannels(); ++c) {
+                    data[offset + c] += value[offset + c] * sampleWeight * filterWeight;
+                }
+            }
+        }
+    }
+    
+
     // 像素的范围
     const AABB2i _pixelBounds;
     
@@ -131,6 +254,12 @@ private:
     
     const Float _maxSampleLuminance;
     
+    // AOV布局，由Film持有，没有AOV时为空
+    const AOVLayout * _aovLayout;
+    
+    // 所有像素的AOV数据
+    std::vector<Float> _aovData;
+    
     friend class Film;
 };
 
@@ -178,13 +307,103 @@ public:
      * 先把函数抄了再说，日后补上详解
      * @param p [description]
      * @param v [description]
+     * @param clampLuminance 是否按_maxSampleLuminance截断，调用方已经截断过时传false
      */
-    void addSplat(const Point2f &p, Spectrum v);
+    void addSplat(const Point2f &p, Spectrum v, bool clampLuminance = true);
     
+    /**
+     * 单个样本的最大亮度，MLT的splat缓存合并之前需要先用它截断每个splat
+     */
+    Float getMaxSampleLuminance() const {
+        return _maxSampleLuminance;
+    }
+    
+    /**
+     * 输出最终结果
+     * 像素的解析(xyz转rgb，除以filter权重，合并splat)按行并行执行，
+     * 之后把图层交给AsyncImageWriter，在后台线程编码并写入所有输出文件，
+     * 渲染线程不等待编码结束，可以直接开始下一帧
+     * 关闭异步输出时在当前线程写文件
+     * @param splatScale splat的缩放
+     */
     void writeImage(Float splatScale = 1);
     
+    /**
+     * 设置输出文件列表，可以同时输出多种格式，例如exr用于合成，png用于预览
+     * 为空时只输出filename
+     */
+    void setOutputs(const std::vector<std::string> &outputs) {
+        _outputs = outputs;
+    }
+    
+    void setAsyncWrite(bool async) {
+        _asyncWrite = async;
+    }
+    
+    /**
+     * 设置需要输出的AOV与光照分组，需要在创建FilmTile之前调用
+     * 每个光照分组输出一个名为 light_分组名 的图层
+     * @param aovs        AOV名称列表，见AOVType的注释
+     * @param lightGroups 光照分组名称列表，与Light::lightGroup对应
+     */
+    void setAOVs(const std::vector<std::string> &aovs,
+                 const std::vector<std::string> &lightGroups);
+    
+    const AOVLayout &getAOVLayout() const {
+        return _aovLayout;
+    }
+    
+    const std::vector<std::string> &getLightGroups() const {
+        return _lightGroups;
+    }
+    
+    bool hasAOVs() const {
+        return !_aovLayout.empty();
+    }
+    
+    /**
+     * 设置降噪器，为空时不降噪
+     * 降噪需要albedo，normal，depth三个AOV作为引导，缺少的引导不参与权重计算
+     */
+    void setDenoiser(std::unique_ptr<Denoiser> denoiser) {
+        _denoiser = std::move(denoiser);
+    }
+    
+    /**
+     * 渲染过程中输出当前结果的快照
+     * 与writeImage不同，该函数可以与mergeFilmTile并发调用
+     * 只在锁内拷贝像素数据，解析与写文件都在锁外完成
+     * @param fileName   输出文件名
+     * @param splatScale splat的缩放
+     */
+    void writeSnapshot(const std::string &fileName, Float splatScale = 1);
+    
     void clear();
     
+    /**
+     * 把所有像素的累加数据(xyz，filter权重之和，splat，AOV)原样写入检查点文件
+     * 用于把一帧图像按样本区间拆分到多个进程或者机器上渲染，以及崩溃之后续渲
+     *
+     * 采样器的样本只取决于(像素，样本索引，维度)，tile按固定的顺序合并到film中，
+     * 所以同一个样本区间[sampleStart, sampleEnd)无论在哪个进程，用多少线程渲染，
+     * 得到的检查点都是逐位相同的
+     *
+     * 文件格式(本机字节序)
+     *     magic "PLDNCKPT"，版本号，sizeof(Float)
+     *     分辨率，像素范围，样本区间，AOV布局
+     *     每个像素7个Float : xyz[3]，filterWeightSum，splatXYZ[3]
+     *     每个像素的AOV数据，长度为AOVLayout::stride
+     */
+    bool writeCheckpoint(const std::string &fileName, int64_t sampleStart, int64_t sampleEnd) const;
+    
+    /**
+     * 清空film，按样本区间的起点从小到大依次累加所有检查点
+     * 分辨率，像素范围，AOV布局必须与当前film相同，样本区间不能重叠
+     * 累加顺序与文件的顺序无关，所以同一组检查点合并的结果是逐位相同的
+     * 任何一个文件不合法时返回false，此时film的内容没有意义
+     */
+    bool mergeCheckpoints(const std::vector<std::string> &fileNames);
+    
     virtual nloJson toJson() const override;
     
     // 图片分辨率，原点在左上角
@@ -220,6 +439,13 @@ private:
     
     // 像素列表
     std::unique_ptr<Pixel[]> _pixels;
+    
+    // 像素数据的普通拷贝，快照在锁内拷贝，在锁外解析
+    struct PixelSnapshot {
+        Float xyz[3];
+        Float filterWeightSum;
+        Float splatXYZ[3];
+    };
 
     static CONSTEXPR int _filterTableWidth = 16;
     
@@ -241,11 +467,77 @@ private:
     // 传感器能采样到的最大亮度
     const Float _maxSampleLuminance;
     
+    // 输出文件列表，为空时只输出filename
+    std::vector<std::string> _outputs;
+    
+    // 是否在后台线程编码输出文件
+    bool _asyncWrite = true;
+    
+    // AOV布局
+    AOVLayout _aovLayout;
+    
+    // 光照分组名称
+    std::vector<std::string> _lightGroups;
+    
+    // 所有像素的AOV数据，布局与FilmTile相同
+    std::vector<Float> _aovData;
+    
+    // 降噪器，为空时不降噪
+    std::unique_ptr<Denoiser> _denoiser;
+    
+    /**
+     * 把所有像素数据转换为rgb，写入rgb数组中
+     * rgb数组的长度为3 * croppedPixelBounds.area()
+     * @param parallel 是否按行并行，只能在渲染的主线程中开启
+     */
+    void resolveImage(Float *rgb, Float splatScale, bool parallel = false);
+    
+    /**
+     * 解析单个像素，结果写入rgb[0..2]
+     */
+    void resolvePixel(const Float xyz[3], Float filterWeightSum,
+                      const Float splatXYZ[3], Float splatScale, Float *rgb) const;
+    
+    /**
+     * 解析单个像素的所有AOV，写入layers中第index个像素
+     */
+    void resolveAOVs(const Float *data, Float filterWeightSum,
+                     std::vector<ImageLayer> &layers, int index) const;
+    
+    /**
+     * 按照AOV布局分配所有图层，第一个图层为beauty
+     */
+    std::vector<ImageLayer> createLayers() const;
+    
+    /**
+     * 解析出所有需要输出的图层，第一个图层为beauty，之后为各个AOV
+     */
+    std::vector<ImageLayer> resolveLayers(Float splatScale, bool parallel);
+    
+    /**
+     * 对beauty图层降噪，降噪之前的beauty保存为名为noisy的图层
+     * 只能在渲染的主线程中调用
+     */
+    void denoiseLayers(std::vector<ImageLayer> &layers) const;
+    
+    /**
+     * 把图层写入fileNames中的所有文件
+     */
+    void outputLayers(const std::vector<std::string> &fileNames,
+                      std::vector<ImageLayer> layers);
+    
     Pixel &getPixel(const Point2i &p) {
+        return _pixels[pixelIndex(p)];
+    }
+    
+    Float *getAOVData(const Point2i &p) {
+        return &_aovData[pixelIndex(p) * _aovLayout.stride];
+    }
+    
+    int pixelIndex(const Point2i &p) const {
         DCHECK(insideExclusive(p, croppedPixelBounds));
         int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
-        int offset = (p.x - croppedPixelBounds.pMin.x) + (p.y - croppedPixelBounds.pMin.y) * width;
-        return _pixels[offset];
+        return (p.x - croppedPixelBounds.pMin.x) + (p.y - croppedPixelBounds.pMin.y) * width;
     }
 };
 
@@ -11,6 +11,7 @@
 #include "tools/parallel.hpp"
 #include "tools/progressreporter.hpp"
 #include "materials/bxdfs/bsdf.hpp"
+#include <chrono>
 
 PALADIN_BEGIN
 
@@ -48,7 +49,8 @@ Spectrum uniformSampleAllLights(const Interaction &it, const Scene &scene,
 Spectrum sampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
                                bool handleMedia,
-                               const Distribution1D *lightDistrib) {
+                               const Distribution1D *lightDistrib,
+                               const Light **sampledLight) {
     // 与uniformSampleAllLights不同的是，
     // 该函数会按照对应分布随机采样一个光源，这个接口会比较常用，也比较科学
     int nLights = int(scene.lights.size());
@@ -68,6 +70,9 @@ Spectrum sampleOneLight(const Interaction &it, const Scene &scene,
     	lightPdf = Float(1) / nLights;
     }
     const std::shared_ptr<Light> &light = scene.lights[lightIndex];
+    if (sampledLight) {
+        *sampledLight = light.get();
+    }
     // 均匀采样光源表面的二维随机变量
     Point2f uLight = sampler.get2D();
     // 均匀采样bsdf函数
@@ -194,9 +199,146 @@ Spectrum estimateDirectLighting(const Interaction &it, const Point2f &uScatterin
     return Ld;
 }
 
+Spectrum MonteCarloIntegrator::evaluateSample(const Point2i &pixel, const Scene &scene,
+                                              Sampler &sampler, MemoryArena &arena,
+                                              CameraSample *cameraSample, Float *rayWeight,
+                                              AOVSample *aov, int64_t spp) const {
+    *cameraSample = sampler.getCameraSample(pixel);
+
+    RayDifferential ray;
+    *rayWeight = _camera->generateRayDifferential(*cameraSample, &ray);
+
+    if (spp <= 0) {
+        spp = sampler.samplesPerPixel;
+    }
+    ray.scaleDifferentials(1/std::sqrt((Float)spp));
+
+    Spectrum L(0.0f);
+    if (*rayWeight > 0) {
+        L = aov ? LiWithAOV(ray, scene, sampler, arena, aov) : Li(ray, scene, sampler, arena);
+    }
+
+    bool valid = false;
+    if (L.HasNaNs()) {
+        COUT << StringPrintf(
+                "Not-a-number radiance value returned "
+                "for pixel (%d, %d), sample %d. Setting to black.",
+                pixel.x, pixel.y,
+                (int)sampler.currentSampleIndex());
+        DCHECK(false);
+        L = Spectrum(0.0f);
+    } else if (L.y() < -1e-5) {
+        COUT << StringPrintf(
+                "Negative luminance value, %f, returned "
+                "for pixel (%d, %d), sample %d. Setting to black.",
+                L.y(), pixel.x, pixel.y,
+                (int)sampler.currentSampleIndex());
+        DCHECK(false);
+        L = Spectrum(0.0f);
+    } else if (std::isinf(L.y())) {
+        COUT << StringPrintf(
+                "Infinite luminance value returned "
+                "for pixel (%d, %d), sample %d. Setting to black.",
+                pixel.x, pixel.y,
+                (int)sampler.currentSampleIndex());
+        DCHECK(false);
+        L = Spectrum(0.0f);
+    } else {
+        valid = true;
+    }
+    if (aov && !valid) {
+        // beauty被置为0时，光照分组也一并置为0，保证所有分组之和不超过beauty
+        aov->clearLightGroups();
+    }
+    return L;
+}
+
+void MonteCarloIntegrator::prepareAOVs(const Scene &scene) {
+    _lightGroupIndex.clear();
+    const std::vector<std::string> &groups = _camera->film->getLightGroups();
+    if (groups.empty()) {
+        return;
+    }
+    for (const auto &light : scene.lights) {
+        if (light->lightGroup.empty()) {
+            continue;
+        }
+        auto iter = std::find(groups.begin(), groups.end(), light->lightGroup);
+        if (iter == groups.end()) {
+            COUT << "light group " << light->lightGroup << " is not in film lightGroups, ignored";
+            continue;
+        }
+        _lightGroupIndex[light.get()] = int(iter - groups.begin());
+    }
+}
+
+AOVSample *MonteCarloIntegrator::createAOVSample(MemoryArena &arena) const {
+    if (!_camera->film->hasAOVs()) {
+        return nullptr;
+    }
+    AOVSample *aov = ARENA_ALLOC(arena, AOVSample)();
+    aov->nLightGroups = int(_camera->film->getLightGroups().size());
+    if (aov->nLightGroups > 0) {
+        aov->lightGroups = arena.alloc<Spectrum>(aov->nLightGroups);
+    }
+    return aov;
+}
+
+void MonteCarloIntegrator::recordPrimaryAOV(AOVSample *aov, const RayDifferential &ray,
+                                            const SurfaceInteraction &isect) {
+    if (!aov || aov->primaryRecorded) {
+        return;
+    }
+    aov->primaryRecorded = true;
+    aov->depth = distance(ray.ori, isect.pos);
+    if (isect.primitive) {
+        aov->primitiveId = isect.primitive->getId();
+        const Material *material = isect.primitive->getMaterial();
+        aov->materialId = material ? material->getId() : 0;
+    }
+}
+
+void MonteCarloIntegrator::recordSurfaceAOV(AOVSample *aov, const SurfaceInteraction &isect) {
+    if (!aov || aov->surfaceRecorded || !isect.bsdf) {
+        return;
+    }
+    if (isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) == 0) {
+        return;
+    }
+    aov->surfaceRecorded = true;
+    // 反照率用固定的分层样本估计，不消耗采样器的维度，
+    // 所以开启AOV不会改变beauty的结果
+    static const Point2f albedoSamples[4] = {
+        Point2f(0.25f, 0.25f), Point2f(0.75f, 0.25f),
+        Point2f(0.25f, 0.75f), Point2f(0.75f, 0.75f)
+    };
+    aov->albedo = isect.bsdf->rho_hd(isect.wo, 4, albedoSamples).clamp(0, 1);
+    aov->normal = isect.shading.normal;
+}
+
 void MonteCarloIntegrator::render(const Scene &scene) {
+    prepareAOVs(scene);
+    if (!_mergeCheckpoints.empty()) {
+        if (_camera->film->mergeCheckpoints(_mergeCheckpoints)) {
+            _camera->film->writeImage();
+        }
+        return;
+    }
+    if (_progressive && !_distributed) {
+        renderProgressive(scene);
+        return;
+    }
+    if (_adaptiveThreshold > 0 && !_distributed) {
+        renderAdaptive(scene);
+        return;
+    }
     preprocess(scene, *_sampler);
     
+    int64_t sampleStart = std::max((int64_t)0, _sampleRangeStart);
+    int64_t sampleEnd = _sampleRangeEnd > 0 ?
+                        std::min(_sampleRangeEnd, _sampler->samplesPerPixel) :
+                        _sampler->samplesPerPixel;
+    
 	// 由于是并行计算，先把屏幕分割成m * n块
     AABB2i samplerBounds = _camera->film->getSampleBounds();
     Vector2i sampleExtent = samplerBounds.diagonal();
@@ -208,13 +350,21 @@ void MonteCarloIntegrator::render(const Scene &scene) {
     
     outputSceneInfo(scene);
     
-    ProgressReporter reporter("rendering", nTile.x * nTile.y);
+    // 相邻tile的FilmTile在边界处有重叠，浮点数的累加顺序会影响结果
+    // 所以tile按照编号顺序合并到film中，先完成的tile等待前面的tile，
+    // 这样渲染结果与线程数和调度无关
+    int nTiles = nTile.x * nTile.y;
+    std::vector<std::unique_ptr<FilmTile>> pendingTiles(nTiles);
+    int nextMergeTile = 0;
+    std::mutex mergeMutex;
+    
+    ProgressReporter reporter("rendering", nTiles);
     auto renderTile = [&](Point2i tile) {
     	// 内存池对象，预先申请一大段连续内存
     	// 之后所有内存全都通过arena分配
     	MemoryArena arena;
     	// 每个tile使用不同的随机种子，避免关联采样导致的artifact
-    	int seed = tile.y + nTile.x + tile.x;
+    	int seed = tile.y * nTile.x + tile.x;
     	std::unique_ptr<Sampler> tileSampler = _sampler->clone(seed);
 
     	// 计算当前tile的起始点与结束点
@@ -235,56 +385,270 @@ void MonteCarloIntegrator::render(const Scene &scene) {
     			continue;
     		}
 
-    		do {
-    			// 循环单个像素，采样spp次
-    			CameraSample cameraSample = tileSampler->getCameraSample(pixel);
-
-    			RayDifferential ray;
-    			Float rayWeight = _camera->generateRayDifferential(cameraSample, &ray);
-
-    			ray.scaleDifferentials(1/std::sqrt((Float)tileSampler->samplesPerPixel));
-
-    			Spectrum L(0.0f);
-    			if (rayWeight > 0) {
-    				L = Li(ray, scene, *tileSampler, arena);
-    			}
-
-    			if (L.HasNaNs()) {
-					COUT << StringPrintf(
-                            "Not-a-number radiance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->currentSampleIndex());
-                    DCHECK(false);
-    				L = Spectrum(0.0f);
-    			} else if (L.y() < -1e-5) {
-    				COUT << StringPrintf(
-                            "Negative luminance value, %f, returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            L.y(), pixel.x, pixel.y,
-                            (int)tileSampler->currentSampleIndex());
-                    DCHECK(false);
-    				L = Spectrum(0.0f);
-    			} else if (std::isinf(L.y())) {
-					COUT << StringPrintf(
-                            "Infinite luminance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->currentSampleIndex());
-                    DCHECK(false);
-    				L = Spectrum(0.0f);
-    			}
+            // 循环单个像素，采样[sampleStart, sampleEnd)区间内的样本
+            tileSampler->setSampleIndex(sampleStart);
+            for (int64_t s = sampleStart; s < sampleEnd; ++s) {
+    			CameraSample cameraSample;
+    			Float rayWeight;
+                AOVSample *aov = createAOVSample(arena);
+    			Spectrum L = evaluateSample(pixel, scene, *tileSampler, arena,
+                                            &cameraSample, &rayWeight, aov);
                 
                 // 将像素样本值与权重保存到pixel像素数据中
-    			filmTile->addSample(cameraSample.pFilm, L, rayWeight);
+    			filmTile->addSample(cameraSample.pFilm, L, rayWeight, aov);
                 arena.reset();
-            } while (tileSampler->startNextSample());
+                tileSampler->startNextSample();
+            }
     	}
         reporter.update();
-    	_camera->film->mergeFilmTile(std::move(filmTile));
+        
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        pendingTiles[tile.y * nTile.x + tile.x] = std::move(filmTile);
+        while (nextMergeTile < nTiles && pendingTiles[nextMergeTile]) {
+            _camera->film->mergeFilmTile(std::move(pendingTiles[nextMergeTile]));
+            ++nextMergeTile;
+        }
     };
     parallelFor2D(renderTile, nTile);
     reporter.done();
+    if (!_checkpointFile.empty()) {
+        _camera->film->writeCheckpoint(_checkpointFile, sampleStart, sampleEnd);
+    }
+    _camera->film->writeImage();
+}
+
+void MonteCarloIntegrator::renderAdaptive(const Scene &scene) {
+    preprocess(scene, *_sampler);
+    
+    AABB2i samplerBounds = _camera->film->getSampleBounds();
+    Vector2i sampleExtent = samplerBounds.diagonal();
+    const int tileSize = 16;
+    Point2i nTile((sampleExtent.x + tileSize - 1) / tileSize,
+                  (sampleExtent.y + tileSize - 1) / tileSize);
+    int nTiles = nTile.x * nTile.y;
+    
+    outputSceneInfo(scene);
+    
+    // 与一次性渲染不同，每个tile的FilmTile需要跨轮次保留，用于累积方差统计量，
+    // 所有轮次结束之后再合并到film中
+    // 采样器每一轮由clonePass重新生成，只包含这一轮的样本，
+    // 所以总样本数可以超过采样器的spp
+    struct TileState {
+        AABB2i bounds;
+        std::unique_ptr<FilmTile> filmTile;
+        bool converged = false;
+    };
+    std::vector<TileState> tiles(nTiles);
+    for (int i = 0; i < nTiles; ++i) {
+        Point2i tile(i % nTile.x, i / nTile.x);
+        int x0 = samplerBounds.pMin.x + tile.x * tileSize;
+        int x1 = std::min(x0 + tileSize, samplerBounds.pMax.x);
+        int y0 = samplerBounds.pMin.y + tile.y * tileSize;
+        int y1 = std::min(y0 + tileSize, samplerBounds.pMax.y);
+        tiles[i].bounds = AABB2i(Point2i(x0, y0), Point2i(x1, y1));
+        tiles[i].filmTile = _camera->film->getFilmTile(tiles[i].bounds);
+    }
+    
+    int64_t maxSamples = _adaptiveMaxSamples > 0 ?
+                         (int64_t)_adaptiveMaxSamples :
+                         _sampler->samplesPerPixel;
+    int64_t minSamples = std::min((int64_t)_adaptiveMinSamples, maxSamples);
+    int nPasses = 1 + (int)((maxSamples - minSamples + _adaptivePassSamples - 1) / _adaptivePassSamples);
+    std::vector<MemoryArena> perThreadArenas(maxThreadIndex());
+    // 统计实际采样数，用于输出节省了多少样本
+    std::atomic<int64_t> totalSamples(0);
+    
+    ProgressReporter reporter("adaptive rendering", nPasses);
+    int64_t passStart = 0;
+    for (int pass = 0; pass < nPasses; ++pass) {
+        int64_t passEnd = pass == 0 ?
+                        minSamples :
+                        std::min(passStart + _adaptivePassSamples, maxSamples);
+        std::atomic<int> activeTiles(0);
+        parallelFor([&](int64_t i) {
+            TileState &ts = tiles[i];
+            if (ts.converged) {
+                return;
+            }
+            MemoryArena &arena = perThreadArenas[ThreadIndex];
+            std::unique_ptr<Sampler> tileSampler = _sampler->clonePass(passStart, passEnd - passStart);
+            bool converged = true;
+            int64_t nSampled = 0;
+            for (Point2i pixel : ts.bounds) {
+                if (!insideExclusive(pixel, _pixelBounds)) {
+                    continue;
+                }
+                FilmTilePixel &stat = ts.filmTile->getPixel(pixel);
+                // 第一轮之后，误差已经低于阈值的像素不再采样
+                if (pass > 0 && stat.relativeError() < _adaptiveThreshold) {
+                    continue;
+                }
+                tileSampler->startPixel(pixel);
+                do {
+                    CameraSample cameraSample;
+                    Float rayWeight;
+                    AOVSample *aov = createAOVSample(arena);
+                    Spectrum L = evaluateSample(pixel, scene, *tileSampler, arena,
+                                                &cameraSample, &rayWeight, aov,
+                                                maxSamples);
+                    ts.filmTile->addSample(cameraSample.pFilm, L, rayWeight, aov);
+                    ts.filmTile->addStatistic(pixel, L);
+                    arena.reset();
+                } while (tileSampler->startNextSample());
+                nSampled += passEnd - passStart;
+                if (stat.relativeError() >= _adaptiveThreshold) {
+                    converged = false;
+                }
+            }
+            totalSamples += nSampled;
+            // tile内所有像素都收敛之后，整个tile不再参与之后的轮次
+            ts.converged = converged;
+            if (!converged) {
+                ++activeTiles;
+            }
+        }, nTiles, 1);
+        reporter.update();
+        passStart = passEnd;
+        if (activeTiles == 0) {
+            break;
+        }
+    }
+    reporter.done();
+    
+    for (int i = 0; i < nTiles; ++i) {
+        _camera->film->mergeFilmTile(std::move(tiles[i].filmTile));
+    }
+    int64_t budget = maxSamples * _pixelBounds.area();
+    COUT << StringPrintf("adaptive sampling: %lld of %lld samples used (%.1f%%)",
+                         (long long)totalSamples.load(), (long long)budget,
+                         budget > 0 ? 100.0 * totalSamples / budget : 0.0);
+    _camera->film->writeImage();
+}
+
+/**
+ * 快照的文件名，在扩展名之前加上"_snapshot"，避免覆盖最终的输出
+ */
+static std::string snapshotFilename(const std::string &filename) {
+    size_t dot = filename.rfind('.');
+    size_t slash = filename.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return filename + "_snapshot";
+    }
+    return filename.substr(0, dot) + "_snapshot" + filename.substr(dot);
+}
+
+void MonteCarloIntegrator::renderProgressive(const Scene &scene) {
+    preprocess(scene, *_sampler);
+    
+    AABB2i samplerBounds = _camera->film->getSampleBounds();
+    Vector2i sampleExtent = samplerBounds.diagonal();
+    const int tileSize = 16;
+    Point2i nTile((sampleExtent.x + tileSize - 1) / tileSize,
+                  (sampleExtent.y + tileSize - 1) / tileSize);
+    int nTiles = nTile.x * nTile.y;
+    
+    outputSceneInfo(scene);
+    
+    // 每一轮的采样器由clonePass生成，只包含这一轮的样本，所以目标spp与采样器的spp无关
+    // 需要"限时出图"时，把targetSpp设得足够大，由timeLimit来控制停止
+    int64_t targetSpp = _progressiveTargetSpp > 0 ?
+                        (int64_t)_progressiveTargetSpp :
+                        _sampler->samplesPerPixel;
+    int64_t passSamples = _progressivePassSamples;
+    int64_t nPasses = (targetSpp + passSamples - 1) / passSamples;
+    std::string snapshotFile = _progressiveSnapshotFile.empty() ?
+                               snapshotFilename(_camera->film->filename) :
+                               _progressiveSnapshotFile;
+    std::vector<MemoryArena> perThreadArenas(maxThreadIndex());
+    
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point startTime = Clock::now();
+    auto elapsedSeconds = [&]() {
+        return std::chrono::duration<Float>(Clock::now() - startTime).count();
+    };
+    std::atomic<bool> timeUp(false);
+    std::atomic<int64_t> finishedTasks(0);
+    
+    // 快照线程，每隔_progressiveSnapshotInterval秒输出一次当前结果
+    // film的快照是在锁内拷贝像素数据之后再写文件，工作线程不会停下来等待
+    std::mutex snapshotMutex;
+    std::condition_variable snapshotCV;
+    bool renderFinished = false;
+    std::thread snapshotThread;
+    if (_progressiveSnapshotInterval > 0) {
+        snapshotThread = std::thread([&]() {
+            std::chrono::duration<Float> interval(_progressiveSnapshotInterval);
+            std::unique_lock<std::mutex> lock(snapshotMutex);
+            while (!snapshotCV.wait_for(lock, interval, [&]() { return renderFinished; })) {
+                lock.unlock();
+                _camera->film->writeSnapshot(snapshotFile);
+                COUT << StringPrintf("snapshot written to %s, %.1f passes, %.1fs elapsed",
+                                     snapshotFile.c_str(), (double)finishedTasks / nTiles,
+                                     (double)elapsedSeconds());
+                lock.lock();
+            }
+        });
+    }
+    
+    ProgressReporter reporter("progressive rendering", nPasses * nTiles);
+    auto renderTask = [&](int64_t task) {
+        if (timeUp) {
+            return;
+        }
+        if (_progressiveTimeLimit > 0 && elapsedSeconds() >= _progressiveTimeLimit) {
+            timeUp = true;
+            return;
+        }
+        int64_t pass = task / nTiles;
+        int tileIndex = task % nTiles;
+        Point2i tile(tileIndex % nTile.x, tileIndex / nTile.x);
+        int x0 = samplerBounds.pMin.x + tile.x * tileSize;
+        int x1 = std::min(x0 + tileSize, samplerBounds.pMax.x);
+        int y0 = samplerBounds.pMin.y + tile.y * tileSize;
+        int y1 = std::min(y0 + tileSize, samplerBounds.pMax.y);
+        AABB2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+        int64_t passStart = pass * passSamples;
+        int64_t passEnd = std::min(passStart + passSamples, targetSpp);
+        
+        // 采样器只包含这一轮的样本，startPixel只生成passEnd - passStart个样本，
+        // 每个任务一个采样器，不同任务之间没有共享的状态
+        std::unique_ptr<Sampler> tileSampler = _sampler->clonePass(passStart, passEnd - passStart);
+        MemoryArena &arena = perThreadArenas[ThreadIndex];
+        std::unique_ptr<FilmTile> filmTile = _camera->film->getFilmTile(tileBounds);
+        for (Point2i pixel : tileBounds) {
+            tileSampler->startPixel(pixel);
+            if (!insideExclusive(pixel, _pixelBounds)) {
+                continue;
+            }
+            do {
+                CameraSample cameraSample;
+                Float rayWeight;
+                AOVSample *aov = createAOVSample(arena);
+                Spectrum L = evaluateSample(pixel, scene, *tileSampler, arena,
+                                            &cameraSample, &rayWeight, aov, targetSpp);
+                filmTile->addSample(cameraSample.pFilm, L, rayWeight, aov);
+                arena.reset();
+            } while (tileSampler->startNextSample());
+        }
+        // 每个任务的结果直接累加到film中，film中始终是一张完整的图像
+        _camera->film->mergeFilmTile(std::move(filmTile));
+        ++finishedTasks;
+        reporter.update();
+    };
+    parallelFor(renderTask, nPasses * nTiles, 1);
+    reporter.done();
+    
+    if (snapshotThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            renderFinished = true;
+        }
+        snapshotCV.notify_one();
+        snapshotThread.join();
+    }
+    COUT << StringPrintf("progressive rendering finished, %.1f spp in %.1fs",
+                         (double)finishedTasks / nTiles * passSamples,
+                         (double)elapsedSeconds());
     _camera->film->writeImage();
 }
 
@@ -303,51 +667,8 @@ Spectrum MonteCarloIntegrator::specularReflect(const RayDifferential &ray,
     const Normal3f &ns = isect.shading.normal;
 
     if (pdf > 0.0f && !f.IsBlack() && absDot(wi, ns) != 0.0f) {
-        // 生成wi方向的主光线
-        RayDifferential rd = isect.spawnRay(wi);
-        if (ray.hasDifferentials) {
-            rd.hasDifferentials = true;
-            // 计算反射差分光线的起点，这还是比较简单的
-            rd.rxOrigin = isect.pos + isect.dpdx;
-            rd.ryOrigin = isect.pos + isect.dpdy;
-            /**
-             * 计算反射差分光线的方向
-             * 用正向差分法去近似，表达式如下
-             * ω ≈ ωi + dωi/dx     0式
-             * 由反射向量公式 ωi = 2(ωo · n)n - ωo
-             * 
-             *  dωi     d(2(ωo · n)n - ωo)
-             * ----- = --------------------     1式
-             *  dx             dx
-             * 
-             *                dn     d(ωo · n)          dωo
-             * = 2 [(ωo · n) ---- + ----------- n]  -  -----  2式
-             *                dx        dx              dx
-             * 其中 
-             *  d(ωo · n)     dωo              dn
-             * ----------- = ----- · n + ωo · ----  3式
-             *     dx         dx               dx
-             * 以上表达式的推导只用到了高中数学学过的乘法法则，很容易推导出来
-             * 以后如果实在不想动手，推荐一个工具wolframalpha，堪称神器！
-             */
-            // 复合函数求导，链式法则不解释！
-            Normal3f dndx = isect.shading.dndu * isect.dudx
-                          + isect.shading.dndv * isect.dvdx;
-            // 注意出射方向的定义ray.rxDirection要乘以-1
-            Vector3f dwodx = -ray.rxDirection - wo;
-            // 3式
-            Float dDNdx = dot(dwodx, ns) + dot(wo, dndx);
-            // 2式结合0式
-            rd.rxDirection = wi - dwodx 
-            		+ 2.f * Vector3f(dot(wo, ns) * dndx + dDNdx * ns);
-            // y方向的差分光线的方向求法同上
-            Normal3f dndy = isect.shading.dndu * isect.dudy
-                          + isect.shading.dndv * isect.dvdy;
-            Vector3f dwody = -ray.ryDirection - wo;
-            Float dDNdy = dot(dwody, ns) + dot(wo, dndy);
-			rd.ryDirection = wi - dwody
-				    + 2.f * Vector3f(dot(wo, ns) * dndy + dDNdy * ns);
-        }
+        // 生成wi方向的主光线，反射差分光线的推导见spawnRayDifferential
+        RayDifferential rd = isect.spawnRayDifferential(ray, wi, type, pdf);
         return f * Li(rd, scene, sampler, arena, depth + 1) * absDot(wi, ns) / pdf;
     } else {
     	return Spectrum(0.0f);
@@ -363,62 +684,15 @@ Spectrum MonteCarloIntegrator::specularTransmit(const RayDifferential &ray,
     Vector3f wo = isect.wo;
     Vector3f wi;
     Float pdf;
-    const Point3f pos;
     const BSDF &bsdf = *isect.bsdf;
     BxDFType type = BxDFType(BSDF_TRANSMISSION | BSDF_SPECULAR);
     Spectrum f = bsdf.sample_f(wo, &wi, sampler.get2D(), &pdf, type);
     Spectrum L(0.0f);
-    Normal3f ns = isect.shading.normal;
+    const Normal3f &ns = isect.shading.normal;
 
     if (pdf > 0.0f && !f.IsBlack() && absDot(wi, ns) != 0) {
-    	RayDifferential rd = isect.spawnRay(wi);
-    	if (ray.hasDifferentials) {
-    		rd.hasDifferentials = true;
-    		rd.rxOrigin = pos + isect.dpdx;
-    		rd.ryOrigin = pos + isect.dpdy;
-
-			Normal3f dndx = isect.shading.dndu * isect.dudx +
-                            isect.shading.dndv * isect.dvdx;
-            Normal3f dndy = isect.shading.dndu * isect.dudy +
-                            isect.shading.dndv * isect.dvdy;
-            // 假设光线进入物体
-            Float eta = 1 / bsdf.eta;
-            if (dot(wo, ns) < 0) {
-            	eta = 1 / eta;
-            	ns = -ns;
-            	dndx = -dndx;
-            	dndy = -dndy;
-            }
-
-            /**
-             * 由折射公式
-             * η = ηi/ηt
-             * ωt = -η ωi + [η (ωi · n) - cosθt] n
-             *
-             *  dωt		d(-η ωi + [η (ωi · n) - cosθt] n)
-             * ----- = ----------------------------------
-             *  dx                   dx
-             *
-             *     d(-η ωi)     d(η (ωi · n) n)     d(n cosθt)
-             * = ----------- + ---------------- - ------------
-             *       dx            dx                 dx
-             */
-			Vector3f dwodx = -ray.rxDirection - wo,
-                     dwody = -ray.ryDirection - wo;
-            Float dDNdx = dot(dwodx, ns) + dot(wo, dndx);
-            Float dDNdy = dot(dwody, ns) + dot(wo, dndy);
-
-            Float mu = eta * dot(wo, ns) - absDot(wi, ns);
-            Float dmudx =
-                (eta - (eta * eta * dot(wo, ns)) / absDot(wi, ns)) * dDNdx;
-            Float dmudy =
-                (eta - (eta * eta * dot(wo, ns)) / absDot(wi, ns)) * dDNdy;
-
-            rd.rxDirection =
-                wi - eta * dwodx + Vector3f(mu * dndx + dmudx * ns);
-            rd.ryDirection =
-                wi - eta * dwody + Vector3f(mu * dndy + dmudy * ns);            
-    	}
+        // 折射差分光线的推导见spawnRayDifferential
+    	RayDifferential rd = isect.spawnRayDifferential(ray, wi, type, pdf);
     	L = f * Li(rd, scene, sampler, arena, depth + 1) * absDot(wi, ns) / pdf;
     }
     return L;
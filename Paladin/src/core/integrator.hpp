@@ -18,6 +18,7 @@
 #include "sampler.hpp"
 #include "material.hpp"
 #include "core/cobject.h"
+#include "core/aov.hpp"
 #include "tools/classfactory.hpp"
 
 PALADIN_BEGIN
@@ -243,12 +244,14 @@ Spectrum uniformSampleAllLights(const Interaction &it, const Scene &scene,
  * @param  sampler      采样器
  * @param  handleMedia  是否处理参与介质
  * @param  lightDistrib 光源分布
+ * @param  sampledLight 返回：选中的光源，用于光照分组AOV，可以为空
  * @return              辐射度
  */
 Spectrum sampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
                                bool handleMedia = false,
-                               const Distribution1D *lightDistrib = nullptr);
+                               const Distribution1D *lightDistrib = nullptr,
+                               const Light **sampledLight = nullptr);
 
 /**
  * 用复合重要性采样进行直接光照的估计
@@ -290,6 +293,84 @@ public:
     
     virtual void render(const Scene &scene) override;
     
+    /**
+     * 设置自适应采样参数，param为空或者threshold不大于0时不开启自适应采样
+     * param : {
+     *     "threshold" : 0.05,
+     *     "minSamples" : 16,
+     *     "passSamples" : 16,
+     *     // 每个像素的样本数上限，0表示采样器的spp，可以超过采样器的spp
+     *     "maxSamples" : 0
+     * }
+     */
+    void setAdaptiveSampling(const nloJson &param) {
+        if (!param.is_object()) {
+            return;
+        }
+        _adaptiveThreshold = param.value("threshold", 0.f);
+        _adaptiveMinSamples = std::max(2, param.value("minSamples", 16));
+        _adaptivePassSamples = std::max(1, param.value("passSamples", 16));
+        _adaptiveMaxSamples = param.value("maxSamples", 0);
+    }
+    
+    /**
+     * 设置渐进式渲染参数，param为空时不开启渐进式渲染
+     * 开启之后会忽略自适应采样的参数
+     * param : {
+     *     // 渲染时间上限，单位为秒，0表示不限时
+     *     "timeLimit" : 600,
+     *     // 目标spp，0表示采样器的spp，可以超过采样器的spp
+     *     "targetSpp" : 0,
+     *     // 每一轮每个像素的样本数
+     *     "passSamples" : 4,
+     *     // 输出中间结果的时间间隔，单位为秒，0表示不输出
+     *     "snapshotInterval" : 30,
+     *     // 快照的文件名，为空时在film的文件名后面加上"_snapshot"
+     *     "snapshotFile" : ""
+     * }
+     */
+    void setProgressive(const nloJson &param) {
+        if (!param.is_object()) {
+            return;
+        }
+        _progressive = true;
+        _progressiveTimeLimit = param.value("timeLimit", 0.f);
+        _progressiveTargetSpp = param.value("targetSpp", 0);
+        _progressivePassSamples = std::max(1, param.value("passSamples", 4));
+        _progressiveSnapshotInterval = param.value("snapshotInterval", 0.f);
+        _progressiveSnapshotFile = param.value("snapshotFile", std::string());
+    }
+    
+    /**
+     * 设置分布式渲染参数，param为空时不开启
+     * 开启之后会忽略渐进式渲染与自适应采样的参数
+     * 每个进程只渲染每个像素的一段样本，把film的累加数据写入检查点，
+     * 最后由一个进程合并所有检查点，输出图像，见Film::writeCheckpoint
+     * param : {
+     *     // 渲染每个像素的第[start, end)个样本，end为0表示采样器的spp
+     *     "sampleRange" : [0, 64],
+     *     // 渲染结束之后写入的检查点文件
+     *     "checkpoint" : "part0.ckpt",
+     *     // 不为空时不渲染，合并这些检查点之后输出图像
+     *     "merge" : ["part0.ckpt", "part1.ckpt"]
+     * }
+     */
+    void setDistributed(const nloJson &param) {
+        if (!param.is_object()) {
+            return;
+        }
+        _distributed = true;
+        nloJson range = param.value("sampleRange", nloJson::array({0, 0}));
+        DCHECK(range.size() == 2);
+        _sampleRangeStart = range.at(0);
+        _sampleRangeEnd = range.at(1);
+        _checkpointFile = param.value("checkpoint", "");
+        _mergeCheckpoints.clear();
+        for (const auto &fileName : param.value("merge", nloJson::array())) {
+            _mergeCheckpoints.push_back(fileName.get<std::string>());
+        }
+    }
+    
     /**
      * 返回当前ray采样到的辐射度       
      */
@@ -297,6 +378,16 @@ public:
                         Sampler &sampler, MemoryArena &arena,
                         int depth = 0) const = 0;
     
+    /**
+     * 与Li相同，同时把AOV数据写入aov中，aov为空时等价于Li
+     * 不支持AOV的积分器直接调用Li，此时AOV图层为0
+     */
+    virtual Spectrum LiWithAOV(const RayDifferential &ray, const Scene &scene,
+                               Sampler &sampler, MemoryArena &arena,
+                               AOVSample *aov) const {
+        return Li(ray, scene, sampler, arena);
+    }
+    
     // 高光反射
     Spectrum specularReflect(const RayDifferential &ray,
                              const SurfaceInteraction &isect,
@@ -318,6 +409,112 @@ protected:
     std::shared_ptr<Sampler> _sampler;
     // 像素范围
     const AABB2i _pixelBounds;
+    // 光源到光照分组索引的映射，不属于任何分组的光源不在其中
+    std::map<const Light *, int> _lightGroupIndex;
+    // 自适应采样的相对误差阈值，小于等于0时不开启自适应采样
+    Float _adaptiveThreshold = 0;
+    // 自适应采样第一轮每个像素的样本数，用于得到可靠的方差估计
+    int _adaptiveMinSamples = 16;
+    // 自适应采样之后每一轮，未收敛像素追加的样本数
+    int _adaptivePassSamples = 16;
+    // 自适应采样每个像素的样本数上限，小于等于0表示采样器的spp
+    int _adaptiveMaxSamples = 0;
+    
+    /**
+     * 生成pixel像素上的一个相机样本，并计算其辐射度
+     * 非法值(NaN，负数，无穷大)会被置为0
+     * @param  cameraSample 返回的相机样本
+     * @param  rayWeight    返回的相机光线权重
+     * @param  aov          返回的AOV数据，为空时不计算AOV
+     * @param  spp          每个像素最终的样本总数，用于缩放光线微分，
+     *                      小于等于0时取采样器的spp
+     *                      clonePass生成的采样器只包含一轮的样本，需要显式传入
+     */
+    Spectrum evaluateSample(const Point2i &pixel, const Scene &scene,
+                            Sampler &sampler, MemoryArena &arena,
+                            CameraSample *cameraSample, Float *rayWeight,
+                            AOVSample *aov = nullptr, int64_t spp = 0) const;
+    
+    /**
+     * 建立光源到光照分组的映射，在渲染开始之前调用
+     */
+    void prepareAOVs(const Scene &scene);
+    
+    /**
+     * 在arena中分配一个相机样本的AOV数据，film没有AOV时返回空
+     */
+    AOVSample *createAOVSample(MemoryArena &arena) const;
+    
+    /**
+     * 记录相机光线的第一个交点，深度与ID
+     * 只记录一次，aov为空时直接返回
+     */
+    static void recordPrimaryAOV(AOVSample *aov, const RayDifferential &ray,
+                                 const SurfaceInteraction &isect);
+    
+    /**
+     * 记录第一个非高光交点，反照率与着色法线，需要在计算bsdf之后调用
+     * 只记录一次，aov为空时直接返回
+     */
+    static void recordSurfaceAOV(AOVSample *aov, const SurfaceInteraction &isect);
+    
+    /**
+     * 把light贡献的radiance累加到所属的光照分组中
+     */
+    void addLightAOV(AOVSample *aov, const Light *light, const Spectrum &L) const {
+        if (!aov || !light || aov->nLightGroups == 0) {
+            return;
+        }
+        auto iter = _lightGroupIndex.find(light);
+        if (iter != _lightGroupIndex.end()) {
+            aov->addLight(iter->second, L);
+        }
+    }
+    
+    /**
+     * 自适应采样渲染
+     * 所有tile按轮次渲染，第一轮每个像素采_adaptiveMinSamples个样本，
+     * 之后每一轮只给相对误差大于阈值的像素追加_adaptivePassSamples个样本，
+     * 直到所有像素收敛，或者达到_adaptiveMaxSamples
+     * 这样平坦区域很快就停止采样，剩余的预算都集中在高方差区域，
+     * 上限可以高于采样器的spp，让难以收敛的像素得到更多的样本
+     * 每一轮的采样器由clonePass生成，与渐进式渲染相同
+     */
+    void renderAdaptive(const Scene &scene);
+    
+    // 是否开启渐进式渲染
+    bool _progressive = false;
+    // 渲染时间上限，单位为秒，小于等于0表示不限时
+    Float _progressiveTimeLimit = 0;
+    // 目标spp，小于等于0表示采样器的spp
+    int _progressiveTargetSpp = 0;
+    // 每一轮每个像素的样本数
+    int _progressivePassSamples = 4;
+    // 输出中间结果的时间间隔，单位为秒，小于等于0表示不输出
+    Float _progressiveSnapshotInterval = 0;
+    // 快照的文件名，为空时由film的文件名生成
+    std::string _progressiveSnapshotFile;
+    
+    /**
+     * 渐进式渲染
+     * 按轮次渲染整个画面，每一轮每个像素追加_progressivePassSamples个样本
+     * 所有(轮次，tile)组成一个任务序列，按顺序分发给工作线程，轮次之间没有同步点
+     * 每个任务用clonePass生成只包含这一轮样本的采样器，总样本数不受采样器spp的限制
+     * 每个任务完成之后立即合并到film中，所以任意时刻film中都是一张完整的图像
+     * 另有一个线程按照固定的时间间隔输出film的快照，快照期间工作线程不会停止
+     * 达到时间上限或者目标spp之后停止渲染
+     */
+    void renderProgressive(const Scene &scene);
+    
+    // 是否开启分布式渲染
+    bool _distributed = false;
+    // 渲染的样本区间[_sampleRangeStart, _sampleRangeEnd)，_sampleRangeEnd为0表示采样器的spp
+    int64_t _sampleRangeStart = 0;
+    int64_t _sampleRangeEnd = 0;
+    // 渲染结束之后写入的检查点，为空时不写
+    std::string _checkpointFile;
+    // 需要合并的检查点，不为空时不渲染
+    std::vector<std::string> _mergeCheckpoints;
 };
 
 PALADIN_END
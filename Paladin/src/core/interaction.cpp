@@ -10,6 +10,7 @@
 #include "shape.hpp"
 #include "light.hpp"
 #include "primitive.hpp"
+#include "materials/bxdfs/bsdf.hpp"
 
 PALADIN_BEGIN
 
@@ -41,103 +42,230 @@ faceIndex(faceIndex) {
 }
 
 void SurfaceInteraction::computeDifferentials(const RayDifferential &ray) const {
-    if (ray.hasDifferentials) {
-        // 平面方程为 ax + by + cz = d
-        // 法向量为n(a,b,c),平面上的点p(x,y,z)
-        // d = n · p
-        // 已知平面方程，射线参数，求交点，表达式如下
-        // a(ox + t dirX) + b(oy + t dirX) + c(oz + t dirZ) = d
-        // 整理得t = (d - (a,b,c) · o) / (a,b,c) · dir
-        Float d = dot(normal, Vector3f(pos));
-        Float tx = (d - dot(normal, Vector3f(ray.rxOrigin))) / dot(normal, ray.rxDirection);
-        if (std::isinf(tx) || std::isnan(tx)) {
-            goto fail;
-        }
-        Point3f px = ray.rxOrigin + tx * ray.rxDirection;
-        Float ty = (d - dot(normal, Vector3f(ray.ryOrigin))) / dot(normal, ray.ryDirection);
-        Point3f py = ray.ryOrigin + ty * ray.ryDirection;
+    _hasPendingDifferentials = false;
+    if (ray.hasDifferentials && computePositionDifferentials(ray)) {
+        computeUVDifferentials();
+    } else {
+        clearDifferentials();
+    }
+}
 
-        dpdx = px - pos;
-        dpdy = py - pos;
+void SurfaceInteraction::clearDifferentials() const {
+    dudx = dvdx = 0;
+    dudy = dvdy = 0;
+    dpdx = dpdy = Vector3f(0, 0, 0);
+}
 
-        /**
-         * p' = p + △u dp/du + △v dp/dv
-         *  
-         *  展开之后可以转化成矩阵相乘的形式
-         *
-         *  p'x = px + △u dpx/du + △v dpx/dv
-         *  p'y = py + △u dpy/du + △v dpy/dv
-         *  p'z = pz + △u dpz/du + △v dpz/dv
-         *          
-         * | p'x - px |   | dpx/du dpx/dv |   | △u |
-         * | p'y - py | = | dpy/du dpy/dv | * |    |
-         * | p'z - pz |   | dpz/du dpz/dv |   | △v |
-         * 
-         * 以上形式，有两个未知数，但有三个方程，显然不符合我们的数学常识(过度约束了)
-         * 也许这个方程组可以退化为二元一次方程组
-         * 例如，假设dp/du,dp/dv都在xy平面上，dpz/du与dpz/dv都为0
-         * 因为点p的xyz坐标之间是有约束条件的，所以！
-         * 我们可以确定以上方程组可以退化为二元一次方程组
-         *
-         * 现在需要选择其中两个方程去求解，选择哪两个呢？
-         * dp/du,dp/dv叉乘得到法向量normal，找到normal最大的一个分量
-         * 用较小两个分量求解线性方程组
-         * 
-         * btw: 为何要这样选择？
-         * 假设normal为(0,0,1)，这时如果选择的是x,z两个维度，或者y，z
-         * 这特么显然是算不出来的嘛，uv变化都不会引起z变化，还算个鸡毛！
-         * 所以要选择normal较小的两个维度，确保这p点的这两个维度随着uv变化而都会发生变化
-         *
-         * y轴方向的辅助光线微分计算同理，不再赘述
-         */
-        int dim[2];
-        if (std::abs(normal.x) > std::abs(normal.y) 
-            && std::abs(normal.x) > std::abs(normal.z)) {
-            dim[0] = 1;
-            dim[1] = 2;
-        } else if (std::abs(normal.y) > std::abs(normal.z)) {
-            dim[0] = 0;
-            dim[1] = 2;
-        } else {
-            dim[0] = 0;
-            dim[1] = 1;
-        }
-        Float A[2][2] = {{dpdu[dim[0]], dpdv[dim[0]]},
-                         {dpdu[dim[1]], dpdv[dim[1]]}};
-        Float Bx[2] = {px[dim[0]] - pos[dim[0]], px[dim[1]] - pos[dim[1]]};
-        Float By[2] = {py[dim[0]] - pos[dim[0]], py[dim[1]] - pos[dim[1]]};
-        if (!solveLinearSystem2x2(A, Bx, &dudx, &dvdx)) {
-            dudx = dvdx = 0;
-        }
-        if (!solveLinearSystem2x2(A, By, &dudy, &dvdy)) {
-            dudy = dvdy = 0;        
-        }
+bool SurfaceInteraction::computePositionDifferentials(const RayDifferential &ray) const {
+    // 平面方程为 ax + by + cz = d
+    // 法向量为n(a,b,c),平面上的点p(x,y,z)
+    // d = n · p
+    // 已知平面方程，射线参数，求交点，表达式如下
+    // a(ox + t dirX) + b(oy + t dirX) + c(oz + t dirZ) = d
+    // 整理得t = (d - (a,b,c) · o) / (a,b,c) · dir
+    Float d = dot(normal, Vector3f(pos));
+    Float tx = (d - dot(normal, Vector3f(ray.rxOrigin))) / dot(normal, ray.rxDirection);
+    if (std::isinf(tx) || std::isnan(tx)) {
+        return false;
+    }
+    Point3f px = ray.rxOrigin + tx * ray.rxDirection;
+    Float ty = (d - dot(normal, Vector3f(ray.ryOrigin))) / dot(normal, ray.ryDirection);
+    Point3f py = ray.ryOrigin + ty * ray.ryDirection;
+
+    dpdx = px - pos;
+    dpdy = py - pos;
+    return true;
+}
 
+void SurfaceInteraction::computeUVDifferentials() const {
+    /**
+     * p' = p + △u dp/du + △v dp/dv
+     *  
+     *  展开之后可以转化成矩阵相乘的形式
+     *
+     *  p'x = px + △u dpx/du + △v dpx/dv
+     *  p'y = py + △u dpy/du + △v dpy/dv
+     *  p'z = pz + △u dpz/du + △v dpz/dv
+     *          
+     * | p'x - px |   | dpx/du dpx/dv |   | △u |
+     * | p'y - py | = | dpy/du dpy/dv | * |    |
+     * | p'z - pz |   | dpz/du dpz/dv |   | △v |
+     * 
+     * 以上形式，有两个未知数，但有三个方程，显然不符合我们的数学常识(过度约束了)
+     * 也许这个方程组可以退化为二元一次方程组
+     * 例如，假设dp/du,dp/dv都在xy平面上，dpz/du与dpz/dv都为0
+     * 因为点p的xyz坐标之间是有约束条件的，所以！
+     * 我们可以确定以上方程组可以退化为二元一次方程组
+     *
+     * 现在需要选择其中两个方程去求解，选择哪两个呢？
+     * dp/du,dp/dv叉乘得到法向量normal，找到normal最大的一个分量
+     * 用较小两个分量求解线性方程组
+     * 
+     * btw: 为何要这样选择？
+     * 假设normal为(0,0,1)，这时如果选择的是x,z两个维度，或者y，z
+     * 这特么显然是算不出来的嘛，uv变化都不会引起z变化，还算个鸡毛！
+     * 所以要选择normal较小的两个维度，确保这p点的这两个维度随着uv变化而都会发生变化
+     *
+     * y轴方向的辅助光线微分计算同理，不再赘述
+     */
+    int dim[2];
+    if (std::abs(normal.x) > std::abs(normal.y) 
+        && std::abs(normal.x) > std::abs(normal.z)) {
+        dim[0] = 1;
+        dim[1] = 2;
+    } else if (std::abs(normal.y) > std::abs(normal.z)) {
+        dim[0] = 0;
+        dim[1] = 2;
     } else {
-        fail:
+        dim[0] = 0;
+        dim[1] = 1;
+    }
+    Float A[2][2] = {{dpdu[dim[0]], dpdv[dim[0]]},
+                     {dpdu[dim[1]], dpdv[dim[1]]}};
+    // px - pos即为dpdx，py同理
+    Float Bx[2] = {dpdx[dim[0]], dpdx[dim[1]]};
+    Float By[2] = {dpdy[dim[0]], dpdy[dim[1]]};
+    if (!solveLinearSystem2x2(A, Bx, &dudx, &dvdx)) {
         dudx = dvdx = 0;
-        dudy = dvdy = 0;
-        dpdx = dpdy = Vector3f(0, 0, 0);
+    }
+    if (!solveLinearSystem2x2(A, By, &dudy, &dvdy)) {
+        dudy = dvdy = 0;        
     }
 }
 
-void SurfaceInteraction::computeTangentSpace() {
+Frame SurfaceInteraction::computeTangentSpace() const {
     if (shape == nullptr) {
-        return;
+        return Frame();
     }
     Vector3f tangent = normalize(shading.dpdu);
     Vector3f bitangent = normalize(shading.dpdv);
-    tangentSpace = Frame(tangent, bitangent, shading.normal);
+    return Frame(tangent, bitangent, shading.normal);
 }
 
 void SurfaceInteraction::computeScatteringFunctions(const RayDifferential &ray,
                                                     MemoryArena &arena,
                                                     bool allowMultipleLobes,/* = false*/
                                                     TransportMode mode/* = TransportMode::Radiance*/) {
-    computeDifferentials(ray);
+    // 只有dpdx，dpdy需要用到光线，在这里直接算出来，
+    // 求解dudx等参数的线性方程组推迟到第一次读取的时候，不需要保存光线
+    _hasPendingDifferentials = ray.hasDifferentials && computePositionDifferentials(ray);
+    if (!_hasPendingDifferentials) {
+        clearDifferentials();
+    }
     primitive->computeScatteringFunctions(this, arena, mode, allowMultipleLobes);
 }
 
+RayDifferential SurfaceInteraction::spawnRayDifferential(const RayDifferential &ray,
+                                                         const Vector3f &wi,
+                                                         BxDFType flags,
+                                                         Float pdf) const {
+    RayDifferential rd = spawnRay(wi);
+    if (!ray.hasDifferentials || !bsdf) {
+        return rd;
+    }
+    rd.hasDifferentials = true;
+    ensureDifferentials();
+    // 微分光线的起点就是当前交点的足迹，三种情况都一样
+    rd.rxOrigin = pos + dpdx;
+    rd.ryOrigin = pos + dpdy;
+    Normal3f ns = shading.normal;
+
+    if ((flags & BSDF_SPECULAR) && (flags & BSDF_REFLECTION)) {
+        /**
+         * 计算反射差分光线的方向
+         * 用正向差分法去近似，表达式如下
+         * ω ≈ ωi + dωi/dx     0式
+         * 由反射向量公式 ωi = 2(ωo · n)n - ωo
+         *
+         *  dωi     d(2(ωo · n)n - ωo)
+         * ----- = --------------------     1式
+         *  dx             dx
+         *
+         *                dn     d(ωo · n)          dωo
+         * = 2 [(ωo · n) ---- + ----------- n]  -  -----  2式
+         *                dx        dx              dx
+         * 其中
+         *  d(ωo · n)     dωo              dn
+         * ----------- = ----- · n + ωo · ----  3式
+         *     dx         dx               dx
+         */
+        // 复合函数求导，链式法则
+        Normal3f dndx = shading.dndu * dudx + shading.dndv * dvdx;
+        Normal3f dndy = shading.dndu * dudy + shading.dndv * dvdy;
+        // 注意出射方向的定义ray.rxDirection要乘以-1
+        Vector3f dwodx = -ray.rxDirection - wo;
+        Vector3f dwody = -ray.ryDirection - wo;
+        // 3式
+        Float dDNdx = dot(dwodx, ns) + dot(wo, dndx);
+        Float dDNdy = dot(dwody, ns) + dot(wo, dndy);
+        // 2式结合0式
+        rd.rxDirection = wi - dwodx + 2.f * Vector3f(dot(wo, ns) * dndx + dDNdx * ns);
+        rd.ryDirection = wi - dwody + 2.f * Vector3f(dot(wo, ns) * dndy + dDNdy * ns);
+    } else if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+        Normal3f dndx = shading.dndu * dudx + shading.dndv * dvdx;
+        Normal3f dndy = shading.dndu * dudy + shading.dndv * dvdy;
+        // 假设光线进入物体
+        Float eta = 1 / bsdf->eta;
+        if (dot(wo, ns) < 0) {
+            eta = 1 / eta;
+            ns = -ns;
+            dndx = -dndx;
+            dndy = -dndy;
+        }
+        /**
+         * 由折射公式
+         * η = ηi/ηt
+         * ωt = -η ωi + [η (ωi · n) - cosθt] n
+         *
+         *  dωt     d(-η ωi + [η (ωi · n) - cosθt] n)
+         * ----- = ----------------------------------
+         *  dx                   dx
+         *
+         *     d(-η ωi)     d(η (ωi · n) n)     d(n cosθt)
+         * = ----------- + ---------------- - ------------
+         *       dx            dx                 dx
+         */
+        Vector3f dwodx = -ray.rxDirection - wo;
+        Vector3f dwody = -ray.ryDirection - wo;
+        Float dDNdx = dot(dwodx, ns) + dot(wo, dndx);
+        Float dDNdy = dot(dwody, ns) + dot(wo, dndy);
+
+        Float mu = eta * dot(wo, ns) - absDot(wi, ns);
+        Float dmudx = (eta - (eta * eta * dot(wo, ns)) / absDot(wi, ns)) * dDNdx;
+        Float dmudy = (eta - (eta * eta * dot(wo, ns)) / absDot(wi, ns)) * dDNdy;
+
+        rd.rxDirection = wi - eta * dwodx + Vector3f(mu * dndx + dmudx * ns);
+        rd.ryDirection = wi - eta * dwody + Vector3f(mu * dndy + dmudy * ns);
+    } else {
+        // 张角用tan表示，超过45°之后纹理查找已经落在最粗糙的几层，没有必要继续扩大
+        const Float MaxSpread = 1;
+        // 入射光线的张角，方向不一定是单位向量，先归一化
+        Vector3f dir = normalize(ray.dir);
+        Float spreadIn = std::max((normalize(ray.rxDirection) - dir).length(),
+                                  (normalize(ray.ryDirection) - dir).length());
+        // 立体角 1/pdf 对应的圆锥半角 θ，πθ² ≈ 1/pdf
+        Float spread = pdf > 0 ? spreadIn + 1 / std::sqrt(Pi * pdf) : MaxSpread;
+        spread = std::min(spread, MaxSpread);
+        Vector3f u, v;
+        coordinateSystem(wi, &u, &v);
+        rd.rxDirection = wi + spread * u;
+        rd.ryDirection = wi + spread * v;
+    }
+    return rd;
+}
+
+RayDifferential SurfaceInteraction::spawnRayThrough(const RayDifferential &ray) const {
+    RayDifferential rd = spawnRay(ray.dir);
+    if (ray.hasDifferentials) {
+        rd.hasDifferentials = true;
+        rd.rxOrigin = ray.rxOrigin;
+        rd.ryOrigin = ray.ryOrigin;
+        rd.rxDirection = ray.rxDirection;
+        rd.ryDirection = ray.ryDirection;
+    }
+    return rd;
+}
+
 Spectrum SurfaceInteraction::Le(const Vector3f &w) const {
     const AreaLight *area = primitive->getAreaLight();
     return area ? area->L(*this, w) : Spectrum(0.f);
@@ -12,6 +12,7 @@
 #include "core/header.h"
 #include "medium.hpp"
 #include "core/material.hpp"
+#include "core/bxdf.hpp"
 #include "math/frame.hpp"
 
 PALADIN_BEGIN
@@ -166,13 +167,50 @@ public:
      * @param ray [description]
      */
     void computeDifferentials(const RayDifferential &ray) const;
+    
+    /**
+     * 读取dpdx，dudx等微分数据之前需要调用
+     * computeScatteringFunctions只计算了dpdx，dpdy，很多材质根本用不到微分，
+     * 所以dudx等参数在第一次读取的时候才真正计算，之后不再重复计算
+     */
+    inline void ensureDifferentials() const {
+        if (_hasPendingDifferentials) {
+            _hasPendingDifferentials = false;
+            computeUVDifferentials();
+        }
+    }
 
     void computeScatteringFunctions(const RayDifferential &ray,
                                     MemoryArena &arena,
                                     bool allowMultipleLobes = false,
                                     TransportMode mode = TransportMode::Radiance);
+
+    /**
+     * 由bsdf采样的方向生成下一段光线，并且传递微分光线(光线的足迹)
+     * 间接光照的纹理查找依赖微分光线选择mipmap的层级，
+     * 如果直接用spawnRay，之后的所有弹射都只会查找最精细的一层
+     *
+     * 1.高光反射与高光透射，由反射/折射公式对屏幕坐标求导，得到精确的微分光线
+     * 2.其余情况用光锥(ray cone)近似，微分光线的起点为当前交点的足迹，
+     *   方向在wi的基础上张开一个角度，这个角度为入射光线的张角加上采样方向的张角
+     *   采样方向代表的立体角约为 1/pdf，对应的张角约为 1/√pdf
+     *   pdf越小，lobe越宽，足迹扩散得越快，之后的纹理查找也就越模糊
+     *
+     * ray为入射光线，没有微分光线时生成的光线也没有
+     * @param  flags 采样到的bxdf类型
+     * @param  pdf   采样wi的概率密度
+     */
+    RayDifferential spawnRayDifferential(const RayDifferential &ray, const Vector3f &wi,
+                                         BxDFType flags, Float pdf) const;
+
+    /**
+     * 没有bsdf的表面(仅仅用于限定参与介质的范围)，光线直接穿过
+     * 方向没有改变，微分光线保持不变
+     */
+    RayDifferential spawnRayThrough(const RayDifferential &ray) const;
     
-    void computeTangentSpace();
+    // 由着色几何构造切线空间，用于法线贴图，shape为空时返回无效的Frame
+    Frame computeTangentSpace() const;
     
     inline void faceForward() {
         normal = faceforward(normal, shading.normal);
@@ -205,8 +243,6 @@ public:
     当屏幕坐标x变化时，表面交点p随x的变化率，y同理
      */
     mutable Vector3f dpdx, dpdy;
-    
-    mutable Frame tangentSpace;
 
     /*
     表面坐标对屏幕坐标对屏幕坐标的一阶导数
@@ -215,6 +251,20 @@ public:
     mutable Float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
 
     int faceIndex = 0;
+    
+private:
+    
+    // 由辅助光线与切平面的交点计算dpdx，dpdy，交点不存在时返回false
+    bool computePositionDifferentials(const RayDifferential &ray) const;
+    
+    // 由dpdx，dpdy求解dudx，dvdx，dudy，dvdy
+    void computeUVDifferentials() const;
+    
+    void clearDifferentials() const;
+    
+    // dpdx，dpdy已经算好，dudx等参数还没有计算时为true
+    // 不保存光线，积分器在读取微分之前复用或修改光线也不会影响结果
+    mutable bool _hasPendingDifferentials = false;
 };
 
 PALADIN_END
@@ -43,6 +43,8 @@ Spectrum VisibilityTester::Tr(const Scene &scene, Sampler &sampler) const {
 
 //"data" : {
 //    "type" : "pointLight",
+//    // 可选，所属的光照分组
+//    "lightGroup" : "key",
 //    "param" : {
 //        "worldToLocal" : {
 //            "type" : "translate",
@@ -64,6 +66,7 @@ Light * createLight(const nloJson &data) {
     nloJson param = data.value("param", nloJson::object());
     auto ret = dynamic_cast<Light *>(creator(param, {}));
     DCHECK(ret != nullptr);
+    ret->lightGroup = data.value("lightGroup", "");
     return ret;
 }
 
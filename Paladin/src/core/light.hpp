@@ -166,6 +166,9 @@ public:
 
     const MediumInterface mediumInterface;
     
+    // 所属的光照分组，为空表示不属于任何分组，用于输出光照分组AOV
+    std::string lightGroup;
+    
 protected:
 
     shared_ptr<const Transform> _lightToWorld;
@@ -15,8 +15,13 @@
 
 PALADIN_BEGIN
 
+int Material::allocateId() {
+    static std::atomic<int> nextId(1);
+    return nextId++;
+}
 
 void Material::bumpMapping(const std::shared_ptr<Texture<Float>> &d, SurfaceInteraction *si) {
+	si->ensureDifferentials();
 	SurfaceInteraction siEval = *si;
 
 	//todo 这里不是很理解为何要将两个方向相加
@@ -72,8 +77,8 @@ void Material::bumpMapping(const std::shared_ptr<Texture<Float>> &d, SurfaceInte
 
 void Material::normalMapping(const shared_ptr<Texture<Spectrum> > &normalMap,
                              SurfaceInteraction *si, Float scale/* = -1*/) {
-    si->computeTangentSpace();
-    if (!si->tangentSpace.isValid()) {
+    Frame tangentSpace = si->computeTangentSpace();
+    if (!tangentSpace.isValid()) {
         return;
     }
     
@@ -89,7 +94,7 @@ void Material::normalMapping(const shared_ptr<Texture<Spectrum> > &normalMap,
     Vector2f v2 = Vector2f(normal.x, normal.y);
     normal.z = std::sqrt((Float)(1.f - clamp(v2.lengthSquared(), 0.f, 1.f)));
     
-    Vector3f worldNormal = si->tangentSpace.toWorld(normal);
+    Vector3f worldNormal = tangentSpace.toWorld(normal);
     
     si->shading.normal = normalize(Normal3f(worldNormal));
     coordinateSystem((Vector3f)si->shading.normal, &si->shading.dpdu, &si->shading.dpdv);
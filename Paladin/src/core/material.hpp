@@ -12,6 +12,7 @@
 #include "core/header.h"
 #include "cobject.h"
 #include "tools/classfactory.hpp"
+#include "core/textureprogram.hpp"
 
 PALADIN_BEGIN
 
@@ -28,7 +29,8 @@ public:
              Float scale = -1)
     : _normalMap(normalMap),
     _bumpMap(bumpMap),
-    _normalMapScale(scale) {
+    _normalMapScale(scale),
+    _id(allocateId()) {
         
     }
     
@@ -41,6 +43,22 @@ public:
     	
     }
     
+    /**
+     * 材质ID，从1开始，按照创建顺序分配，用于输出materialId AOV
+     * 场景解析是单线程的，所以同一个场景每次渲染的ID都相同
+     */
+    int getId() const {
+        return _id;
+    }
+    
+    /**
+     * 会生成BSSRDF的材质返回true，场景会为这类材质单独建立加速结构，
+     * 供次表面散射的探测光线使用
+     */
+    virtual bool hasSubsurface() const {
+        return false;
+    }
+    
     virtual void processNormal(SurfaceInteraction * si) const {
         if (_normalMap) {
             normalMapping(_normalMap, si, _normalMapScale);
@@ -103,12 +121,24 @@ public:
                      SurfaceInteraction *si);
     
 protected:
+    /**
+     * 材质参数的纹理编译成的程序，子类在构造函数中把参数添加进来，
+     * 着色时执行一次得到所有参数的值
+     * 法线贴图与bump贴图需要在偏移之后的位置求值，不放在程序中
+     */
+    TextureProgram _textures;
     // 法线贴图
     std::shared_ptr<Texture<Spectrum>> _normalMap;
     // bump贴图
     std::shared_ptr<Texture<Float>> _bumpMap;
     // [-1,1]
     Float _normalMapScale;
+    
+private:
+    
+    static int allocateId();
+    
+    const int _id;
 };
 
 Material * createMaterial(const nloJson &);
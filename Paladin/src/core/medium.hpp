@@ -119,8 +119,11 @@
 #define medium_hpp
 
 #include "core/header.h"
+#include "core/spectrum.hpp"
+#include "math/rng.h"
 #include "cobject.h"
 #include "tools/classfactory.hpp"
+#include <functional>
 
 PALADIN_BEGIN
 /**
@@ -153,6 +156,22 @@ public:
     virtual std::string toString() const = 0;
 };
 
+/**
+ * 空碰撞(null-scattering)追踪时，候选碰撞点处的介质属性
+ */
+struct MajorantSample {
+    // 世界空间中的位置
+    Point3f pos;
+    // 碰撞点处的吸收系数与散射系数
+    Spectrum sigma_a, sigma_s;
+    // 碰撞点所在区间的majorant，σn = σmaj - σa - σs
+    Spectrum sigma_maj;
+    // 上一个碰撞点(或者光线起点)到该点的majorant透射率 e^(-σmaj * Δt)
+    Spectrum T_maj;
+    // 相函数的各向异性系数
+    Float g;
+};
+
 // 介质
 class Medium : public CObject {
 public:
@@ -168,6 +187,21 @@ public:
     virtual Spectrum sample(const Ray &ray, Sampler &sampler,
                             MemoryArena &arena,
                             MediumInteraction *mi) const = 0;
+    
+    /**
+     * 按照majorant沿光线采样候选碰撞点，供空碰撞路径追踪使用
+     * 与sample不同，该函数不决定碰撞类型，每个候选碰撞点都交给callback处理，
+     * callback返回false时停止追踪
+     * 距离用channel通道的majorant采样，其他通道由调用者用MIS权重修正
+     * @param  ray      光线，范围为[0, ray.tMax]
+     * @param  channel  用于采样距离的通道
+     * @param  rng      随机数生成器，碰撞次数不确定，不适合消耗采样器的维度
+     * @param  callback 每个候选碰撞点的回调
+     * @return          如果走完了整条光线，返回最后一个碰撞点到终点的majorant透射率
+     *                  如果callback提前终止，返回1
+     */
+    virtual Spectrum sampleTmaj(const Ray &ray, int channel, RNG &rng,
+                                const std::function<bool(const MajorantSample &)> &callback) const = 0;
 };
 
 
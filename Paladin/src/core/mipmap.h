@@ -13,11 +13,21 @@
 #include "core/spectrum.hpp"
 #include "core/texture.hpp"
 #include "math/bounds.h"
+#include "math/simd.h"
 
 PALADIN_BEGIN
 
 enum class ImageWrap { Repeat, Black, Clamp };
 
+/**
+ * 带偏导数的纹理查询方式
+ *     Trilinear    取偏导数的最大跨度作为宽度，三线性插值，最快但倾斜角度下很模糊
+ *     EWA          椭圆加权平均，质量最好，开销与椭圆覆盖的像素数成正比
+ *     Anisotropic  沿椭圆长轴做若干次三线性采样，类似GPU的各向异性过滤，
+ *                  采样次数不超过maxAniso，开销介于前两者之间
+ */
+enum class MIPFilter { Trilinear, EWA, Anisotropic };
+
 // 重采样的权重
 struct ResampleWeight {
     // 第一个纹理像素的索引
@@ -28,9 +38,9 @@ struct ResampleWeight {
 template <typename T>
 class MIPMap {
 public:
-    MIPMap(const Point2i &res, const T *img, bool doTri = true,
+    MIPMap(const Point2i &res, const T *img, MIPFilter filter = MIPFilter::Trilinear,
            Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat)
-    : _doTrilinear(doTri),
+    : _filter(filter),
     _maxAnisotropy(maxAniso),
     _wrapMode(wrapMode),
     _resolution(res) {
@@ -103,6 +113,7 @@ public:
 
         int nLevels = 1 + Log2Int(std::max(_resolution[0], _resolution[1]));
         _pyramid.resize(nLevels);
+        _maxLevel = nLevels - 1;
 
         _pyramid[0].reset(
             new BlockedArray<T>(_resolution[0], _resolution[1],
@@ -161,7 +172,7 @@ public:
                 break;
             case ImageWrap::Black:
                 static const T black(0.0f);
-                if (s < 0 || s >= l.uSize() || t < 0 || t > l.vSize()) {
+                if (s < 0 || s >= l.uSize() || t < 0 || t >= l.vSize()) {
                     return black;
                 }
                 break;
@@ -176,24 +187,7 @@ public:
      * @return       [description]
      */
     T lookup(const Point2f &st, Float width = 0.f) const {
-        // 根据宽度找到对应的mipmap级别
-        // width越大，对应的纹理级别越高，分辨率越低
-        // 1/width = 2^(nLevels - 1 - level)
-        Float level = levels() - 1 + Log2(std::max(width, (Float)1e-8));
-
-        if (level < 0) {
-            // 如果分辨率最大的纹理也不能满足需求
-            return triangle(0, st);
-        } else if (level >= levels() - 1) {
-            // 如果已经取到了金字塔顶端的纹理，则直接取值
-            return texel(levels() - 1, 0, 0);
-        } else {
-            // 如果level范围在纹理金字塔的范围内
-            int iLevel = std::floor(level);
-            Float delta = level - iLevel;
-            // 对相邻两个级别的纹理取插值
-            return lerp(delta, triangle(iLevel, st), triangle(iLevel + 1, st));
-        }
+        return trilinear(st, level(width));
     }
     
     /**
@@ -208,6 +202,8 @@ public:
      * 参考资料 http://www.pbr-book.org/3ed-2018/Texture/Image_Texture.html#EllipticallyWeightedAverage
      * Elliptically Weighted Average (ewa):
      *     x方向的采样跨度与y方向的跨度不同，可以将这样的情况看成一个椭圆
+     * Anisotropic:
+     *     与ewa使用相同的椭圆，但只沿长轴做若干次三线性插值，见probe函数
      * 
      * @param  st    纹理坐标
      * @param  dst0  dstdx
@@ -216,14 +212,13 @@ public:
      */
     T lookup(const Point2f &st, Vector2f dst0, Vector2f dst1) const {
         using namespace std;
-        if (_doTrilinear) {
+        if (_filter == MIPFilter::Trilinear) {
             Float width = std::max(std::max(std::abs(dst0[0]), 
                                     std::abs(dst0[1])), 
                             std::max(std::abs(dst1[0]), 
                                     std::abs(dst1[1])));
             return lookup(st, width);
         }
-        // ewa
         // 找到椭圆较长的轴
         // 保证dst0是主轴
         if (dst0.lengthSquared() < dst1.lengthSquared()) {
@@ -245,10 +240,18 @@ public:
         if (minorLength == 0) {
             return triangle(0, st);
         }
-        Float lv = levels() - (Float)1 + Log2(minorLength);
-        Float lod = std::max((Float)0, lv);
+        if (_filter == MIPFilter::Anisotropic) {
+            return probe(st, dst0, majorLength, minorLength);
+        }
+        // ewa
+        Float lod = std::max((Float)0, level(minorLength));
         int iLod = std::floor(lod);
-        return lerp(lod - iLod,
+        Float delta = lod - iLod;
+        if (delta == 0) {
+            // 短轴长度小于最精细一级的像素时只需要过滤一级
+            return EWA(iLod, st, dst0, dst1);
+        }
+        return lerp(delta,
                     EWA(iLod, st, dst0, dst1),
                     EWA(iLod + 1, st, dst0, dst1));
     }
@@ -297,6 +300,64 @@ private:
         return v.clamp(0.f, Infinity);
     }
     
+    /**
+     * 过滤宽度对应的mipmap级别，可以为负数或超出金字塔的范围
+     * 1/width = 2^(nLevels - 1 - level)
+     */
+    Float level(Float width) const {
+        return _maxLevel + std::log2(std::max(width, (Float)1e-8));
+    }
+    
+    /**
+     * 在连续的级别上三线性插值，级别由level()计算
+     * width越大，对应的纹理级别越高，分辨率越低
+     */
+    T trilinear(const Point2f &st, Float level) const {
+        if (level < 0) {
+            // 如果分辨率最大的纹理也不能满足需求
+            return triangle(0, st);
+        } else if (level >= _maxLevel) {
+            // 如果已经取到了金字塔顶端的纹理，则直接取值
+            return texel(levels() - 1, 0, 0);
+        }
+        // 如果level范围在纹理金字塔的范围内
+        int iLevel = std::floor(level);
+        Float delta = level - iLevel;
+        // 对相邻两个级别的纹理取插值
+        return lerp(delta, triangle(iLevel, st), triangle(iLevel + 1, st));
+    }
+    
+    /**
+     * 沿椭圆长轴均匀分布nProbes个采样点，每个采样点以短轴长度为宽度做三线性插值
+     * nProbes = ceil(长轴 / 短轴)，短轴已经按照maxAniso扩大过，所以不会超过ceil(maxAniso)
+     * 各个采样点按照与EWA相同的高斯权重加权
+     * 所有采样点的mipmap级别相同，只计算一次
+     * @param  st          纹理坐标
+     * @param  dst0        椭圆长半轴向量
+     * @param  majorLength 长半轴长度
+     * @param  minorLength 短半轴长度
+     */
+    T probe(const Point2f &st, const Vector2f &dst0,
+            Float majorLength, Float minorLength) const {
+        Float lv = level(minorLength);
+        // 减去一个很小的值，避免长短轴之比恰好为maxAniso时因为舍入误差多采样一次
+        int nProbes = std::max(1, (int)std::ceil(majorLength / minorLength - (Float)1e-4));
+        if (nProbes == 1) {
+            return trilinear(st, lv);
+        }
+        T sum(0.f);
+        Float sumWts = 0;
+        for (int i = 0; i < nProbes; ++i) {
+            // 采样点在长轴上的位置，范围(-1, 1)
+            Float x = (2 * i + 1) / Float(nProbes) - 1;
+            Float weight = _weightLut[std::min((int)(x * x * WeightLUTSize),
+                                               WeightLUTSize - 1)];
+            sum += trilinear(st + dst0 * x, lv) * weight;
+            sumWts += weight;
+        }
+        return sum / sumWts;
+    }
+    
     T triangle(int level, const Point2f &st) const {
         level = clamp(level, 0, levels() - 1);
         // 离散坐标转为连续坐标
@@ -306,6 +367,19 @@ private:
         int t0 = std::floor(t);
         Float ds = s - s0;
         Float dt = t - t0;
+        if (_wrapMode == ImageWrap::Repeat) {
+            // 分辨率为2的整数次幂，取模等价于按位与，两行各计算一次rowOffset
+            const BlockedArray<T> &l = *_pyramid[level];
+            int uMask = l.uSize() - 1, vMask = l.vSize() - 1;
+            const T *row0 = l.data() + l.rowOffset(t0 & vMask);
+            const T *row1 = l.data() + l.rowOffset((t0 + 1) & vMask);
+            int col0 = l.columnOffset(s0 & uMask);
+            int col1 = l.columnOffset((s0 + 1) & uMask);
+            return (1 - ds) * (1 - dt) * row0[col0] +
+                   (1 - ds) * dt       * row1[col0] +
+                   ds       * (1 - dt) * row0[col1] +
+                   ds       * dt       * row1[col1];
+        }
         // 相当于双线性插值
         return (1 - ds) * (1 - dt) * texel(level, s0,   t0) +
                (1 - ds) * dt       * texel(level, s0,   t0+1) +
@@ -331,11 +405,15 @@ private:
         }
 
         // 先把st坐标从[0,1)范围转到对应级别纹理的分辨率上
-        // 对应的偏导数也要进行转换
-        st.x = st.x * _pyramid[level]->uSize() - 0.5f;
-        st.y = st.y * _pyramid[level]->vSize() - 0.5f;
-        dst0 = dst0 * _pyramid[level]->uSize();
-        dst1 = dst1 * _pyramid[level]->vSize();
+        // 对应的偏导数也要进行转换，s分量乘以u方向分辨率，t分量乘以v方向分辨率
+        const BlockedArray<T> &l = *_pyramid[level];
+        Float uRes = l.uSize(), vRes = l.vSize();
+        st.x = st.x * uRes - 0.5f;
+        st.y = st.y * vRes - 0.5f;
+        dst0.x *= uRes;
+        dst0.y *= vRes;
+        dst1.x *= uRes;
+        dst1.y *= vRes;
 
         // 开始计算椭圆方程
         // 高中数学就学过椭圆方程啦，做个转换得到如下形式
@@ -369,21 +447,91 @@ private:
         int t0 = std::ceil (st[1] - 2 * invDet * vSqrt);
         int t1 = std::floor(st[1] + 2 * invDet * vSqrt);
 
-        // 遍历AABB内的所有纹理像素点，对于在椭圆内的点进行高斯过滤
+        // 逐行遍历AABB，r2 < 1的像素在椭圆内
+        // 不需要处理环绕的时候(Repeat模式，或者AABB都在纹理范围内)，
+        // 每行只计算一次rowOffset，列偏移只需要移位与按位与，
+        // 其余情况逐个像素调用texel处理环绕
         T sum(0.0f);
         Float sumWts = 0;
+        bool repeat = _wrapMode == ImageWrap::Repeat;
+        bool direct = repeat || (s0 >= 0 && s1 < l.uSize() && t0 >= 0 && t1 < l.vSize());
+        // 构造函数中已经把分辨率重采样为2的整数次幂，取模等价于按位与，对负数同样成立
+        int uMask = repeat ? l.uSize() - 1 : ~0;
+        int vMask = repeat ? l.vSize() - 1 : ~0;
+        Float inv2A = 0.5f / A;
+#ifdef PALADIN_SIMD_SSE
+        CONSTEXPR int logBlockSize = BlockedArray<T>::LogBlockSize;
+        const __m128 A4 = _mm_set1_ps(A);
+        const __m128 center4 = _mm_set1_ps(st.x);
+        const __m128 one4 = _mm_set1_ps(1.f);
+        const __m128 lutSize4 = _mm_set1_ps((Float)WeightLUTSize);
+        const __m128i uMask4 = _mm_set1_epi32(uMask);
+        const __m128i offsetMask4 = _mm_set1_epi32((1 << logBlockSize) - 1);
+        const __m128i lane4 = _mm_setr_epi32(0, 1, 2, 3);
+        const __m128i end4 = _mm_set1_epi32(s1 + 1);
+        PALADIN_SIMD_ALIGN int32_t lutIndex[4];
+        PALADIN_SIMD_ALIGN int32_t column[4];
+#endif
         for (int it = t0; it <= t1; ++it) {
-            Float tt = it - st.x;
-            for (int is = s0; is <= s1; ++is) {
-                Float ss = is - st.y;
-                Float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
-                // e(s,t) = A s^2 + B s t + C t^2 < 1
+            Float tt = it - st.y;
+            Float Bt = B * tt;
+            Float Ct = C * tt * tt;
+#ifdef PALADIN_SIMD_SSE
+            if (direct) {
+                // 每次处理4个像素，同时计算r2，权重查询表的索引以及列偏移，
+                // 4个像素都在椭圆外时整组跳过
+                // 椭圆通常只覆盖几十个像素，这里不再逐行求解椭圆内的范围，
+                // 求解的开方与取整比多算几组r2的开销更大
+                const T *row = l.data() + l.rowOffset(it & vMask);
+                const __m128 Bt4 = _mm_set1_ps(Bt);
+                const __m128 Ct4 = _mm_set1_ps(Ct);
+                for (int is = s0; is <= s1; is += 4) {
+                    __m128i is4 = _mm_add_epi32(_mm_set1_epi32(is), lane4);
+                    __m128 ss = _mm_sub_ps(_mm_cvtepi32_ps(is4), center4);
+                    __m128 r2 = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(A4, ss), Bt4), ss), Ct4);
+                    // 在椭圆内，并且没有超过AABB的范围
+                    __m128 inside = _mm_and_ps(_mm_cmplt_ps(r2, one4),
+                                               _mm_castsi128_ps(_mm_cmplt_epi32(is4, end4)));
+                    int mask = _mm_movemask_ps(inside);
+                    if (mask == 0) {
+                        continue;
+                    }
+                    // r2 < 1，截断之后不会超过WeightLUTSize - 1
+                    _mm_store_si128((__m128i *)lutIndex, _mm_cvttps_epi32(_mm_mul_ps(r2, lutSize4)));
+                    // columnOffset的向量版本
+                    __m128i u4 = _mm_and_si128(is4, uMask4);
+                    __m128i col4 = _mm_add_epi32(
+                            _mm_slli_epi32(_mm_srli_epi32(u4, logBlockSize), 2 * logBlockSize),
+                            _mm_and_si128(u4, offsetMask4));
+                    _mm_store_si128((__m128i *)column, col4);
+                    for (int j = 0; j < 4; ++j) {
+                        if (mask & (1 << j)) {
+                            Float weight = _weightLut[lutIndex[j]];
+                            sum += row[column[j]] * weight;
+                            sumWts += weight;
+                        }
+                    }
+                }
+                continue;
+            }
+#endif
+            // 逐个像素处理时，先解出该行在椭圆内的s范围，只遍历范围内的像素
+            // 第it行满足 A ss^2 + (B tt) ss + (C tt^2 - 1) < 0，解一元二次方程即可
+            Float disc = Bt * Bt - 4 * A * (Ct - 1);
+            if (disc <= 0) {
+                continue;
+            }
+            Float sqrtDisc = std::sqrt(disc);
+            int rs0 = std::max(s0, (int)std::ceil (st.x + (-Bt - sqrtDisc) * inv2A));
+            int rs1 = std::min(s1, (int)std::floor(st.x + (-Bt + sqrtDisc) * inv2A));
+            const T *row = direct ? l.data() + l.rowOffset(it & vMask) : nullptr;
+            for (int is = rs0; is <= rs1; ++is) {
+                Float ss = is - st.x;
+                Float r2 = (A * ss + Bt) * ss + Ct;
                 if (r2 < 1) {
-                    // 找到满足上述方程的点进行过滤
-                    int index = std::min((int)(r2 * WeightLUTSize), 
-                                                WeightLUTSize - 1);
-                    Float weight = _weightLut[index];
-                    sum += texel(level, is, it) * weight;
+                    Float weight = _weightLut[std::min((int)(r2 * WeightLUTSize),
+                                                       WeightLUTSize - 1)];
+                    sum += (direct ? row[l.columnOffset(is & uMask)] : texel(level, is, it)) * weight;
                     sumWts += weight;
                 }
             }
@@ -391,8 +539,8 @@ private:
         return sum / sumWts;
     }
     
-    // 是否为三线性插值
-    const bool _doTrilinear;
+    // 带偏导数查询时的过滤方式
+    const MIPFilter _filter;
 
     // 各向异性的最大比例，可以理解为椭圆的最大偏心率
     // 详见lookup函数注释
@@ -405,6 +553,8 @@ private:
     Point2i _resolution;
     // 多级纹理金字塔
     std::vector<std::unique_ptr<BlockedArray<T>>> _pyramid;
+    // levels() - 1，用于计算过滤宽度对应的级别
+    Float _maxLevel;
     static CONSTEXPR int WeightLUTSize = 128;
     static Float _weightLut[WeightLUTSize];
 };
@@ -11,6 +11,7 @@
 
 #include "parser/sceneparser.hpp"
 #include "tools/parallel.hpp"
+#include "tools/fileio.hpp"
 
 PALADIN_BEGIN
 
@@ -25,6 +26,8 @@ public:
         _basePath = fn.substr(0, fn.find_last_of("/") + 1);
         _sceneParser.loadFromJson(fn);
         parallelCleanup();
+        // 图像在后台线程编码写入，返回之前确保所有文件都已经写完
+        AsyncImageWriter::getInstance()->wait();
     }
     
     static Paladin * getInstance();
@@ -12,6 +12,12 @@
 
 PALADIN_BEGIN
 
+// 场景解析是单线程的，所以同一个场景每次渲染的ID都相同
+int allocatePrimitiveId() {
+    static std::atomic<int> nextId(1);
+    return nextId++;
+}
+
 //GeometricPrimitive
 GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
                                        const std::shared_ptr<const Material> &material,
@@ -20,7 +26,9 @@ GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
 : _shape(shape),
 _material(material),
 _areaLight(areaLight),
-_mediumInterface(mediumInterface) {
+_mediumInterface(mediumInterface),
+_id(allocatePrimitiveId()),
+_deferredHit(shape->supportsDeferredHit()) {
     
 }
 
@@ -51,6 +59,40 @@ bool GeometricPrimitive::intersect(const Ray &r,
         return false;
     }
     r.tMax = tHit;
+    fillHitInfo(r, isect);
+    return true;
+}
+
+bool GeometricPrimitive::intersectHit(const Ray &r, HitRecord *hit,
+                                      SurfaceInteraction *isect) const {
+    if (!_deferredHit) {
+        if (!intersect(r, isect)) {
+            return false;
+        }
+        hit->primitive = hit->instance = nullptr;
+        return true;
+    }
+    Float tHit, u, v;
+    if (!_shape->intersectHit(r, &tHit, &u, &v)) {
+        return false;
+    }
+    r.tMax = tHit;
+    hit->primitive = this;
+    hit->instance = nullptr;
+    hit->t = tHit;
+    hit->u = u;
+    hit->v = v;
+    return true;
+}
+
+void GeometricPrimitive::computeInteraction(const Ray &r, const HitRecord &hit,
+                                            SurfaceInteraction *isect) const {
+    DCHECK(hit.primitive == this);
+    _shape->computeInteraction(r, hit.t, hit.u, hit.v, isect);
+    fillHitInfo(r, isect);
+}
+
+void GeometricPrimitive::fillHitInfo(const Ray &r, SurfaceInteraction *isect) const {
     isect->primitive = this;
     CHECK_GE(dot(isect->normal, isect->shading.normal), 0.);
 
@@ -59,7 +101,6 @@ bool GeometricPrimitive::intersect(const Ray &r,
     } else {
         isect->mediumInterface = MediumInterface(r.medium);
     }
-    return true;
 }
 
 const AreaLight *GeometricPrimitive::getAreaLight() const {
@@ -120,9 +161,37 @@ bool TransformedPrimitive::intersect(const Ray &r,
     }
     // 更新tMax
     r.tMax = ray.tMax;
+    fillHitInfo(r, _objectToWorld, isect);
+    return true;
+}
 
-    if (!_objectToWorld.isIdentity()) {
-        *isect = _objectToWorld.exec(*isect);
+bool TransformedPrimitive::intersectHit(const Ray &r, HitRecord *hit,
+                                        SurfaceInteraction *isect) const {
+    Ray ray = _objectToWorld.getInverse().exec(r);
+    if (!_primitive->intersectHit(ray, hit, isect)) {
+        return false;
+    }
+    r.tMax = ray.tMax;
+    if (hit->primitive) {
+        // 交点的构造推迟到遍历结束，由computeInteraction变换到世界空间
+        hit->instance = this;
+    } else {
+        fillHitInfo(r, _objectToWorld, isect);
+    }
+    return true;
+}
+
+void TransformedPrimitive::computeInteraction(const Ray &r, const HitRecord &hit,
+                                              SurfaceInteraction *isect) const {
+    Ray ray = _objectToWorld.getInverse().exec(r);
+    hit.primitive->computeInteraction(ray, hit, isect);
+    fillHitInfo(r, _objectToWorld, isect);
+}
+
+void TransformedPrimitive::fillHitInfo(const Ray &r, const Transform &o2w,
+                                       SurfaceInteraction *isect) const {
+    if (!o2w.isIdentity()) {
+        *isect = o2w.exec(*isect);
     }
     
     if (_mediumInterface.isMediumTransition()){
@@ -132,7 +201,6 @@ bool TransformedPrimitive::intersect(const Ray &r,
     }
     isect->primitive = this;
     CHECK_GE(dot(isect->normal, isect->shading.normal), 0);
-    return true;
 }
 
 bool TransformedPrimitive::intersectP(const Ray &r) const {
@@ -141,6 +209,123 @@ bool TransformedPrimitive::intersectP(const Ray &r) const {
     return _primitive->intersectP(InterpolatedWorldToPrim.exec(r));
 }
 
+//AnimatedPrimitive
+shared_ptr<AnimatedPrimitive> AnimatedPrimitive::create(const shared_ptr<Primitive> &primitive,
+                                                        const shared_ptr<const Transform> &o2wStart,
+                                                        Float startTime,
+                                                        const shared_ptr<const Transform> &o2wEnd,
+                                                        Float endTime,
+                                                        const std::shared_ptr<const Material> &mat,
+                                                        const MediumInterface &mediumInterface) {
+    // 与TransformedPrimitive相同，先变回图元的对象空间再施加实例的变换
+    shared_ptr<GeometricPrimitive> prim = dynamic_pointer_cast<GeometricPrimitive>(primitive);
+    const Transform & trf = prim->getWorldToObject();
+    auto start = make_shared<const Transform>((*o2wStart) * trf);
+    auto end = make_shared<const Transform>((*o2wEnd) * trf);
+    AnimatedTransform o2w(start, startTime, end, endTime);
+    return make_shared<AnimatedPrimitive>(primitive, o2w, mat, mediumInterface);
+}
+
+AnimatedPrimitive::AnimatedPrimitive(const shared_ptr<Primitive> &primitive,
+                                     const AnimatedTransform &o2w,
+                                     const std::shared_ptr<const Material> &mat,
+                                     const MediumInterface &mediumInterface):
+_primitive(primitive),
+_objectToWorld(o2w),
+_material(mat),
+_mediumInterface(mediumInterface) {
+    
+}
+
+bool AnimatedPrimitive::intersect(const Ray &r,
+                                  SurfaceInteraction *isect) const {
+    // 插值获取ray.time时刻primitive到world的变换
+    Transform interpolatedO2W = _objectToWorld.interpolate(r.time);
+    Ray ray = interpolatedO2W.getInverse().exec(r);
+    
+    if (!_primitive->intersect(ray, isect)) {
+        return false;
+    }
+    r.tMax = ray.tMax;
+    fillHitInfo(r, interpolatedO2W, isect);
+    return true;
+}
+
+bool AnimatedPrimitive::intersectHit(const Ray &r, HitRecord *hit,
+                                     SurfaceInteraction *isect) const {
+    Transform interpolatedO2W = _objectToWorld.interpolate(r.time);
+    Ray ray = interpolatedO2W.getInverse().exec(r);
+    if (!_primitive->intersectHit(ray, hit, isect)) {
+        return false;
+    }
+    r.tMax = ray.tMax;
+    if (hit->primitive) {
+        hit->instance = this;
+    } else {
+        fillHitInfo(r, interpolatedO2W, isect);
+    }
+    return true;
+}
+
+void AnimatedPrimitive::computeInteraction(const Ray &r, const HitRecord &hit,
+                                           SurfaceInteraction *isect) const {
+    // 插值的开销不小，但每条光线只有最近的交点会走到这里
+    Transform interpolatedO2W = _objectToWorld.interpolate(r.time);
+    Ray ray = interpolatedO2W.getInverse().exec(r);
+    hit.primitive->computeInteraction(ray, hit, isect);
+    fillHitInfo(r, interpolatedO2W, isect);
+}
+
+void AnimatedPrimitive::fillHitInfo(const Ray &r, const Transform &o2w,
+                                    SurfaceInteraction *isect) const {
+    if (!o2w.isIdentity()) {
+        *isect = o2w.exec(*isect);
+    }
+    
+    if (_mediumInterface.isMediumTransition()){
+        isect->mediumInterface = _mediumInterface;
+    } else {
+        isect->mediumInterface = MediumInterface(r.medium);
+    }
+    isect->primitive = this;
+    CHECK_GE(dot(isect->normal, isect->shading.normal), 0);
+}
+
+bool AnimatedPrimitive::intersectP(const Ray &r) const {
+    Transform interpolatedW2O = _objectToWorld.interpolate(r.time).getInverse();
+    return _primitive->intersectP(interpolatedW2O.exec(r));
+}
+
+bool AnimatedPrimitive::getMotionRange(Float *t0, Float *t1) const {
+    if (!_objectToWorld.isAnimated()) {
+        return false;
+    }
+    *t0 = _objectToWorld.getStartTime();
+    *t1 = _objectToWorld.getEndTime();
+    return true;
+}
+
+void AnimatedPrimitive::motionBounds(Float t0, Float t1,
+                                     AABB3f *b0, AABB3f *b1) const {
+    AABB3f bound = _primitive->worldBound();
+    if (!_objectToWorld.isAnimated()) {
+        *b0 = *b1 = _objectToWorld.getStartTransform().exec(bound);
+        return;
+    }
+    if (_objectToWorld.hasRotation()
+        || t0 != _objectToWorld.getStartTime()
+        || t1 != _objectToWorld.getEndTime()) {
+        // 旋转时包围盒的轨迹不是t的线性函数，时间区间不一致时插值参数也对不上
+        // 这两种情况都退化为整个运动过程的包围盒，保证保守
+        *b0 = *b1 = worldBound();
+        return;
+    }
+    // 只有平移缩放时，包围盒每个顶点的轨迹都是t的线性函数，
+    // 顶点坐标的最大值为凸函数，最小值为凹函数，都不会越过端点的连线
+    *b0 = _objectToWorld.getStartTransform().exec(bound);
+    *b1 = _objectToWorld.getEndTransform().exec(bound);
+}
+
 //"data" : {
 //    "type" : "bvh",
 //    "param" : {
@@ -16,6 +16,33 @@
 
 PALADIN_BEGIN
 
+/**
+ * 求交过程中的候选交点，只记录构造交点需要的参数
+ * SurfaceInteraction有三百多字节，构造它需要计算偏导数，着色法线等
+ * 遍历BVH时大部分候选交点都会被更近的交点覆盖，
+ * 所以遍历时只记录参数，确定最近的交点之后再构造一次SurfaceInteraction
+ */
+struct HitRecord {
+    // 需要延迟构造交点的几何图元，为空表示交点已经完整地写入了SurfaceInteraction
+    const Primitive *primitive = nullptr;
+    // 交点所在的实例图元，构造交点时需要先变换到实例的局部空间
+    const Primitive *instance = nullptr;
+    Float t = 0;
+    // 形状相关的参数，三角形为重心坐标
+    Float u = 0, v = 0;
+    // 形状相关的索引，例如细分曲面patch中的三角形编号
+    int index = 0;
+};
+
+/**
+ * 沿着一条线段找到的所有交点，节点在MemoryArena中分配
+ * 用于次表面散射的探测光线
+ */
+struct IntersectionChain {
+    SurfaceInteraction si;
+    IntersectionChain *next = nullptr;
+};
+
 // Primitive可以理解为片段
 class Primitive : public CObject {
 public:
@@ -25,20 +52,81 @@ public:
     
     virtual AABB3f worldBound() const = 0;
     
+    /**
+     * 运动图元返回true，并输出运动的起止时间
+     */
+    virtual bool getMotionRange(Float *t0, Float *t1) const {
+        return false;
+    }
+    
+    /**
+     * 输出t0,t1两个时刻的包围盒b0,b1，
+     * 需要保证[t0,t1]内任意时刻的图元都在b0,b1线性插值得到的包围盒之内
+     * 静止图元两个包围盒都是worldBound
+     */
+    virtual void motionBounds(Float t0, Float t1, AABB3f *b0, AABB3f *b1) const {
+        *b0 = *b1 = worldBound();
+    }
+    
     virtual bool intersect(const Ray &r, SurfaceInteraction *) const = 0;
     
+    /**
+     * 延迟构造交点的求交函数，聚合体遍历时调用，命中时更新r.tMax
+     * 支持延迟构造的图元只在hit中记录参数，由最终的最近交点调用computeInteraction
+     * 默认实现直接构造完整的交点，并把hit->primitive置空
+     */
+    virtual bool intersectHit(const Ray &r, HitRecord *hit, SurfaceInteraction *isect) const {
+        if (!intersect(r, isect)) {
+            return false;
+        }
+        hit->primitive = hit->instance = nullptr;
+        return true;
+    }
+    
+    /**
+     * 根据最近交点的hit构造完整的SurfaceInteraction
+     * r为调用intersectHit时的光线，tMax已经更新为最近交点的距离
+     */
+    virtual void computeInteraction(const Ray &r, const HitRecord &hit,
+                                    SurfaceInteraction *isect) const {
+        DCHECK(false);
+    }
+    
+    /**
+     * 由聚合体在遍历结束之后调用，有实例时先交给实例处理
+     */
+    static void finishHit(const Ray &r, const HitRecord &hit, SurfaceInteraction *isect) {
+        if (hit.instance) {
+            hit.instance->computeInteraction(r, hit, isect);
+        } else if (hit.primitive) {
+            hit.primitive->computeInteraction(r, hit, isect);
+        }
+    }
+    
     virtual bool intersectP(const Ray &r) const = 0;
     
     virtual const AreaLight *getAreaLight() const = 0;
     
     virtual const Material *getMaterial() const = 0;
     
+    /**
+     * 几何图元ID，用于输出primitiveId AOV，聚合体等没有ID的图元返回0
+     */
+    virtual int getId() const {
+        return 0;
+    }
+    
     virtual void computeScatteringFunctions(SurfaceInteraction *isect,
                                             MemoryArena &arena,
                                             TransportMode mode,
                                             bool allowMultipleLobes) const = 0;
 };
 
+/**
+ * 分配几何图元ID，从1开始，按照创建顺序递增
+ */
+int allocatePrimitiveId();
+
 // 几何片元，有形状，材质，是否发光等属性，是需要渲染的具体物件
 class GeometricPrimitive : public Primitive {
     
@@ -55,12 +143,22 @@ public:
     
     virtual bool intersect(const Ray &r, SurfaceInteraction *isect) const override;
     
+    virtual bool intersectHit(const Ray &r, HitRecord *hit, SurfaceInteraction *isect) const override;
+    
+    virtual void computeInteraction(const Ray &r, const HitRecord &hit,
+                                    SurfaceInteraction *isect) const override;
+    
     virtual bool intersectP(const Ray &r) const override;
     
     virtual const AreaLight *getAreaLight() const override;
     
     virtual const Material *getMaterial() const override;
     
+    // 从1开始，按照创建顺序分配
+    virtual int getId() const override {
+        return _id;
+    }
+    
     virtual void computeScatteringFunctions(SurfaceInteraction *isect,
                                     MemoryArena &arena, TransportMode mode,
                                     bool allowMultipleLobes) const override;
@@ -80,12 +178,17 @@ public:
     
 private:
 
+    // 填充交点中与图元相关的数据
+    void fillHitInfo(const Ray &r, SurfaceInteraction *isect) const;
     
     std::shared_ptr<Shape> _shape;
     std::shared_ptr<const Material> _material;
     // 发光属性
     std::shared_ptr<AreaLight> _areaLight;
     MediumInterface _mediumInterface;
+    const int _id;
+    // 构造时缓存shape->supportsDeferredHit()，避免每次求交多一次虚函数调用
+    const bool _deferredHit;
 };
 
 // 用于多个完全相同的实例，只保存一个实例对象在内存中，
@@ -105,6 +208,11 @@ public:
     
     virtual bool intersect(const Ray &r, SurfaceInteraction *isect) const override;
     
+    virtual bool intersectHit(const Ray &r, HitRecord *hit, SurfaceInteraction *isect) const override;
+    
+    virtual void computeInteraction(const Ray &r, const HitRecord &hit,
+                                    SurfaceInteraction *isect) const override;
+    
     virtual bool intersectP(const Ray &r) const override;
     
     virtual const Material *getMaterial() const override {
@@ -139,6 +247,9 @@ public:
     }
     
 private:
+    // 把局部空间中的交点变换到世界空间，并填充与实例相关的数据
+    void fillHitInfo(const Ray &r, const Transform &o2w, SurfaceInteraction *isect) const;
+    
     std::shared_ptr<Primitive> _primitive;
     
     Transform _objectToWorld;
@@ -148,6 +259,80 @@ private:
     MediumInterface _mediumInterface;
 };
 
+// 运动的实例，变换由AnimatedTransform在起止两个变换之间插值得到，用于运动模糊
+// 与TransformedPrimitive一样，暂时不支持光源
+class AnimatedPrimitive : public Primitive {
+public:
+    AnimatedPrimitive(const shared_ptr<Primitive> &primitive,
+                      const AnimatedTransform &o2w,
+                      const std::shared_ptr<const Material> &mat = nullptr,
+                      const MediumInterface &mediumInterface = nullptr);
+    
+    static shared_ptr<AnimatedPrimitive> create(const shared_ptr<Primitive> &primitive,
+                                                const shared_ptr<const Transform> &o2wStart,
+                                                Float startTime,
+                                                const shared_ptr<const Transform> &o2wEnd,
+                                                Float endTime,
+                                                const std::shared_ptr<const Material> &mat = nullptr,
+                                                const MediumInterface &mediumInterface = nullptr);
+    
+    virtual bool intersect(const Ray &r, SurfaceInteraction *isect) const override;
+    
+    virtual bool intersectHit(const Ray &r, HitRecord *hit, SurfaceInteraction *isect) const override;
+    
+    virtual void computeInteraction(const Ray &r, const HitRecord &hit,
+                                    SurfaceInteraction *isect) const override;
+    
+    virtual bool intersectP(const Ray &r) const override;
+    
+    virtual const Material *getMaterial() const override {
+        return _material != nullptr
+                ? _material.get()
+                : _primitive->getMaterial();
+    }
+    
+    virtual const AreaLight * getAreaLight() const override {
+        return nullptr;
+    }
+    
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+    
+    virtual void computeScatteringFunctions(SurfaceInteraction *isect,
+                                    MemoryArena &arena, TransportMode mode,
+                                    bool allowMultipleLobes) const override {
+        auto material = getMaterial();
+        if (material) {
+            material->computeScatteringFunctions(isect, arena, mode,
+                                            allowMultipleLobes);
+        }
+        CHECK_GE(dot(isect->normal, isect->shading.normal), 0.);
+    }
+    
+    /**
+     * 整个运动过程扫过的包围盒
+     */
+    virtual AABB3f worldBound() const override {
+        return _objectToWorld.motionAABB(_primitive->worldBound());
+    }
+    
+    virtual bool getMotionRange(Float *t0, Float *t1) const override;
+    
+    virtual void motionBounds(Float t0, Float t1, AABB3f *b0, AABB3f *b1) const override;
+    
+private:
+    void fillHitInfo(const Ray &r, const Transform &o2w, SurfaceInteraction *isect) const;
+    
+    std::shared_ptr<Primitive> _primitive;
+    
+    AnimatedTransform _objectToWorld;
+    
+    shared_ptr<const Material> _material;
+    
+    MediumInterface _mediumInterface;
+};
+
 class Aggregate : public Primitive {
 public:
 
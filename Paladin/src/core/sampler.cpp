@@ -12,7 +12,9 @@
 PALADIN_BEGIN
 
 Sampler::Sampler(int64_t samplesPerPixel)
-: samplesPerPixel(samplesPerPixel) {
+: samplesPerPixel(samplesPerPixel),
+_currentPixel(0, 0),
+_currentPixelSampleIndex(0) {
     
 }
 
@@ -72,22 +74,39 @@ bool Sampler::setSampleIndex(int64_t sampleNum) {
 }
 
 // PixelSampler
-PixelSampler::PixelSampler(int64_t samplesPerPixel, int nSampledDimensions)
-: Sampler(samplesPerPixel) {
+PixelSampler::PixelSampler(int64_t samplesPerPixel, int nSampledDimensions, int seed)
+: Sampler(samplesPerPixel),
+_seed(seed) {
     for (int i = 0; i < nSampledDimensions; ++i) {
         _samples1D.push_back(std::vector<Float>(samplesPerPixel));
         _samples2D.push_back(std::vector<Point2f>(samplesPerPixel));
     }
 }
 
+void PixelSampler::startPixel(const Point2i &p) {
+    Sampler::startPixel(p);
+    _curDimension1D = _curDimension2D = 0;
+    seekSample();
+}
+
+void PixelSampler::seekSample() {
+    // 与样本数组使用不同的序列，每个样本占MaxRandomPerSample个随机数
+    _rng.setSequence(MixBits(pixelHash(_currentPixel, _seed) ^ 0x9e3779b97f4a7c15ULL) ^ passHash());
+    _rng.advance(_currentPixelSampleIndex * MaxRandomPerSample);
+}
+
 bool PixelSampler::startNextSample() {
     _curDimension1D = _curDimension2D = 0;
-    return Sampler::startNextSample();
+    bool ret = Sampler::startNextSample();
+    seekSample();
+    return ret;
 }
 
 bool PixelSampler::setSampleIndex(int64_t sampleNum) {
     _curDimension1D = _curDimension2D = 0;
-    return Sampler::setSampleIndex(sampleNum);
+    bool ret = Sampler::setSampleIndex(sampleNum);
+    seekSample();
+    return ret;
 }
 
 Float PixelSampler::get1D() {
@@ -112,14 +131,14 @@ Point2f PixelSampler::get2D() {
 void GlobalSampler::startPixel(const Point2i &p) {
     Sampler::startPixel(p);
     _dimension = 0;
-    _globalIndex = getIndexForSample(0);
+    _globalIndex = getIndexForSample(_firstSample);
     _arrayEndDim = _arrayStartDim + _sampleArray1D.size() + 2 * _sampleArray2D.size();
     
     // 生成一维样本数组
     for (size_t i = 0; i < _samples1DArraySizes.size(); ++i) {
         int nSamples = _samples1DArraySizes[i] * samplesPerPixel;
         for (int j = 0; j < nSamples; ++j) {
-            int64_t index = getIndexForSample(j);
+            int64_t index = getIndexForSample(_firstSample * _samples1DArraySizes[i] + j);
             _sampleArray1D[i][j] = sampleDimension(index, _arrayStartDim + i);
         }
     }
@@ -129,7 +148,7 @@ void GlobalSampler::startPixel(const Point2i &p) {
     for (size_t i = 0; i < _samples2DArraySizes.size(); ++i) {
         int nSamples = _samples2DArraySizes[i] * samplesPerPixel;
         for (int j = 0; j < nSamples; ++j) {
-            int64_t idx = getIndexForSample(j);
+            int64_t idx = getIndexForSample(_firstSample * _samples2DArraySizes[i] + j);
             _sampleArray2D[i][j].x = sampleDimension(idx, dim);
             _sampleArray2D[i][j].y = sampleDimension(idx, dim + 1);
         }
@@ -140,13 +159,13 @@ void GlobalSampler::startPixel(const Point2i &p) {
 
 bool GlobalSampler::startNextSample() {
     _dimension = 0;
-    _globalIndex = getIndexForSample(_currentPixelSampleIndex + 1);
+    _globalIndex = getIndexForSample(_firstSample + _currentPixelSampleIndex + 1);
     return Sampler::startNextSample();
 }
 
 bool GlobalSampler::setSampleIndex(int64_t sampleNum) {
     _dimension = 0;
-    _globalIndex = getIndexForSample(sampleNum);
+    _globalIndex = getIndexForSample(_firstSample + sampleNum);
     return Sampler::setSampleIndex(sampleNum);
 }
 
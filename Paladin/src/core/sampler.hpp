@@ -11,6 +11,7 @@
 
 #include "core/header.h"
 #include "math/rng.h"
+#include "math/lowdiscrepancy.hpp"
 #include "core/cobject.h"
 #include "tools/classfactory.hpp"
 
@@ -99,8 +100,28 @@ public:
     // 开始下一个样本，返回值为该像素是否采样完毕
     virtual bool startNextSample();
 
+    /**
+     * 复制一个采样器，每个tile一个
+     * 所有采样器的样本都只取决于(像素，样本索引，维度)，与seed无关，
+     * seed只是为了兼容旧的接口，这样渲染结果与tile的划分和线程调度无关
+     */
     virtual std::unique_ptr<Sampler> clone(int seed) = 0;
 
+    /**
+     * 渐进式渲染每一轮使用的采样器
+     * 返回的采样器每像素nSamples个样本，第i个样本对应原序列的第firstSample + i个样本，
+     * 样本数组的长度也只有nSamples，startPixel的开销只与nSamples有关，
+     * 所以轮数与总样本数都不受samplesPerPixel的限制
+     * 可以按索引寻址的采样器，所有轮次的样本连成同一个序列
+     * 分层采样器每一轮是一组独立的分层样本，由firstSample区分
+     */
+    virtual std::unique_ptr<Sampler> clonePass(int64_t firstSample, int64_t nSamples) = 0;
+
+    /**
+     * 跳到当前像素的第sampleNum个样本
+     * 之后取到的样本与从第0个样本依次startNextSample到sampleNum完全相同，
+     * 所以一帧图像可以按样本区间拆分到多个进程渲染，再合并
+     */
     virtual bool setSampleIndex(int64_t sampleNum);
 
     std::string stateString() const {
@@ -116,6 +137,40 @@ public:
     
 protected:
 
+    // 每个样本最多消耗的随机数个数，计数器RNG按照这个步长定位到每个样本
+    static CONSTEXPR int64_t MaxRandomPerSample = 65536;
+
+    /**
+     * 像素与种子的哈希，作为计数器RNG的序列号
+     */
+    static uint64_t pixelHash(const Point2i &p, uint64_t seed) {
+        uint64_t key = (uint64_t(uint32_t(p.x)) << 32) | uint32_t(p.y);
+        return MixBits(key ^ MixBits(seed + 1));
+    }
+
+    /**
+     * 不能按索引寻址的随机数(例如每个像素预先生成的样本数组)，
+     * 渐进式渲染中每一轮使用不同的序列，第一轮与普通渲染相同
+     */
+    uint64_t passHash() const {
+        return _firstSample == 0 ? 0 : MixBits(uint64_t(_firstSample) * 0xbf58476d1ce4e5b9ULL);
+    }
+
+    /**
+     * 按照sampler申请过的样本数组重新申请一遍，用于clonePass
+     */
+    void copyArrayRequests(const Sampler &sampler) {
+        for (int n : sampler._samples1DArraySizes) {
+            request1DArray(n);
+        }
+        for (int n : sampler._samples2DArraySizes) {
+            request2DArray(n);
+        }
+    }
+
+    // 第0个样本在整个序列中的索引，只有clonePass出来的采样器不为0
+    int64_t _firstSample = 0;
+
     // 当前处理的像素点
     Point2i _currentPixel;
     
@@ -160,7 +215,9 @@ class PixelSampler : public Sampler {
     
 public:
     
-    PixelSampler(int64_t samplerPerPixel, int nSampledDimensions);
+    PixelSampler(int64_t samplerPerPixel, int nSampledDimensions, int seed = 0);
+    
+    virtual void startPixel(const Point2i &p);
     
     virtual bool startNextSample();
     
@@ -181,8 +238,26 @@ protected:
     int _curDimension1D;
     int _curDimension2D;
     
+    // 子类在startPixel中用_rng生成样本数组之前，需要先调用seedPixel
+    // 样本数组用完之后get1D/get2D也使用_rng，此时_rng由PixelSampler定位到(像素，样本索引)
     RNG _rng;
     
+    const int _seed;
+    
+    /**
+     * 把_rng设为只与像素p相关的序列，用于生成整个像素的样本数组
+     */
+    void seedPixel(const Point2i &p) {
+        _rng.setSequence(pixelHash(p, _seed) ^ passHash());
+    }
+    
+private:
+    
+    /**
+     * 把_rng定位到当前像素当前样本的额外随机数序列
+     */
+    void seekSample();
+    
 };
 
 
@@ -254,6 +329,14 @@ public:
      */
     virtual Float sampleDimension(int64_t index, int dimension) const = 0;
     
+protected:
+
+    // 样本数组开始的维度，前五个样本生成的是相机样本
+    static const int _arrayStartDim = 5;
+
+    // 样本数组结束的维度
+    int _arrayEndDim;
+
 private:
 
     // 当前样本的维度
@@ -261,12 +344,6 @@ private:
 
     // 当前样本的全局索引
     int64_t _globalIndex;
-
-    // 样本数组开始的维度，前五个样本生成的是相机样本
-    static const int _arrayStartDim = 5;
-
-    // 样本数组结束的维度
-    int _arrayEndDim;
 };
 
 
@@ -7,6 +7,8 @@
 //
 
 #include "scene.hpp"
+#include "accelerators/bvh.hpp"
+#include "core/material.hpp"
 
 PALADIN_BEGIN
 
@@ -16,7 +18,7 @@ bool Scene::intersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
     while (true) {
         bool hitSurface = intersect(ray, isect);
         if (ray.medium) {
-            *Tr = ray.medium->Tr(ray, sampler);
+            *Tr *= ray.medium->Tr(ray, sampler);
         }
         
         if (!hitSurface) {
@@ -30,4 +32,49 @@ bool Scene::intersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
     }
 }
 
+void Scene::initSubsurfaceAccels(const std::vector<std::shared_ptr<Primitive>> &primitives) {
+    std::map<const Material *, std::vector<std::shared_ptr<Primitive>>> groups;
+    for (const auto &prim : primitives) {
+        const Material *material = prim->getMaterial();
+        if (material && material->hasSubsurface()) {
+            groups[material].push_back(prim);
+        }
+    }
+    for (auto &group : groups) {
+        _subsurfaceAccels[group.first] = make_shared<BVHAccel>(group.second, 4);
+    }
+}
+
+int Scene::intersectAll(const Interaction &base, const Point3f &pTarget,
+                        const Material *material, MemoryArena &arena,
+                        IntersectionChain **chain) const {
+    auto iter = _subsurfaceAccels.find(material);
+    if (iter != _subsurfaceAccels.end()) {
+        Ray ray = base.spawnRayTo(pTarget);
+        if (ray.dir == Vector3f(0, 0, 0)) {
+            return 0;
+        }
+        return iter->second->intersectAll(ray, arena, chain);
+    }
+    
+    // 没有单独的加速结构，沿着线段逐个找最近的交点
+    int nFound = 0;
+    Interaction cur = base;
+    IntersectionChain *node = ARENA_ALLOC(arena, IntersectionChain)();
+    while (true) {
+        Ray ray = cur.spawnRayTo(pTarget);
+        if (ray.dir == Vector3f(0, 0, 0) || !intersect(ray, &node->si)) {
+            break;
+        }
+        cur = node->si;
+        if (node->si.primitive->getMaterial() == material) {
+            node->next = *chain;
+            *chain = node;
+            ++nFound;
+            node = ARENA_ALLOC(arena, IntersectionChain)();
+        }
+    }
+    return nFound;
+}
+
 PALADIN_END
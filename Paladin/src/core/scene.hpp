@@ -16,12 +16,20 @@
 
 PALADIN_BEGIN
 
+class BVHAccel;
+
 class Scene {
 public:
+    /**
+     * primitives为场景中所有的图元，用于给次表面散射材质单独建立加速结构，
+     * 为空时探测光线遍历整个场景
+     */
     Scene(std::shared_ptr<Primitive> aggregate,
-          const std::vector<std::shared_ptr<Light>> &lights)
+          const std::vector<std::shared_ptr<Light>> &lights,
+          const std::vector<std::shared_ptr<Primitive>> &primitives = {})
     : lights(lights), _aggregate(aggregate) {
         _worldBound = _aggregate->worldBound();
+        initSubsurfaceAccels(primitives);
         for (const auto &light : lights) {
             light->preprocess(*this);
             if (light->flags & (int)LightFlags::Infinite) {
@@ -55,13 +63,28 @@ public:
     bool intersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *Tr) const;
     
+    /**
+     * 找出base到pTarget之间所有材质为material的交点，用于次表面散射的探测光线
+     * 交点插入chain的头部，返回交点个数
+     * 如果material有单独的加速结构，只遍历该材质的图元，
+     * 否则沿着线段在整个场景中逐个求交，跳过其他材质的交点
+     */
+    int intersectAll(const Interaction &base, const Point3f &pTarget,
+                     const Material *material, MemoryArena &arena,
+                     IntersectionChain **chain) const;
+    
     std::vector<std::shared_ptr<Light>> lights;
 
     std::vector<std::shared_ptr<Light>> infiniteLights;
     
 private:
+    
+    void initSubsurfaceAccels(const std::vector<std::shared_ptr<Primitive>> &primitives);
+    
     // 片段的集合
     std::shared_ptr<Primitive> _aggregate;
+    // 次表面散射材质各自的加速结构，探测光线只需要与同一材质的图元求交
+    std::map<const Material *, std::shared_ptr<BVHAccel>> _subsurfaceAccels;
     // 整个场景的包围盒
     AABB3f _worldBound;
 };
@@ -51,6 +51,24 @@ public:
         return intersect(ray, nullptr, nullptr, testAlphaTexture);
     }
 
+    // 是否支持延迟构造交点，支持的子类需要实现intersectHit与computeInteraction
+    virtual bool supportsDeferredHit() const {
+        return false;
+    }
+
+    // 只求交点的t值以及两个形状相关的参数(三角形为重心坐标)，不构造SurfaceInteraction
+    virtual bool intersectHit(const Ray &ray, Float *tHit, Float *u, Float *v,
+                              bool testAlphaTexture = true) const {
+        DCHECK(false);
+        return false;
+    }
+
+    // 由intersectHit得到的参数构造完整的SurfaceInteraction，只对最近的交点调用一次
+    virtual void computeInteraction(const Ray &ray, Float tHit, Float u, Float v,
+                                    SurfaceInteraction *isect) const {
+        DCHECK(false);
+    }
+
     // 表面积
     virtual Float area() const = 0;
 
@@ -10,6 +10,7 @@
 #define spectrum_hpp
 
 #include "core/header.h"
+#include "math/simd.h"
 
 PALADIN_BEGIN
 // 光谱类，太特么复杂了，代码照抄 pbrt-v3
@@ -67,23 +68,31 @@ extern const Float RGBIllum2SpectGreen[nRGB2SpectSamples];
 extern const Float RGBIllum2SpectBlue[nRGB2SpectSamples];
 
 // Spectrum Declarations
+/**
+ * 分量数补齐到SIMD宽度的整数倍(SimdFloatWidth，见math/simd.h)，
+ * 例如RGB补齐为4个分量，补齐的分量恒为0
+ * 加减乘，数乘，开方都保持补齐分量为0，直接对整个数组做SIMD运算
+ * 除法，clamp等运算会改变补齐分量，运算之后重新置0
+ * 归约运算(MaxComponentValue，HasNaNs等)只访问前nSpectrumSamples个分量
+ */
 template <int nSpectrumSamples>
 class CoefficientSpectrum {
 public:
     // CoefficientSpectrum Public Methods
     CoefficientSpectrum(Float v = 0.f) {
         for (int i = 0; i < nSpectrumSamples; ++i) c[i] = v;
+        for (int i = nSpectrumSamples; i < nStorage; ++i) c[i] = 0.f;
         DCHECK(!HasNaNs());
     }
 #ifdef DEBUG
     CoefficientSpectrum(const CoefficientSpectrum &s) {
         DCHECK(!s.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] = s.c[i];
+        for (int i = 0; i < nStorage; ++i) c[i] = s.c[i];
     }
     
     CoefficientSpectrum &operator=(const CoefficientSpectrum &s) {
         DCHECK(!s.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] = s.c[i];
+        for (int i = 0; i < nStorage; ++i) c[i] = s.c[i];
         return *this;
     }
 #endif  // DEBUG
@@ -97,49 +106,51 @@ public:
     }
     CoefficientSpectrum &operator+=(const CoefficientSpectrum &s2) {
         DCHECK(!s2.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] += s2.c[i];
+        simd::add<nStorage>(c, c, s2.c);
         return *this;
     }
     CoefficientSpectrum operator+(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] += s2.c[i];
+        simd::add<nStorage>(ret.c, c, s2.c);
         return ret;
     }
     CoefficientSpectrum operator-(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] -= s2.c[i];
+        simd::sub<nStorage>(ret.c, c, s2.c);
         return ret;
     }
     CoefficientSpectrum operator/(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
-        CoefficientSpectrum ret = *this;
         for (int i = 0; i < nSpectrumSamples; ++i) {
             CHECK_NE(s2.c[i], 0);
-            ret.c[i] /= s2.c[i];
         }
+        CoefficientSpectrum ret = *this;
+        simd::div<nStorage>(ret.c, c, s2.c);
+        // 补齐分量为0/0
+        ret.clearPadding();
         return ret;
     }
     CoefficientSpectrum operator*(const CoefficientSpectrum &sp) const {
         DCHECK(!sp.HasNaNs());
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] *= sp.c[i];
+        simd::mul<nStorage>(ret.c, c, sp.c);
         return ret;
     }
     CoefficientSpectrum &operator*=(const CoefficientSpectrum &sp) {
         DCHECK(!sp.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] *= sp.c[i];
+        simd::mul<nStorage>(c, c, sp.c);
         return *this;
     }
     CoefficientSpectrum operator*(Float a) const {
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] *= a;
+        simd::scale<nStorage>(ret.c, c, a);
         DCHECK(!ret.HasNaNs());
         return ret;
     }
     CoefficientSpectrum &operator*=(Float a) {
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] *= a;
+        simd::scale<nStorage>(c, c, a);
         DCHECK(!HasNaNs());
         return *this;
     }
@@ -152,14 +163,14 @@ public:
         CHECK_NE(a, 0);
         DCHECK(!std::isnan(a));
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] /= a;
+        simd::scale<nStorage>(ret.c, c, 1 / a);
         DCHECK(!ret.HasNaNs());
         return ret;
     }
     CoefficientSpectrum &operator/=(Float a) {
         CHECK_NE(a, 0);
         DCHECK(!std::isnan(a));
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] /= a;
+        simd::scale<nStorage>(c, c, 1 / a);
         return *this;
     }
     bool operator==(const CoefficientSpectrum &sp) const {
@@ -171,13 +182,12 @@ public:
         return !(*this == sp);
     }
     bool IsBlack() const {
-        for (int i = 0; i < nSpectrumSamples; ++i)
-            if (c[i] != 0.) return false;
-        return true;
+        // 补齐分量恒为0，不影响结果
+        return simd::allZero<nStorage>(c);
     }
     friend CoefficientSpectrum Sqrt(const CoefficientSpectrum &s) {
         CoefficientSpectrum ret;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] = std::sqrt(s.c[i]);
+        simd::sqrt<nStorage>(ret.c, s.c);
         DCHECK(!ret.HasNaNs());
         return ret;
     }
@@ -186,10 +196,11 @@ public:
                                              Float e);
     CoefficientSpectrum operator-() const {
         CoefficientSpectrum ret;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] = -c[i];
+        simd::sub<nStorage>(ret.c, ret.c, c);
         return ret;
     }
     friend CoefficientSpectrum Exp(const CoefficientSpectrum &s) {
+        // exp没有对应的SIMD指令，只计算有效分量，补齐分量保持为0
         CoefficientSpectrum ret;
         for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] = std::exp(s.c[i]);
         DCHECK(!ret.HasNaNs());
@@ -210,16 +221,14 @@ public:
     }
     CoefficientSpectrum clamp(Float low = 0, Float high = Infinity) const {
         CoefficientSpectrum ret;
-        for (int i = 0; i < nSpectrumSamples; ++i)
-            ret.c[i] = paladin::clamp(c[i], low, high);
+        simd::clamp<nStorage>(ret.c, c, low, high);
+        // low大于0时补齐分量会被改为low
+        ret.clearPadding();
         DCHECK(!ret.HasNaNs());
         return ret;
     }
     Float MaxComponentValue() const {
-        Float m = c[0];
-        for (int i = 1; i < nSpectrumSamples; ++i)
-            m = std::max(m, c[i]);
-        return m;
+        return simd::maxValue<nSpectrumSamples>(c);
     }
     bool HasNaNs() const {
         for (int i = 0; i < nSpectrumSamples; ++i)
@@ -260,8 +269,15 @@ public:
     static const int nSamples = nSpectrumSamples;
     
 protected:
+    // 补齐之后的分量数
+    static CONSTEXPR int nStorage = simdPadded<nSpectrumSamples>();
+    
+    void clearPadding() {
+        for (int i = nSpectrumSamples; i < nStorage; ++i) c[i] = 0.f;
+    }
+    
     // CoefficientSpectrum Protected Data
-    Float c[nSpectrumSamples];
+    PALADIN_SIMD_ALIGN Float c[nStorage];
 };
 
 // 采样光谱默认从400到700纳米采样，总共有60个采样点
@@ -373,12 +389,9 @@ public:
     }
         
     void ToXYZ(Float xyz[3]) const {
-        xyz[0] = xyz[1] = xyz[2] = 0.f;
-        for (int i = 0; i < nSpectralSamples; ++i) {
-            xyz[0] += X.c[i] * c[i];
-            xyz[1] += Y.c[i] * c[i];
-            xyz[2] += Z.c[i] * c[i];
-        }
+        xyz[0] = simd::dot<nStorage>(X.c, c);
+        xyz[1] = simd::dot<nStorage>(Y.c, c);
+        xyz[2] = simd::dot<nStorage>(Z.c, c);
         Float scale = Float(sampledLambdaEnd - sampledLambdaStart) /
         Float(CIE_Y_integral * nSpectralSamples);
         xyz[0] *= scale;
@@ -387,8 +400,7 @@ public:
     }
         
     Float y() const {
-        Float yy = 0.f;
-        for (int i = 0; i < nSpectralSamples; ++i) yy += Y.c[i] * c[i];
+        Float yy = simd::dot<nStorage>(Y.c, c);
         return yy * Float(sampledLambdaEnd - sampledLambdaStart) /
         Float(CIE_Y_integral * nSpectralSamples);
     }
@@ -21,6 +21,7 @@ _dv(dv) {
 }
 
 Point2f UVMapping2D::map(const paladin::SurfaceInteraction &si, Vector2f *dstdx, Vector2f *dstdy) const {
+    si.ensureDifferentials();
     // 求s对x的偏导数ds/dx
     // 由导函数链式法则，ds/dx = ds/du * du/dx
     // 显然偏导数ds/du = _su，则可以写出如下表达式
@@ -42,6 +43,7 @@ Point2f UVMapping2D::map(const paladin::SurfaceInteraction &si, Vector2f *dstdx,
 
 //SphericalMapping2D
 Point2f SphericalMapping2D::map(const paladin::SurfaceInteraction &si, Vector2f *dstdx, Vector2f *dstdy) const {
+    si.ensureDifferentials();
     Point2f st = pointToSphereToST(si.pos);
 
     // 偏导数，用正向差分法(其实就是导函数的定义)
@@ -98,6 +100,7 @@ Point2f CylindricalMapping2D::map(const SurfaceInteraction &si, Vector2f *dstdx,
                                   Vector2f *dstdy) const {
 	// 这个版本跟SphericalMapping2D的没太大区别，
 	// 用同样的方式处理正向差分产生的问题
+    si.ensureDifferentials();
     Point2f st = pointToCylinderToST(si.pos);
 
     const Float delta = .01f;
@@ -122,6 +125,7 @@ Point2f CylindricalMapping2D::map(const SurfaceInteraction &si, Vector2f *dstdx,
 // PlanarMapping2D
 Point2f PlanarMapping2D::map(const SurfaceInteraction &si, Vector2f *dstdx,
                              Vector2f *dstdy) const {
+    si.ensureDifferentials();
     Vector3f vec(si.pos);
     // 由向量函数求导的链式法则可得
     // ds/dx = ds/dp dp/dx
@@ -145,6 +149,7 @@ Point2f PlanarMapping2D::map(const SurfaceInteraction &si, Vector2f *dstdx,
 // IdentityMapping3D
 Point3f IdentityMapping3D::map(const SurfaceInteraction &si, Vector3f *dpdx,
                                Vector3f *dpdy) const {
+    si.ensureDifferentials();
     *dpdx = _worldToTexture.exec(si.dpdx);
     *dpdy = _worldToTexture.exec(si.dpdy);
     return _worldToTexture.exec(si.pos);
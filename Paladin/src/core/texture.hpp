@@ -14,6 +14,7 @@
 #include "interaction.hpp"
 #include "core/cobject.h"
 #include "core/spectrum.hpp"
+#include "core/textureprogram.hpp"
 
 PALADIN_BEGIN
 
@@ -41,6 +42,14 @@ public:
 	 * @return       返回映射之后的纹理坐标
 	 */	
 	virtual Point2f map(const SurfaceInteraction &si, Vector2f *dstdx, Vector2f *dstdy) const = 0;
+    
+    /**
+     * 两个映射的结果是否总是相同，TextureProgram用于合并相同的映射
+     * 默认只有同一个对象才相同
+     */
+    virtual bool equals(const TextureMapping2D &other) const {
+        return this == &other;
+    }
 };
 
 
@@ -53,6 +62,11 @@ public:
 	UVMapping2D(Float su = 1, Float sv = 1, Float du = 0, Float dv = 0);
 
     virtual Point2f map(const SurfaceInteraction &si, Vector2f *dstdx, Vector2f *dstdy)	const;
+    
+    virtual bool equals(const TextureMapping2D &other) const override {
+        auto uv = dynamic_cast<const UVMapping2D *>(&other);
+        return uv && uv->_su == _su && uv->_sv == _sv && uv->_du == _du && uv->_dv == _dv;
+    }
 
 private:
 	const Float _su, _sv, _du, _dv;
@@ -167,6 +181,14 @@ class Texture : public CObject {
 public:
     virtual T evaluate(const SurfaceInteraction &) const = 0;
     
+    /**
+     * 把纹理展开为TextureProgram中的指令，返回结果所在的寄存器
+     * 默认生成一条调用evaluate的指令，可以展开的纹理需要重写
+     */
+    virtual TextureReg<T> compile(TextureProgram *program) const {
+        return program->opaque(this);
+    }
+    
     virtual ~Texture() {
         
     }
@@ -0,0 +1,360 @@
+//
+//  textureprogram.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/14.
+//
+
+#include "textureprogram.hpp"
+#include "core/texture.hpp"
+#include "core/mipmap.h"
+#include "core/interaction.hpp"
+#include "tools/memory.hpp"
+
+PALADIN_BEGIN
+
+// 纹理映射的结果
+struct TextureCoord {
+    Point2f st;
+    Vector2f dstdx, dstdy;
+};
+
+TextureReg<Float> TextureProgram::add(const shared_ptr<Texture<Float>> &tex) {
+    return tex ? tex->compile(this) : constant(Float(0));
+}
+
+TextureReg<Spectrum> TextureProgram::add(const shared_ptr<Texture<Spectrum>> &tex) {
+    return tex ? tex->compile(this) : constant(Spectrum(0.f));
+}
+
+int TextureProgram::emit(Op op, const int *src, int nSrc, const void *ptr, bool doFilter) {
+    for (const Instruction &ins : _code) {
+        if (ins.op != op || ins.ptr != ptr || ins.doFilter != doFilter) {
+            continue;
+        }
+        if (std::equal(src, src + nSrc, ins.src)) {
+            return ins.dst;
+        }
+    }
+    Instruction ins;
+    ins.op = op;
+    std::fill(ins.src, ins.src + 5, -1);
+    std::copy(src, src + nSrc, ins.src);
+    ins.ptr = ptr;
+    ins.doFilter = doFilter;
+    switch (op) {
+        case Op::MapUV:
+        case Op::Map2D:
+            ins.dst = _numMappings++;
+            break;
+        case Op::FloatImage:
+        case Op::FloatBilerp:
+        case Op::FloatMul:
+        case Op::FloatMix:
+        case Op::FloatOpaque:
+            ins.dst = (int)_floatRegs.size();
+            _floatRegs.push_back(0);
+            _floatConstant.push_back(false);
+            break;
+        default:
+            ins.dst = (int)_spectrumRegs.size();
+            _spectrumRegs.push_back(Spectrum(0.f));
+            _spectrumConstant.push_back(false);
+            break;
+    }
+    _code.push_back(ins);
+    return ins.dst;
+}
+
+TextureReg<Float> TextureProgram::constant(Float value) {
+    TextureReg<Float> ret;
+    for (size_t i = 0; i < _floatRegs.size(); ++i) {
+        if (_floatConstant[i] && _floatRegs[i] == value) {
+            ret.index = (int)i;
+            return ret;
+        }
+    }
+    ret.index = (int)_floatRegs.size();
+    _floatRegs.push_back(value);
+    _floatConstant.push_back(true);
+    return ret;
+}
+
+TextureReg<Spectrum> TextureProgram::constant(const Spectrum &value) {
+    TextureReg<Spectrum> ret;
+    for (size_t i = 0; i < _spectrumRegs.size(); ++i) {
+        if (_spectrumConstant[i] && _spectrumRegs[i] == value) {
+            ret.index = (int)i;
+            return ret;
+        }
+    }
+    ret.index = (int)_spectrumRegs.size();
+    _spectrumRegs.push_back(value);
+    _spectrumConstant.push_back(true);
+    return ret;
+}
+
+int TextureProgram::mapping(const TextureMapping2D *mapping) {
+    for (const Instruction &ins : _code) {
+        if ((ins.op == Op::MapUV || ins.op == Op::Map2D) &&
+            static_cast<const TextureMapping2D *>(ins.ptr)->equals(*mapping)) {
+            return ins.dst;
+        }
+    }
+    Op op = dynamic_cast<const UVMapping2D *>(mapping) ? Op::MapUV : Op::Map2D;
+    return emit(op, nullptr, 0, mapping);
+}
+
+TextureReg<Float> TextureProgram::image(const MIPMap<Float> *mipmap, int map, bool doFilter) {
+    TextureReg<Float> ret;
+    ret.index = emit(Op::FloatImage, &map, 1, mipmap, doFilter);
+    return ret;
+}
+
+TextureReg<Spectrum> TextureProgram::image(const MIPMap<RGBSpectrum> *mipmap, int map, bool doFilter) {
+    TextureReg<Spectrum> ret;
+    ret.index = emit(Op::SpectrumImage, &map, 1, mipmap, doFilter);
+    return ret;
+}
+
+TextureReg<Float> TextureProgram::bilerp(int map, TextureReg<Float> v00, TextureReg<Float> v01,
+                                         TextureReg<Float> v10, TextureReg<Float> v11) {
+    if (v00.index == v01.index && v00.index == v10.index && v00.index == v11.index) {
+        return v00;
+    }
+    int src[5] = {map, v00.index, v01.index, v10.index, v11.index};
+    TextureReg<Float> ret;
+    ret.index = emit(Op::FloatBilerp, src, 5);
+    return ret;
+}
+
+TextureReg<Spectrum> TextureProgram::bilerp(int map, TextureReg<Spectrum> v00, TextureReg<Spectrum> v01,
+                                            TextureReg<Spectrum> v10, TextureReg<Spectrum> v11) {
+    if (v00.index == v01.index && v00.index == v10.index && v00.index == v11.index) {
+        return v00;
+    }
+    int src[5] = {map, v00.index, v01.index, v10.index, v11.index};
+    TextureReg<Spectrum> ret;
+    ret.index = emit(Op::SpectrumBilerp, src, 5);
+    return ret;
+}
+
+TextureReg<Float> TextureProgram::mul(TextureReg<Float> a, TextureReg<Float> b) {
+    if (isConstant(a) && isConstant(b)) {
+        return constant(_floatRegs[a.index] * _floatRegs[b.index]);
+    }
+    // 保证常量在a中，并且交换律下相同的乘法只生成一条指令
+    if (isConstant(b) || (!isConstant(a) && a.index > b.index)) {
+        std::swap(a, b);
+    }
+    if (isConstant(a)) {
+        if (_floatRegs[a.index] == 0) {
+            return a;
+        }
+        if (_floatRegs[a.index] == 1) {
+            return b;
+        }
+    }
+    int src[2] = {a.index, b.index};
+    TextureReg<Float> ret;
+    ret.index = emit(Op::FloatMul, src, 2);
+    return ret;
+}
+
+TextureReg<Spectrum> TextureProgram::mul(TextureReg<Float> a, TextureReg<Spectrum> b) {
+    if (isConstant(a) && isConstant(b)) {
+        return constant(_floatRegs[a.index] * _spectrumRegs[b.index]);
+    }
+    if ((isConstant(a) && _floatRegs[a.index] == 0) ||
+        (isConstant(b) && _spectrumRegs[b.index].IsBlack())) {
+        return constant(Spectrum(0.f));
+    }
+    if (isConstant(a) && _floatRegs[a.index] == 1) {
+        return b;
+    }
+    int src[2] = {a.index, b.index};
+    TextureReg<Spectrum> ret;
+    ret.index = emit(Op::FloatSpectrumMul, src, 2);
+    return ret;
+}
+
+TextureReg<Spectrum> TextureProgram::mul(TextureReg<Spectrum> a, TextureReg<Spectrum> b) {
+    if (isConstant(a) && isConstant(b)) {
+        return constant(_spectrumRegs[a.index] * _spectrumRegs[b.index]);
+    }
+    if (isConstant(b) || (!isConstant(a) && a.index > b.index)) {
+        std::swap(a, b);
+    }
+    if (isConstant(a)) {
+        if (_spectrumRegs[a.index].IsBlack()) {
+            return a;
+        }
+        if (_spectrumRegs[a.index] == Spectrum(1.f)) {
+            return b;
+        }
+    }
+    int src[2] = {a.index, b.index};
+    TextureReg<Spectrum> ret;
+    ret.index = emit(Op::SpectrumMul, src, 2);
+    return ret;
+}
+
+TextureReg<Float> TextureProgram::mix(TextureReg<Float> t1, TextureReg<Float> t2,
+                                      TextureReg<Float> amount) {
+    if (t1.index == t2.index) {
+        return t1;
+    }
+    if (isConstant(amount)) {
+        Float amt = _floatRegs[amount.index];
+        if (amt == 0) {
+            return t1;
+        }
+        if (amt == 1) {
+            return t2;
+        }
+        if (isConstant(t1) && isConstant(t2)) {
+            return constant((1 - amt) * _floatRegs[t1.index] + amt * _floatRegs[t2.index]);
+        }
+    }
+    int src[3] = {t1.index, t2.index, amount.index};
+    TextureReg<Float> ret;
+    ret.index = emit(Op::FloatMix, src, 3);
+    return ret;
+}
+
+TextureReg<Spectrum> TextureProgram::mix(TextureReg<Spectrum> t1, TextureReg<Spectrum> t2,
+                                         TextureReg<Float> amount) {
+    if (t1.index == t2.index) {
+        return t1;
+    }
+    if (isConstant(amount)) {
+        Float amt = _floatRegs[amount.index];
+        if (amt == 0) {
+            return t1;
+        }
+        if (amt == 1) {
+            return t2;
+        }
+        if (isConstant(t1) && isConstant(t2)) {
+            return constant((1 - amt) * _spectrumRegs[t1.index] + amt * _spectrumRegs[t2.index]);
+        }
+    }
+    int src[3] = {t1.index, t2.index, amount.index};
+    TextureReg<Spectrum> ret;
+    ret.index = emit(Op::SpectrumMix, src, 3);
+    return ret;
+}
+
+TextureReg<Float> TextureProgram::opaque(const Texture<Float> *tex) {
+    TextureReg<Float> ret;
+    ret.index = emit(Op::FloatOpaque, nullptr, 0, tex);
+    return ret;
+}
+
+TextureReg<Spectrum> TextureProgram::opaque(const Texture<Spectrum> *tex) {
+    TextureReg<Spectrum> ret;
+    ret.index = emit(Op::SpectrumOpaque, nullptr, 0, tex);
+    return ret;
+}
+
+TextureValues TextureProgram::execute(const SurfaceInteraction &si, MemoryArena &arena) const {
+    if (_code.empty()) {
+        return TextureValues(_floatRegs.data(), _spectrumRegs.data());
+    }
+    Float *f = nullptr;
+    if (!_floatRegs.empty()) {
+        f = arena.alloc<Float>(_floatRegs.size(), false);
+        std::copy(_floatRegs.begin(), _floatRegs.end(), f);
+    }
+    Spectrum *s = nullptr;
+    if (!_spectrumRegs.empty()) {
+        s = arena.alloc<Spectrum>(_spectrumRegs.size());
+        std::copy(_spectrumRegs.begin(), _spectrumRegs.end(), s);
+    }
+    TextureCoord *coords = nullptr;
+    if (_numMappings > 0) {
+        coords = arena.alloc<TextureCoord>(_numMappings);
+    }
+
+    for (const Instruction &ins : _code) {
+        const int *src = ins.src;
+        switch (ins.op) {
+            case Op::MapUV: {
+                TextureCoord &c = coords[ins.dst];
+                auto mapping = static_cast<const UVMapping2D *>(
+                                static_cast<const TextureMapping2D *>(ins.ptr));
+                c.st = mapping->UVMapping2D::map(si, &c.dstdx, &c.dstdy);
+                break;
+            }
+            case Op::Map2D: {
+                TextureCoord &c = coords[ins.dst];
+                auto mapping = static_cast<const TextureMapping2D *>(ins.ptr);
+                c.st = mapping->map(si, &c.dstdx, &c.dstdy);
+                break;
+            }
+            case Op::FloatImage: {
+                const TextureCoord &c = coords[src[0]];
+                auto mipmap = static_cast<const MIPMap<Float> *>(ins.ptr);
+                f[ins.dst] = ins.doFilter
+                            ? mipmap->lookup(c.st, c.dstdx, c.dstdy)
+                            : mipmap->lookup(c.st);
+                break;
+            }
+            case Op::SpectrumImage: {
+                const TextureCoord &c = coords[src[0]];
+                auto mipmap = static_cast<const MIPMap<RGBSpectrum> *>(ins.ptr);
+                RGBSpectrum mem = ins.doFilter
+                                ? mipmap->lookup(c.st, c.dstdx, c.dstdy)
+                                : mipmap->lookup(c.st);
+                Float rgb[3];
+                mem.ToRGB(rgb);
+                s[ins.dst] = Spectrum::FromRGB(rgb);
+                break;
+            }
+            case Op::FloatBilerp: {
+                Point2f st = coords[src[0]].st;
+                f[ins.dst] = (1 - st[0]) * (1 - st[1]) * f[src[1]]
+                            + (1 - st[0]) * (st[1]) * f[src[2]]
+                            + (st[0]) * (1 - st[1]) * f[src[3]]
+                            + (st[0]) * (st[1]) * f[src[4]];
+                break;
+            }
+            case Op::SpectrumBilerp: {
+                Point2f st = coords[src[0]].st;
+                s[ins.dst] = (1 - st[0]) * (1 - st[1]) * s[src[1]]
+                            + (1 - st[0]) * (st[1]) * s[src[2]]
+                            + (st[0]) * (1 - st[1]) * s[src[3]]
+                            + (st[0]) * (st[1]) * s[src[4]];
+                break;
+            }
+            case Op::FloatMul:
+                f[ins.dst] = f[src[0]] * f[src[1]];
+                break;
+            case Op::FloatSpectrumMul:
+                s[ins.dst] = f[src[0]] * s[src[1]];
+                break;
+            case Op::SpectrumMul:
+                s[ins.dst] = s[src[0]] * s[src[1]];
+                break;
+            case Op::FloatMix: {
+                Float amt = f[src[2]];
+                f[ins.dst] = (1 - amt) * f[src[0]] + amt * f[src[1]];
+                break;
+            }
+            case Op::SpectrumMix: {
+                Float amt = f[src[2]];
+                s[ins.dst] = (1 - amt) * s[src[0]] + amt * s[src[1]];
+                break;
+            }
+            case Op::FloatOpaque:
+                f[ins.dst] = static_cast<const Texture<Float> *>(ins.ptr)->evaluate(si);
+                break;
+            case Op::SpectrumOpaque:
+                s[ins.dst] = static_cast<const Texture<Spectrum> *>(ins.ptr)->evaluate(si);
+                break;
+        }
+    }
+    return TextureValues(f, s);
+}
+
+PALADIN_END
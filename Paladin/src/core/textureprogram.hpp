@@ -0,0 +1,183 @@
+//
+//  textureprogram.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/14.
+//
+
+#ifndef textureprogram_hpp
+#define textureprogram_hpp
+
+#include "core/header.h"
+#include "core/spectrum.hpp"
+
+PALADIN_BEGIN
+
+class TextureMapping2D;
+
+template <typename T>
+class MIPMap;
+
+/**
+ * 纹理程序中的寄存器，用模板参数区分Float与Spectrum两种寄存器
+ */
+template <typename T>
+struct TextureReg {
+    int index = -1;
+};
+
+/**
+ * 纹理程序执行之后的寄存器，在MemoryArena中分配
+ */
+class TextureValues {
+public:
+    TextureValues(const Float *floats, const Spectrum *spectrums)
+    : _floats(floats), _spectrums(spectrums) {
+
+    }
+
+    Float get(TextureReg<Float> reg) const {
+        DCHECK(reg.index >= 0);
+        return _floats[reg.index];
+    }
+
+    const Spectrum &get(TextureReg<Spectrum> reg) const {
+        DCHECK(reg.index >= 0);
+        return _spectrums[reg.index];
+    }
+
+private:
+    const Float *_floats;
+    const Spectrum *_spectrums;
+};
+
+/**
+ * 材质的所有纹理参数编译成的线性程序
+ *
+ * 材质的每个参数都是一个纹理，ScaleTexture，MixTexture等纹理又引用了其他纹理，
+ * 整体是一个DAG，逐个调用evaluate时每个节点都是一次虚函数调用，
+ * 每个ImageTexture也都会重新计算一次纹理映射以及偏导数
+ *
+ * 材质构造时(也就是场景加载时)把所有参数的DAG展开为一个指令序列
+ *     1.常量在编译期折叠，例如常量乘常量，混合系数为0或1的MixTexture
+ *     2.相同的指令只保留一条，参数相同的纹理映射在每个交点只计算一次，
+ *       同一张贴图使用同一个映射的查找也只执行一次
+ *     3.无法展开的纹理作为一条调用evaluate的指令
+ * 着色时执行一次程序，得到所有参数的值
+ */
+class TextureProgram {
+public:
+    TextureProgram() {
+
+    }
+
+    /**
+     * 添加一个需要求值的纹理，返回结果所在的寄存器
+     * 纹理为空时返回值为零的常量
+     */
+    TextureReg<Float> add(const std::shared_ptr<Texture<Float>> &tex);
+
+    TextureReg<Spectrum> add(const std::shared_ptr<Texture<Spectrum>> &tex);
+
+    /**
+     * 对交点执行程序，寄存器在arena中分配
+     * 全部是常量时不执行任何指令，直接返回常量
+     */
+    TextureValues execute(const SurfaceInteraction &si, MemoryArena &arena) const;
+
+    /**
+     * 以下为Texture::compile使用的接口，每个函数生成一条指令，返回结果的寄存器
+     */
+    TextureReg<Float> constant(Float value);
+
+    TextureReg<Spectrum> constant(const Spectrum &value);
+
+    // 纹理映射，返回映射结果的编号，参数相同的映射共用一个编号
+    int mapping(const TextureMapping2D *mapping);
+
+    TextureReg<Float> image(const MIPMap<Float> *mipmap, int map, bool doFilter);
+
+    TextureReg<Spectrum> image(const MIPMap<RGBSpectrum> *mipmap, int map, bool doFilter);
+
+    TextureReg<Float> bilerp(int map, TextureReg<Float> v00, TextureReg<Float> v01,
+                             TextureReg<Float> v10, TextureReg<Float> v11);
+
+    TextureReg<Spectrum> bilerp(int map, TextureReg<Spectrum> v00, TextureReg<Spectrum> v01,
+                                TextureReg<Spectrum> v10, TextureReg<Spectrum> v11);
+
+    TextureReg<Float> mul(TextureReg<Float> a, TextureReg<Float> b);
+
+    TextureReg<Spectrum> mul(TextureReg<Float> a, TextureReg<Spectrum> b);
+
+    TextureReg<Spectrum> mul(TextureReg<Spectrum> a, TextureReg<Spectrum> b);
+
+    // (1 - amount) * t1 + amount * t2
+    TextureReg<Float> mix(TextureReg<Float> t1, TextureReg<Float> t2, TextureReg<Float> amount);
+
+    TextureReg<Spectrum> mix(TextureReg<Spectrum> t1, TextureReg<Spectrum> t2,
+                             TextureReg<Float> amount);
+
+    // 无法展开的纹理，每次执行时调用evaluate
+    TextureReg<Float> opaque(const Texture<Float> *tex);
+
+    TextureReg<Spectrum> opaque(const Texture<Spectrum> *tex);
+
+    int numInstructions() const {
+        return (int)_code.size();
+    }
+
+private:
+
+    enum class Op {
+        // 纹理映射，UV映射直接调用，不经过虚函数
+        MapUV,
+        Map2D,
+        FloatImage,
+        SpectrumImage,
+        FloatBilerp,
+        SpectrumBilerp,
+        FloatMul,
+        FloatSpectrumMul,
+        SpectrumMul,
+        FloatMix,
+        SpectrumMix,
+        FloatOpaque,
+        SpectrumOpaque
+    };
+
+    struct Instruction {
+        Op op;
+        // 结果寄存器，纹理映射指令为映射结果的编号
+        int dst;
+        // 源寄存器，贴图与双线性插值的src[0]为纹理映射的编号
+        int src[5];
+        // 纹理映射，mipmap或者无法展开的纹理
+        const void *ptr;
+        bool doFilter;
+    };
+
+    /**
+     * 已经存在相同的指令时返回其结果寄存器，否则添加指令并分配寄存器
+     */
+    int emit(Op op, const int *src, int nSrc, const void *ptr = nullptr, bool doFilter = false);
+
+    bool isConstant(TextureReg<Float> reg) const {
+        return _floatConstant[reg.index];
+    }
+
+    bool isConstant(TextureReg<Spectrum> reg) const {
+        return _spectrumConstant[reg.index];
+    }
+
+    // 寄存器的初始值，常量寄存器为常量的值，其余为零
+    std::vector<Float> _floatRegs;
+    std::vector<Spectrum> _spectrumRegs;
+    std::vector<bool> _floatConstant;
+    std::vector<bool> _spectrumConstant;
+    int _numMappings = 0;
+    std::vector<Instruction> _code;
+};
+
+PALADIN_END
+
+#endif /* textureprogram_hpp */
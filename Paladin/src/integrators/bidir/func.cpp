@@ -326,7 +326,9 @@ Spectrum connectPath(const Scene &scene, Vertex *lightVertices,
     Float weight = L.IsBlack() ? 0.f : MISWeight(scene, lightVertices, cameraVertices,
                                             sampled, s, t, lightDistr, lightToIndex);
     DCHECK(!isNaN(weight));
-    *misWeight = weight;
+    if (misWeight) {
+        *misWeight = weight;
+    }
     L *= weight;
     
     return L;
@@ -12,6 +12,9 @@ PALADIN_BEGIN
 
 //"param" : {
 //    "type" : "normal",
+//    "adaptive" : {"threshold" : 0.05},
+//    "progressive" : {"timeLimit" : 600, "snapshotInterval" : 30},
+//    "distributed" : {"sampleRange" : [0, 64], "checkpoint" : "part0.ckpt"}
 //}
 CObject_ptr createGeometryIntegrator(const nloJson &param, const Arguments &lst) {
     string type = param.value("type", "normal");
@@ -21,7 +24,11 @@ CObject_ptr createGeometryIntegrator(const nloJson &param, const Arguments &lst)
     Camera * camera = dynamic_cast<Camera *>(*iter);
     AABB2i pixelBounds = camera->film->getSampleBounds();
     
-    return new GeometryIntegrator(shared_ptr<const Camera>(camera), shared_ptr<Sampler>(sampler), pixelBounds, GeometryIntegratorType::Normal);
+    GeometryIntegrator * ret = new GeometryIntegrator(shared_ptr<const Camera>(camera), shared_ptr<Sampler>(sampler), pixelBounds, GeometryIntegratorType::Normal);
+    ret->setAdaptiveSampling(param.value("adaptive", nloJson()));
+    ret->setProgressive(param.value("progressive", nloJson()));
+    ret->setDistributed(param.value("distributed", nloJson()));
+    return ret;
 }
 
 REGISTER("Geometry", createGeometryIntegrator);
@@ -37,7 +37,6 @@ public:
         
         if (scene.intersect(ray, &ref)) {
             if(_type == GeometryIntegratorType::Normal){
-                ref.computeTangentSpace();
                 ref.primitive->getMaterial()->computeScatteringFunctions(&ref, arena, TransportMode::Radiance, true);
                 Normal3f nn = normalize(ref.shading.normal);
                 nn = mapTo01(nn);
@@ -6,3 +6,254 @@
 //
 
 #include "mlt.hpp"
+#include "math/lightdistribute.hpp"
+#include "tools/progressreporter.hpp"
+#include "tools/parallel.hpp"
+#include "../bidir/func.hpp"
+
+PALADIN_BEGIN
+
+// 相机子路径，光源子路径，连接三组随机数分别使用不同的流
+static const int cameraStreamIndex = 0;
+static const int lightStreamIndex = 1;
+static const int connectionStreamIndex = 2;
+static const int nSampleStreams = 3;
+
+/**
+ * 每条马尔可夫链私有的splat缓存
+ *
+ * 每次变异都会产生两个splat，如果直接写入胶片，
+ * 所有链都在对胶片像素做原子加法，高贡献区域的像素会被大量的链争抢
+ * 而被拒绝的变异会把当前状态反复splat到同一个像素上，
+ * 所以先在链内缓存，相同像素的连续splat直接合并，缓存满了再统一写入胶片
+ * 胶片的splat只关心样本所在的像素，所以合并不影响结果
+ * 但是亮度截断是针对单个样本的，合并之前先截断，写入胶片时不再截断
+ */
+class SplatBuffer {
+
+public:
+
+    SplatBuffer(Film *film, int capacity = 1024)
+    : _film(film),
+    _maxSampleLuminance(film->getMaxSampleLuminance()),
+    _capacity(capacity) {
+        _records.reserve(capacity);
+    }
+
+    ~SplatBuffer() {
+        flush();
+    }
+
+    void add(const Point2f &pRaster, Spectrum v) {
+        Point2i pixel = (Point2i)pRaster;
+        if (v.y() > _maxSampleLuminance) {
+            v *= _maxSampleLuminance / v.y();
+        }
+        if (!_records.empty() && _records.back().pixel == pixel) {
+            _records.back().v += v;
+            return;
+        }
+        if (_records.size() >= _capacity) {
+            flush();
+        }
+        _records.push_back({pixel, v});
+    }
+
+    void flush() {
+        for (const auto &record : _records) {
+            _film->addSplat(Point2f(record.pixel.x + 0.5f, record.pixel.y + 0.5f),
+                            record.v, false);
+        }
+        _records.clear();
+    }
+
+private:
+
+    struct SplatRecord {
+        Point2i pixel;
+        Spectrum v;
+    };
+
+    Film * _film;
+
+    const Float _maxSampleLuminance;
+
+    const size_t _capacity;
+
+    std::vector<SplatRecord> _records;
+};
+
+Spectrum MLTIntegrator::L(const Scene &scene, MemoryArena &arena,
+                          const std::unique_ptr<Distribution1D> &lightDistr,
+                          const std::unordered_map<const Light *, size_t> &lightToIndex,
+                          MLTSampler &sampler, int depth, Point2f *pRaster) {
+    sampler.startStream(cameraStreamIndex);
+    // 确定(s,t)策略，深度为depth的路径有depth + 2种策略
+    int s, t, nStrategies;
+    if (depth == 0) {
+        nStrategies = 1;
+        s = 0;
+        t = 2;
+    } else {
+        nStrategies = depth + 2;
+        s = std::min((int)(sampler.get1D() * nStrategies), nStrategies - 1);
+        t = nStrategies - s;
+    }
+
+    // 生成相机子路径
+    Vertex *cameraVertices = arena.alloc<Vertex>(t);
+    AABB2f sampleBounds = (AABB2f)_camera->film->getSampleBounds();
+    *pRaster = sampleBounds.lerp(sampler.get2D());
+    if (generateCameraSubpath(scene, sampler, arena, t, *_camera, *pRaster,
+                              cameraVertices, _rrThreshold) != t) {
+        return Spectrum(0.f);
+    }
+
+    // 生成光源子路径
+    sampler.startStream(lightStreamIndex);
+    Vertex *lightVertices = arena.alloc<Vertex>(s);
+    if (generateLightSubpath(scene, sampler, arena, s, cameraVertices[0].time(),
+                             *lightDistr, lightToIndex, lightVertices,
+                             _rrThreshold) != s) {
+        return Spectrum(0.f);
+    }
+
+    // 连接两条子路径，每个样本只使用一种策略，所以要乘以策略数量
+    sampler.startStream(connectionStreamIndex);
+    return connectPath(scene, lightVertices, cameraVertices, s, t, *lightDistr,
+                       lightToIndex, *_camera, sampler, pRaster) * nStrategies;
+}
+
+void MLTIntegrator::render(const Scene &scene) {
+    std::unique_ptr<Distribution1D> lightDistr =
+    computeLightPowerDistribution(scene);
+    if (!lightDistr) {
+        COUT << "no light in scene, MLT abort";
+        return;
+    }
+
+    std::unordered_map<const Light *, size_t> lightToIndex;
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        lightToIndex[scene.lights[i].get()] = i;
+    }
+
+    // 1.启动阶段，对每个深度各生成_nBootstrap个独立样本
+    int nBootstrapSamples = _nBootstrap * (_maxDepth + 1);
+    std::vector<Float> bootstrapWeights(nBootstrapSamples, 0);
+    if (scene.lights.size() > 0) {
+        ProgressReporter progress("Generating bootstrap paths", _nBootstrap / 256);
+        const int chunkSize = clamp(_nBootstrap / 128, 1, 8192);
+        auto bootstrap = [&](int64_t i) {
+            MemoryArena arena;
+            for (int depth = 0; depth <= _maxDepth; ++depth) {
+                // 启动样本的序号直接作为rng的序列号，
+                // 之后选中该样本作为链的起点时可以完全复现出同一条路径
+                int rngIndex = i * (_maxDepth + 1) + depth;
+                MLTSampler sampler(_mutationsPerPixel, rngIndex, _sigma,
+                                   _largeStepProbability, nSampleStreams);
+                Point2f pRaster;
+                bootstrapWeights[rngIndex] = L(scene, arena, lightDistr,
+                                               lightToIndex, sampler, depth,
+                                               &pRaster).y();
+                arena.reset();
+            }
+            if ((i + 1) % 256 == 0) {
+                progress.update();
+            }
+        };
+        parallelFor(bootstrap, _nBootstrap, chunkSize);
+        progress.done();
+    }
+    Distribution1D bootstrap(&bootstrapWeights[0], nBootstrapSamples);
+    // 归一化常数，所有深度的贡献之和
+    Float b = bootstrap.getFuncInt() * (_maxDepth + 1);
+
+    // 2.运行马尔可夫链
+    Film &film = *_camera->film;
+    int64_t nTotalMutations = (int64_t)_mutationsPerPixel *
+                            (int64_t)film.getSampleBounds().area();
+    if (scene.lights.size() > 0) {
+        const int progressFrequency = 32768;
+        ProgressReporter progress("Rendering", nTotalMutations / progressFrequency);
+        auto runChain = [&](int64_t i) {
+            // 把总变异次数平均分给每条链
+            int64_t nChainMutations =
+            std::min((i + 1) * nTotalMutations / _nChains, nTotalMutations) -
+            i * nTotalMutations / _nChains;
+            RNG rng(i);
+            MemoryArena arena;
+            SplatBuffer splats(&film);
+
+            // 按照启动样本的贡献选择链的初始状态
+            int bootstrapIndex = bootstrap.sampleDiscrete(rng.uniformFloat());
+            int depth = bootstrapIndex % (_maxDepth + 1);
+
+            MLTSampler sampler(_mutationsPerPixel, bootstrapIndex, _sigma,
+                               _largeStepProbability, nSampleStreams);
+            Point2f pCurrent;
+            Spectrum LCurrent = L(scene, arena, lightDistr, lightToIndex,
+                                  sampler, depth, &pCurrent);
+
+            for (int64_t j = 0; j < nChainMutations; ++j) {
+                sampler.startIteration();
+                Point2f pProposed;
+                Spectrum LProposed = L(scene, arena, lightDistr, lightToIndex,
+                                       sampler, depth, &pProposed);
+                Float accept = std::min((Float)1, LProposed.y() / LCurrent.y());
+
+                // 两个状态都按照期望值的权重写入
+                if (accept > 0) {
+                    splats.add(pProposed, LProposed * accept / LProposed.y());
+                }
+                splats.add(pCurrent, LCurrent * (1 - accept) / LCurrent.y());
+
+                if (rng.uniformFloat() < accept) {
+                    pCurrent = pProposed;
+                    LCurrent = LProposed;
+                    sampler.accept();
+                } else {
+                    sampler.reject();
+                }
+                if ((i * nTotalMutations / _nChains + j) % progressFrequency == 0) {
+                    progress.update();
+                }
+                arena.reset();
+            }
+        };
+        parallelFor(runChain, _nChains);
+        progress.done();
+    }
+
+    film.writeImage(b / _mutationsPerPixel);
+}
+
+//"param" : {
+//    "maxBounce" : 5,
+//    "bootstrapSamples" : 100000,
+//    "chains" : 1000,
+//    "mutationsPerPixel" : 100,
+//    "largeStepProbability" : 0.3,
+//    "sigma" : 0.01,
+//    "rrThreshold" : 1
+//}
+// lst = {sampler, camera}
+// mlt使用自己的主样本空间采样器，场景中配置的采样器不会被使用
+CObject_ptr createMLT(const nloJson &param, const Arguments &lst) {
+    int maxDepth = param.value("maxBounce", 5);
+    int nBootstrap = param.value("bootstrapSamples", 100000);
+    int nChains = param.value("chains", 1000);
+    int mutationsPerPixel = param.value("mutationsPerPixel", 100);
+    Float largeStepProbability = param.value("largeStepProbability", 0.3f);
+    Float sigma = param.value("sigma", 0.01f);
+    Float rrThreshold = param.value("rrThreshold", 1.f);
+    auto iter = lst.begin();
+    ++iter;
+    Camera * camera = dynamic_cast<Camera *>(*iter);
+    return new MLTIntegrator(shared_ptr<const Camera>(camera), maxDepth,
+                             nBootstrap, nChains, mutationsPerPixel, sigma,
+                             largeStepProbability, rrThreshold);
+}
+
+REGISTER("mlt", createMLT);
+
+PALADIN_END
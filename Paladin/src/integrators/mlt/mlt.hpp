@@ -9,10 +9,92 @@
 #define mlt_hpp
 
 #include "samplers/mcmc.hpp"
+#include "core/integrator.hpp"
+#include "core/camera.hpp"
 
 PALADIN_BEGIN
 
+/**
+ * 梅特波利斯光照传输(metropolis light transport)
+ *
+ * 蒙特卡洛方法的样本之间相互独立，即使找到了一条贡献很大的路径，
+ * 下一个样本也无法利用这个信息，对于那些只有很窄的路径才能把光送到相机的场景
+ * (例如光只能从门缝透进房间)，绝大部分样本的贡献都是0，收敛极慢
+ *
+ * MLT用梅特波利斯-黑斯廷斯算法构造一条马尔可夫链，
+ * 链的平稳分布正比于路径对图像的贡献函数f(这里用亮度作为标量贡献)
+ * 一旦找到高贡献的路径，就在它附近不断地做小变异，充分探索这片区域
+ *
+ * 每次迭代，从当前状态X提议一个新状态X'，接受概率为
+ *
+ *   a(X -> X') = min(1, f(X') / f(X))
+ *
+ * 为了减小方差，无论是否接受，两个状态都会按照期望值的权重写入胶片(splat)
+ *     X' 的权重为 a / f(X')
+ *     X  的权重为 (1 - a) / f(X)
+ *
+ * 由于样本的分布正比于f而不是f本身，最终图像需要乘以归一化常数
+ *
+ *   b = ∫f(X)dX
+ *
+ * b由启动阶段(bootstrap)的独立样本估计，并且启动样本同时用于选择每条链的初始状态，
+ * 以消除起始偏差(start-up bias)
+ *
+ * 路径生成复用双向路径追踪的函数，每个样本只使用一个(s,t)策略，
+ * 路径深度在启动阶段就已经确定，同一条链的所有样本深度相同
+ */
+class MLTIntegrator : public Integrator {
 
+public:
+
+    MLTIntegrator(std::shared_ptr<const Camera> camera, int maxDepth,
+                  int nBootstrap, int nChains, int mutationsPerPixel,
+                  Float sigma, Float largeStepProbability,
+                  Float rrThreshold)
+    : _camera(camera),
+    _maxDepth(maxDepth),
+    _nBootstrap(nBootstrap),
+    _nChains(nChains),
+    _mutationsPerPixel(mutationsPerPixel),
+    _sigma(sigma),
+    _largeStepProbability(largeStepProbability),
+    _rrThreshold(rrThreshold) {
+
+    }
+
+    virtual void render(const Scene &scene) override;
+
+    /**
+     * 根据sampler中的主样本向量生成一条深度为depth的路径，返回该路径的贡献
+     * @param  pRaster 返回路径对应的光栅坐标
+     */
+    Spectrum L(const Scene &scene, MemoryArena &arena,
+               const std::unique_ptr<Distribution1D> &lightDistr,
+               const std::unordered_map<const Light *, size_t> &lightToIndex,
+               MLTSampler &sampler, int depth, Point2f *pRaster);
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
+private:
+
+    std::shared_ptr<const Camera> _camera;
+    const int _maxDepth;
+    // 每个深度的启动样本数量
+    const int _nBootstrap;
+    // 马尔可夫链数量，链之间相互独立，可以并行执行
+    const int _nChains;
+    // 平均每个像素的变异次数
+    const int _mutationsPerPixel;
+    // 小变异的标准差
+    const Float _sigma;
+    // 选择大变异的概率
+    const Float _largeStepProbability;
+    const Float _rrThreshold;
+};
+
+CObject_ptr createMLT(const nloJson &param, const Arguments &lst);
 
 PALADIN_END
 
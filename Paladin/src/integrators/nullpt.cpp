@@ -0,0 +1,354 @@
+//
+//  nullpt.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/1.
+//
+
+#include "nullpt.hpp"
+#include "core/camera.hpp"
+#include "core/medium.hpp"
+#include "core/light.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+
+PALADIN_BEGIN
+
+// 各通道的平均值
+static inline Float average(const Spectrum &s) {
+    Float sum = 0;
+    for (int i = 0; i < Spectrum::nSamples; ++i) {
+        sum += s[i];
+    }
+    return sum / Spectrum::nSamples;
+}
+
+NullScatteringPathTracer::NullScatteringPathTracer(int maxDepth, std::shared_ptr<const Camera> camera,
+                                                   std::shared_ptr<Sampler> sampler,
+                                                   const AABB2i &pixelBounds, Float rrThreshold /* = 1*/,
+                                                   const std::string &lightSampleStrategy /*= "power"*/)
+: MonteCarloIntegrator(camera, sampler, pixelBounds),
+_maxDepth(maxDepth),
+_rrThreshold(rrThreshold),
+_lightSampleStrategy(lightSampleStrategy) {
+
+}
+
+void NullScatteringPathTracer::preprocess(const Scene &scene, Sampler &sampler) {
+    _lightDistribution = createLightSampleDistribution(_lightSampleStrategy, scene);
+    _lightToIndex.clear();
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        _lightToIndex[scene.lights[i].get()] = i;
+    }
+}
+
+Float NullScatteringPathTracer::lightPdf(const Interaction &ref, const Light *light,
+                                         const Vector3f &wi) const {
+    auto iter = _lightToIndex.find(light);
+    if (iter == _lightToIndex.end()) {
+        return 0;
+    }
+    const Distribution1D *distrib = _lightDistribution->lookup(ref.pos);
+    return distrib->discretePDF((int)iter->second) * light->pdf_Li(ref, wi);
+}
+
+/**
+ * 路径的吞吐量beta，以及pdf比值r_u，r_l的更新规则(设c为主通道)
+ *
+ * 沿光线按照σmaj[c]采样到候选碰撞点，majorant透射率为T_maj
+ *     散射：  pdf = T_maj[c] σs[c]
+ *            beta *= T_maj σs / pdf，r_u *= T_maj σs / pdf
+ *     空碰撞：pdf = T_maj[c] σn[c]
+ *            beta *= T_maj σn / pdf，r_u *= T_maj σn / pdf，r_l *= T_maj σmaj / pdf
+ *     没有碰撞，直接到达表面：
+ *            pdf = T_maj[c]，beta，r_u，r_l都乘以 T_maj / T_maj[c]
+ *
+ * r_l乘的是σmaj而不是σn，因为光源采样的阴影光线是用ratio tracking估计透射率的，
+ * 阴影光线上所有的碰撞都是空碰撞，pdf为 T_maj σmaj
+ *
+ * 击中光源时，MIS权重为
+ *     w = r_u / (r_u + r_l)    (取各通道平均)
+ * 所以贡献为 beta * Le / average(r_u + r_l)
+ */
+Spectrum NullScatteringPathTracer::Li(const RayDifferential &r, const Scene &scene,
+                                      Sampler &sampler, MemoryArena &arena, int depth) const {
+    Spectrum L(0.f);
+    Spectrum beta(1.f), r_u(1.f), r_l(1.f);
+    RayDifferential ray(r);
+    bool specularBounce = false;
+    Float etaScale = 1.f;
+    // 上一个散射顶点，击中光源时用于计算光源采样的pdf
+    Interaction prevIt;
+
+    // 每条路径随机选择一个主通道
+    int channel = std::min((int)(sampler.get1D() * Spectrum::nSamples),
+                           Spectrum::nSamples - 1);
+    // 介质中碰撞的次数不确定，用单独的随机数生成器，避免打乱采样器的维度
+    uint64_t seed = (uint64_t)(sampler.get1D() * 4294967296.0);
+    seed |= (uint64_t)(sampler.get1D() * 4294967296.0) << 32;
+    RNG rng(seed);
+
+    int bounce = 0;
+    while (true) {
+        SurfaceInteraction isect;
+        bool foundIntersection = scene.intersect(ray, &isect);
+
+        if (ray.medium) {
+            bool scattered = false;
+            bool terminated = false;
+            Spectrum T_maj = ray.medium->sampleTmaj(ray, channel, rng,
+                                                    [&](const MajorantSample &ms) {
+                Float pAbsorb = ms.sigma_a[channel] / ms.sigma_maj[channel];
+                Float pScatter = ms.sigma_s[channel] / ms.sigma_maj[channel];
+                Float u = rng.uniformFloat();
+                if (u < pAbsorb) {
+                    // 吸收，介质不发光，路径结束
+                    terminated = true;
+                    return false;
+                } else if (u < pAbsorb + pScatter) {
+                    // 真实散射
+                    if (bounce++ >= _maxDepth) {
+                        terminated = true;
+                        return false;
+                    }
+                    Float pdf = ms.T_maj[channel] * ms.sigma_s[channel];
+                    beta *= ms.T_maj * ms.sigma_s / pdf;
+                    r_u *= ms.T_maj * ms.sigma_s / pdf;
+                    if (beta.IsBlack() || r_u.IsBlack()) {
+                        terminated = true;
+                        return false;
+                    }
+                    HenyeyGreenstein *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(ms.g);
+                    MediumInteraction mi(ms.pos, -ray.dir, ray.time, ray.medium, phase);
+                    L += sampleLd(mi, scene, sampler, rng, channel, beta, r_u);
+
+                    Vector3f wi;
+                    Float p = phase->sample_p(-ray.dir, &wi, sampler.get2D());
+                    if (p == 0) {
+                        terminated = true;
+                        return false;
+                    }
+                    // 相函数的采样是完美重要性采样，p / pdf = 1，beta不变
+                    r_l = r_u / p;
+                    prevIt = mi;
+                    scattered = true;
+                    ray = mi.spawnRay(wi);
+                    specularBounce = false;
+                    return false;
+                } else {
+                    // 空碰撞，方向不变，继续追踪
+                    Spectrum sigma_n = ms.sigma_maj - ms.sigma_a - ms.sigma_s;
+                    sigma_n = sigma_n.clamp();
+                    Float pdf = ms.T_maj[channel] * sigma_n[channel];
+                    if (pdf == 0) {
+                        beta = Spectrum(0.f);
+                        return false;
+                    }
+                    beta *= ms.T_maj * sigma_n / pdf;
+                    r_u *= ms.T_maj * sigma_n / pdf;
+                    r_l *= ms.T_maj * ms.sigma_maj / pdf;
+                    return !beta.IsBlack() && !r_u.IsBlack();
+                }
+            });
+            if (terminated || beta.IsBlack() || r_u.IsBlack()) {
+                return L;
+            }
+            if (scattered) {
+                continue;
+            }
+            if (T_maj[channel] == 0) {
+                return L;
+            }
+            beta *= T_maj / T_maj[channel];
+            r_u *= T_maj / T_maj[channel];
+            r_l *= T_maj / T_maj[channel];
+        }
+
+        if (!foundIntersection) {
+            for (const auto &light : scene.infiniteLights) {
+                Spectrum Le = light->Le(ray);
+                if (Le.IsBlack()) {
+                    continue;
+                }
+                if (bounce == 0 || specularBounce) {
+                    L += beta * Le / average(r_u);
+                } else {
+                    Spectrum rl = r_l * lightPdf(prevIt, light.get(), ray.dir);
+                    L += beta * Le / average(r_u + rl);
+                }
+            }
+            break;
+        }
+
+        Spectrum Le = isect.Le(-ray.dir);
+        if (!Le.IsBlack()) {
+            if (bounce == 0 || specularBounce) {
+                L += beta * Le / average(r_u);
+            } else {
+                const Light *areaLight = isect.primitive->getAreaLight();
+                Spectrum rl = r_l * lightPdf(prevIt, areaLight, ray.dir);
+                L += beta * Le / average(r_u + rl);
+            }
+        }
+
+        isect.computeScatteringFunctions(ray, arena);
+        // 没有bsdf的表面只是介质的边界，穿过去，不计入反射次数
+        if (!isect.bsdf) {
+            ray = isect.spawnRayThrough(ray);
+            continue;
+        }
+        if (bounce++ >= _maxDepth) {
+            break;
+        }
+        if (isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR))) {
+            L += sampleLd(isect, scene, sampler, rng, channel, beta, r_u);
+        }
+        prevIt = isect;
+
+        Vector3f wo = -ray.dir;
+        Vector3f wi;
+        Float pdf;
+        BxDFType flags;
+        Spectrum f = isect.bsdf->sample_f(wo, &wi, sampler.get2D(), &pdf, BSDF_ALL, &flags);
+        if (f.IsBlack() || pdf == 0) {
+            break;
+        }
+        beta *= f * absDot(wi, isect.shading.normal) / pdf;
+        r_l = r_u / pdf;
+        specularBounce = (flags & BSDF_SPECULAR) != 0;
+        if (flags & BSDF_TRANSMISSION) {
+            Float eta = isect.bsdf->eta;
+            etaScale *= (dot(wo, isect.normal) > 0) ? (eta * eta) : 1 / (eta * eta);
+        }
+        ray = isect.spawnRayDifferential(ray, wi, flags, pdf);
+
+        // 俄罗斯轮盘赌，用经过MIS归一化之后的吞吐量来判断
+        Spectrum rrBeta = beta * etaScale / average(r_u);
+        if (rrBeta.MaxComponentValue() < _rrThreshold && bounce > 3) {
+            Float q = std::max((Float)0.05, 1 - rrBeta.MaxComponentValue());
+            if (sampler.get1D() < q) {
+                break;
+            }
+            beta /= 1 - q;
+            DCHECK(!std::isinf(beta.y()));
+        }
+    }
+    return L;
+}
+
+Spectrum NullScatteringPathTracer::sampleLd(const Interaction &it, const Scene &scene,
+                                            Sampler &sampler, RNG &rng, int channel,
+                                            const Spectrum &beta, const Spectrum &r_p) const {
+    const Distribution1D *distrib = _lightDistribution->lookup(it.pos);
+    Float lightPmf;
+    int lightIndex = distrib->sampleDiscrete(sampler.get1D(), &lightPmf);
+    Point2f uLight = sampler.get2D();
+    if (lightPmf == 0) {
+        return Spectrum(0.f);
+    }
+    const std::shared_ptr<Light> &light = scene.lights[lightIndex];
+    Vector3f wi;
+    Float pdfLight;
+    VisibilityTester visibility;
+    Spectrum Li = light->sample_Li(it, uLight, &wi, &pdfLight, &visibility);
+    if (pdfLight == 0 || Li.IsBlack()) {
+        return Spectrum(0.f);
+    }
+
+    Spectrum f;
+    Float scatteringPdf;
+    if (it.isSurfaceInteraction()) {
+        const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
+        f = isect.bsdf->f(isect.wo, wi) * absDot(wi, isect.shading.normal);
+        scatteringPdf = isect.bsdf->pdfDir(isect.wo, wi);
+    } else {
+        const MediumInteraction &mi = (const MediumInteraction &)it;
+        Float p = mi.phase->p(mi.wo, wi);
+        f = Spectrum(p);
+        scatteringPdf = p;
+    }
+    if (f.IsBlack()) {
+        return Spectrum(0.f);
+    }
+
+    // 一次遍历阴影光线，穿过无材质的介质边界，对每一段介质做ratio tracking
+    Ray lightRay = it.spawnRayTo(visibility.P1());
+    Spectrum T_ray(1.f), r_l(1.f), r_u(1.f);
+    while (true) {
+        SurfaceInteraction isect;
+        bool hitSurface = scene.intersect(lightRay, &isect);
+        if (hitSurface && isect.primitive->getMaterial() != nullptr) {
+            return Spectrum(0.f);
+        }
+        if (lightRay.medium) {
+            Spectrum T_maj = lightRay.medium->sampleTmaj(lightRay, channel, rng,
+                                                         [&](const MajorantSample &ms) {
+                Spectrum sigma_n = (ms.sigma_maj - ms.sigma_a - ms.sigma_s).clamp();
+                Float pdf = ms.T_maj[channel] * ms.sigma_maj[channel];
+                T_ray *= ms.T_maj * sigma_n / pdf;
+                r_l *= ms.T_maj * ms.sigma_maj / pdf;
+                r_u *= ms.T_maj * sigma_n / pdf;
+                // 透射率很小时用俄罗斯轮盘赌提前结束
+                Spectrum Tr = T_ray / average(r_l + r_u);
+                if (Tr.MaxComponentValue() < 0.05f) {
+                    if (rng.uniformFloat() < 0.75f) {
+                        T_ray = Spectrum(0.f);
+                    } else {
+                        T_ray /= 0.25f;
+                    }
+                }
+                return !T_ray.IsBlack();
+            });
+            if (T_maj[channel] == 0) {
+                return Spectrum(0.f);
+            }
+            T_ray *= T_maj / T_maj[channel];
+            r_l *= T_maj / T_maj[channel];
+            r_u *= T_maj / T_maj[channel];
+        }
+        if (T_ray.IsBlack()) {
+            return Spectrum(0.f);
+        }
+        if (!hitSurface) {
+            break;
+        }
+        lightRay = isect.spawnRayTo(visibility.P1());
+    }
+
+    r_l *= r_p * lightPmf * pdfLight;
+    r_u *= r_p * scatteringPdf;
+    if (light->isDelta()) {
+        return beta * f * T_ray * Li / average(r_l);
+    }
+    return beta * f * T_ray * Li / average(r_l + r_u);
+}
+
+//"param" : {
+//    "maxBounce" : 5,
+//    "rrThreshold" : 1,
+//    "lightSampleStrategy" : "power"
+//}
+// lst = {sampler, camera}
+CObject_ptr createNullScatteringPathTracer(const nloJson &param, const Arguments &lst) {
+    int maxBounce = param.value("maxBounce", 5);
+    Float rrThreshold = param.value("rrThreshold", 1.f);
+    string lightSampleStrategy = param.value("lightSampleStrategy", "power");
+    auto iter = lst.begin();
+    Sampler * sampler = dynamic_cast<Sampler *>(*iter);
+    ++iter;
+    Camera * camera = dynamic_cast<Camera *>(*iter);
+    AABB2i pixelBounds = camera->film->getSampleBounds();
+    NullScatteringPathTracer * ret = new NullScatteringPathTracer(maxBounce,
+                                                                  shared_ptr<const Camera>(camera),
+                                                                  shared_ptr<Sampler>(sampler),
+                                                                  pixelBounds,
+                                                                  rrThreshold,
+                                                                  lightSampleStrategy);
+    ret->setAdaptiveSampling(param.value("adaptive", nloJson()));
+    ret->setProgressive(param.value("progressive", nloJson()));
+    ret->setDistributed(param.value("distributed", nloJson()));
+    return ret;
+}
+
+REGISTER("nullpt", createNullScatteringPathTracer);
+
+PALADIN_END
@@ -0,0 +1,109 @@
+//
+//  nullpt.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/1.
+//
+
+#ifndef nullpt_hpp
+#define nullpt_hpp
+
+#include "core/integrator.hpp"
+#include "math/lightdistribute.hpp"
+#include <unordered_map>
+
+PALADIN_BEGIN
+
+/**
+ * 基于空碰撞路径积分(null-scattering path integral)的体渲染路径追踪
+ *
+ * 参考资料
+ * Miller et al. A null-scattering path integral formulation of light transport (2019)
+ * pbrt-v4 VolPathIntegrator
+ *
+ * VolumePathTracer的问题在于
+ *     1.介质的sample与Tr是两个独立的黑盒，非均匀介质中delta tracking的各种随机决策无法参与MIS
+ *     2.sampleOneLight中的estimateDirectLighting对每个光源样本做两次遍历，
+ *       一次沿光源样本方向计算Tr，一次沿bsdf样本方向调用intersectTr，
+ *       之后路径追踪本身还要沿bsdf方向再遍历一次，同一段介质被追踪了两遍
+ *
+ * 空碰撞的思路是，在介质中加入空粒子，使总消光系数处处等于majorant σmaj，
+ * 沿光线按照σmaj采样候选碰撞点，每个碰撞点有三种可能
+ *     吸收 概率 σa / σmaj
+ *     散射 概率 σs / σmaj
+ *     空碰撞 概率 σn / σmaj，光线方向不变，继续追踪
+ *
+ * 这样路径上每个顶点的pdf都可以显式地写出来，于是可以像表面一样做MIS
+ *
+ * 我们不直接储存pdf的值(很容易上溢或下溢)，而是储存pdf的比值
+ *     r_u = p_u / p_path   单向(unidirectional)采样，也就是当前路径的生成方式
+ *     r_l = p_l / p_path   在最后一个顶点改用光源采样时的pdf
+ * 其中p_path为实际采样当前路径所用的pdf
+ *
+ * 光谱MIS：
+ * 当σ随通道变化时，每个通道的最优采样距离是不同的，
+ * 每条相机路径随机选一个"主通道"(hero channel)，用主通道的σmaj采样距离，
+ * r_u中储存的是其他通道的pdf与主通道pdf的比值，
+ * 最终贡献除以r_u的平均值，就相当于对所有通道的采样策略做了balance heuristic
+ *
+ * 共享遍历：
+ * 直接光照的bsdf采样策略不再单独发射光线，而是复用路径的下一段，
+ * 路径的下一段击中光源时，用沿途累积的r_l计算光源采样策略的MIS权重
+ * 光源采样策略的阴影光线只遍历一次，遍历过程中同时跳过无材质的介质边界，
+ * 并对每一段介质做ratio tracking
+ */
+class NullScatteringPathTracer : public MonteCarloIntegrator {
+
+public:
+
+    NullScatteringPathTracer(int maxDepth, std::shared_ptr<const Camera> camera,
+                             std::shared_ptr<Sampler> sampler,
+                             const AABB2i &pixelBounds, Float rrThreshold = 1,
+                             const std::string &lightSampleStrategy = "power");
+
+    virtual void preprocess(const Scene &scene, Sampler &sampler) override;
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
+    virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
+                        Sampler &sampler, MemoryArena &arena, int depth) const override;
+
+private:
+
+    /**
+     * 在it处采样一个光源，估计直接光照
+     * 阴影光线经过介质时用ratio tracking估计透射率，同时更新r_l与r_u
+     * @param  it       表面或介质中的点
+     * @param  channel  主通道
+     * @param  beta     路径吞吐量
+     * @param  r_p      路径的r_u
+     * @return          直接光照的贡献，已经乘以beta并且除以了MIS的归一化因子
+     */
+    Spectrum sampleLd(const Interaction &it, const Scene &scene, Sampler &sampler,
+                      RNG &rng, int channel, const Spectrum &beta,
+                      const Spectrum &r_p) const;
+
+    /**
+     * 从ref处采样到light的概率，用于击中光源时计算MIS权重
+     */
+    Float lightPdf(const Interaction &ref, const Light *light, const Vector3f &wi) const;
+
+    // 最大反射次数
+    const int _maxDepth;
+    // 俄罗斯轮盘结束的阈值
+    const Float _rrThreshold;
+    // 光源采样策略
+    const std::string _lightSampleStrategy;
+    // 光源分布
+    std::unique_ptr<LightDistribution> _lightDistribution;
+    // 光源在scene.lights中的索引
+    std::unordered_map<const Light *, size_t> _lightToIndex;
+};
+
+CObject_ptr createNullScatteringPathTracer(const nloJson &param, const Arguments &lst);
+
+PALADIN_END
+
+#endif /* nullpt_hpp */
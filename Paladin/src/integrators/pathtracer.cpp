@@ -9,6 +9,7 @@
 #include "pathtracer.hpp"
 #include "core/camera.hpp"
 #include "materials/bxdfs/bsdf.hpp"
+#include "materials/bxdfs/bssrdf.hpp"
 
 PALADIN_BEGIN
 
@@ -29,6 +30,12 @@ void PathTracer::preprocess(const Scene &scene, Sampler &sampler) {
 
 Spectrum PathTracer::Li(const RayDifferential &r, const Scene &scene,
 						Sampler &sampler, MemoryArena &arena, int depth) const {
+    return LiWithAOV(r, scene, sampler, arena, nullptr);
+}
+
+Spectrum PathTracer::LiWithAOV(const RayDifferential &r, const Scene &scene,
+                               Sampler &sampler, MemoryArena &arena,
+                               AOVSample *aov) const {
 	Spectrum L(0.0f);
 	Spectrum throughput(1.0f);
 	RayDifferential ray(r);
@@ -45,11 +52,15 @@ Spectrum PathTracer::Li(const RayDifferential &r, const Scene &scene,
 		if (bounces == 0 || specularBounce) {
 			// 如果与几何图元有交点，则判断是否为光源，估计Le
 			if (foundIntersection) {
-				L += throughput * isect.Le(-ray.dir);
+				Spectrum Le = throughput * isect.Le(-ray.dir);
+				L += Le;
+				addLightAOV(aov, isect.primitive->getAreaLight(), Le);
 			} else {
 				// 如果没有交点，则采样环境光
 				for (const auto &light : scene.infiniteLights) {
-					L += throughput * light->Le(ray);
+					Spectrum Le = throughput * light->Le(ray);
+					L += Le;
+					addLightAOV(aov, light.get(), Le);
 				}
 			}
 		}
@@ -63,17 +74,22 @@ Spectrum PathTracer::Li(const RayDifferential &r, const Scene &scene,
 		// 有些几何图元是仅仅是为了限定参与介质的范围
 		// 所以没有bsdf
 		if (!isect.bsdf) {
-			ray = isect.spawnRay(ray.dir);
+			ray = isect.spawnRayThrough(ray);
 			--bounces;
 			continue;
 		}
+		recordPrimaryAOV(aov, r, isect);
+		recordSurfaceAOV(aov, isect);
 
 		const Distribution1D * distrib = _lightDistribution->lookup(isect.pos);
 		// 找到非高光反射comp，如果有，则估计直接光照贡献
 		if (isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0) {
-			Spectrum Ld = throughput * sampleOneLight(isect, scene, arena, sampler, false, distrib);
+			const Light *sampledLight = nullptr;
+			Spectrum Ld = throughput * sampleOneLight(isect, scene, arena, sampler, false,
+			                                          distrib, &sampledLight);
 
 			L += Ld;
+			addLightAOV(aov, sampledLight, Ld);
 		}
 
 		// 开始采样BSDF，生成wi方向，追踪更长的路径
@@ -103,9 +119,37 @@ Spectrum PathTracer::Li(const RayDifferential &r, const Scene &scene,
 			etaScale *= (dot(wo, isect.normal) > 0) ? (eta * eta) : 1 / (eta * eta);
 		}
 
-		ray = isect.spawnRay(wi);
+		// 非高光的弹射也需要传递微分光线，间接光照的纹理查找才能选到合适的mipmap层级
+		ray = isect.spawnRayDifferential(ray, wi, flags, pdf);
 		if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
-			// todo 处理bssrdf
+			// 光线折射进入物体内部，由BSSRDF采样出射点pi，
+			// 相当于路径从pi处重新开始，估计pi处的直接光照并采样下一个方向
+			SurfaceInteraction pi;
+			Spectrum S = isect.bssrdf->sample_S(scene, sampler.get1D(), sampler.get2D(),
+			                                    arena, &pi, &pdf);
+			DCHECK(!std::isinf(throughput.y()));
+			if (S.IsBlack() || pdf == 0) {
+				break;
+			}
+			throughput *= S / pdf;
+
+			const Light *sampledLight = nullptr;
+			Spectrum Ld = throughput * sampleOneLight(pi, scene, arena, sampler, false,
+			                                          _lightDistribution->lookup(pi.pos),
+			                                          &sampledLight);
+			L += Ld;
+			addLightAOV(aov, sampledLight, Ld);
+
+			Spectrum f = pi.bsdf->sample_f(pi.wo, &wi, sampler.get2D(), &pdf,
+			                               BSDF_ALL, &flags);
+			if (f.IsBlack() || pdf == 0) {
+				break;
+			}
+			throughput *= f * absDot(wi, pi.shading.normal) / pdf;
+			DCHECK(!std::isinf(throughput.y()));
+			specularBounce = (flags & BSDF_SPECULAR) != 0;
+			// pi处没有微分数据，足迹从pi重新开始，只保留折射光线的张角
+			ray = pi.spawnRayDifferential(ray, wi, flags, pdf);
 		}
         // 为何不直接使用throughput，包含的是radiance，radiance是经过折射缩放的
         // 但rrThroughput没有经过折射缩放，包含的是power，我们需要根据能量去筛选路径
@@ -127,7 +171,23 @@ USING_STD;
 //"param" : {
 //    "maxBounce" : 5,
 //    "rrThreshold" : 1,
-//    "lightSampleStrategy" : "power"
+//    "lightSampleStrategy" : "power",
+//    "adaptive" : {
+//        "threshold" : 0.05,
+//        "minSamples" : 16,
+//        "passSamples" : 16
+//    },
+//    "progressive" : {
+//        "timeLimit" : 600,
+//        "targetSpp" : 0,
+//        "passSamples" : 4,
+//        "snapshotInterval" : 30
+//    },
+//    "distributed" : {
+//        "sampleRange" : [0, 64],
+//        "checkpoint" : "part0.ckpt",
+//        "merge" : []
+//    }
 //}
 // lst = {sampler, camera}
 CObject_ptr createPathTracer(const nloJson &param, const Arguments &lst) {
@@ -146,6 +206,9 @@ CObject_ptr createPathTracer(const nloJson &param, const Arguments &lst) {
                                       rrThreshold,
                                       lightSampleStrategy);
     
+    ret->setAdaptiveSampling(param.value("adaptive", nloJson()));
+    ret->setProgressive(param.value("progressive", nloJson()));
+    ret->setDistributed(param.value("distributed", nloJson()));
     return ret;
 }
 
@@ -260,6 +260,16 @@ public:
 	
 	virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const override;
+    
+    /**
+     * 在beauty的同一条路径上记录AOV
+     *     深度与ID来自相机光线的第一个交点
+     *     反照率与法线来自第一个非高光交点，经过镜面，玻璃之后看到的表面也能得到正确的引导图层
+     *     自发光，环境光，直接光照按照光源所属的分组累加
+     */
+    virtual Spectrum LiWithAOV(const RayDifferential &ray, const Scene &scene,
+                               Sampler &sampler, MemoryArena &arena,
+                               AOVSample *aov) const override;
 
 private:
 	// 最大反射次数
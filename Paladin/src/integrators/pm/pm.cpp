@@ -6,3 +6,487 @@
 //
 
 #include "pm.hpp"
+#include "core/scene.hpp"
+#include "core/light.hpp"
+#include "core/sampler.hpp"
+#include "core/film.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+#include "math/lightdistribute.hpp"
+#include "math/lowdiscrepancy.hpp"
+#include "samplers/halton.hpp"
+#include "tools/progressreporter.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * 可见点，相机路径第一个非镜面顶点
+ * bsdf分配在每个线程各自的内存池中，每轮迭代结束时统一释放
+ */
+struct VisiblePoint {
+    VisiblePoint() {
+
+    }
+
+    VisiblePoint(const Point3f &p, const Vector3f &wo, const BSDF *bsdf,
+                 const Spectrum &beta)
+    : pos(p),
+    wo(wo),
+    bsdf(bsdf),
+    beta(beta) {
+
+    }
+
+    Point3f pos;
+    Vector3f wo;
+    const BSDF *bsdf = nullptr;
+    // 相机路径到达可见点的吞吐量
+    Spectrum beta;
+};
+
+/**
+ * SPPM中的像素数据，每个像素对应一个可见点
+ */
+struct SPPMPixel {
+    SPPMPixel() : M(0) {
+
+    }
+
+    // 当前搜索半径
+    Float radius = 0;
+    // 相机路径估计的直接光照(包括直接击中光源的部分)之和
+    Spectrum Ld;
+    // 本轮迭代的可见点
+    VisiblePoint vp;
+    // 本轮迭代中落在半径内的光子通量之和
+    // 光子pass是并行的，多个线程可能同时往同一个像素上累积，所以用原子浮点数
+    AtomicFloat Phi[Spectrum::nSamples];
+    // 本轮迭代中落在半径内的光子数量
+    std::atomic<int> M;
+    // 累积的有效光子数量
+    Float N = 0;
+    // 累积的通量，已经按照半径缩放过
+    Spectrum tau;
+};
+
+/**
+ * 哈希网格中的链表节点，每个节点指向一个像素
+ * 一个可见点的搜索范围可能跨越多个网格，所以一个像素可能对应多个节点
+ */
+struct SPPMPixelListNode {
+    SPPMPixel *pixel;
+    SPPMPixelListNode *next;
+};
+
+/**
+ * 计算点p所在的网格坐标，如果点p在网格范围之外，返回false
+ * 返回的坐标总是会被限制在[0, gridRes)范围内
+ */
+static bool toGrid(const Point3f &p, const AABB3f &bounds,
+                   const int gridRes[3], Point3i *pi) {
+    bool inBounds = true;
+    Vector3f pg = bounds.offset(p);
+    for (int i = 0; i < 3; ++i) {
+        (*pi)[i] = (int)(gridRes[i] * pg[i]);
+        inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
+        (*pi)[i] = clamp((*pi)[i], 0, gridRes[i] - 1);
+    }
+    return inBounds;
+}
+
+/**
+ * 空间哈希函数，三个大质数分别与三个坐标相乘再异或
+ * 由于网格的分辨率由可见点的分布决定，整个网格所需的数组大小无法预先确定
+ * 所以用哈希的方式把无限大的网格映射到固定大小的数组上，
+ * 哈希冲突只会导致少量多余的距离判断，不影响正确性
+ */
+inline unsigned int hashGrid(const Point3i &p, int hashSize) {
+    return (unsigned int)((p.x * 73856093) ^ (p.y * 19349663) ^
+                          (p.z * 83492791)) %
+    hashSize;
+}
+
+void PhotonMapper::render(const Scene &scene) {
+    Film *film = _camera->film.get();
+    AABB2i pixelBounds = film->croppedPixelBounds;
+    int nPixels = pixelBounds.area();
+    std::unique_ptr<SPPMPixel[]> pixels(new SPPMPixel[nPixels]);
+    for (int i = 0; i < nPixels; ++i) {
+        pixels[i].radius = _initialSearchRadius;
+    }
+    const Float invSqrtSPP = 1.f / std::sqrt(_nIterations);
+
+    // 光子按照光源功率分布来发射，相机pass的直接光照也使用同一个分布
+    std::unique_ptr<Distribution1D> lightDistr =
+    computeLightPowerDistribution(scene);
+    if (!lightDistr) {
+        COUT << "no light in scene, SPPM abort";
+        return;
+    }
+
+    // 每轮迭代需要用同一个像素的不同样本，用halton序列的样本索引来区分每轮迭代
+    HaltonSampler sampler(_nIterations, pixelBounds);
+
+    Vector2i pixelExtent = pixelBounds.diagonal();
+    const int tileSize = 16;
+    Point2i nTiles((pixelExtent.x + tileSize - 1) / tileSize,
+                   (pixelExtent.y + tileSize - 1) / tileSize);
+
+    // 每个线程各自一个内存池，可见点的bsdf与网格节点都分配在这里
+    // 每轮迭代结束时reset，所以内存占用只跟像素数量有关，与迭代次数无关
+    std::vector<MemoryArena> perThreadArenas(maxThreadIndex());
+    // 光子路径的bsdf只在追踪单个光子时有效，用单独的内存池，每个光子结束时reset
+    std::vector<MemoryArena> photonArenas(maxThreadIndex());
+
+    ProgressReporter reporter("rendering", 2 * _nIterations);
+
+    for (int iter = 0; iter < _nIterations; ++iter) {
+
+        // 1.相机pass，生成可见点
+        auto cameraPass = [&](Point2i tile) {
+            MemoryArena &arena = perThreadArenas[ThreadIndex];
+            int tileIndex = tile.y * nTiles.x + tile.x;
+            std::unique_ptr<Sampler> tileSampler = sampler.clone(tileIndex);
+
+            int x0 = pixelBounds.pMin.x + tile.x * tileSize;
+            int x1 = std::min(x0 + tileSize, pixelBounds.pMax.x);
+            int y0 = pixelBounds.pMin.y + tile.y * tileSize;
+            int y1 = std::min(y0 + tileSize, pixelBounds.pMax.y);
+            AABB2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+
+            for (Point2i pPixel : tileBounds) {
+                tileSampler->startPixel(pPixel);
+                tileSampler->setSampleIndex(iter);
+
+                CameraSample cameraSample = tileSampler->getCameraSample(pPixel);
+                RayDifferential ray;
+                Spectrum beta = _camera->generateRayDifferential(cameraSample, &ray);
+                if (beta.IsBlack()) {
+                    continue;
+                }
+                ray.scaleDifferentials(invSqrtSPP);
+
+                Point2i pPixelOffset = Point2i(pPixel - pixelBounds.pMin);
+                int pixelOffset = pPixelOffset.x +
+                                pPixelOffset.y * (pixelBounds.pMax.x - pixelBounds.pMin.x);
+                SPPMPixel &pixel = pixels[pixelOffset];
+                // 上一轮的可见点已经失效
+                pixel.vp.beta = 0.f;
+                bool specularBounce = false;
+
+                for (int depth = 0; depth < _maxDepth; ++depth) {
+                    SurfaceInteraction isect;
+                    if (!scene.intersect(ray, &isect)) {
+                        // 没有交点，累积环境光
+                        // 与击中面光源相同，非镜面弹射之后的环境光已经由光源采样计算过了
+                        if (depth == 0 || specularBounce) {
+                            for (const auto &light : scene.infiniteLights) {
+                                pixel.Ld += beta * light->Le(ray);
+                            }
+                        }
+                        break;
+                    }
+
+                    isect.computeScatteringFunctions(ray, arena, true);
+                    if (!isect.bsdf) {
+                        // 没有bsdf的表面只是介质的边界，直接穿过
+                        ray = isect.spawnRay(ray.dir);
+                        --depth;
+                        continue;
+                    }
+                    const BSDF &bsdf = *isect.bsdf;
+
+                    Vector3f wo = -ray.dir;
+                    if (depth == 0 || specularBounce) {
+                        pixel.Ld += beta * isect.Le(wo);
+                    }
+                    pixel.Ld += beta * sampleOneLight(isect, scene, arena,
+                                                      *tileSampler, false,
+                                                      lightDistr.get());
+
+                    // 击中漫反射表面，或者最后一次弹射时击中glossy表面，则记录可见点
+                    bool isDiffuse = bsdf.numComponents(BxDFType(BSDF_DIFFUSE |
+                                                                 BSDF_REFLECTION |
+                                                                 BSDF_TRANSMISSION)) > 0;
+                    bool isGlossy = bsdf.numComponents(BxDFType(BSDF_GLOSSY |
+                                                                BSDF_REFLECTION |
+                                                                BSDF_TRANSMISSION)) > 0;
+                    if (isDiffuse || (isGlossy && depth == _maxDepth - 1)) {
+                        pixel.vp = VisiblePoint(isect.pos, wo, &bsdf, beta);
+                        break;
+                    }
+
+                    // 否则继续追踪相机路径
+                    if (depth < _maxDepth - 1) {
+                        Float pdf;
+                        Vector3f wi;
+                        BxDFType type;
+                        Spectrum f = bsdf.sample_f(wo, &wi, tileSampler->get2D(),
+                                                   &pdf, BSDF_ALL, &type);
+                        if (pdf == 0. || f.IsBlack()) {
+                            break;
+                        }
+                        specularBounce = (type & BSDF_SPECULAR) != 0;
+                        beta *= f * absDot(wi, isect.shading.normal) / pdf;
+                        if (beta.y() < 0.25) {
+                            Float continueProb = std::min((Float)1, beta.y());
+                            if (tileSampler->get1D() > continueProb) {
+                                break;
+                            }
+                            beta /= continueProb;
+                        }
+                        ray = (RayDifferential)isect.spawnRay(wi);
+                    }
+                }
+            }
+        };
+        parallelFor2D(cameraPass, nTiles);
+        reporter.update();
+
+        // 2.建立可见点的空间哈希网格
+        // 哈希表大小取像素数量，网格尺寸与最大半径相当，
+        // 每个可见点的搜索范围在每个轴上最多跨越3个网格，
+        // 所以网格节点数量不会超过27倍像素数量
+        int hashSize = nPixels;
+        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
+
+        AABB3f gridBounds;
+        Float maxRadius = 0.;
+        for (int i = 0; i < nPixels; ++i) {
+            const SPPMPixel &pixel = pixels[i];
+            if (pixel.vp.beta.IsBlack()) {
+                continue;
+            }
+            AABB3f vpBound = expand(AABB3f(pixel.vp.pos), pixel.radius);
+            gridBounds = unionSet(gridBounds, vpBound);
+            maxRadius = std::max(maxRadius, pixel.radius);
+        }
+
+        // 网格尺寸与最大搜索半径相当，网格数量约等于像素数量
+        Vector3f diag = gridBounds.diagonal();
+        Float maxDiag = maxComponent(diag);
+        // 如果没有任何可见点，maxRadius为0，网格退化为一个格子
+        int baseGridRes = maxRadius > 0 ? std::max((int)(maxDiag / maxRadius), 1) : 1;
+        int gridRes[3];
+        for (int i = 0; i < 3; ++i) {
+            gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
+        }
+
+        // 并行地把可见点插入网格，链表头用CAS替换，无需加锁
+        auto buildGrid = [&](int64_t pixelIndex) {
+            MemoryArena &arena = perThreadArenas[ThreadIndex];
+            SPPMPixel &pixel = pixels[pixelIndex];
+            if (pixel.vp.beta.IsBlack()) {
+                return;
+            }
+            Float radius = pixel.radius;
+            Point3i pMin, pMax;
+            toGrid(pixel.vp.pos - Vector3f(radius, radius, radius),
+                   gridBounds, gridRes, &pMin);
+            toGrid(pixel.vp.pos + Vector3f(radius, radius, radius),
+                   gridBounds, gridRes, &pMax);
+            for (int z = pMin.z; z <= pMax.z; ++z) {
+                for (int y = pMin.y; y <= pMax.y; ++y) {
+                    for (int x = pMin.x; x <= pMax.x; ++x) {
+                        int h = hashGrid(Point3i(x, y, z), hashSize);
+                        SPPMPixelListNode *node = arena.alloc<SPPMPixelListNode>();
+                        node->pixel = &pixel;
+                        node->next = grid[h];
+                        // 如果其他线程抢先修改了链表头，compare_exchange_weak会把
+                        // 最新的链表头写回node->next，然后重试
+                        while (!grid[h].compare_exchange_weak(node->next, node)) {
+
+                        }
+                    }
+                }
+            }
+        };
+        parallelFor(buildGrid, nPixels, 4096);
+
+        // 3.光子pass，并行发射光子并累积到可见点上
+        auto tracePhotons = [&](int64_t photonIndex) {
+            MemoryArena &arena = photonArenas[ThreadIndex];
+            // 用halton序列生成光子路径的样本
+            // 每轮迭代的光子索引接着上一轮，保证所有光子的样本都不重复
+            uint64_t haltonIndex = (uint64_t)iter * (uint64_t)_photonsPerIteration +
+                                    photonIndex;
+            int haltonDim = 0;
+
+            Float lightPdf;
+            Float lightSample = RadicalInverse(haltonDim++, haltonIndex);
+            int lightNum = lightDistr->sampleDiscrete(lightSample, &lightPdf);
+            const std::shared_ptr<Light> &light = scene.lights[lightNum];
+
+            Point2f uLight0(RadicalInverse(haltonDim, haltonIndex),
+                            RadicalInverse(haltonDim + 1, haltonIndex));
+            Point2f uLight1(RadicalInverse(haltonDim + 2, haltonIndex),
+                            RadicalInverse(haltonDim + 3, haltonIndex));
+            Float uLightTime = lerp(RadicalInverse(haltonDim + 4, haltonIndex),
+                                    _camera->shutterOpen, _camera->shutterClose);
+            haltonDim += 5;
+
+            RayDifferential photonRay;
+            Normal3f nLight;
+            Float pdfPos, pdfDir;
+            Spectrum Le = light->sample_Le(uLight0, uLight1, uLightTime,
+                                           &photonRay, &nLight, &pdfPos, &pdfDir);
+            if (pdfPos == 0 || pdfDir == 0 || Le.IsBlack()) {
+                return;
+            }
+            // 光子初始的通量
+            Spectrum beta = (absDot(nLight, photonRay.dir) * Le) /
+                            (lightPdf * pdfPos * pdfDir);
+            if (beta.IsBlack()) {
+                return;
+            }
+
+            SurfaceInteraction isect;
+            for (int depth = 0; depth < _maxDepth; ++depth) {
+                if (!scene.intersect(photonRay, &isect)) {
+                    break;
+                }
+                // 第一次击中的表面贡献的是直接光照，已经在相机pass中计算过了
+                if (depth > 0) {
+                    Point3i photonGridIndex;
+                    if (toGrid(isect.pos, gridBounds, gridRes, &photonGridIndex)) {
+                        int h = hashGrid(photonGridIndex, hashSize);
+                        for (SPPMPixelListNode *node = grid[h].load(std::memory_order_relaxed);
+                             node != nullptr; node = node->next) {
+                            SPPMPixel &pixel = *node->pixel;
+                            Float radius = pixel.radius;
+                            if (distanceSquared(pixel.vp.pos, isect.pos) > radius * radius) {
+                                continue;
+                            }
+                            Vector3f wi = -photonRay.dir;
+                            Spectrum Phi = beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
+                            for (int i = 0; i < Spectrum::nSamples; ++i) {
+                                pixel.Phi[i].add(Phi[i]);
+                            }
+                            ++pixel.M;
+                        }
+                    }
+                }
+
+                // 光子在表面上散射，注意传输模式为Importance
+                isect.computeScatteringFunctions(photonRay, arena, true,
+                                                 TransportMode::Importance);
+                if (!isect.bsdf) {
+                    --depth;
+                    photonRay = isect.spawnRay(photonRay.dir);
+                    continue;
+                }
+                const BSDF &photonBSDF = *isect.bsdf;
+
+                Vector3f wi, wo = -photonRay.dir;
+                Float pdf;
+                BxDFType flags;
+                Point2f bsdfSample(RadicalInverse(haltonDim, haltonIndex),
+                                   RadicalInverse(haltonDim + 1, haltonIndex));
+                haltonDim += 2;
+                Spectrum fr = photonBSDF.sample_f(wo, &wi, bsdfSample, &pdf,
+                                                  BSDF_ALL, &flags);
+                if (fr.IsBlack() || pdf == 0.f) {
+                    break;
+                }
+                Spectrum bnew = beta * fr * absDot(wi, isect.shading.normal) / pdf;
+
+                // 俄罗斯轮盘，保持光子的通量大致不变
+                Float q = std::max((Float)0, 1 - bnew.y() / beta.y());
+                if (RadicalInverse(haltonDim++, haltonIndex) < q) {
+                    break;
+                }
+                beta = bnew / (1 - q);
+                photonRay = (RayDifferential)isect.spawnRay(wi);
+                // 超过素数表的维度之后就不能继续用radical inverse了
+                if (haltonDim + 3 >= PrimeTableSize) {
+                    break;
+                }
+            }
+            arena.reset();
+        };
+        parallelFor(tracePhotons, _photonsPerIteration, 8192);
+
+        // 4.更新像素的统计量，缩小搜索半径
+        auto updatePixels = [&](int64_t i) {
+            SPPMPixel &p = pixels[i];
+            int M = p.M.load();
+            if (M > 0) {
+                Float N_new = p.N + _alpha * M;
+                Float R_new = p.radius * std::sqrt(N_new / (p.N + M));
+                Spectrum Phi;
+                for (int j = 0; j < Spectrum::nSamples; ++j) {
+                    Phi[j] = p.Phi[j];
+                    p.Phi[j] = (Float)0;
+                }
+                p.tau = (p.tau + p.vp.beta * Phi) * (R_new * R_new) /
+                        (p.radius * p.radius);
+                p.N = N_new;
+                p.radius = R_new;
+                p.M = 0;
+            }
+            // 可见点的bsdf分配在内存池中，下一轮迭代之前全部失效
+            p.vp.beta = 0.;
+            p.vp.bsdf = nullptr;
+        };
+        parallelFor(updatePixels, nPixels, 4096);
+
+        for (size_t i = 0; i < perThreadArenas.size(); ++i) {
+            perThreadArenas[i].reset();
+        }
+        reporter.update();
+
+        // 5.周期性地输出图像
+        if (iter + 1 == _nIterations ||
+            (_writeFrequency > 0 && (iter + 1) % _writeFrequency == 0)) {
+            int x0 = pixelBounds.pMin.x;
+            int x1 = pixelBounds.pMax.x;
+            uint64_t Np = (uint64_t)(iter + 1) * (uint64_t)_photonsPerIteration;
+            std::unique_ptr<Spectrum[]> image(new Spectrum[nPixels]);
+            int offset = 0;
+            for (int y = pixelBounds.pMin.y; y < pixelBounds.pMax.y; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    const SPPMPixel &pixel =
+                    pixels[(y - pixelBounds.pMin.y) * (x1 - x0) + (x - x0)];
+                    // 直接光照与间接光照两部分
+                    Spectrum L = pixel.Ld / (iter + 1);
+                    L += pixel.tau / (Np * Pi * pixel.radius * pixel.radius);
+                    image[offset++] = L;
+                }
+            }
+            film->setImage(image.get());
+            film->writeImage();
+        }
+    }
+    reporter.done();
+}
+
+//"param" : {
+//    "iterations" : 64,
+//    "photonsPerIteration" : -1,
+//    "maxBounce" : 5,
+//    "radius" : 1,
+//    "writeFrequency" : 0,
+//    "alpha" : 0.666667
+//}
+// photonsPerIteration小于等于0时，取像素数量
+// writeFrequency为0时只在最后一轮迭代输出图像
+// lst = {sampler, camera}，sampler被忽略
+CObject_ptr createPhotonMapper(const nloJson &param, const Arguments &lst) {
+    int nIterations = param.value("iterations", 64);
+    int photonsPerIter = param.value("photonsPerIteration", -1);
+    int maxDepth = param.value("maxBounce", 5);
+    Float radius = param.value("radius", 1.f);
+    int writeFreq = param.value("writeFrequency", 0);
+    Float alpha = param.value("alpha", 2.f / 3.f);
+    auto iter = lst.begin();
+    // 相机pass每轮迭代都需要同一个像素的不同样本，所以内部自行创建halton采样器
+    // 场景中配置的采样器不会被使用，所有权在这里，直接释放
+    delete *iter;
+    ++iter;
+    Camera * camera = dynamic_cast<Camera *>(*iter);
+    return new PhotonMapper(shared_ptr<const Camera>(camera), nIterations,
+                            photonsPerIter, maxDepth, radius, writeFreq, alpha);
+}
+
+REGISTER("sppm", createPhotonMapper);
+
+PALADIN_END
@@ -9,18 +9,96 @@
 #define pm_hpp
 
 #include "core/integrator.hpp"
+#include "core/camera.hpp"
+#include "tools/parallel.hpp"
 
 PALADIN_BEGIN
 
-class PhotonMapper : Integrator {
-    
+/**
+ * 随机渐进式光子映射(stochastic progressive photon mapping)
+ *
+ * 路径追踪在处理 光源->镜面->漫反射->镜面->相机 这类路径(也就是常说的SDS路径)时几乎无能为力
+ * 例如透过玻璃看到的焦散，相机路径打到漫反射表面之后，
+ * 需要随机采样一个方向刚好经过玻璃折射之后击中一个很小的光源，概率接近于0
+ * 双向方法也解决不了，因为镜面顶点无法连接
+ *
+ * 光子映射的思路是从光源发射光子，光子在场景中弹射，每次击中非镜面表面时将能量沉积下来，
+ * 然后在相机路径的可见点(visible point)处，对半径r范围内的光子做密度估计
+ *
+ *            1       Nj
+ * L(p,ωo) ≈ ---  *   ∑  f(p,ωo,ωj) * βj
+ *          N*πr^2   j=1
+ *
+ * 传统光子映射需要把所有光子存起来，内存跟光子数成正比，而且结果是有偏不一致的
+ * 渐进式光子映射(PPM)反过来，先存相机可见点，然后一轮一轮地发射光子，
+ * 每一轮光子只在可见点上累积，累积完就扔掉，内存与光子数无关
+ * 并且每一轮迭代之后缩小可见点的搜索半径，使得估计值收敛到正确结果(一致)
+ *
+ * 随机渐进式光子映射(SPPM)在PPM的基础上，每一轮迭代都重新生成相机路径(可见点)，
+ * 这样就可以正确处理景深，运动模糊，glossy表面等需要在像素内积分的情况
+ *
+ * 每轮迭代分为三个步骤
+ *     1.相机pass：每个像素生成一条相机路径，直到击中第一个非镜面表面，记录可见点
+ *       顺便用路径追踪的方式估计直接光照Ld(直接光照用光子估计的话噪点很大)
+ *     2.建立网格：把所有可见点按照搜索半径放入空间哈希网格中
+ *     3.光子pass：并行发射光子，光子每次击中表面，查找所在网格中的可见点，
+ *       如果在可见点的半径内，则把光子通量(flux)用原子操作累积到可见点上
+ *     4.更新统计量：根据本轮光子数M更新半径与累积通量tau
+ *
+ * 关于半径的更新，详见pbrt第16.2节，假设上一轮累积光子数为N，本轮新增光子数为M
+ * 我们只保留 γM 个光子(γ ∈ (0,1)，通常取2/3)
+ *
+ *     N' = N + γM
+ *     r' = r * sqrt(N' / (N + M))
+ *     τ' = (τ + Φ) * r'^2 / r^2
+ *
+ * 如此一来，半径单调递减，光子数单调递增，估计值的偏差与方差同时趋于0
+ */
+class PhotonMapper : public Integrator {
+
 public:
-    
-    
+
+    PhotonMapper(std::shared_ptr<const Camera> camera, int nIterations,
+                 int photonsPerIteration, int maxDepth,
+                 Float initialSearchRadius, int writeFrequency,
+                 Float alpha = 2.f / 3.f)
+    : _camera(camera),
+    _initialSearchRadius(initialSearchRadius),
+    _nIterations(nIterations),
+    _maxDepth(maxDepth),
+    _photonsPerIteration(photonsPerIteration > 0 ?
+                         photonsPerIteration :
+                         camera->film->croppedPixelBounds.area()),
+    _writeFrequency(writeFrequency),
+    _alpha(alpha) {
+
+    }
+
+    virtual void render(const Scene &scene) override;
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
 private:
-    
+
+    std::shared_ptr<const Camera> _camera;
+    // 初始搜索半径，之后每轮迭代都会缩小
+    const Float _initialSearchRadius;
+    // 迭代次数
+    const int _nIterations;
+    // 相机路径与光子路径的最大深度
+    const int _maxDepth;
+    // 每轮迭代发射的光子数量，光子用完即丢弃，所以内存与光子总数无关
+    const int _photonsPerIteration;
+    // 每隔多少轮迭代输出一次图像
+    const int _writeFrequency;
+    // 每轮迭代保留的光子比例，也就是上面注释中的γ
+    const Float _alpha;
 };
 
+CObject_ptr createPhotonMapper(const nloJson &param, const Arguments &lst);
+
 PALADIN_END
 
 #endif /* pm_hpp */
@@ -0,0 +1,909 @@
+//
+//  vcm.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/2/23.
+//
+
+#include "vcm.hpp"
+#include "core/scene.hpp"
+#include "core/light.hpp"
+#include "core/medium.hpp"
+#include "core/film.hpp"
+#include "math/lightdistribute.hpp"
+#include "samplers/random.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+#include "tools/progressreporter.hpp"
+#include "tools/parallel.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * 子路径上的散射点，表面顶点与介质顶点统一处理
+ * 介质顶点没有法线，所有余弦项都记为1，bsdf换成相函数
+ */
+struct ScatterPoint {
+
+    ScatterPoint() = default;
+
+    explicit ScatterPoint(const SurfaceInteraction &isect)
+    : bsdf(isect.bsdf),
+    ng(isect.normal),
+    ns(isect.shading.normal),
+    wo(isect.wo) {
+
+    }
+
+    explicit ScatterPoint(const MediumInteraction &mi)
+    : phase(mi.phase),
+    wo(mi.wo) {
+
+    }
+
+    bool isOnSurface() const {
+        return bsdf != nullptr;
+    }
+
+    // 包含非镜面分量的顶点才可以连接或合并
+    bool isConnectible() const {
+        return phase != nullptr ||
+               bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0;
+    }
+
+    // 立体角pdf与面积pdf转换时用到的余弦，取几何法线
+    Float cosGeometric(const Vector3f &w) const {
+        return bsdf ? absDot(ng, w) : 1;
+    }
+
+    /**
+     * 返回 f(wo, wi) * |ns · wi|，importance模式下包含着色法线的校正因子
+     * 推导见bidir/func.hpp中的correctShadingNormal
+     * pdfFwd为从wo采样到wi的立体角pdf，pdfRev为从wi采样到wo的立体角pdf
+     */
+    Spectrum eval(const Vector3f &wi, TransportMode mode,
+                  Float *pdfFwd, Float *pdfRev) const {
+        if (phase) {
+            Float p = phase->p(wo, wi);
+            *pdfFwd = *pdfRev = p;
+            return Spectrum(p);
+        }
+        *pdfFwd = bsdf->pdfDir(wo, wi);
+        *pdfRev = bsdf->pdfDir(wi, wo);
+        return bsdf->f(wo, wi) * absDot(ns, wi) * shadingCorrection(wi, mode);
+    }
+
+    Float shadingCorrection(const Vector3f &wi, TransportMode mode) const {
+        if (mode == TransportMode::Radiance) {
+            return 1;
+        }
+        Float num = absDot(wo, ns) * absDot(wi, ng);
+        Float denom = absDot(wo, ng) * absDot(wi, ns);
+        return denom == 0 ? 0 : num / denom;
+    }
+
+    const BSDF *bsdf = nullptr;
+    const PhaseFunction *phase = nullptr;
+    Normal3f ng;
+    Normal3f ns;
+    Vector3f wo;
+};
+
+/**
+ * 光源子路径上储存的顶点
+ * 只保留连接与合并需要的数据，bsdf分配在光源子路径所在线程的内存池中
+ * 光源本身以及纯镜面的顶点不储存
+ */
+struct LightVertex {
+    Point3f pos;
+    Vector3f pError;
+    ScatterPoint point;
+    Spectrum throughput;
+    // 递推的MIS量，定义见SubpathState
+    Float dVCM, dVC, dVM;
+    // 从光源到该顶点的边数
+    int pathLength;
+};
+
+/**
+ * 子路径的追踪状态，光源子路径与相机子路径共用
+ *
+ * dVCM，dVC，dVM是Georgiev等人在VCM技术报告中定义的递推量，
+ * 当前顶点的MIS权重只需要这三个值以及当前顶点的pdf就可以算出，
+ * 不需要像双向路径追踪一样回溯整条子路径
+ * 这里使用balance heuristic
+ */
+struct SubpathState {
+    RayDifferential ray;
+    Spectrum throughput;
+    Float dVCM = 0;
+    Float dVC = 0;
+    Float dVM = 0;
+    // 子路径的边数
+    int pathLength = 1;
+    // 上一个散射点，子路径起点为光源或相机上的点
+    Point3f prevPos;
+    // 环境光与方向光的起点在无穷远处，第一条边不需要乘以距离的平方
+    bool finiteOrigin = true;
+    // 折射导致的radiance缩放，只用于俄罗斯轮盘赌
+    Float etaScale = 1;
+
+    /**
+     * 到达新的散射点时，把上一个顶点的立体角pdf转换为面积pdf
+     * cosIn为入射方向与几何法线夹角的余弦，为0时路径无法继续
+     */
+    bool arrive(const Point3f &p, Float cosIn) {
+        if (cosIn == 0) {
+            return false;
+        }
+        if (pathLength > 1 || finiteOrigin) {
+            dVCM *= distanceSquared(prevPos, p);
+        }
+        dVCM /= cosIn;
+        dVC /= cosIn;
+        dVM /= cosIn;
+        prevPos = p;
+        return true;
+    }
+};
+
+/**
+ * 每轮迭代不变的数据，供光源子路径与相机子路径的各个函数共享
+ */
+struct VCMContext {
+    const Scene *scene;
+    const Camera *camera;
+    const Distribution1D *lightDistr;
+    const std::unordered_map<const Light *, size_t> *lightToIndex;
+    // 路径的最大边数
+    int maxPathLength;
+    Float rrThreshold;
+    // 合并策略与连接策略的pdf之比 η_VCM = N * πr^2，N为光源子路径数量
+    Float misVmWeightFactor;
+    // 1 / η_VCM
+    Float misVcWeightFactor;
+    // 合并的核函数 1 / (N * πr^2)
+    Float vmNormalization;
+};
+
+/**
+ * 光源顶点的空间哈希网格
+ *
+ * 网格尺寸为合并直径，所以任意一个半径为r的球在每个轴上通常只跨两个网格，
+ * 浮点舍入时最多跨三个，查询时最多访问3x3x3个网格
+ * 建立网格使用计数排序:
+ *     1.并行统计每个哈希桶中的顶点数量(原子加法)
+ *     2.前缀和得到每个桶的起始位置
+ *     3.并行地把顶点写入对应桶中(原子加法获取写入位置)
+ * 整个过程没有锁，建立完成之后网格只读，并行查询不需要任何同步
+ * 每个桶的顶点在内存上是连续的，对缓存也比链表友好
+ */
+class LightVertexGrid {
+
+public:
+
+    /**
+     * 网格中储存的光源顶点引用
+     * 位置单独存一份，查询时只需要访问这块连续的内存做距离判断
+     */
+    struct Entry {
+        Point3f pos;
+        const LightVertex *vertex;
+    };
+
+    /**
+     * 只有表面顶点参与合并，介质中的顶点只做连接
+     * buffers为各个线程储存光源顶点的数组
+     */
+    void build(const std::vector<std::vector<LightVertex>> &buffers,
+               int hashSize, Float radius) {
+        _radius = radius;
+        _invCellSize = 1.f / (2.f * radius);
+        _hashSize = std::max(hashSize, 1);
+        std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[_hashSize]);
+        for (int i = 0; i < _hashSize; ++i) {
+            counts[i] = 0;
+        }
+
+        int nBuffers = (int)buffers.size();
+        parallelFor([&](int64_t b) {
+            for (const LightVertex &v : buffers[b]) {
+                if (v.point.isOnSurface()) {
+                    ++counts[hashIndex(v.pos)];
+                }
+            }
+        }, nBuffers, 1);
+
+        // 前缀和，_cellStarts[h]为第h个桶在_entries中的起始位置
+        _cellStarts.resize(_hashSize + 1);
+        _cellStarts[0] = 0;
+        for (int i = 0; i < _hashSize; ++i) {
+            _cellStarts[i + 1] = _cellStarts[i] + counts[i];
+            counts[i] = _cellStarts[i];
+        }
+        _entries.resize(_cellStarts[_hashSize]);
+
+        parallelFor([&](int64_t b) {
+            for (const LightVertex &v : buffers[b]) {
+                if (v.point.isOnSurface()) {
+                    int idx = counts[hashIndex(v.pos)].fetch_add(1);
+                    _entries[idx] = {v.pos, &v};
+                }
+            }
+        }, nBuffers, 1);
+    }
+
+
+    /**
+     * 遍历与p距离小于半径的所有光源顶点
+     */
+    template <typename Func>
+    void lookup(const Point3f &p, Func func) const {
+        Point3i pMin = toCell(p - Vector3f(_radius, _radius, _radius));
+        Point3i pMax = toCell(p + Vector3f(_radius, _radius, _radius));
+        Float radius2 = _radius * _radius;
+        // 不同的网格可能哈希到同一个桶中，记录已经访问过的桶，避免重复计算
+        // 网格边长为2r，每个轴通常只跨两个网格，
+        // 但是浮点舍入可能使p±r落在三个网格中，所以按3x3x3分配
+        int visited[27];
+        int nVisited = 0;
+        for (int z = pMin.z; z <= pMax.z; ++z) {
+            for (int y = pMin.y; y <= pMax.y; ++y) {
+                for (int x = pMin.x; x <= pMax.x; ++x) {
+                    int h = hashCell(Point3i(x, y, z));
+                    if (std::find(visited, visited + nVisited, h) != visited + nVisited) {
+                        continue;
+                    }
+                    DCHECK_LT(nVisited, 27);
+                    visited[nVisited++] = h;
+                    for (int i = _cellStarts[h]; i < _cellStarts[h + 1]; ++i) {
+                        const Entry &entry = _entries[i];
+                        if (distanceSquared(entry.pos, p) < radius2) {
+                            func(*entry.vertex);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+
+    Point3i toCell(const Point3f &p) const {
+        return Point3i((int)std::floor(p.x * _invCellSize),
+                       (int)std::floor(p.y * _invCellSize),
+                       (int)std::floor(p.z * _invCellSize));
+    }
+
+    int hashCell(const Point3i &c) const {
+        return (int)((unsigned int)((c.x * 73856093) ^ (c.y * 19349663) ^
+                                    (c.z * 83492791)) % (unsigned int)_hashSize);
+    }
+
+    int hashIndex(const Point3f &p) const {
+        return hashCell(toCell(p));
+    }
+
+    Float _radius;
+
+    Float _invCellSize;
+
+    int _hashSize;
+
+    std::vector<int> _cellStarts;
+
+    std::vector<Entry> _entries;
+};
+
+static bool isFiniteLight(const Light &light) {
+    return !(light.flags & ((int)LightFlags::Infinite | (int)LightFlags::DeltaDirection));
+}
+
+/**
+ * 由光源发射pdf计算VCM需要的两个pdf，都包含选择光源的概率
+ * directPdf为直接采样光源的pdf，有限远光源为面积pdf，无穷远光源为立体角pdf
+ * emissionPdf为光源发射光线的pdf，即位置pdf乘以方向pdf
+ * delta分布的部分记为1
+ */
+static void lightPdfs(const Light &light, Float pickPdf, Float pdfPos, Float pdfDir,
+                      Float *directPdf, Float *emissionPdf) {
+    if (light.flags & (int)LightFlags::DeltaPosition) {
+        pdfPos = 1;
+    }
+    if (light.flags & (int)LightFlags::DeltaDirection) {
+        pdfDir = 1;
+    }
+    *emissionPdf = pickPdf * pdfPos * pdfDir;
+    *directPdf = pickPdf * (isFiniteLight(light) ? pdfPos : pdfDir);
+}
+
+static Float lightPickPdf(const VCMContext &ctx, const Light *light) {
+    auto iter = ctx.lightToIndex->find(light);
+    CHECK(iter != ctx.lightToIndex->end());
+    return ctx.lightDistr->discretePDF((int)iter->second);
+}
+
+/**
+ * 在散射点处采样下一个方向，并更新子路径的MIS量与throughput
+ * 镜面反射时立体角pdf为delta分布，与合并无关，只保留余弦项
+ */
+static bool sampleScattering(const VCMContext &ctx, const ScatterPoint &point,
+                             Sampler &sampler, TransportMode mode,
+                             SubpathState *state, Vector3f *wi) {
+    Spectrum f;
+    Float pdfFwd, pdfRev, cosOut;
+    bool specular = false;
+    if (point.isOnSurface()) {
+        BxDFType type;
+        f = point.bsdf->sample_f(point.wo, wi, sampler.get2D(), &pdfFwd, BSDF_ALL, &type);
+        if (f.IsBlack() || pdfFwd == 0) {
+            return false;
+        }
+        specular = (type & BSDF_SPECULAR) != 0;
+        pdfRev = specular ? pdfFwd : point.bsdf->pdfDir(*wi, point.wo);
+        if (specular && (type & BSDF_TRANSMISSION)) {
+            Float eta = point.bsdf->eta;
+            bool entering = mode == TransportMode::Radiance ?
+                            dot(point.wo, point.ng) > 0 : dot(point.wo, point.ng) < 0;
+            state->etaScale *= entering ? (eta * eta) : 1 / (eta * eta);
+        }
+        f *= absDot(*wi, point.ns) * point.shadingCorrection(*wi, mode);
+        cosOut = point.cosGeometric(*wi);
+    } else {
+        pdfFwd = pdfRev = point.phase->sample_p(point.wo, wi, sampler.get2D());
+        f = Spectrum(pdfFwd);
+        cosOut = 1;
+    }
+
+    if (specular) {
+        state->dVCM = 0;
+        state->dVC *= cosOut;
+        state->dVM *= cosOut;
+    } else {
+        Float mergeable = point.isOnSurface() ? 1 : 0;
+        state->dVC = cosOut / pdfFwd * (state->dVC * pdfRev + state->dVCM +
+                                        mergeable * ctx.misVmWeightFactor);
+        state->dVM = cosOut / pdfFwd * (state->dVM * pdfRev +
+                                        state->dVCM * ctx.misVcWeightFactor + mergeable);
+        state->dVCM = 1 / pdfFwd;
+    }
+    state->throughput *= f / pdfFwd;
+
+    Spectrum rrThroughput = state->throughput * state->etaScale;
+    if (state->pathLength >= 2 && rrThroughput.MaxComponentValue() < ctx.rrThreshold) {
+        Float q = std::max((Float).05, 1 - rrThroughput.MaxComponentValue());
+        if (sampler.get1D() < q) {
+            return false;
+        }
+        state->throughput /= 1 - q;
+    }
+    return !state->throughput.IsBlack();
+}
+
+/**
+ * 光源顶点与相机直接相连(光线追踪策略)，结果写入film的splat中
+ */
+static void connectToCamera(const VCMContext &ctx, const SubpathState &state,
+                            const Interaction &it, const ScatterPoint &point,
+                            Sampler &sampler) {
+    Vector3f wi;
+    Float pdfWi;
+    Point2f pRaster;
+    VisibilityTester vis;
+    Spectrum We = ctx.camera->sample_Wi(it, sampler.get2D(), &wi, &pdfWi, &pRaster, &vis);
+    if (pdfWi == 0 || We.IsBlack()) {
+        return;
+    }
+    Float pdfFwd, pdfRev;
+    Spectrum f = point.eval(wi, TransportMode::Importance, &pdfFwd, &pdfRev);
+    if (f.IsBlack()) {
+        return;
+    }
+    // pdf_We返回的方向pdf是对整个胶片而言的，
+    // 每个像素一条光源子路径，恰好抵消了N/p_pixel中的N
+    Float pdfPos, pdfDir;
+    const Point3f &pLens = vis.P0().pos;
+    ctx.camera->pdf_We(Ray(pLens, -wi, Infinity, it.time), &pdfPos, &pdfDir);
+    Float cameraPdfA = pdfDir * point.cosGeometric(wi) / distanceSquared(pLens, it.pos);
+    Float wLight = cameraPdfA * (ctx.misVmWeightFactor + state.dVCM + state.dVC * pdfRev);
+
+    Spectrum L = state.throughput * f * We / (pdfWi * (1 + wLight));
+    if (L.IsBlack()) {
+        return;
+    }
+    L *= vis.Tr(*ctx.scene, sampler);
+    ctx.camera->film->addSplat(pRaster, L);
+}
+
+/**
+ * 生成一条光源子路径，可以连接的顶点追加到vertices中
+ * 每个顶点同时与相机相连
+ */
+static void traceLightPath(const VCMContext &ctx, Sampler &sampler, MemoryArena &arena,
+                           Float time, std::vector<LightVertex> *vertices) {
+    Float pickPdf;
+    int lightNum = ctx.lightDistr->sampleDiscrete(sampler.get1D(), &pickPdf);
+    const Light &light = *ctx.scene->lights[lightNum];
+    Ray lightRay;
+    Normal3f nLight;
+    Float pdfPos, pdfDir;
+    Spectrum Le = light.sample_Le(sampler.get2D(), sampler.get2D(), time,
+                                  &lightRay, &nLight, &pdfPos, &pdfDir);
+    if (pdfPos == 0 || pdfDir == 0 || Le.IsBlack()) {
+        return;
+    }
+    Float directPdf, emissionPdf;
+    lightPdfs(light, pickPdf, pdfPos, pdfDir, &directPdf, &emissionPdf);
+    Float cosLight = absDot(nLight, lightRay.dir);
+
+    SubpathState state;
+    state.ray = RayDifferential(lightRay);
+    state.throughput = Le * cosLight / (pickPdf * pdfPos * pdfDir);
+    state.dVCM = directPdf / emissionPdf;
+    state.dVC = light.isDelta() ? 0 : cosLight / emissionPdf;
+    state.dVM = state.dVC * ctx.misVcWeightFactor;
+    state.prevPos = lightRay.ori;
+    state.finiteOrigin = isFiniteLight(light);
+
+    while (true) {
+        SurfaceInteraction isect;
+        MediumInteraction mi;
+        bool foundIntersection = ctx.scene->intersect(state.ray, &isect);
+        if (state.ray.medium) {
+            state.throughput *= state.ray.medium->sample(state.ray, sampler, arena, &mi);
+        }
+        if (state.throughput.IsBlack()) {
+            break;
+        }
+        ScatterPoint point;
+        const Interaction *it;
+        if (mi.isValid()) {
+            point = ScatterPoint(mi);
+            it = &mi;
+        } else {
+            if (!foundIntersection) {
+                break;
+            }
+            isect.computeScatteringFunctions(state.ray, arena, true,
+                                             TransportMode::Importance);
+            if (isect.bsdf == nullptr) {
+                state.ray = isect.spawnRay(state.ray.dir);
+                continue;
+            }
+            point = ScatterPoint(isect);
+            it = &isect;
+        }
+        if (!state.arrive(it->pos, point.cosGeometric(point.wo))) {
+            break;
+        }
+
+        if (point.isConnectible()) {
+            LightVertex vertex;
+            vertex.pos = it->pos;
+            vertex.pError = it->pError;
+            vertex.point = point;
+            vertex.throughput = state.throughput;
+            vertex.dVCM = state.dVCM;
+            vertex.dVC = state.dVC;
+            vertex.dVM = state.dVM;
+            vertex.pathLength = state.pathLength;
+            vertices->push_back(vertex);
+
+            if (state.pathLength + 1 <= ctx.maxPathLength) {
+                connectToCamera(ctx, state, *it, point, sampler);
+            }
+        }
+
+        // 光源顶点至少还要与相机子路径的一条边组成完整路径
+        if (state.pathLength + 2 > ctx.maxPathLength) {
+            break;
+        }
+        Vector3f wi;
+        if (!sampleScattering(ctx, point, sampler, TransportMode::Importance, &state, &wi)) {
+            break;
+        }
+        state.ray = it->spawnRay(wi);
+        ++state.pathLength;
+    }
+}
+
+/**
+ * 相机子路径击中面光源，或者逃逸到环境光中
+ * 这个策略只有一种"光源端"的替代策略需要比较:光源采样与光源发射
+ */
+static Float emissionWeight(const SubpathState &state, Float directPdf, Float emissionPdf) {
+    if (state.pathLength == 1) {
+        return 1;
+    }
+    Float wCamera = directPdf * state.dVCM + emissionPdf * state.dVC;
+    return 1 / (1 + wCamera);
+}
+
+static Spectrum hitAreaLight(const VCMContext &ctx, const SubpathState &state,
+                             const SurfaceInteraction &isect) {
+    Spectrum Le = isect.Le(isect.wo);
+    if (Le.IsBlack()) {
+        return Spectrum(0.f);
+    }
+    const AreaLight *light = isect.primitive->getAreaLight();
+    Float pdfPos, pdfDir, directPdf, emissionPdf;
+    light->pdf_Le(Ray(isect.pos, isect.wo, Infinity, isect.time), isect.normal,
+                  &pdfPos, &pdfDir);
+    lightPdfs(*light, lightPickPdf(ctx, light), pdfPos, pdfDir, &directPdf, &emissionPdf);
+    return Le * emissionWeight(state, directPdf, emissionPdf);
+}
+
+static Spectrum hitBackground(const VCMContext &ctx, const SubpathState &state) {
+    Spectrum L(0.f);
+    const RayDifferential &ray = state.ray;
+    for (const auto &light : ctx.scene->infiniteLights) {
+        Spectrum Le = light->Le(ray);
+        if (Le.IsBlack()) {
+            continue;
+        }
+        Float pdfPos, pdfDir, directPdf, emissionPdf;
+        light->pdf_Le(Ray(ray.ori, -ray.dir, Infinity, ray.time), Normal3f(ray.dir),
+                      &pdfPos, &pdfDir);
+        lightPdfs(*light, lightPickPdf(ctx, light.get()), pdfPos, pdfDir,
+                  &directPdf, &emissionPdf);
+        L += Le * emissionWeight(state, directPdf, emissionPdf);
+    }
+    return L;
+}
+
+/**
+ * 直接采样光源(s = 1的连接策略)
+ */
+static Spectrum directLighting(const VCMContext &ctx, const SubpathState &state,
+                               const Interaction &it, const ScatterPoint &point,
+                               Sampler &sampler) {
+    Float pickPdf;
+    int lightNum = ctx.lightDistr->sampleDiscrete(sampler.get1D(), &pickPdf);
+    const Light &light = *ctx.scene->lights[lightNum];
+    Vector3f wi;
+    Float pdfLi;
+    VisibilityTester vis;
+    Spectrum Li = light.sample_Li(it, sampler.get2D(), &wi, &pdfLi, &vis);
+    if (pdfLi == 0 || Li.IsBlack()) {
+        return Spectrum(0.f);
+    }
+    Float bsdfPdfFwd, bsdfPdfRev;
+    Spectrum f = point.eval(wi, TransportMode::Radiance, &bsdfPdfFwd, &bsdfPdfRev);
+    if (f.IsBlack()) {
+        return Spectrum(0.f);
+    }
+
+    const Interaction &pLight = vis.P1();
+    Float pdfPos, pdfDir, directPdf, emissionPdf;
+    light.pdf_Le(Ray(pLight.pos, -wi, Infinity, it.time), pLight.normal, &pdfPos, &pdfDir);
+    lightPdfs(light, pickPdf, pdfPos, pdfDir, &directPdf, &emissionPdf);
+    // 与发射pdf保持一致，MIS中直接采样的pdf取面积pdf换算得到的立体角pdf
+    Float cosAtLight = 1;
+    Float directPdfW = directPdf;
+    if (isFiniteLight(light)) {
+        if (light.flags & (int)LightFlags::Area) {
+            cosAtLight = absDot(pLight.normal, wi);
+        }
+        if (cosAtLight == 0) {
+            return Spectrum(0.f);
+        }
+        directPdfW *= distanceSquared(pLight.pos, it.pos) / cosAtLight;
+    }
+    Float wLight = light.isDelta() ? 0 : bsdfPdfFwd / directPdfW;
+    Float wCamera = emissionPdf * point.cosGeometric(wi) / (directPdfW * cosAtLight) *
+                    (ctx.misVmWeightFactor + state.dVCM + state.dVC * bsdfPdfRev);
+
+    Spectrum L = Li * f / (pickPdf * pdfLi * (wLight + 1 + wCamera));
+    if (L.IsBlack()) {
+        return L;
+    }
+    return L * vis.Tr(*ctx.scene, sampler);
+}
+
+/**
+ * 相机顶点与光源顶点相连
+ */
+static Spectrum connectVertices(const VCMContext &ctx, const SubpathState &state,
+                                const Interaction &it, const ScatterPoint &point,
+                                const LightVertex &lv, Sampler &sampler) {
+    Vector3f d = lv.pos - it.pos;
+    Float dist2 = d.lengthSquared();
+    if (dist2 == 0) {
+        return Spectrum(0.f);
+    }
+    d /= std::sqrt(dist2);
+    Float cameraPdfFwd, cameraPdfRev;
+    Spectrum cameraF = point.eval(d, TransportMode::Radiance, &cameraPdfFwd, &cameraPdfRev);
+    if (cameraF.IsBlack()) {
+        return Spectrum(0.f);
+    }
+    Float lightPdfFwd, lightPdfRev;
+    Spectrum lightF = lv.point.eval(-d, TransportMode::Importance, &lightPdfFwd, &lightPdfRev);
+    if (lightF.IsBlack()) {
+        return Spectrum(0.f);
+    }
+
+    // 把各自延伸到对方顶点的立体角pdf转换为面积pdf
+    Float cameraPdfA = cameraPdfFwd * lv.point.cosGeometric(d) / dist2;
+    Float lightPdfA = lightPdfFwd * point.cosGeometric(d) / dist2;
+    Float wLight = cameraPdfA * (ctx.misVmWeightFactor + lv.dVCM + lv.dVC * lightPdfRev);
+    Float wCamera = lightPdfA * (ctx.misVmWeightFactor + state.dVCM + state.dVC * cameraPdfRev);
+
+    Spectrum L = cameraF * lightF * lv.throughput / (dist2 * (wLight + 1 + wCamera));
+    if (L.IsBlack()) {
+        return L;
+    }
+    Interaction lightIntr(lv.pos, lv.point.ng, lv.pError, lv.point.wo,
+                          it.time, MediumInterface());
+    VisibilityTester vis(it, lightIntr);
+    return L * vis.Tr(*ctx.scene, sampler);
+}
+
+/**
+ * 在相机顶点处合并半径内的所有光源顶点，返回值还需要乘以核函数
+ * 光源顶点的入射方向作为相机顶点的入射方向，光子的throughput已经包含了入射余弦
+ */
+static Spectrum mergeVertices(const VCMContext &ctx, const SubpathState &state,
+                              const Interaction &it, const ScatterPoint &point,
+                              const LightVertexGrid &grid) {
+    Spectrum L(0.f);
+    grid.lookup(it.pos, [&](const LightVertex &lv) {
+        if (lv.pathLength + state.pathLength > ctx.maxPathLength) {
+            return;
+        }
+        Float cameraPdfFwd = point.bsdf->pdfDir(point.wo, lv.point.wo);
+        Float cameraPdfRev = point.bsdf->pdfDir(lv.point.wo, point.wo);
+        Spectrum f = point.bsdf->f(point.wo, lv.point.wo);
+        if (f.IsBlack()) {
+            return;
+        }
+        Float wLight = lv.dVCM * ctx.misVcWeightFactor + lv.dVM * cameraPdfFwd;
+        Float wCamera = state.dVCM * ctx.misVcWeightFactor + state.dVM * cameraPdfRev;
+        L += f * lv.throughput / (wLight + 1 + wCamera);
+    });
+    return L;
+}
+
+/**
+ * 生成一条相机子路径，在每个顶点处计算所有连接与合并策略
+ * lightPath为与当前像素对应的光源子路径
+ */
+static Spectrum traceCameraPath(const VCMContext &ctx, Sampler &sampler,
+                                MemoryArena &arena, const Point2f &pFilm,
+                                const LightVertex *lightPath, int nLightVertices,
+                                const LightVertexGrid &grid) {
+    CameraSample cameraSample;
+    cameraSample.pFilm = pFilm;
+    cameraSample.time = sampler.get1D();
+    cameraSample.pLens = sampler.get2D();
+
+    SubpathState state;
+    Float cameraWeight = ctx.camera->generateRayDifferential(cameraSample, &state.ray);
+    state.ray.scaleDifferentials(1 / std::sqrt((Float)sampler.samplesPerPixel));
+    Float pdfPos, pdfDir;
+    ctx.camera->pdf_We(state.ray, &pdfPos, &pdfDir);
+    if (cameraWeight == 0 || pdfDir == 0) {
+        return Spectrum(0.f);
+    }
+    state.throughput = Spectrum(cameraWeight);
+    // pdf_We的方向pdf针对整个胶片，N / p_pixel = 1 / p_film
+    state.dVCM = 1 / pdfDir;
+    state.prevPos = state.ray.ori;
+
+    Spectrum L(0.f);
+    while (true) {
+        SurfaceInteraction isect;
+        MediumInteraction mi;
+        bool foundIntersection = ctx.scene->intersect(state.ray, &isect);
+        if (state.ray.medium) {
+            state.throughput *= state.ray.medium->sample(state.ray, sampler, arena, &mi);
+        }
+        if (state.throughput.IsBlack()) {
+            break;
+        }
+        ScatterPoint point;
+        const Interaction *it;
+        if (mi.isValid()) {
+            point = ScatterPoint(mi);
+            it = &mi;
+        } else {
+            if (!foundIntersection) {
+                L += state.throughput * hitBackground(ctx, state);
+                break;
+            }
+            isect.computeScatteringFunctions(state.ray, arena, true,
+                                             TransportMode::Radiance);
+            if (isect.bsdf == nullptr) {
+                state.ray = isect.spawnRay(state.ray.dir);
+                continue;
+            }
+            point = ScatterPoint(isect);
+            it = &isect;
+        }
+        if (!state.arrive(it->pos, point.cosGeometric(point.wo))) {
+            break;
+        }
+        if (!mi.isValid()) {
+            L += state.throughput * hitAreaLight(ctx, state, isect);
+        }
+        if (state.pathLength >= ctx.maxPathLength) {
+            break;
+        }
+
+        if (point.isConnectible()) {
+            if (state.pathLength + 1 <= ctx.maxPathLength) {
+                L += state.throughput * directLighting(ctx, state, *it, point, sampler);
+            }
+            for (int i = 0; i < nLightVertices; ++i) {
+                const LightVertex &lv = lightPath[i];
+                if (lv.pathLength + 1 + state.pathLength > ctx.maxPathLength) {
+                    continue;
+                }
+                L += state.throughput * connectVertices(ctx, state, *it, point, lv, sampler);
+            }
+            if (point.isOnSurface()) {
+                L += state.throughput * ctx.vmNormalization *
+                     mergeVertices(ctx, state, *it, point, grid);
+            }
+        }
+
+        Vector3f wi;
+        if (!sampleScattering(ctx, point, sampler, TransportMode::Radiance, &state, &wi)) {
+            break;
+        }
+        state.ray = it->spawnRay(wi);
+        ++state.pathLength;
+    }
+    return L;
+}
+
+/**
+ * 每条光源子路径在对应线程缓冲区中的位置
+ */
+struct LightPathRange {
+    int buffer;
+    int begin;
+    int count;
+};
+
+void VCMIntegrator::render(const Scene &scene) {
+    std::unique_ptr<Distribution1D> lightDistr =
+    computeLightPowerDistribution(scene);
+    if (!lightDistr) {
+        COUT << "no light in scene, VCM abort";
+        return;
+    }
+
+    std::unordered_map<const Light *, size_t> lightToIndex;
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        lightToIndex[scene.lights[i].get()] = i;
+    }
+
+    Film *film = _camera->film.get();
+    const AABB2i sampleBounds = film->getSampleBounds();
+    const Vector2i sampleExtent = sampleBounds.diagonal();
+    const int tileSize = 16;
+    const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
+    const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
+
+    // 每个像素对应一条光源子路径
+    const int nPaths = sampleBounds.area();
+    // 光源顶点按线程分别储存，数组在迭代之间复用，只有可连接的顶点才占用空间
+    std::vector<std::vector<LightVertex>> lightVertices(maxThreadIndex());
+    std::vector<LightPathRange> lightPaths(nPaths);
+    // 光源子路径的bsdf分配在每个线程各自的内存池中，每轮迭代结束时reset
+    std::vector<MemoryArena> lightArenas(maxThreadIndex());
+
+    Float radius = _initialRadius;
+    if (radius <= 0) {
+        Point3f center;
+        Float sceneRadius;
+        scene.worldBound().boundingSphere(&center, &sceneRadius);
+        radius = 0.003f * sceneRadius;
+    }
+
+    const int nIterations = _sampler->samplesPerPixel;
+    ProgressReporter reporter("rendering", nIterations);
+    LightVertexGrid grid;
+
+    VCMContext ctx;
+    ctx.scene = &scene;
+    ctx.camera = _camera.get();
+    ctx.lightDistr = lightDistr.get();
+    ctx.lightToIndex = &lightToIndex;
+    // _maxDepth为弹射次数，边数比弹射次数多1
+    ctx.maxPathLength = _maxDepth + 1;
+    ctx.rrThreshold = _rrThreshold;
+
+    for (int iter = 0; iter < nIterations; ++iter) {
+        Float iterRadius = radius * std::pow((Float)(iter + 1), (_alpha - 1) / 2);
+        Float etaVCM = nPaths * Pi * iterRadius * iterRadius;
+        ctx.misVmWeightFactor = etaVCM;
+        ctx.misVcWeightFactor = 1 / etaVCM;
+        ctx.vmNormalization = 1 / etaVCM;
+
+        for (auto &buffer : lightVertices) {
+            buffer.clear();
+        }
+
+        // 1.生成光源子路径，同时与相机相连
+        auto tracePath = [&](int64_t pathIndex) {
+            MemoryArena &arena = lightArenas[ThreadIndex];
+            std::vector<LightVertex> &buffer = lightVertices[ThreadIndex];
+            RandomSampler sampler(1, (int)((int64_t)iter * nPaths + pathIndex));
+            Float time = lerp(sampler.get1D(), _camera->shutterOpen,
+                              _camera->shutterClose);
+            int begin = (int)buffer.size();
+            traceLightPath(ctx, sampler, arena, time, &buffer);
+            lightPaths[pathIndex] = {ThreadIndex, begin, (int)buffer.size() - begin};
+        };
+        parallelFor(tracePath, nPaths, 256);
+
+        // 2.建立光源顶点的哈希网格，此后光源顶点数组不再修改，网格中的指针保持有效
+        grid.build(lightVertices, nPaths, iterRadius);
+
+        // 3.生成相机子路径，连接与合并
+        auto renderTile = [&](Point2i tile) {
+            MemoryArena arena;
+            int seed = (iter * nYTiles + tile.y) * nXTiles + tile.x;
+            std::unique_ptr<Sampler> tileSampler = _sampler->clone(seed);
+            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+            AABB2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+
+            std::unique_ptr<FilmTile> filmTile = film->getFilmTile(tileBounds);
+
+            for (Point2i pPixel : tileBounds) {
+                tileSampler->startPixel(pPixel);
+                tileSampler->setSampleIndex(iter);
+
+                Point2f pFilm = (Point2f)pPixel + tileSampler->get2D();
+                int pathIndex = (pPixel.y - sampleBounds.pMin.y) * sampleExtent.x +
+                                (pPixel.x - sampleBounds.pMin.x);
+                const LightPathRange &range = lightPaths[pathIndex];
+                const LightVertex *lightPath = lightVertices[range.buffer].data() + range.begin;
+                Spectrum L = traceCameraPath(ctx, *tileSampler, arena, pFilm,
+                                             lightPath, range.count, grid);
+                filmTile->addSample(pFilm, L);
+                arena.reset();
+            }
+            film->mergeFilmTile(std::move(filmTile));
+        };
+        parallelFor2D(renderTile, Point2i(nXTiles, nYTiles));
+
+        for (size_t i = 0; i < lightArenas.size(); ++i) {
+            lightArenas[i].reset();
+        }
+        reporter.update();
+    }
+    reporter.done();
+    film->writeImage(1.f / nIterations);
+}
+
+//"param" : {
+//    "maxBounce" : 5,
+//    "rrThreshold" : 1,
+//    "radius" : 0,
+//    "alpha" : 0.75
+//}
+// radius小于等于0时取场景包围球半径的0.003倍
+// 迭代次数为采样器的spp
+// lst = {sampler, camera}
+CObject_ptr createVCM(const nloJson &param, const Arguments &lst) {
+    int maxBounce = param.value("maxBounce", 5);
+    Float rrThreshold = param.value("rrThreshold", 1.f);
+    Float radius = param.value("radius", 0.f);
+    Float alpha = param.value("alpha", 0.75f);
+    auto iter = lst.begin();
+    Sampler * sampler = dynamic_cast<Sampler *>(*iter);
+    ++iter;
+    Camera * camera = dynamic_cast<Camera *>(*iter);
+    return new VCMIntegrator(shared_ptr<Sampler>(sampler),
+                             shared_ptr<const Camera>(camera),
+                             maxBounce, radius, alpha, rrThreshold);
+}
+
+REGISTER("vcm", createVCM);
+
+PALADIN_END
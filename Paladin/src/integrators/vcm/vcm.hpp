@@ -0,0 +1,91 @@
+//
+//  vcm.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/2/23.
+//
+
+#ifndef vcm_hpp
+#define vcm_hpp
+
+#include "core/integrator.hpp"
+#include "core/camera.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * 顶点连接与合并(vertex connection and merging)
+ * 也叫统一路径采样(unified path sampling)
+ *
+ * 双向路径追踪的所有策略都是"连接"两个子路径的端点，
+ * 对于 光源->镜面->漫反射->镜面->相机 这类路径，没有任何一个连接策略是可用的
+ * 而光子映射的"合并"策略恰好擅长处理这类路径，但在漫反射场景中的效率远不如双向方法
+ *
+ * VCM的思路是把光子映射的密度估计也看作一种路径采样策略:
+ * 光源子路径的第s个顶点与相机子路径的第t个顶点足够接近(距离小于r)时，
+ * 就认为两个顶点重合了，合并成一条完整路径
+ * 与连接策略(s,t)相比，合并策略多采样了一个顶点，所以pdf为
+ *
+ *     p_merge = p_connect(s,t) * N * πr^2 * p_light(x)
+ *
+ * 其中N为每轮迭代的光源子路径数量(所有相机子路径共享所有光源子路径)，
+ * p_light(x)为光源子路径采样到合并点x的面积pdf
+ * 有了pdf之后，合并策略就可以与连接策略一起做MIS
+ *
+ * MIS权重使用Georgiev等人提出的递推形式:每条子路径只维护dVCM，dVC，dVM三个量，
+ * 在每个顶点处随着采样递推更新，计算任意一个策略的权重时，
+ * 只需要用到两个端点的这三个量以及端点处的pdf，不需要回溯整条子路径
+ * 所以光源顶点只需要储存位置，法线，throughput，三个MIS量，bsdf指针以及路径长度，
+ * 比双向路径追踪中完整的Vertex小得多
+ *
+ * 每轮迭代分为三个步骤
+ *     1.并行生成N条光源子路径，N为像素数量，可连接的顶点追加到所在线程的数组中，
+ *       同时把每个顶点与相机相连(光线追踪策略)
+ *     2.把光源子路径中的表面顶点放入空间哈希网格中，
+ *       网格只在建立时用原子计数，建立之后只读，查询不需要任何同步
+ *     3.并行生成相机子路径，在每个顶点处采样光源，与对应像素的光源子路径做连接，
+ *       同时查询网格，与半径内的所有光源顶点做合并
+ *
+ * 与SPPM相同，合并半径随着迭代次数缩小，保证结果一致
+ *
+ *     r_i = r_0 * i^((α - 1) / 2)
+ */
+class VCMIntegrator : public Integrator {
+
+public:
+
+    VCMIntegrator(std::shared_ptr<Sampler> sampler,
+                  std::shared_ptr<const Camera> camera, int maxDepth,
+                  Float initialRadius, Float alpha, Float rrThreshold)
+    : _sampler(sampler),
+    _camera(camera),
+    _maxDepth(maxDepth),
+    _initialRadius(initialRadius),
+    _alpha(alpha),
+    _rrThreshold(rrThreshold) {
+
+    }
+
+    virtual void render(const Scene &scene) override;
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
+private:
+
+    std::shared_ptr<Sampler> _sampler;
+    std::shared_ptr<const Camera> _camera;
+    const int _maxDepth;
+    // 初始合并半径，小于等于0时根据场景包围球自动计算
+    const Float _initialRadius;
+    // 半径缩小的速度
+    const Float _alpha;
+    const Float _rrThreshold;
+};
+
+CObject_ptr createVCM(const nloJson &param, const Arguments &lst);
+
+PALADIN_END
+
+#endif /* vcm_hpp */
@@ -9,6 +9,7 @@
 #include "core/camera.hpp"
 #include "core/medium.hpp"
 #include "materials/bxdfs/bsdf.hpp"
+#include "materials/bxdfs/bssrdf.hpp"
 
 PALADIN_BEGIN
 
@@ -36,6 +37,12 @@ void VolumePathTracer::preprocess(const Scene &scene, Sampler &sampler) {
  */
 Spectrum VolumePathTracer::Li(const RayDifferential &r, const Scene &scene,
 						Sampler &sampler, MemoryArena &arena, int depth) const {
+    return LiWithAOV(r, scene, sampler, arena, nullptr);
+}
+
+Spectrum VolumePathTracer::LiWithAOV(const RayDifferential &r, const Scene &scene,
+                                     Sampler &sampler, MemoryArena &arena,
+                                     AOVSample *aov) const {
     Spectrum L(0.f);
     Spectrum throughput(1.f);
     RayDifferential ray(r);
@@ -66,8 +73,11 @@ Spectrum VolumePathTracer::Li(const RayDifferential &r, const Scene &scene,
                 break;
             }
             const Distribution1D *lightDistrib = _lightDistribution->lookup(mi.pos);
-            L += throughput * sampleOneLight(mi, scene, arena, sampler, true,
-                                              lightDistrib);
+            const Light *sampledLight = nullptr;
+            Spectrum Ld = throughput * sampleOneLight(mi, scene, arena, sampler, true,
+                                                      lightDistrib, &sampledLight);
+            L += Ld;
+            addLightAOV(aov, sampledLight, Ld);
             
             Vector3f wo = -ray.dir;
             Vector3f wi;
@@ -82,10 +92,14 @@ Spectrum VolumePathTracer::Li(const RayDifferential &r, const Scene &scene,
             if (specularBounce || bounce == 0) {
                 // 因为在这种情况下，ray的方向是确定的，因此直接取isect的Le
                 if (foundIntersection) {
-                    L += throughput * isect.Le(-ray.dir);
+                    Spectrum Le = throughput * isect.Le(-ray.dir);
+                    L += Le;
+                    addLightAOV(aov, isect.primitive->getAreaLight(), Le);
                 } else {
                     for (const auto &light : scene.infiniteLights) {
-                        L += throughput * light->Le(ray);
+                        Spectrum Le = throughput * light->Le(ray);
+                        L += Le;
+                        addLightAOV(aov, light.get(), Le);
                     }
                 }
             }
@@ -99,23 +113,26 @@ Spectrum VolumePathTracer::Li(const RayDifferential &r, const Scene &scene,
             // 有些几何图元是仅仅是为了限定参与介质的范围
             // 所以没有bsdf
             if (!isect.bsdf) {
-                ray = isect.spawnRay(ray.dir);
+                ray = isect.spawnRayThrough(ray);
                 --bounce;
                 continue;
             }
+            recordPrimaryAOV(aov, r, isect);
+            recordSurfaceAOV(aov, isect);
             const Distribution1D * distrib = _lightDistribution->lookup(isect.pos);
             // 找到非高光反射comp，如果有，则估计直接光照贡献
             if (isect.bsdf->numComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR))) {
+                const Light *sampledLight = nullptr;
                 Spectrum Ld = throughput * sampleOneLight(isect, scene, arena,
-                                                 sampler, true, distrib);
+                                                 sampler, true, distrib, &sampledLight);
                 L += Ld;
+                addLightAOV(aov, sampledLight, Ld);
             }
             Vector3f wo = -ray.dir;
             Vector3f wi;
             Float pdf;
             BxDFType flags;
             Spectrum f = isect.bsdf->sample_f(wo, &wi, sampler.get2D(), &pdf, BSDF_ALL, &flags);
-            ray = isect.spawnRay(wi);
             if (f.IsBlack() || pdf == 0) {
                 break;
             }
@@ -137,9 +154,33 @@ Spectrum VolumePathTracer::Li(const RayDifferential &r, const Scene &scene,
                 etaScale *= (dot(wo, isect.normal) > 0) ? (eta * eta) : 1 / (eta * eta);
             }
             
-            ray = isect.spawnRay(wi);
+            ray = isect.spawnRayDifferential(ray, wi, flags, pdf);
             if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
-                // todo 处理bssrdf
+                // 与PathTracer相同，由BSSRDF采样出射点pi，从pi处继续追踪
+                SurfaceInteraction pi;
+                Spectrum S = isect.bssrdf->sample_S(scene, sampler.get1D(), sampler.get2D(),
+                                                    arena, &pi, &pdf);
+                if (S.IsBlack() || pdf == 0) {
+                    break;
+                }
+                throughput *= S / pdf;
+                
+                const Light *sampledLight = nullptr;
+                Spectrum Ld = throughput * sampleOneLight(pi, scene, arena, sampler, true,
+                                                          _lightDistribution->lookup(pi.pos),
+                                                          &sampledLight);
+                L += Ld;
+                addLightAOV(aov, sampledLight, Ld);
+                
+                Spectrum f = pi.bsdf->sample_f(pi.wo, &wi, sampler.get2D(), &pdf,
+                                               BSDF_ALL, &flags);
+                if (f.IsBlack() || pdf == 0) {
+                    break;
+                }
+                throughput *= f * absDot(wi, pi.shading.normal) / pdf;
+                DCHECK(!std::isinf(throughput.y()));
+                specularBounce = (flags & BSDF_SPECULAR) != 0;
+                ray = pi.spawnRayDifferential(ray, wi, flags, pdf);
             }
         }
         // 为何不直接使用throughput，包含的是radiance，radiance是经过折射缩放的
@@ -161,7 +202,23 @@ Spectrum VolumePathTracer::Li(const RayDifferential &r, const Scene &scene,
 //"param" : {
 //    "maxBounce" : 5,
 //    "rrThreshold" : 1,
-//    "lightSampleStrategy" : "power"
+//    "lightSampleStrategy" : "power",
+//    "adaptive" : {
+//        "threshold" : 0.05,
+//        "minSamples" : 16,
+//        "passSamples" : 16
+//    },
+//    "progressive" : {
+//        "timeLimit" : 600,
+//        "targetSpp" : 0,
+//        "passSamples" : 4,
+//        "snapshotInterval" : 30
+//    },
+//    "distributed" : {
+//        "sampleRange" : [0, 64],
+//        "checkpoint" : "part0.ckpt",
+//        "merge" : []
+//    }
 //}
 // lst = {sampler, camera}
 CObject_ptr createVolumePathTracer(const nloJson &param, const Arguments &lst) {
@@ -180,6 +237,9 @@ CObject_ptr createVolumePathTracer(const nloJson &param, const Arguments &lst) {
                                       rrThreshold,
                                       lightSampleStrategy);
     
+    ret->setAdaptiveSampling(param.value("adaptive", nloJson()));
+    ret->setProgressive(param.value("progressive", nloJson()));
+    ret->setDistributed(param.value("distributed", nloJson()));
     return ret;
 }
 
@@ -55,6 +55,14 @@ public:
     virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const override;
 
+    /**
+     * 与PathTracer::LiWithAOV相同，介质中的散射点不记录反照率与法线，
+     * 但介质中的直接光照同样按照光源所属的分组累加
+     */
+    virtual Spectrum LiWithAOV(const RayDifferential &ray, const Scene &scene,
+                               Sampler &sampler, MemoryArena &arena,
+                               AOVSample *aov) const override;
+
 private:
 	// 最大反射次数
 	const int _maxDepth;
@@ -30,7 +30,7 @@ _Lmap(nullptr) {
 }
 
 void DiffuseAreaLight::loadLeMap(const string &texname) {
-    _Lmap = ImageTexture<RGBSpectrum, Spectrum>::getTexture(texname, true, 8, ImageWrap::Repeat, 1, false);
+    _Lmap = ImageTexture<RGBSpectrum, Spectrum>::getTexture(texname, MIPFilter::Trilinear, 8, ImageWrap::Repeat, 1, false);
 }
 
 Spectrum DiffuseAreaLight::power() const {
@@ -113,7 +113,8 @@ shared_ptr<DiffuseAreaLight> DiffuseAreaLight::create(Float rgb[3], const std::s
 //        "color" : [1,1,1],
 //    },
 //    "scale" : 1.f,
-//    "twoSided" : false
+//    "twoSided" : false,
+//    "lightGroup" : "key"
 //}
 DiffuseAreaLight * createDiffuseAreaLight(const nloJson &param,
                                           const std::shared_ptr<Shape> &shape,
@@ -128,6 +129,8 @@ DiffuseAreaLight * createDiffuseAreaLight(const nloJson &param,
     Le *= (Float)scale;
     bool twoSided = param.value("twoSided", false);
     int nSamples = param.value("nSamples", 1);
-    return new DiffuseAreaLight(l2w, mi, Le, nSamples, shape, twoSided);
+    DiffuseAreaLight * ret = new DiffuseAreaLight(l2w, mi, Le, nSamples, shape, twoSided);
+    ret->lightGroup = param.value("lightGroup", "");
+    return ret;
 }
 PALADIN_END
@@ -19,6 +19,11 @@
 #include "alltest/testrender.h"
 #include "math/lowdiscrepancy.hpp"
 #include "alltest/jsontest.h"
+#include "alltest/benchspectrum.h"
+#include "alltest/benchsampler.h"
+#include "alltest/benchintersect.h"
+#include "alltest/benchdisney.h"
+#include "alltest/benchtexture.h"
 #include "parser/transformcache.h"
 
 
@@ -30,6 +35,11 @@ int main(int argc, const char * argv[]) {
     // insert code here...
     COUT << "Hello, paladin!\n";
 //    testscene();
+//    benchSpectrum();
+//    benchSampler();
+//    benchIntersect();
+//    benchDisney();
+//    benchTexture();
     
     Paladin * paladin = Paladin::getInstance();
     if (argc >= 2) {
@@ -49,8 +49,10 @@ Spectrum BSDF::rho_hh(int nSamples, const Point2f *samples1,
     return ret;
 }
 
-Spectrum BSDF::rho_hd(const Vector3f &wo, int nSamples, const Point2f *samples,
+Spectrum BSDF::rho_hd(const Vector3f &woWorld, int nSamples, const Point2f *samples,
                    BxDFType flags) const {
+    // BxDF在局部坐标系中计算，wo需要先转换到局部坐标系
+    Vector3f wo = worldToLocal(woWorld);
     Spectrum ret(0.f);
     for (int i = 0; i < nBxDFs; ++i) {
         if (bxdfs[i]->matchesFlags(flags)) {
@@ -8,6 +8,9 @@
 #include "bssrdf.hpp"
 #include "math/interpolation.hpp"
 #include "tools/parallel.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+#include "core/scene.hpp"
+#include <map>
 
 PALADIN_BEGIN
 
@@ -170,6 +173,142 @@ profileCDF(new Float[nRadiusSamples * nRhoSamples]) {
 
 }
 
+shared_ptr<const BSSRDFTable> BSSRDFTable::getBeamDiffusionTable(Float g, Float eta) {
+    static std::mutex mutex;
+    static std::map<std::pair<Float, Float>, shared_ptr<const BSSRDFTable>> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_pair(g, eta);
+    auto iter = tables.find(key);
+    if (iter != tables.end()) {
+        return iter->second;
+    }
+    auto table = make_shared<BSSRDFTable>(100, 64);
+    computeBeamDiffusionBSSRDF(g, eta, table.get());
+    tables[key] = table;
+    return table;
+}
+
+/**
+ * 用于次表面散射材质，由有效反射率ρeff以及平均自由程mfp反推σa，σs
+ * ρeff是ρ的单调递增函数，所以可以用InvertCatmullRom求出ρ
+ * 而σt = 1 / mfp
+ */
+void subsurfaceFromDiffuse(const BSSRDFTable &t, const Spectrum &rhoEff,
+                           const Spectrum &mfp, Spectrum *sigma_a,
+                           Spectrum *sigma_s) {
+    for (int c = 0; c < Spectrum::nSamples; ++c) {
+        Float rho = InvertCatmullRom(t.nRhoSamples, t.rhoSamples.get(),
+                                     t.rhoEff.get(), rhoEff[c]);
+        (*sigma_s)[c] = rho / mfp[c];
+        (*sigma_a)[c] = (1 - rho) / mfp[c];
+    }
+}
+
+Spectrum SeparableBSSRDF::sample_S(const Scene &scene, Float u1, const Point2f &u2,
+                                   MemoryArena &arena, SurfaceInteraction *si,
+                                   Float *pdf) const {
+    Spectrum Sp = sample_Sp(scene, u1, u2, arena, si, pdf);
+    if (!Sp.IsBlack()) {
+        // 入射点的方向分布为Sw，用SeparableBSSRDFAdapter包装成BSDF，
+        // 积分器可以像普通表面一样估计入射点的直接光照以及继续追踪路径
+        si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
+        si->bsdf->add(ARENA_ALLOC(arena, SeparableBSSRDFAdapter)(this));
+        si->wo = Vector3f(si->shading.normal);
+    }
+    return Sp;
+}
+
+Spectrum SeparableBSSRDF::sample_Sp(const Scene &scene, Float u1, const Point2f &u2,
+                                    MemoryArena &arena, SurfaceInteraction *si,
+                                    Float *pdf) const {
+    // 选择投影轴，法线方向的概率为0.5，两条切线方向各为0.25
+    Vector3f vx, vy, vz;
+    if (u1 < .5f) {
+        vx = _sTangent;
+        vy = _tTangent;
+        vz = Vector3f(_sNormal);
+        u1 *= 2;
+    } else if (u1 < .75f) {
+        vx = _tTangent;
+        vy = Vector3f(_sNormal);
+        vz = _sTangent;
+        u1 = (u1 - .5f) * 4;
+    } else {
+        vx = Vector3f(_sNormal);
+        vy = _sTangent;
+        vz = _tTangent;
+        u1 = (u1 - .75f) * 4;
+    }
+
+    // 均匀地选择一个颜色通道，并复用u1
+    int ch = clamp((int)(u1 * Spectrum::nSamples), 0, Spectrum::nSamples - 1);
+    u1 = u1 * Spectrum::nSamples - ch;
+
+    // 在圆盘上采样半径以及角度
+    Float r = sample_Sr(ch, u2[0]);
+    if (r < 0) {
+        return Spectrum(0.f);
+    }
+    Float phi = 2 * Pi * u2[1];
+
+    // 半径超过rMax的样本能量可以忽略，用rMax限制探测光线的长度
+    Float rMax = sample_Sr(ch, 0.999f);
+    if (r >= rMax) {
+        return Spectrum(0.f);
+    }
+    Float l = 2 * std::sqrt(rMax * rMax - r * r);
+
+    Point3f pStart = _po.pos + r * (vx * std::cos(phi) + vy * std::sin(phi)) - l * vz / 2;
+    Point3f pTarget = pStart + l * vz;
+
+    // 只需要与当前材质的交点，场景为该材质单独建立了加速结构时，
+    // 不需要遍历整个场景
+    IntersectionChain *chain = nullptr;
+    int nFound = scene.intersectAll(Interaction(pStart, _po.time, _po.mediumInterface),
+                                    pTarget, _material, arena, &chain);
+    if (nFound == 0) {
+        return Spectrum(0.f);
+    }
+
+    // 均匀地选择一个交点
+    int selected = clamp((int)(u1 * nFound), 0, nFound - 1);
+    while (selected-- > 0) {
+        chain = chain->next;
+    }
+    *si = chain->si;
+
+    *pdf = pdf_Sp(*si) / nFound;
+    return Sp(*si);
+}
+
+Float SeparableBSSRDF::pdf_Sp(const SurfaceInteraction &pi) const {
+    // 转换到po的着色空间
+    Vector3f d = _po.pos - pi.pos;
+    Vector3f dLocal(dot(_sTangent, d), dot(_tTangent, d), dot(_sNormal, d));
+    Normal3f nLocal(dot(_sTangent, pi.normal), dot(_tTangent, pi.normal),
+                    dot(_sNormal, pi.normal));
+
+    // 三个投影轴对应的投影半径
+    Float rProj[3] = {std::sqrt(dLocal.y * dLocal.y + dLocal.z * dLocal.z),
+                      std::sqrt(dLocal.z * dLocal.z + dLocal.x * dLocal.x),
+                      std::sqrt(dLocal.x * dLocal.x + dLocal.y * dLocal.y)};
+
+    // 面积概率密度转换到投影平面上需要乘以|cosθ|
+    Float pdf = 0, axisProb[3] = {.25f, .25f, .5f};
+    Float chProb = 1 / (Float)Spectrum::nSamples;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int ch = 0; ch < Spectrum::nSamples; ++ch) {
+            pdf += pdf_Sr(ch, rProj[axis]) * std::abs(nLocal[axis]) * chProb * axisProb[axis];
+        }
+    }
+    return pdf;
+}
+
+/**
+ * 对每个通道，在(ρ, r_optical)二维表中做样条插值
+ * 表中储存的是2πr_optical Sr，所以需要除以2πr_optical，
+ * 再乘以σt^2转换到真实的半径
+ */
 Spectrum TabulatedBSSRDF::Sr(Float r) const {
     Spectrum ret(0.f);
     
@@ -177,16 +316,76 @@ Spectrum TabulatedBSSRDF::Sr(Float r) const {
         Float rOptical = r * _sigma_t[ch];
         int rhoOffset, radiusOffset;
         Float rhoWeights[4], radiusWeights[4];
+        if (!CatmullRomWeights(_table.nRhoSamples, _table.rhoSamples.get(),
+                               _rho[ch], &rhoOffset, rhoWeights) ||
+            !CatmullRomWeights(_table.nRadiusSamples, _table.radiusSamples.get(),
+                               rOptical, &radiusOffset, radiusWeights)) {
+            continue;
+        }
+        Float sr = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (rhoWeights[i] == 0) {
+                continue;
+            }
+            int rhoIndex = rhoOffset + i;
+            for (int j = 0; j < 4; ++j) {
+                if (radiusWeights[j] == 0) {
+                    continue;
+                }
+                sr += rhoWeights[i] * radiusWeights[j]
+                    * _table.evalProfile(rhoIndex, radiusOffset + j);
+            }
+        }
+        if (rOptical != 0) {
+            sr /= 2 * Pi * rOptical;
+        }
+        ret[ch] = sr;
     }
-    return ret;
+    ret *= _sigma_t * _sigma_t;
+    return ret.clamp();
 }
 
-Float TabulatedBSSRDF::pdf_Sr(int ch, Float distance) const {
-    return 0;
+Float TabulatedBSSRDF::pdf_Sr(int ch, Float r) const {
+    Float rOptical = r * _sigma_t[ch];
+    int rhoOffset, radiusOffset;
+    Float rhoWeights[4], radiusWeights[4];
+    if (!CatmullRomWeights(_table.nRhoSamples, _table.rhoSamples.get(),
+                           _rho[ch], &rhoOffset, rhoWeights) ||
+        !CatmullRomWeights(_table.nRadiusSamples, _table.radiusSamples.get(),
+                           rOptical, &radiusOffset, radiusWeights)) {
+        return 0.f;
+    }
+    // 采样时使用的是profile的分布，归一化系数为ρeff
+    Float sr = 0, rhoEff = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (rhoWeights[i] == 0) {
+            continue;
+        }
+        int rhoIndex = rhoOffset + i;
+        rhoEff += _table.rhoEff[rhoIndex] * rhoWeights[i];
+        for (int j = 0; j < 4; ++j) {
+            if (radiusWeights[j] == 0) {
+                continue;
+            }
+            sr += rhoWeights[i] * radiusWeights[j]
+                * _table.evalProfile(rhoIndex, radiusOffset + j);
+        }
+    }
+    if (rOptical != 0) {
+        sr /= 2 * Pi * rOptical;
+    }
+    return std::max((Float)0, sr * _sigma_t[ch] * _sigma_t[ch] / rhoEff);
 }
 
-Float TabulatedBSSRDF::sample_Sr(int ch, Float sample) const {
-    return 0;
+Float TabulatedBSSRDF::sample_Sr(int ch, Float u) const {
+    if (_sigma_t[ch] == 0) {
+        return -1;
+    }
+    // 在光学半径空间中采样，再转换到真实的半径
+    return SampleCatmullRom2D(_table.nRhoSamples, _table.nRadiusSamples,
+                              _table.rhoSamples.get(), _table.radiusSamples.get(),
+                              _table.profile.get(), _table.profileCDF.get(),
+                              _rho[ch], u) / _sigma_t[ch];
 }
 
 PALADIN_END
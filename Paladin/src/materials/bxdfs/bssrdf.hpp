@@ -47,7 +47,11 @@ public:
 
 	virtual Spectrum S(const SurfaceInteraction &pi, const Vector3f &wi) = 0;
 
-	virtual Spectrum sampleS(const Scene &scene, Float u1, const Point2f &u2,
+	/**
+	 * 采样入射点pi，返回S值，pdf为面积与方向的联合概率密度
+	 * 采样之后si->bsdf为描述入射方向分布的BSDF
+	 */
+	virtual Spectrum sample_S(const Scene &scene, Float u1, const Point2f &u2,
                               MemoryArena &arena, SurfaceInteraction *si,
                               Float *pdf) const = 0;
 
@@ -124,10 +128,11 @@ public:
 	}
 
 	// S(po, ωo, pi, ωi) ≈ (1 - Fr(cosθo)) Sp(po, pi) Sω(ωi)
-	Spectrum S(const SurfaceInteraction &pi, const Vector3f &wi) {
-		// todo 这里的折射率应该要传入，待优化
-		Float Ft = FrDielectric(cosTheta(_po.wo), 1, _eta);
-		return (1 - Ft) * Sp(pi) * Sw(wi);
+	// wi为世界空间的方向，Sw需要的是pi处着色空间的方向
+	Spectrum S(const SurfaceInteraction &pi, const Vector3f &wi) override {
+		Float Ft = FrDielectric(dot(_po.wo, _sNormal), 1, _eta);
+		Vector3f wiLocal(0, 0, dot(wi, pi.shading.normal));
+		return (1 - Ft) * Sp(pi) * Sw(wiLocal);
 	}
 
 	// Sω(ωi) = (1 - Fr(cosθi)) / cπ
@@ -142,14 +147,25 @@ public:
 		return Sr(distance(_po.pos, pi.pos));
 	}
 
-	Spectrum sample_S(const Scene &scene, Float u1, const Point2f &u2,
-                      MemoryArena &arena, SurfaceInteraction *si,
-                      Float *pdf) const;
-
+	virtual Spectrum sample_S(const Scene &scene, Float u1, const Point2f &u2,
+                              MemoryArena &arena, SurfaceInteraction *si,
+                              Float *pdf) const override;
+
+	/**
+	 * 采样入射点pi
+	 * 先选择一个投影轴(着色法线的概率为0.5，两条切线各为0.25)以及一个颜色通道，
+	 * 在垂直于投影轴的圆盘上按照Sr的分布采样半径r，按照均匀分布采样角度φ，
+	 * 再沿着投影轴发射一条长度为 2 * sqrt(r_max^2 - r^2) 的探测光线，
+	 * 探测光线与同一材质的物体可能有多个交点，均匀地选择其中一个
+	 */
 	Spectrum sample_Sp(const Scene &scene, Float u1, const Point2f &u2,
                        MemoryArena &arena, SurfaceInteraction *si,
                        Float *pdf) const;
 
+	/**
+	 * 由于三个投影轴与所有颜色通道都可能采样到pi，
+	 * 所以pdf为所有组合的概率密度之和(单样本MIS)
+	 */
 	Float pdf_Sp(const SurfaceInteraction &si) const;
 
 	virtual Spectrum Sr(Float d) const = 0;
@@ -412,6 +428,13 @@ struct BSSRDFTable {
 
     BSSRDFTable(int nRhoSamples, int nRadiusSamples);
     
+    /**
+     * 生成表格需要对每个样本做数值积分，耗时较长，
+     * 而表格只与各向异性系数g以及折射率η有关，
+     * 所以g，η相同的材质共享同一个表格，第一次使用时生成
+     */
+    static shared_ptr<const BSSRDFTable> getBeamDiffusionTable(Float g, Float eta);
+    
     inline Float evalProfile(int rhoIndex, int radiusIndex) const {
         return profile[rhoIndex * nRadiusSamples + radiusIndex];
     }
@@ -426,7 +449,7 @@ public:
         
     }
     
-    Spectrum f(const Vector3f &wo, const Vector3f &wi) const {
+    virtual Spectrum f(const Vector3f &wo, const Vector3f &wi) const override {
         Spectrum f = _bssrdf->Sw(wi);
         if (_bssrdf->_mode == TransportMode::Radiance) {
             f *= _bssrdf->_eta * _bssrdf->_eta;
@@ -434,7 +457,7 @@ public:
         return f;
     }
     
-    std::string toString() const {
+    virtual std::string toString() const override {
         return "[ SeparableBSSRDFAdapter ]";
     }
 
@@ -442,18 +465,6 @@ private:
     const SeparableBSSRDF * _bssrdf;
 };
 
-/**
- *
- *
- *
- *
- *
- *
- *
- *
- * 
- */
-
 Float beamDiffusionSS(Float sigma_s, Float sigma_a, Float g, Float eta,
                       Float r);
 
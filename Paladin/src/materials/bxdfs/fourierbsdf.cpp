@@ -27,27 +27,21 @@ Spectrum FourierBSDF::f(const Vector3f &wo, const Vector3f &wi) const {
         return Spectrum(0.f);
     }
     
-    Float *ak = ALLOCA(Float, _bsdfTable.mMax * _bsdfTable.nChannels);
-    memset(ak, 0, _bsdfTable.mMax * _bsdfTable.nChannels * sizeof(Float));
-    
-    int mMax = 0;
-    for (int b = 0; b < 4; ++b) {
-        for (int a = 0; a < 4; ++a) {
-            Float weight = weightsI[a] * weightsO[b];
-            if (weight != 0) {
-                int m;
-                const Float *ap = _bsdfTable.getAk(offsetI + a, offsetO + b, &m);
-                mMax = std::max(mMax, m);
-                for (int c = 0; c < _bsdfTable.nChannels; ++c) {
-                    for (int k = 0; k < mMax; ++k) {
-                        ak[c * _bsdfTable.mMax + k] += weight * ap[c * m + k];
-                    }
-                }
-            }
-        }
-    }
+    // 只清零实际用到的阶数，而不是整个表的mMax
+    int nChannels = _bsdfTable.nChannels;
+    int mMax = _bsdfTable.maxOrder(offsetI, weightsI, offsetO, weightsO);
+    int stride = FourierBSDFTable::paddedOrder(mMax);
+    Float *ak = ALLOCA(Float, stride * nChannels);
+    memset(ak, 0, stride * nChannels * sizeof(Float));
+    _bsdfTable.blendCoefficients(offsetI, weightsI, offsetO, weightsO,
+                                 nChannels, stride, ak);
     
     Float Y = std::max((Float)0, Fourier(ak, mMax, cosPhi));
+    return evaluate(ak, stride, mMax, Y, muI, muO, cosPhi);
+}
+
+Spectrum FourierBSDF::evaluate(const Float *ak, int stride, int mMax, Float Y,
+                               Float muI, Float muO, Float cosPhi) const {
     // 8.21式中的|μi|
     Float scale = muI != 0 ? (1 / std::abs(muI)) : (Float)0;
 
@@ -60,31 +54,252 @@ Spectrum FourierBSDF::f(const Vector3f &wo, const Vector3f &wi) const {
     if (_bsdfTable.nChannels == 1)
         return Spectrum(Y * scale);
     else {
-        Float R = Fourier(ak + 1 * _bsdfTable.mMax, mMax, cosPhi);
-        Float B = Fourier(ak + 2 * _bsdfTable.mMax, mMax, cosPhi);
+        Float R = Fourier(ak + 1 * stride, mMax, cosPhi);
+        Float B = Fourier(ak + 2 * stride, mMax, cosPhi);
         Float G = 1.39829f * Y - 0.100913f * B - 0.297375f * R;
         Float rgb[3] = {R * scale, G * scale, B * scale};
         return Spectrum::FromRGB(rgb).clamp();
     }
 }
 
+/**
+ * 先用a0的二维CatmullRom样条采样μi，
+ * 再根据插值得到的亮度通道系数采样方位角差φ，
+ * 两者概率密度的乘积即为wi的概率密度
+ */
 Spectrum FourierBSDF::sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
                   Float *pdf, BxDFType *sampledType) const {
-    return Spectrum(1.f);
+    Float muO = cosTheta(wo);
+    Float pdfMu;
+    Float muI = SampleCatmullRom2D(_bsdfTable.nMu, _bsdfTable.nMu, _bsdfTable.mu.get(),
+                                   _bsdfTable.mu.get(), _bsdfTable.a0.get(),
+                                   _bsdfTable.cdf.get(), muO, u[1], nullptr, &pdfMu);
+
+    int offsetI, offsetO;
+    Float weightsI[4], weightsO[4];
+    if (!_bsdfTable.getWeightsAndOffset(muI, &offsetI, weightsI) ||
+        !_bsdfTable.getWeightsAndOffset(muO, &offsetO, weightsO)) {
+        *pdf = 0;
+        return Spectrum(0.f);
+    }
+
+    int nChannels = _bsdfTable.nChannels;
+    int mMax = _bsdfTable.maxOrder(offsetI, weightsI, offsetO, weightsO);
+    if (mMax == 0) {
+        *pdf = 0;
+        return Spectrum(0.f);
+    }
+    int stride = FourierBSDFTable::paddedOrder(mMax);
+    Float *ak = ALLOCA(Float, stride * nChannels);
+    memset(ak, 0, stride * nChannels * sizeof(Float));
+    _bsdfTable.blendCoefficients(offsetI, weightsI, offsetO, weightsO,
+                                 nChannels, stride, ak);
+
+    Float phi, pdfPhi;
+    Float Y = SampleFourier(ak, _bsdfTable.recip.get(), mMax, u[0], &pdfPhi, &phi);
+    *pdf = std::max((Float)0, pdfPhi * pdfMu);
+
+    // 由μi以及φ构造wi，φ为wo绕z轴旋转的角度
+    Float sin2ThetaI = std::max((Float)0, 1 - muI * muI);
+    Float norm = std::sqrt(sin2ThetaI / sin2Theta(wo));
+    if (std::isinf(norm)) {
+        norm = 0;
+    }
+    Float sinPhi = std::sin(phi), cosPhi = std::cos(phi);
+    *wi = -Vector3f(norm * (cosPhi * wo.x - sinPhi * wo.y),
+                    norm * (sinPhi * wo.x + cosPhi * wo.y), muI);
+    // 数值误差可能导致wi没有归一化
+    *wi = normalize(*wi);
+
+    return evaluate(ak, stride, mMax, Y, muI, muO, cosPhi);
 }
 
+/**
+ * 只需要亮度通道，μi的边缘分布为a0对μi的积分，
+ * 即cdf中每一行的最后一个值乘以2π，再按照μo的权重插值
+ */
 Float FourierBSDF::pdfDir(const Vector3f &wo, const Vector3f &wi) const {
-    return 0;
+    Float muI = cosTheta(-wi), muO = cosTheta(wo);
+    Float cosPhi = cosDPhi(-wi, wo);
+
+    int offsetI, offsetO;
+    Float weightsI[4], weightsO[4];
+    if (!_bsdfTable.getWeightsAndOffset(muI, &offsetI, weightsI) ||
+        !_bsdfTable.getWeightsAndOffset(muO, &offsetO, weightsO)) {
+        return 0;
+    }
+
+    int mMax = _bsdfTable.maxOrder(offsetI, weightsI, offsetO, weightsO);
+    int stride = FourierBSDFTable::paddedOrder(mMax);
+    Float *ak = ALLOCA(Float, stride);
+    memset(ak, 0, stride * sizeof(Float));
+    _bsdfTable.blendCoefficients(offsetI, weightsI, offsetO, weightsO,
+                                 1, stride, ak);
+
+    Float rho = 0;
+    int nMu = _bsdfTable.nMu;
+    for (int o = 0; o < 4; ++o) {
+        if (weightsO[o] == 0) {
+            continue;
+        }
+        rho += weightsO[o] * _bsdfTable.cdf[(offsetO + o) * nMu + nMu - 1] * (2 * Pi);
+    }
+
+    Float Y = Fourier(ak, mMax, cosPhi);
+    return (rho > 0 && Y > 0) ? (Y / rho) : 0;
 }
 
 std::string FourierBSDF::toString() const {
-    // todo
-    return "";
+    return StringPrintf("[ FourierBSDF eta: %f mMax: %d nChannels: %d nMu: %d  mode : %s ]",
+                        _bsdfTable.eta, _bsdfTable.mMax, _bsdfTable.nChannels,
+                        _bsdfTable.nMu,
+                        (_mode == TransportMode::Radiance ? "RADIANCE" : "IMPORTANCE"));
 }
 
 bool FourierBSDFTable::getWeightsAndOffset(Float cosTheta, int *offset,
                                        Float weights[4]) const {
-    return CatmullRomWeights(nMu, mu, cosTheta, offset, weights);
+    return CatmullRomWeights(nMu, mu.get(), cosTheta, offset, weights);
+}
+
+int FourierBSDFTable::maxOrder(int offsetI, const Float weightsI[4],
+                               int offsetO, const Float weightsO[4]) const {
+    int ret = 0;
+    for (int b = 0; b < 4; ++b) {
+        if (weightsO[b] == 0) {
+            continue;
+        }
+        const int *row = &mMat[(offsetO + b) * nMu + offsetI];
+        for (int a = 0; a < 4; ++a) {
+            if (weightsI[a] != 0) {
+                ret = std::max(ret, row[a]);
+            }
+        }
+    }
+    return ret;
+}
+
+void FourierBSDFTable::blendCoefficients(int offsetI, const Float weightsI[4],
+                                         int offsetO, const Float weightsO[4],
+                                         int nCh, int stride, Float *ak) const {
+    for (int b = 0; b < 4; ++b) {
+        if (weightsO[b] == 0) {
+            continue;
+        }
+        for (int a = 0; a < 4; ++a) {
+            Float weight = weightsI[a] * weightsO[b];
+            if (weight == 0) {
+                continue;
+            }
+            int m;
+            const Float *ap = getAk(offsetI + a, offsetO + b, &m);
+            int mPad = paddedOrder(m);
+            DCHECK_LE(mPad, stride);
+            for (int c = 0; c < nCh; ++c) {
+                simd::addScaled(ak + c * stride, ap + c * mPad, weight, mPad);
+            }
+        }
+    }
+}
+
+/**
+ * 文件格式如下，所有数据均为小端序的32位int或者float
+ *
+ *     header     "SCATFUN" 加版本号 1，共8字节
+ *     flags, nMu, nCoeffs, mMax, nChannels, nBases, 3个保留值, eta, 4个保留值
+ *     mu         nMu个
+ *     cdf        nMu * nMu个
+ *     offset与length交替排列  nMu * nMu * 2个
+ *     系数        nCoeffs个
+ */
+bool FourierBSDFTable::read(const std::string &filename, FourierBSDFTable *table) {
+    table->nChannels = 0;
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        COUT << "unable to open tabulated BSDF file " << filename;
+        return false;
+    }
+
+    auto read32 = [&](void *target, size_t count) -> bool {
+        return fread(target, sizeof(int32_t), count, f) == count;
+    };
+    auto readFloat = [&](Float *target, size_t count) -> bool {
+        if (sizeof(*target) == sizeof(float)) {
+            return read32(target, count);
+        }
+        std::unique_ptr<float[]> buf(new float[count]);
+        bool ret = read32(buf.get(), count);
+        for (size_t i = 0; i < count; ++i) {
+            target[i] = buf[i];
+        }
+        return ret;
+    };
+
+    const char headerExp[8] = {'S', 'C', 'A', 'T', 'F', 'U', 'N', '\x01'};
+    char header[8];
+    int flags, nCoeffs, nBases, unused[4];
+    int nMu2 = 0;
+    std::unique_ptr<int[]> offsetAndLength;
+    std::unique_ptr<Float[]> coeffs;
+    bool ok = fread(header, 1, 8, f) == 8 && memcmp(header, headerExp, 8) == 0 &&
+            read32(&flags, 1) && read32(&table->nMu, 1) && read32(&nCoeffs, 1) &&
+            read32(&table->mMax, 1) && read32(&table->nChannels, 1) &&
+            read32(&nBases, 1) && read32(unused, 3) && readFloat(&table->eta, 1) &&
+            read32(unused, 4);
+    // 只支持单色或者RGB，并且材质参数均匀(非纹理)的文件
+    ok = ok && flags == 1 && (table->nChannels == 1 || table->nChannels == 3) &&
+            nBases == 1 && table->nMu > 0 && nCoeffs >= 0;
+    if (ok) {
+        nMu2 = table->nMu * table->nMu;
+        table->mu.reset(new Float[table->nMu]);
+        table->cdf.reset(new Float[nMu2]);
+        table->a0.reset(new Float[nMu2]);
+        table->aOffset.reset(new int[nMu2]);
+        table->mMat.reset(new int[nMu2]);
+        offsetAndLength.reset(new int[nMu2 * 2]);
+        coeffs.reset(new Float[nCoeffs]);
+        ok = readFloat(table->mu.get(), table->nMu) &&
+                readFloat(table->cdf.get(), nMu2) &&
+                read32(offsetAndLength.get(), nMu2 * 2) &&
+                readFloat(coeffs.get(), nCoeffs);
+    }
+    fclose(f);
+    if (!ok) {
+        COUT << "tabulated BSDF file " << filename << " has an incompatible format";
+        table->nChannels = 0;
+        return false;
+    }
+
+    // 按照(o, i)的顺序重新排列系数，每个通道补齐到SimdFloatWidth的整数倍
+    size_t total = 0;
+    for (int i = 0; i < nMu2; ++i) {
+        int offset = offsetAndLength[2 * i], length = offsetAndLength[2 * i + 1];
+        if (offset < 0 || length < 0 || length > table->mMax ||
+            offset + (size_t)length * table->nChannels > (size_t)nCoeffs) {
+            COUT << "tabulated BSDF file " << filename << " has invalid offsets";
+            table->nChannels = 0;
+            return false;
+        }
+        total += (size_t)paddedOrder(length) * table->nChannels;
+    }
+    table->a.reset(new Float[total]());
+    size_t cursor = 0;
+    for (int i = 0; i < nMu2; ++i) {
+        int offset = offsetAndLength[2 * i], m = offsetAndLength[2 * i + 1];
+        int mPad = paddedOrder(m);
+        table->aOffset[i] = (int)cursor;
+        table->mMat[i] = m;
+        table->a0[i] = m > 0 ? coeffs[offset] : (Float)0;
+        for (int c = 0; c < table->nChannels; ++c) {
+            memcpy(&table->a[cursor + c * mPad], &coeffs[offset + c * m], m * sizeof(Float));
+        }
+        cursor += mPad * table->nChannels;
+    }
+
+    table->recip.reset(new Float[table->mMax]);
+    for (int i = 0; i < table->mMax; ++i) {
+        table->recip[i] = 1 / (Float)i;
+    }
+    return true;
 }
 
 PALADIN_END
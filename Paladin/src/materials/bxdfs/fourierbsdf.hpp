@@ -9,6 +9,7 @@
 #define fourierbsdf_hpp
 
 #include "core/bxdf.hpp"
+#include "math/simd.h"
 
 PALADIN_BEGIN
 
@@ -108,10 +109,10 @@ PALADIN_BEGIN
  */
 
 /**
- *
- * 为了简单起见，我们现在给出的基本思想就好像是最接近的方向的系数小于等于
- *
- *
+ * 读取文件之后，系数a会按照(o, i)的顺序重新排列，
+ * 每个方向对的系数块中，每个通道的长度补齐到SimdFloatWidth的整数倍，补齐部分为0
+ * 这样插值时同一个o的4个相邻系数块在内存中是连续的，
+ * 每个通道的累加也可以直接用SIMD处理，不需要处理不足4个的尾部
  */
 struct FourierBSDFTable {
     // 折射率
@@ -122,35 +123,66 @@ struct FourierBSDFTable {
     // 为1时，表示单色bsdf
     // 为3时，三个通道分别为亮度，红，蓝，三个通道
     // 直接表示亮度对于蒙特卡洛采样非常有用，并且用这三个量也容易计算出绿色通道
-    int nChannels;
+    int nChannels = 0;
 
     // 将天顶角离散成nMu个方向，储存在mu中
     // μ的数量
     int nMu;
-    // μ列表，从小到大排列，尺寸为nMu * nMu
-    Float *mu;
+    // μ列表，从小到大排列，尺寸为nMu
+    std::unique_ptr<Float[]> mu;
 
     // nMu × nMu矩阵，储存对应的阶数m
-    int *mMat;
+    std::unique_ptr<int[]> mMat;
 
-    // 系数ak列表
-    Float *a;
+    // 系数ak列表，已经按照上述方式重新排列
+    std::unique_ptr<Float[]> a;
     // ak列表的偏移，尺寸为nMu * nMu的列表
-    int *aOffset;
-    Float *a0;
-    Float *cdf;
+    std::unique_ptr<int[]> aOffset;
+    // 每个方向对的a0，用于采样μi
+    std::unique_ptr<Float[]> a0;
+    // a0对μi的累积分布函数，尺寸为nMu * nMu
+    std::unique_ptr<Float[]> cdf;
     // 1/i
-    Float *recip;
+    std::unique_ptr<Float[]> recip;
 
+    /**
+     * 读取pbrt/Mitsuba的layerlab格式的二进制BSDF文件
+     * 只支持单通道或者RGB三通道，并且材质参数均匀的文件
+     */
     static bool read(const std::string &filename, FourierBSDFTable *table);
 
+    /**
+     * 每个通道补齐之后的长度
+     */
+    static int paddedOrder(int m) {
+        return (m + SimdFloatWidth - 1) / SimdFloatWidth * SimdFloatWidth;
+    }
+
+    /**
+     * 返回方向对的系数，第c个通道从 c * paddedOrder(m) 开始
+     */
     const Float *getAk(int offsetI, int offsetO, int *mptr) const {
         *mptr = mMat[offsetO * nMu + offsetI];
-        return a + aOffset[offsetO * nMu + offsetI];
+        return a.get() + aOffset[offsetO * nMu + offsetI];
     }
 
     bool getWeightsAndOffset(Float cosTheta, int *offset,
                              Float weights[4]) const;
+
+    /**
+     * 4x4个相邻方向对中，权重不为0的最大阶数
+     */
+    int maxOrder(int offsetI, const Float weightsI[4],
+                 int offsetO, const Float weightsO[4]) const;
+
+    /**
+     * 把4x4个相邻方向对的前nCh个通道的系数加权累加到ak中
+     * ak中第c个通道从 c * stride 开始，stride为paddedOrder(maxOrder(...))
+     * 调用之前ak需要清零
+     */
+    void blendCoefficients(int offsetI, const Float weightsI[4],
+                           int offsetO, const Float weightsO[4],
+                           int nCh, int stride, Float *ak) const;
 };
 
 class FourierBSDF : public BxDF {
@@ -174,6 +206,13 @@ public:
     virtual std::string toString() const override;
     
 private:
+    /**
+     * 由插值之后的系数计算BSDF函数值，Y为亮度通道的傅里叶级数值
+     * 三通道时再计算红蓝两个通道，并且由亮度换算出绿色通道
+     */
+    Spectrum evaluate(const Float *ak, int stride, int mMax, Float Y,
+                      Float muI, Float muO, Float cosPhi) const;
+
     const FourierBSDFTable &_bsdfTable;
     
     const TransportMode _mode;
@@ -20,10 +20,11 @@ void ClearCoatedMaterial::computeScatteringFunctions(SurfaceInteraction *si,
     processNormal(si);
     
     si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
-    Float urough = _uRoughness->evaluate(*si);
-    Float vrough = _vRoughness->evaluate(*si);
-    Spectrum Rd = _Kd->evaluate(*si).clamp();
-    Spectrum Rs = _Ks->evaluate(*si).clamp();
+    TextureValues tex = _textures.execute(*si, arena);
+    Float urough = tex.get(_uRoughnessReg);
+    Float vrough = tex.get(_vRoughnessReg);
+    Spectrum Rd = tex.get(_KdReg).clamp();
+    Spectrum Rs = tex.get(_KsReg).clamp();
     
     if (_remapRoughness) {
         urough = BeckmannDistribution::RoughnessToAlpha(urough);
@@ -30,7 +30,10 @@ public:
     _uRoughness(urough),
     _vRoughness(vrough),
     _remapRoughness(remapRough) {
-        
+        _KsReg = _textures.add(_Ks);
+        _KdReg = _textures.add(_Kd);
+        _uRoughnessReg = _textures.add(_uRoughness);
+        _vRoughnessReg = _textures.add(_vRoughness);
     }
     
     virtual nloJson toJson() const override {
@@ -44,6 +47,8 @@ public:
 private:
     std::shared_ptr<Texture<Spectrum>> _Ks, _Kd;
     std::shared_ptr<Texture<Float>> _uRoughness, _vRoughness;
+    TextureReg<Spectrum> _KsReg, _KdReg;
+    TextureReg<Float> _uRoughnessReg, _vRoughnessReg;
     bool _remapRoughness;
 };
 
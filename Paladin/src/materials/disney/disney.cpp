@@ -6,3 +6,470 @@
 //
 
 #include "disney.hpp"
+#include "core/texture.hpp"
+#include "core/interaction.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+#include "materials/bxdfs/bssrdf.hpp"
+#include "materials/bxdfs/specular.hpp"
+#include "math/sampling.hpp"
+
+PALADIN_BEGIN
+
+DisneyBxDF::DisneyBxDF(const DisneyLobes &lobes, Float alphax, Float alphay,
+                       Float transAlphax, Float transAlphay, TransportMode mode)
+: BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE | BSDF_GLOSSY |
+                ((lobes.specTrans.IsBlack() && lobes.diffTrans.IsBlack())
+                 ? 0 : BSDF_TRANSMISSION))),
+_lobes(lobes),
+_distrib(alphax, alphay, true),
+_transDistrib(transAlphax, transAlphay, true),
+_clearcoatAlpha(lerp(lobes.clearcoatGloss, .1f, .001f)),
+_mode(mode) {
+    _hasFakeSS = !lobes.fakeSS.IsBlack();
+    _hasSheen = !lobes.sheen.IsBlack();
+    _hasDiffuse = !lobes.diffuse.IsBlack() || _hasFakeSS || _hasSheen || !lobes.retro.IsBlack();
+    _hasSpecTrans = !lobes.specTrans.IsBlack();
+    _hasDiffTrans = !lobes.diffTrans.IsBlack();
+    // 逆反射的强度与粗糙度成正比
+    _diffuseAlbedo = Spectrum(lobes.diffuse + lobes.fakeSS + lobes.sheen).y() +
+                    lobes.roughness * lobes.retro.y();
+    _specR0Y = lobes.specR0.y();
+    _specTransY = lobes.specTrans.y();
+    _diffTransY = lobes.diffTrans.y();
+}
+
+Spectrum DisneyBxDF::f(const Vector3f &wo, const Vector3f &wi) const {
+    Float cosThetaO = absCosTheta(wo), cosThetaI = absCosTheta(wi);
+    if (cosThetaO == 0 || cosThetaI == 0) {
+        return Spectrum(0.f);
+    }
+    Spectrum ret(0.f);
+    if (sameHemisphere(wo, wi)) {
+        Vector3f wh = wi + wo;
+        if (wh.x == 0 && wh.y == 0 && wh.z == 0) {
+            return Spectrum(0.f);
+        }
+        wh = normalize(wh);
+        // 所有反射波瓣共享半程向量与θd
+        Float cosThetaD = dot(wi, wh);
+        
+        if (_hasDiffuse) {
+            Float Fo = schlickWeight(cosThetaO), Fi = schlickWeight(cosThetaI);
+            // Burley漫反射，掠射角的反射率降低一半
+            ret += _lobes.diffuse * (InvPi * (1 - Fo / 2) * (1 - Fi / 2));
+            
+            // 逆反射，粗糙表面在掠射角的反射率会升高
+            Float Rr = 2 * _lobes.roughness * cosThetaD * cosThetaD;
+            ret += _lobes.retro * (InvPi * Rr * (Fo + Fi + Fo * Fi * (Rr - 1)));
+            
+            if (_hasFakeSS) {
+                // Hanrahan-Krueger次表面散射的近似
+                Float Fss90 = cosThetaD * cosThetaD * _lobes.roughness;
+                Float Fss = lerp(Fo, 1, Fss90) * lerp(Fi, 1, Fss90);
+                Float ss = 1.25f * (Fss * (1 / (cosThetaO + cosThetaI) - .5f) + .5f);
+                ret += _lobes.fakeSS * (InvPi * ss);
+            }
+            
+            if (_hasSheen) {
+                ret += _lobes.sheen * schlickWeight(cosThetaD);
+            }
+        }
+        
+        // 高光反射，遮挡项为两个方向的G1的乘积
+        Spectrum F = disneyFresnel(_lobes.specR0, _lobes.metallic, _lobes.eta, cosThetaD);
+        Float G = _distrib.G1(wo) * _distrib.G1(wi);
+        ret += F * (_distrib.D(wh) * G / (4 * cosThetaI * cosThetaO));
+        
+        if (_lobes.clearcoat > 0) {
+            Float Dr = GTR1(absCosTheta(wh), _clearcoatAlpha);
+            Float Fr = frSchlick(.04f, dot(wo, wh));
+            Float Gr = smithG_GGX(cosThetaO, .25f) * smithG_GGX(cosThetaI, .25f);
+            ret += Spectrum(_lobes.clearcoat * Gr * Fr * Dr / 4);
+        }
+    } else {
+        if (_hasSpecTrans) {
+            Float eta = cosTheta(wo) > 0 ? _lobes.eta : 1 / _lobes.eta;
+            Vector3f wh = normalize(wo + wi * eta);
+            if (wh.z < 0) {
+                wh = -wh;
+            }
+            // 微表面法线朝向外侧，wo与wi都需要在微表面与宏观表面的同一侧，
+            // 否则采样不到该方向，需要同时排除
+            if (wh.z != 0 && dot(wo, wh) * cosTheta(wo) > 0 && dot(wi, wh) * cosTheta(wi) > 0) {
+                Float F = FrDielectric(dot(wo, wh), 1, _lobes.eta);
+                Float sqrtDenom = dot(wo, wh) + eta * dot(wi, wh);
+                Float factor = (_mode == TransportMode::Radiance) ? (1 / eta) : 1;
+                Float G = _transDistrib.G1(wo) * _transDistrib.G1(wi);
+                ret += _lobes.specTrans * ((1 - F) *
+                        std::abs(_transDistrib.D(wh) * G * eta * eta *
+                                 absDot(wi, wh) * absDot(wo, wh) * factor * factor /
+                                 (cosThetaI * cosThetaO * sqrtDenom * sqrtDenom)));
+            }
+        }
+        if (_hasDiffTrans) {
+            ret += _lobes.diffTrans * InvPi;
+        }
+    }
+    return ret;
+}
+
+void DisneyBxDF::lobeWeights(const Vector3f &wo, Float weights[NumLobes]) const {
+    // 有效的波瓣至少有这个权重，避免反照率估计偏低的波瓣几乎采样不到
+    const Float minWeight = 0.02f;
+    Float cosThetaO = absCosTheta(wo);
+    // 高光反射与透射共用同一个电介质菲涅尔项
+    // wo在内侧时宏观法线方向可能全反射，但粗糙的微表面仍然可以折射，
+    // 直接用宏观的菲涅尔项会使透射波瓣几乎采样不到，所以统一按外侧入射估计
+    Float Fr = FrDielectric(cosThetaO, 1, _lobes.eta);
+    weights[Diffuse] = _hasDiffuse ? std::max(_diffuseAlbedo, minWeight) : 0;
+    // 用R0的亮度估计高光的菲涅尔项，Schlick近似对R0是线性的
+    Float Fs = lerp(_lobes.metallic, Fr, frSchlick(_specR0Y, cosThetaO));
+    weights[Specular] = std::max(Fs, minWeight);
+    weights[Clearcoat] = _lobes.clearcoat > 0
+                        ? std::max(.25f * _lobes.clearcoat * frSchlick(.04f, cosThetaO), minWeight)
+                        : 0;
+    Float transScale = 1;
+    if (_mode == TransportMode::Radiance) {
+        // 辐射度经过折射之后按相对折射率的平方缩放
+        transScale = cosTheta(wo) > 0 ? 1 / (_lobes.eta * _lobes.eta) : _lobes.eta * _lobes.eta;
+    }
+    weights[SpecTrans] = _hasSpecTrans
+                        ? std::max(_specTransY * (1 - Fr) * transScale, minWeight)
+                        : 0;
+    weights[DiffTrans] = _hasDiffTrans ? std::max(_diffTransY, minWeight) : 0;
+    Float sum = 0;
+    for (int i = 0; i < NumLobes; ++i) {
+        sum += weights[i];
+    }
+    for (int i = 0; i < NumLobes; ++i) {
+        weights[i] /= sum;
+    }
+}
+
+Float DisneyBxDF::pdfDir(const Vector3f &wo, const Vector3f &wi,
+                         const Float weights[NumLobes]) const {
+    Float pdf = 0;
+    if (sameHemisphere(wo, wi)) {
+        if (weights[Diffuse] > 0) {
+            pdf += weights[Diffuse] * absCosTheta(wi) * InvPi;
+        }
+        Vector3f wh = wo + wi;
+        if (wh.x == 0 && wh.y == 0 && wh.z == 0) {
+            return pdf;
+        }
+        wh = normalize(wh);
+        Float cosThetaD = dot(wo, wh);
+        pdf += weights[Specular] * _distrib.pdfDir(wo, wh) / (4 * cosThetaD);
+        if (weights[Clearcoat] > 0) {
+            Float Dr = GTR1(absCosTheta(wh), _clearcoatAlpha);
+            pdf += weights[Clearcoat] * Dr * absCosTheta(wh) / (4 * cosThetaD);
+        }
+    } else {
+        if (weights[SpecTrans] > 0) {
+            Float eta = cosTheta(wo) > 0 ? _lobes.eta : 1 / _lobes.eta;
+            Vector3f wh = normalize(wo + wi * eta);
+            if (wh.z < 0) {
+                wh = -wh;
+            }
+            if (wh.z != 0 && dot(wo, wh) * cosTheta(wo) > 0 && dot(wi, wh) * cosTheta(wi) > 0) {
+                Float sqrtDenom = dot(wo, wh) + eta * dot(wi, wh);
+                Float dwh_dwi = std::abs((eta * eta * dot(wi, wh)) / (sqrtDenom * sqrtDenom));
+                pdf += weights[SpecTrans] * _transDistrib.pdfDir(wo, wh) * dwh_dwi;
+            }
+        }
+        if (weights[DiffTrans] > 0) {
+            pdf += weights[DiffTrans] * absCosTheta(wi) * InvPi;
+        }
+    }
+    return pdf;
+}
+
+Float DisneyBxDF::pdfDir(const Vector3f &wo, const Vector3f &wi) const {
+    Float weights[NumLobes];
+    lobeWeights(wo, weights);
+    return pdfDir(wo, wi, weights);
+}
+
+Spectrum DisneyBxDF::sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
+                              Float *pdf, BxDFType *sampledType) const {
+    *pdf = 0;
+    if (wo.z == 0) {
+        return Spectrum(0.f);
+    }
+    Float weights[NumLobes];
+    lobeWeights(wo, weights);
+    
+    // 按权重选择波瓣，并把u[0]重新映射到[0, 1)
+    int lobe = -1;
+    Float u0 = u[0];
+    for (int i = 0; i < NumLobes; ++i) {
+        if (weights[i] == 0) {
+            continue;
+        }
+        lobe = i;
+        if (u0 < weights[i]) {
+            break;
+        }
+        u0 -= weights[i];
+    }
+    Point2f uRemapped(std::min(u0 / weights[lobe], OneMinusEpsilon), u[1]);
+    
+    BxDFType type;
+    switch (lobe) {
+        case Diffuse: {
+            *wi = cosineSampleHemisphere(uRemapped);
+            if (wo.z < 0) {
+                wi->z *= -1;
+            }
+            type = BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE);
+            break;
+        }
+        case Specular: {
+            Vector3f wh = _distrib.sample_wh(wo, uRemapped);
+            if (dot(wo, wh) < 0) {
+                return Spectrum(0.f);
+            }
+            *wi = reflect(wo, wh);
+            if (!sameHemisphere(wo, *wi)) {
+                return Spectrum(0.f);
+            }
+            type = BxDFType(BSDF_REFLECTION | BSDF_GLOSSY);
+            break;
+        }
+        case Clearcoat: {
+            // 按GTR1分布采样半程向量
+            Float alpha2 = _clearcoatAlpha * _clearcoatAlpha;
+            Float cosTheta = std::sqrt(std::max(Float(0),
+                                (1 - std::pow(alpha2, 1 - uRemapped[0])) / (1 - alpha2)));
+            Float sinTheta = std::sqrt(std::max((Float)0, 1 - cosTheta * cosTheta));
+            Float phi = 2 * Pi * uRemapped[1];
+            Vector3f wh = sphericalDirection(sinTheta, cosTheta, phi);
+            if (!sameHemisphere(wo, wh)) {
+                wh = -wh;
+            }
+            *wi = reflect(wo, wh);
+            if (!sameHemisphere(wo, *wi)) {
+                return Spectrum(0.f);
+            }
+            type = BxDFType(BSDF_REFLECTION | BSDF_GLOSSY);
+            break;
+        }
+        case SpecTrans: {
+            Vector3f wh = _transDistrib.sample_wh(wo, uRemapped);
+            // 背向wo的微表面无法折射
+            if (dot(wo, wh) < 0) {
+                return Spectrum(0.f);
+            }
+            Float eta = cosTheta(wo) > 0 ? (1 / _lobes.eta) : _lobes.eta;
+            // 折射之后仍在wo一侧的方向由反射波瓣负责，否则概率密度对不上
+            if (!refract(wo, (Normal3f)wh, eta, wi) || sameHemisphere(wo, *wi)) {
+                return Spectrum(0.f);
+            }
+            type = BxDFType(BSDF_TRANSMISSION | BSDF_GLOSSY);
+            break;
+        }
+        default: {
+            *wi = cosineSampleHemisphere(uRemapped);
+            if (wo.z > 0) {
+                wi->z *= -1;
+            }
+            type = BxDFType(BSDF_TRANSMISSION | BSDF_DIFFUSE);
+            break;
+        }
+    }
+    
+    *pdf = pdfDir(wo, *wi, weights);
+    if (*pdf == 0) {
+        return Spectrum(0.f);
+    }
+    if (sampledType) {
+        *sampledType = type;
+    }
+    return f(wo, *wi);
+}
+
+std::string DisneyBxDF::toString() const {
+    return StringPrintf("[ DisneyBxDF roughness: %f metallic: %f eta: %f clearcoat: %f ]",
+                        _lobes.roughness, _lobes.metallic, _lobes.eta,
+                        _lobes.clearcoat) +
+            std::string(" diffuse: ") + _lobes.diffuse.ToString() +
+            std::string(" specTrans: ") + _lobes.specTrans.ToString();
+}
+
+void DisneyMaterial::computeScatteringFunctions(SurfaceInteraction *si,
+                                                MemoryArena &arena,
+                                                TransportMode mode,
+                                                bool allowMultipleLobes) const {
+    processNormal(si);
+    
+    // 所有参数由纹理程序一次求值
+    TextureValues tex = _textures.execute(*si, arena);
+    Spectrum c = tex.get(_colorReg).clamp();
+    Float metallicWeight = tex.get(_metallicReg);
+    Float e = tex.get(_etaReg);
+    Float strans = tex.get(_specTransReg);
+    Float diffuseWeight = (1 - metallicWeight) * (1 - strans);
+    // 为0时漫反射全部反射，为1时全部透射，只用于thin模式
+    Float dt = tex.get(_diffTransReg) / 2;
+    Float rough = tex.get(_roughnessReg);
+    Float lum = c.y();
+    // 归一化亮度之后的颜色，用于给高光以及sheen着色
+    Spectrum Ctint = lum > 0 ? (c / lum) : Spectrum(1.f);
+    
+    DisneyLobes lobes;
+    lobes.roughness = rough;
+    lobes.metallic = metallicWeight;
+    lobes.eta = e;
+    
+    // 非thin模式下指定了平均自由程，漫反射部分改为真正的次表面散射
+    Spectrum sd = (!_thin && _scatterDistance) ? tex.get(_scatterDistanceReg) : Spectrum(0.f);
+    bool useBSSRDF = diffuseWeight > 0 && !sd.IsBlack();
+    
+    if (diffuseWeight > 0) {
+        if (_thin) {
+            Float flat = tex.get(_flatnessReg);
+            lobes.diffuse = c * (diffuseWeight * (1 - flat) * (1 - dt));
+            lobes.fakeSS = c * (diffuseWeight * flat * (1 - dt));
+        } else if (!useBSSRDF) {
+            lobes.diffuse = c * diffuseWeight;
+        }
+        lobes.retro = c * diffuseWeight;
+        
+        Float sheenWeight = tex.get(_sheenReg);
+        if (sheenWeight > 0) {
+            Float sheenTint = tex.get(_sheenTintReg);
+            lobes.sheen = lerp(sheenTint, Spectrum(1.f), Ctint) * (diffuseWeight * sheenWeight);
+        }
+    }
+    
+    // 各向异性通过两个方向的alpha的比例实现
+    Float aspect = std::sqrt(1 - tex.get(_anisotropicReg) * .9f);
+    Float ax = std::max(Float(.001), rough * rough / aspect);
+    Float ay = std::max(Float(.001), rough * rough * aspect);
+    
+    Float specTint = tex.get(_specularTintReg);
+    lobes.specR0 = lerp(metallicWeight,
+                        lerp(specTint, Spectrum(1.f), Ctint) * schlickR0FromEta(e), c);
+    
+    Float cc = tex.get(_clearcoatReg);
+    if (cc > 0) {
+        lobes.clearcoat = cc;
+        lobes.clearcoatGloss = tex.get(_clearcoatGlossReg);
+    }
+    
+    Float tax = ax, tay = ay;
+    if (strans > 0) {
+        lobes.specTrans = Sqrt(c) * strans;
+        if (_thin) {
+            // thin模式下透射的粗糙度按折射率缩放
+            Float rscaled = (0.65f * e - 0.35f) * rough;
+            tax = std::max(Float(.001), rscaled * rscaled / aspect);
+            tay = std::max(Float(.001), rscaled * rscaled * aspect);
+        }
+    }
+    
+    if (_thin) {
+        lobes.diffTrans = c * dt;
+    }
+    
+    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
+    si->bsdf->add(ARENA_ALLOC(arena, DisneyBxDF)(lobes, ax, ay, tax, tay, mode));
+    
+    if (useBSSRDF) {
+        // 与SubsurfaceMaterial相同，积分器采样到折射分量时，再由BSSRDF采样入射点
+        si->bsdf->add(ARENA_ALLOC(arena, SpecularTransmission)(Spectrum(1.f), 1.f, e, mode));
+        Spectrum sigma_a, sigma_s;
+        subsurfaceFromDiffuse(*_table, c * diffuseWeight, sd, &sigma_a, &sigma_s);
+        si->bssrdf = ARENA_ALLOC(arena, TabulatedBSSRDF)(*si, this, mode, e,
+                                                         sigma_a, sigma_s, *_table);
+    }
+}
+
+//"param" : {
+//    "color" : [0.5, 0.5, 0.5],
+//    "metallic" : 0,
+//    "eta" : 1.5,
+//    "roughness" : 0.5,
+//    "specularTint" : 0,
+//    "anisotropic" : 0,
+//    "sheen" : 0,
+//    "sheenTint" : 0.5,
+//    "clearcoat" : 0,
+//    "clearcoatGloss" : 1,
+//    "specTrans" : 0,
+//    "scatterDistance" : null,
+//    "thin" : false,
+//    "flatness" : 0,
+//    "diffTrans" : 1,
+//    "normalMap" : null,
+//    "bumpMap" : null
+//}
+// scatterDistance为平均自由程，非thin模式下不为空时，漫反射由次表面散射代替
+// BSSRDF表格按eta建立，eta为纹理时按1.5建表
+CObject_ptr createDisney(const nloJson &param, const Arguments &lst) {
+    nloJson _color = param.value("color", nloJson::array({0.5f, 0.5f, 0.5f}));
+    auto color = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_color));
+    
+    nloJson _metallic = param.value("metallic", nloJson(0.f));
+    auto metallic = shared_ptr<Texture<Float>>(createFloatTexture(_metallic));
+    
+    nloJson _eta = param.value("eta", nloJson(1.5f));
+    auto eta = shared_ptr<Texture<Float>>(createFloatTexture(_eta));
+    
+    nloJson _roughness = param.value("roughness", nloJson(0.5f));
+    auto roughness = shared_ptr<Texture<Float>>(createFloatTexture(_roughness));
+    
+    nloJson _specularTint = param.value("specularTint", nloJson(0.f));
+    auto specularTint = shared_ptr<Texture<Float>>(createFloatTexture(_specularTint));
+    
+    nloJson _anisotropic = param.value("anisotropic", nloJson(0.f));
+    auto anisotropic = shared_ptr<Texture<Float>>(createFloatTexture(_anisotropic));
+    
+    nloJson _sheen = param.value("sheen", nloJson(0.f));
+    auto sheen = shared_ptr<Texture<Float>>(createFloatTexture(_sheen));
+    
+    nloJson _sheenTint = param.value("sheenTint", nloJson(0.5f));
+    auto sheenTint = shared_ptr<Texture<Float>>(createFloatTexture(_sheenTint));
+    
+    nloJson _clearcoat = param.value("clearcoat", nloJson(0.f));
+    auto clearcoat = shared_ptr<Texture<Float>>(createFloatTexture(_clearcoat));
+    
+    nloJson _clearcoatGloss = param.value("clearcoatGloss", nloJson(1.f));
+    auto clearcoatGloss = shared_ptr<Texture<Float>>(createFloatTexture(_clearcoatGloss));
+    
+    nloJson _specTrans = param.value("specTrans", nloJson(0.f));
+    auto specTrans = shared_ptr<Texture<Float>>(createFloatTexture(_specTrans));
+    
+    nloJson _scatterDistance = param.value("scatterDistance", nloJson());
+    shared_ptr<Texture<Spectrum>> scatterDistance;
+    shared_ptr<const BSSRDFTable> table;
+    if (!_scatterDistance.is_null()) {
+        scatterDistance.reset(createSpectrumTexture(_scatterDistance));
+        Float tableEta = _eta.is_number() ? _eta.get<Float>() : 1.5f;
+        table = BSSRDFTable::getBeamDiffusionTable(0.f, tableEta);
+    }
+    
+    bool thin = param.value("thin", false);
+    
+    nloJson _flatness = param.value("flatness", nloJson(0.f));
+    auto flatness = shared_ptr<Texture<Float>>(createFloatTexture(_flatness));
+    
+    nloJson _diffTrans = param.value("diffTrans", nloJson(1.f));
+    auto diffTrans = shared_ptr<Texture<Float>>(createFloatTexture(_diffTrans));
+    
+    nloJson _normalMap = param.value("normalMap", nloJson());
+    auto normalMap = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_normalMap));
+    
+    nloJson _bumpMap = param.value("bumpMap", nloJson());
+    auto bumpMap = shared_ptr<Texture<Float>>(createFloatTexture(_bumpMap));
+    
+    auto ret = new DisneyMaterial(color, metallic, eta, roughness, specularTint,
+                                  anisotropic, sheen, sheenTint, clearcoat,
+                                  clearcoatGloss, specTrans, scatterDistance,
+                                  table, thin, flatness, diffTrans, normalMap, bumpMap);
+    return ret;
+}
+
+REGISTER("disney", createDisney)
+
+PALADIN_END
@@ -9,11 +9,149 @@
 #define disney_hpp
 
 #include "core/material.hpp"
+#include "core/bxdf.hpp"
+#include "materials/bxdfs/microfacet/distribute.hpp"
 
 PALADIN_BEGIN
 
+struct BSSRDFTable;
+
+/**
+ * 迪士尼材质(principled BSDF)
+ * 参考 https://blog.selfshadow.com/publications/s2015-shading-course/burley/s2015_pbs_disney_bsdf_notes.pdf
+ * 以及pbrt-v3中的实现
+ *
+ * 由以下几个波瓣组成
+ *
+ *     漫反射        Burley漫反射加上逆反射(retro-reflection)，thin模式下还有近似次表面散射的fakeSS
+ *     光泽(sheen)   布料边缘的高光
+ *     高光反射      各向异性GGX，菲涅尔项在金属的Schlick与电介质之间插值
+ *     清漆层        GTR1分布
+ *     高光透射      粗糙电介质透射
+ *     漫透射        只用于thin模式
+ *
+ * 各个波瓣共享半程向量，菲涅尔权重等中间量，
+ * 所以不像HyperMaterial一样每个波瓣分配一个BxDF，而是合并为一个DisneyBxDF，
+ * 一次计算所有波瓣，省去BSDF对每个BxDF的虚函数调用以及重复计算
+ */
+
+inline Float schlickWeight(Float cosTheta) {
+    Float m = clamp(1 - cosTheta, 0, 1);
+    return (m * m) * (m * m) * m;
+}
+
+inline Float frSchlick(Float R0, Float cosTheta) {
+    return lerp(schlickWeight(cosTheta), R0, 1);
+}
+
+inline Spectrum frSchlick(const Spectrum &R0, Float cosTheta) {
+    return lerp(schlickWeight(cosTheta), R0, Spectrum(1.f));
+}
+
+// 由折射率计算法线方向的反射率
+inline Float schlickR0FromEta(Float eta) {
+    return (eta - 1) * (eta - 1) / ((eta + 1) * (eta + 1));
+}
+
+// 清漆层的法线分布
+inline Float GTR1(Float cosTheta, Float alpha) {
+    Float alpha2 = alpha * alpha;
+    return (alpha2 - 1) /
+           (Pi * std::log(alpha2) * (1 + (alpha2 - 1) * cosTheta * cosTheta));
+}
+
+// 清漆层的遮挡项，固定使用alpha = 0.25
+inline Float smithG_GGX(Float cosTheta, Float alpha) {
+    Float alpha2 = alpha * alpha;
+    Float cosTheta2 = cosTheta * cosTheta;
+    return 1 / (cosTheta + std::sqrt(alpha2 + cosTheta2 - alpha2 * cosTheta2));
+}
+
+/**
+ * 金属部分用Schlick近似，电介质部分用精确的菲涅尔函数，按金属度插值
+ */
+inline Spectrum disneyFresnel(const Spectrum &R0, Float metallic, Float eta, Float cosI) {
+    return lerp(metallic, Spectrum(FrDielectric(cosI, 1, eta)), frSchlick(R0, cosI));
+}
+
+/**
+ * 迪士尼材质中已经计算好的各个波瓣的参数，由DisneyMaterial根据纹理计算
+ * 为零的波瓣不参与计算
+ */
+struct DisneyLobes {
+    // Burley漫反射
+    Spectrum diffuse = Spectrum(0.f);
+    // thin模式下近似次表面散射
+    Spectrum fakeSS = Spectrum(0.f);
+    // 逆反射
+    Spectrum retro = Spectrum(0.f);
+    Spectrum sheen = Spectrum(0.f);
+    // 高光反射法线方向的反射率
+    Spectrum specR0 = Spectrum(0.f);
+    // 高光透射
+    Spectrum specTrans = Spectrum(0.f);
+    // thin模式下的漫透射
+    Spectrum diffTrans = Spectrum(0.f);
+    Float roughness = 0;
+    Float metallic = 0;
+    Float eta = 1.5;
+    Float clearcoat = 0;
+    Float clearcoatGloss = 1;
+};
+
+/**
+ * 采样时先按照各个波瓣估计的反照率选择一个波瓣，
+ * 由该波瓣采样wi，概率密度为所有波瓣概率密度按照选择概率的加权和
+ * 反照率的估计依赖wo，所以pdfDir与sample_f使用同一套权重
+ */
+class DisneyBxDF : public BxDF {
+public:
+    enum {
+        Diffuse,
+        Specular,
+        Clearcoat,
+        SpecTrans,
+        DiffTrans,
+        NumLobes
+    };
+
+    DisneyBxDF(const DisneyLobes &lobes, Float alphax, Float alphay,
+               Float transAlphax, Float transAlphay, TransportMode mode);
+
+    virtual Spectrum f(const Vector3f &wo, const Vector3f &wi) const override;
+
+    virtual Spectrum sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
+                              Float *pdf, BxDFType *sampledType) const override;
+
+    virtual Float pdfDir(const Vector3f &wo, const Vector3f &wi) const override;
+
+    virtual std::string toString() const override;
+
+private:
+    /**
+     * 根据wo估计各个波瓣的反照率，归一化之后作为选择波瓣的概率
+     */
+    void lobeWeights(const Vector3f &wo, Float weights[NumLobes]) const;
+
+    // 各个波瓣单独的概率密度，按照weights加权求和
+    Float pdfDir(const Vector3f &wo, const Vector3f &wi,
+                 const Float weights[NumLobes]) const;
+
+    DisneyLobes _lobes;
+    // 高光反射与透射的GGX分布，thin模式下透射的粗糙度按折射率缩放
+    GGXDistribution _distrib;
+    GGXDistribution _transDistrib;
+    // 清漆层GTR1的alpha
+    Float _clearcoatAlpha;
+    // 构造时判断各个波瓣是否为零，避免每次求值都对光谱做判断
+    bool _hasDiffuse, _hasFakeSS, _hasSheen, _hasSpecTrans, _hasDiffTrans;
+    // 与wo无关的反照率估计，用于选择波瓣
+    Float _diffuseAlbedo, _specR0Y, _specTransY, _diffTransY;
+    const TransportMode _mode;
+};
+
 class DisneyMaterial : public Material {
-    
+
 public:
 	DisneyMaterial(const std::shared_ptr<Texture<Spectrum>> &color,
 					const std::shared_ptr<Texture<Float>> &metallic,
@@ -27,11 +165,14 @@ public:
 					const std::shared_ptr<Texture<Float>> &clearcoatGloss,
 					const std::shared_ptr<Texture<Float>> &specTrans,
 					const std::shared_ptr<Texture<Spectrum>> &scatterDistance,
+					const std::shared_ptr<const BSSRDFTable> &table,
 					bool thin,
 					const std::shared_ptr<Texture<Float>> &flatness,
 					const std::shared_ptr<Texture<Float>> &diffTrans,
+					const std::shared_ptr<Texture<Spectrum>> &normalMap,
 					const std::shared_ptr<Texture<Float>> &bumpMap)
-	: _color(color),
+	: Material(normalMap, bumpMap),
+	_color(color),
 	_metallic(metallic),
 	_eta(eta),
 	_roughness(roughness),
@@ -43,33 +184,59 @@ public:
 	_clearcoatGloss(clearcoatGloss),
 	_specTrans(specTrans),
 	_scatterDistance(scatterDistance),
+	_table(table),
 	_thin(thin),
 	_flatness(flatness),
-	_diffTrans(diffTrans),
-	_bumpMap(bumpMap) {
-		
+	_diffTrans(diffTrans) {
+		_colorReg = _textures.add(_color);
+		_metallicReg = _textures.add(_metallic);
+		_etaReg = _textures.add(_eta);
+		_roughnessReg = _textures.add(_roughness);
+		_specularTintReg = _textures.add(_specularTint);
+		_anisotropicReg = _textures.add(_anisotropic);
+		_sheenReg = _textures.add(_sheen);
+		_sheenTintReg = _textures.add(_sheenTint);
+		_clearcoatReg = _textures.add(_clearcoat);
+		_clearcoatGlossReg = _textures.add(_clearcoatGloss);
+		_specTransReg = _textures.add(_specTrans);
+		_flatnessReg = _textures.add(_flatness);
+		_diffTransReg = _textures.add(_diffTrans);
+		if (_scatterDistance) {
+			_scatterDistanceReg = _textures.add(_scatterDistance);
+		}
 	}
-    
+
     virtual nloJson toJson() const override {
         return nloJson();
     }
-    
+
     virtual void computeScatteringFunctions(SurfaceInteraction *si,
                                             MemoryArena &arena,
                                             TransportMode mode,
                                             bool allowMultipleLobes) const override;
-    
+
 private:
 	std::shared_ptr<Texture<Spectrum>> _color;
 	std::shared_ptr<Texture<Float>> _metallic, _eta;
 	std::shared_ptr<Texture<Float>> _roughness, _specularTint, _anisotropic, _sheen;
 	std::shared_ptr<Texture<Float>> _sheenTint, _clearcoat, _clearcoatGloss;
 	std::shared_ptr<Texture<Float>> _specTrans;
+	// 平均自由程，非thin模式下不为空时，漫反射波瓣由次表面散射代替
+	// 为空时次表面散射由漫反射波瓣近似
 	std::shared_ptr<Texture<Spectrum>> _scatterDistance;
+	// 用于由漫反射颜色与平均自由程反推散射系数，_scatterDistance为空时也为空
+	std::shared_ptr<const BSSRDFTable> _table;
 	bool _thin;
-	std::shared_ptr<Texture<Float>> _flatness, _diffTrans, _bumpMap;
+	std::shared_ptr<Texture<Float>> _flatness, _diffTrans;
+	TextureReg<Spectrum> _colorReg;
+	TextureReg<Float> _metallicReg, _etaReg, _roughnessReg, _specularTintReg, _anisotropicReg;
+	TextureReg<Float> _sheenReg, _sheenTintReg, _clearcoatReg, _clearcoatGlossReg;
+	TextureReg<Float> _specTransReg, _flatnessReg, _diffTransReg;
+	TextureReg<Spectrum> _scatterDistanceReg;
 };
 
+CObject_ptr createDisney(const nloJson &param, const Arguments &lst);
+
 PALADIN_END
 
 #endif /* disney_hpp */
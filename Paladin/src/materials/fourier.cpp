@@ -0,0 +1,65 @@
+//
+//  fourier.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/10.
+//
+
+#include "fourier.hpp"
+#include "core/texture.hpp"
+#include "core/paladin.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+#include <map>
+#include <mutex>
+
+PALADIN_BEGIN
+
+void FourierMaterial::computeScatteringFunctions(SurfaceInteraction *si,
+                                                 MemoryArena &arena,
+                                                 TransportMode mode,
+                                                 bool allowMultipleLobes) const {
+    processNormal(si);
+    
+    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
+    // 通道数为0说明文件读取失败，此时没有任何散射
+    if (_bsdfTable->nChannels > 0) {
+        si->bsdf->add(ARENA_ALLOC(arena, FourierBSDF)(*_bsdfTable, mode));
+    }
+}
+
+shared_ptr<const FourierBSDFTable> FourierMaterial::getBSDFTable(const std::string &fileName) {
+    static std::mutex mutex;
+    static std::map<std::string, shared_ptr<const FourierBSDFTable>> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = tables.find(fileName);
+    if (iter != tables.end()) {
+        return iter->second;
+    }
+    auto table = make_shared<FourierBSDFTable>();
+    FourierBSDFTable::read(fileName, table.get());
+    tables[fileName] = table;
+    return table;
+}
+
+//"param" : {
+//    "fileName" : "res/ceramic.bsdf",
+//    "normalMap" : null,
+//    "bumpMap" : 0
+//}
+CObject_ptr createFourier(const nloJson &param, const Arguments &lst) {
+    string fn = param.value("fileName", "");
+    auto bsdfTable = FourierMaterial::getBSDFTable(Paladin::getInstance()->getBasePath() + fn);
+    
+    nloJson _normalMap = param.value("normalMap", nloJson());
+    auto normalMap = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_normalMap));
+    
+    nloJson _bumpMap = param.value("bumpMap", nloJson(0.f));
+    auto bumpMap = shared_ptr<Texture<Float>>(createFloatTexture(_bumpMap));
+    
+    auto ret = new FourierMaterial(bsdfTable, normalMap, bumpMap);
+    return ret;
+}
+
+REGISTER("fourier", createFourier)
+
+PALADIN_END
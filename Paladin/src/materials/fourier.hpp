@@ -0,0 +1,52 @@
+//
+//  fourier.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/10.
+//
+
+#ifndef fourier_hpp
+#define fourier_hpp
+
+#include "core/header.h"
+#include "core/material.hpp"
+#include "materials/bxdfs/fourierbsdf.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * 测量材质，BSDF数据从文件中读取，用FourierBSDF表示
+ * 同一个文件只会读取一次，多个材质共享同一个FourierBSDFTable
+ */
+class FourierMaterial : public Material {
+public:
+    FourierMaterial(const shared_ptr<const FourierBSDFTable> &bsdfTable,
+                    const std::shared_ptr<Texture<Spectrum>> &normalMap,
+                    const std::shared_ptr<Texture<Float>> &bump)
+    : Material(normalMap, bump),
+    _bsdfTable(bsdfTable) {
+        
+    }
+    
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+    
+    virtual void computeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena,
+                                    TransportMode mode,
+                                    bool allowMultipleLobes) const override;
+    
+    /**
+     * 按文件名缓存读取的FourierBSDFTable，读取失败时返回的表nChannels为0
+     */
+    static shared_ptr<const FourierBSDFTable> getBSDFTable(const std::string &fileName);
+    
+private:
+    shared_ptr<const FourierBSDFTable> _bsdfTable;
+};
+
+CObject_ptr createFourier(const nloJson &param, const Arguments &lst);
+
+PALADIN_END
+
+#endif /* fourier_hpp */
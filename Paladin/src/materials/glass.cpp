@@ -22,11 +22,12 @@ void GlassMaterial::computeScatteringFunctions(SurfaceInteraction *si,
                                                bool allowMultipleLobes) const {
     processNormal(si);
     
-    Float eta = _eta->evaluate(*si);
-    Float urough = _uRoughness->evaluate(*si);
-    Float vrough = _vRoughness->evaluate(*si);
-    Spectrum R = _Kr->evaluate(*si).clamp();
-    Spectrum T = _Kt->evaluate(*si).clamp();
+    TextureValues tex = _textures.execute(*si, arena);
+    Float eta = tex.get(_etaReg);
+    Float urough = tex.get(_uRoughnessReg);
+    Float vrough = tex.get(_vRoughnessReg);
+    Spectrum R = tex.get(_KrReg).clamp();
+    Spectrum T = tex.get(_KtReg).clamp();
     
     si->bsdf = ARENA_ALLOC(arena, BSDF)(*si,eta);
     
@@ -32,7 +32,11 @@ public:
     _eta(eta),
     _remapRoughness(remapRoughness),
     _thin(thin) {
-        
+        _KrReg = _textures.add(_Kr);
+        _KtReg = _textures.add(_Kt);
+        _uRoughnessReg = _textures.add(_uRoughness);
+        _vRoughnessReg = _textures.add(_vRoughness);
+        _etaReg = _textures.add(_eta);
     }
     
     virtual nloJson toJson() const override {
@@ -48,6 +52,8 @@ private:
     std::shared_ptr<Texture<Spectrum>> _Kr, _Kt;
     std::shared_ptr<Texture<Float>> _uRoughness, _vRoughness;
     std::shared_ptr<Texture<Float>> _eta;
+    TextureReg<Spectrum> _KrReg, _KtReg;
+    TextureReg<Float> _uRoughnessReg, _vRoughnessReg, _etaReg;
     bool _remapRoughness;
     bool _thin;
 };
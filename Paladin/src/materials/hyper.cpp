@@ -20,9 +20,10 @@ void HyperMaterial::computeScatteringFunctions(SurfaceInteraction *si, MemoryAre
     
     processNormal(si);
     
-    Float eta = _eta->evaluate(*si);
+    TextureValues tex = _textures.execute(*si, arena);
+    Float eta = tex.get(_etaReg);
     // opacity不透明度
-    Spectrum opacity = _opacity->evaluate(*si).clamp();
+    Spectrum opacity = tex.get(_opacityReg).clamp();
     // t为透明度
     Spectrum t = (Spectrum(1.f) - opacity).clamp();
     if (!t.IsBlack()) {
@@ -35,27 +36,18 @@ void HyperMaterial::computeScatteringFunctions(SurfaceInteraction *si, MemoryAre
         si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, eta);
     }
     
-    Spectrum Kd = opacity * _Kd->evaluate(*si).clamp();
+    Spectrum Kd = opacity * tex.get(_KdReg).clamp();
     if (!Kd.IsBlack()) {
         auto diff = ARENA_ALLOC(arena, LambertianReflection)(Kd);
         si->bsdf->add(diff);
     }
     
-    Spectrum Ks = opacity * _Ks->evaluate(*si);
+    Spectrum Ks = opacity * tex.get(_KsReg);
     if (!Ks.IsBlack()) {
         // ks用于计算反射
         auto * fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, eta);
-        Float rough_u, rough_v;
-        if (_roughness_u) {
-            rough_u = _roughness_u->evaluate(*si);
-        } else {
-            rough_u = _roughness->evaluate(*si);
-        }
-        if (_roughness_v) {
-            rough_v = _roughness_v->evaluate(*si);
-        } else {
-            rough_v = _roughness->evaluate(*si);
-        }
+        Float rough_u = tex.get(_roughnessUReg);
+        Float rough_v = tex.get(_roughnessVReg);
         if (_remapRoughness) {
             rough_u = GGXDistribution::RoughnessToAlpha(rough_u);
             rough_v = GGXDistribution::RoughnessToAlpha(rough_v);
@@ -67,7 +59,7 @@ void HyperMaterial::computeScatteringFunctions(SurfaceInteraction *si, MemoryAre
     }
     
     if (_Kr) {
-        Spectrum Kr = opacity * _Kr->evaluate(*si);
+        Spectrum Kr = opacity * tex.get(_KrReg);
         if (!Kr.IsBlack()) {
             auto fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, eta);
             auto specR = ARENA_ALLOC(arena, SpecularReflection)(Kr, fresnel);
@@ -75,7 +67,7 @@ void HyperMaterial::computeScatteringFunctions(SurfaceInteraction *si, MemoryAre
         }
     }
     if (_Kt) {
-        Spectrum Kt = t * _Kt->evaluate(*si);
+        Spectrum Kt = t * tex.get(_KtReg);
         if (!Kt.IsBlack()) {
             auto specT = ARENA_ALLOC(arena, SpecularTransmission)(Kt, 1.f, eta, mode);
             si->bsdf->add(specT);
@@ -46,7 +46,14 @@ public:
 	_roughness_v(roughnessv),
 	_eta(eta),
     _remapRoughness(remapRoughness) {
-        
+        _KdReg = _textures.add(_Kd);
+        _KsReg = _textures.add(_Ks);
+        _KrReg = _textures.add(_Kr);
+        _KtReg = _textures.add(_Kt);
+        _opacityReg = _textures.add(_opacity);
+        _roughnessUReg = _textures.add(_roughness_u ? _roughness_u : _roughness);
+        _roughnessVReg = _textures.add(_roughness_v ? _roughness_v : _roughness);
+        _etaReg = _textures.add(_eta);
     }
     
     nloJson toJson() const override {
@@ -74,6 +81,8 @@ private:
     std::shared_ptr<Texture<Spectrum>> _Kd, _Ks, _Kr, _Kt, _opacity;
     std::shared_ptr<Texture<Float>> _roughness, _roughness_u,_roughness_v; 
     std::shared_ptr<Texture<Float>> _eta;
+    TextureReg<Spectrum> _KdReg, _KsReg, _KrReg, _KtReg, _opacityReg;
+    TextureReg<Float> _roughnessUReg, _roughnessVReg, _etaReg;
     bool _remapRoughness;
 };
 
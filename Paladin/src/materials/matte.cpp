@@ -25,8 +25,10 @@ void MatteMaterial::computeScatteringFunctions(SurfaceInteraction *si,
     processNormal(si);
 
 	si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
-	Spectrum r = _Kd->evaluate(*si).clamp();
-	Float sig = _sigma ? clamp(_sigma->evaluate(*si), 0, 90) : 0;
+	TextureValues tex = _textures.execute(*si, arena);
+	Spectrum r = tex.get(_KdReg).clamp();
+	// _sigma为空时寄存器为常量0
+	Float sig = clamp(tex.get(_sigmaReg), 0, 90);
 	if (!r.IsBlack()) {
 		if (sig == 0) {
 			// 如果粗糙度为零，朗博反射
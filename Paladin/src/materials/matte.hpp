@@ -29,7 +29,8 @@ public:
     : Material(normalMap, bumpMap),
     _Kd(Kd),
     _sigma(sigma) {
-
+        _KdReg = _textures.add(_Kd);
+        _sigmaReg = _textures.add(_sigma);
     }
     
     virtual nloJson toJson() const override {
@@ -46,6 +47,8 @@ private:
     std::shared_ptr<Texture<Spectrum>> _Kd;
     // 粗糙度
     std::shared_ptr<Texture<Float>> _sigma;
+    TextureReg<Spectrum> _KdReg;
+    TextureReg<Float> _sigmaReg;
 };
 
 /**
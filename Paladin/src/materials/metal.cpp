@@ -21,14 +21,15 @@ void MetalMaterial::computeScatteringFunctions(SurfaceInteraction *si,
     
     si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
     
-    Float uRough = _uRoughness ? _uRoughness->evaluate(*si) : _roughness->evaluate(*si);
-    Float vRough = _vRoughness ? _vRoughness->evaluate(*si) : _roughness->evaluate(*si);
+    TextureValues tex = _textures.execute(*si, arena);
+    Float uRough = tex.get(_uRoughnessReg);
+    Float vRough = tex.get(_vRoughnessReg);
     if (_remapRoughness) {
         uRough = GGXDistribution::RoughnessToAlpha(uRough);
         vRough = GGXDistribution::RoughnessToAlpha(vRough);
     }
-    Fresnel *frMf = ARENA_ALLOC(arena, FresnelConductor)(1., _eta->evaluate(*si),
-                                                         _k->evaluate(*si));
+    Fresnel *frMf = ARENA_ALLOC(arena, FresnelConductor)(1., tex.get(_etaReg),
+                                                         tex.get(_kReg));
     uRough = correctRoughness(uRough);
     vRough = correctRoughness(vRough);
     
@@ -30,7 +30,10 @@ public:
     _uRoughness(urough),
     _vRoughness(vrough),
     _remapRoughness(remapRoughness) {
-        
+        _etaReg = _textures.add(_eta);
+        _kReg = _textures.add(_k);
+        _uRoughnessReg = _textures.add(_uRoughness ? _uRoughness : _roughness);
+        _vRoughnessReg = _textures.add(_vRoughness ? _vRoughness : _roughness);
     }
     
     virtual nloJson toJson() const override {
@@ -45,6 +48,9 @@ private:
     // eta折射率，k吸收系数，详见bxdf.hpp文件
     std::shared_ptr<Texture<Spectrum>> _eta, _k;
     std::shared_ptr<Texture<Float>> _roughness, _uRoughness, _vRoughness;
+    TextureReg<Spectrum> _etaReg, _kReg;
+    // 没有单独指定u,v方向的粗糙度时与_roughness为同一个寄存器
+    TextureReg<Float> _uRoughnessReg, _vRoughnessReg;
     bool _remapRoughness;
 };
 
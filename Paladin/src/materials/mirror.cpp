@@ -22,7 +22,7 @@ void MirrorMaterial::computeScatteringFunctions(SurfaceInteraction *si,
     processNormal(si);
     
     si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
-    Spectrum R = _Kr->evaluate(*si).clamp();
+    Spectrum R = _textures.execute(*si, arena).get(_KrReg).clamp();
     if (!R.IsBlack()) {
         FresnelNoOp * fresnel = ARENA_ALLOC(arena, FresnelNoOp)();
         SpecularReflection * sr = ARENA_ALLOC(arena, SpecularReflection)(R, fresnel);
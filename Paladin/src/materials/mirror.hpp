@@ -20,7 +20,7 @@ public:
                    const std::shared_ptr<Texture<Float>> &bump)
     :Material(normalMap, bump),
     _Kr(r) {
-        
+        _KrReg = _textures.add(_Kr);
     }
     
     virtual nloJson toJson() const override {
@@ -33,6 +33,7 @@ public:
     
 private:
     std::shared_ptr<Texture<Spectrum>> _Kr;
+    TextureReg<Spectrum> _KrReg;
 };
 
 CObject_ptr createMirror(const nloJson &param, const Arguments &lst);
@@ -15,7 +15,7 @@ void MixMaterial::computeScatteringFunctions(SurfaceInteraction *si,
                                              MemoryArena &arena,
                                              TransportMode mode,
                                              bool allowMultipleLobes) const {
-    Spectrum s1 = _scale->evaluate(*si).clamp();
+    Spectrum s1 = _textures.execute(*si, arena).get(_scaleReg).clamp();
     Spectrum s2 = (Spectrum(1.f) - s1).clamp();
     SurfaceInteraction si2 = *si;
     _m1->computeScatteringFunctions(si, arena, mode, allowMultipleLobes);
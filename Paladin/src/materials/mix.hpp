@@ -21,7 +21,7 @@ public:
                 const std::shared_ptr<Material> &m2,
                 const std::shared_ptr<Texture<Spectrum>> &scale)
     : _m1(m1), _m2(m2), _scale(scale) {
-        
+        _scaleReg = _textures.add(_scale);
     }
     
     virtual nloJson toJson() const override {
@@ -35,6 +35,7 @@ public:
 private:
     std::shared_ptr<Material> _m1, _m2;
     std::shared_ptr<Texture<Spectrum>> _scale;
+    TextureReg<Spectrum> _scaleReg;
 };
 
 PALADIN_END
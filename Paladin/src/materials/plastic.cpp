@@ -22,16 +22,17 @@ void PlasticMaterial::computeScatteringFunctions(
     
     processNormal(si);
     si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
-    Spectrum kd = _Kd->evaluate(*si).clamp();
+    TextureValues tex = _textures.execute(*si, arena);
+    Spectrum kd = tex.get(_KdReg).clamp();
     if (!kd.IsBlack()) {
         si->bsdf->add(ARENA_ALLOC(arena, LambertianReflection)(kd));
     }
 
-    Spectrum ks = _Ks->evaluate(*si).clamp();
+    Spectrum ks = tex.get(_KsReg).clamp();
     if (!ks.IsBlack()) {
         Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, 1.5f);
         
-        Float rough = _roughness->evaluate(*si);
+        Float rough = tex.get(_roughnessReg);
         if (_remapRoughness) {
             rough = GGXDistribution::RoughnessToAlpha(rough);
         }
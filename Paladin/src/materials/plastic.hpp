@@ -31,7 +31,9 @@ public:
 	_Ks(Ks),
 	_roughness(roughness),
 	_remapRoughness(remapRoughness) {
-
+        _KdReg = _textures.add(_Kd);
+        _KsReg = _textures.add(_Ks);
+        _roughnessReg = _textures.add(_roughness);
 	}
     
     virtual nloJson toJson() const override {
@@ -45,6 +47,8 @@ public:
 private:
     std::shared_ptr<Texture<Spectrum>> _Kd, _Ks;
     std::shared_ptr<Texture<Float>> _roughness;
+    TextureReg<Spectrum> _KdReg, _KsReg;
+    TextureReg<Float> _roughnessReg;
     const bool _remapRoughness;
 };
 
@@ -6,9 +6,176 @@
 //
 
 #include "subsurface.hpp"
+#include "core/interaction.hpp"
+#include "core/bxdf.hpp"
+#include "core/texture.hpp"
+#include "bxdfs/specular.hpp"
+#include "bxdfs/bssrdf.hpp"
+#include "materials/bxdfs/bsdf.hpp"
+#include "bxdfs/microfacet/transmission.hpp"
+#include "bxdfs/microfacet/reflection.hpp"
 
 PALADIN_BEGIN
 
+SubsurfaceMaterial::SubsurfaceMaterial(Float scale,
+                                       const std::shared_ptr<Texture<Spectrum>> &Kr,
+                                       const std::shared_ptr<Texture<Spectrum>> &Kt,
+                                       const std::shared_ptr<Texture<Spectrum>> &sigma_a,
+                                       const std::shared_ptr<Texture<Spectrum>> &sigma_s,
+                                       const std::shared_ptr<Texture<Spectrum>> &reflectance,
+                                       const std::shared_ptr<Texture<Spectrum>> &mfp,
+                                       Float g, Float eta,
+                                       const std::shared_ptr<Texture<Float>> &uRoughness,
+                                       const std::shared_ptr<Texture<Float>> &vRoughness,
+                                       const std::shared_ptr<Texture<Spectrum>> &normalMap,
+                                       const std::shared_ptr<Texture<Float>> &bumpMap,
+                                       bool remapRoughness)
+: Material(normalMap, bumpMap),
+_scale(scale),
+_Kr(Kr),
+_Kt(Kt),
+_sigma_a(sigma_a),
+_sigma_s(sigma_s),
+_reflectance(reflectance),
+_mfp(mfp),
+_uRoughness(uRoughness),
+_vRoughness(vRoughness),
+_eta(eta),
+_remapRoughness(remapRoughness),
+_table(BSSRDFTable::getBeamDiffusionTable(g, eta)) {
+    _KrReg = _textures.add(_Kr);
+    _KtReg = _textures.add(_Kt);
+    _uRoughnessReg = _textures.add(_uRoughness);
+    _vRoughnessReg = _textures.add(_vRoughness);
+    if (_reflectance) {
+        // 平均自由程的缩放在编译时合并到程序中
+        _mfpReg = _textures.mul(_textures.constant(_scale), _textures.add(_mfp));
+        _reflectanceReg = _textures.add(_reflectance);
+    } else {
+        _sigma_aReg = _textures.add(_sigma_a);
+        _sigma_sReg = _textures.add(_sigma_s);
+    }
+}
 
+void SubsurfaceMaterial::computeScatteringFunctions(SurfaceInteraction *si,
+                                                    MemoryArena &arena,
+                                                    TransportMode mode,
+                                                    bool allowMultipleLobes) const {
+    processNormal(si);
+    
+    TextureValues tex = _textures.execute(*si, arena);
+    Spectrum R = tex.get(_KrReg).clamp();
+    Spectrum T = tex.get(_KtReg).clamp();
+    Float urough = tex.get(_uRoughnessReg);
+    Float vrough = tex.get(_vRoughnessReg);
+    
+    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, _eta);
+    
+    if (R.IsBlack() && T.IsBlack()) {
+        return;
+    }
+    
+    // 表面的反射与折射与玻璃材质相同，
+    // 积分器采样到折射分量时，再由BSSRDF采样入射点
+    bool isSpecular = urough == 0 && vrough == 0;
+    if (isSpecular && allowMultipleLobes) {
+        si->bsdf->add(ARENA_ALLOC(arena, FresnelSpecular)(R, T, 1.f, _eta, mode));
+    } else {
+        if (_remapRoughness) {
+            urough = GGXDistribution::RoughnessToAlpha(urough);
+            vrough = GGXDistribution::RoughnessToAlpha(vrough);
+        }
+        MicrofacetDistribution *distrib = isSpecular ?
+                                            nullptr :
+                                            ARENA_ALLOC(arena, GGXDistribution)(urough, vrough);
+        if (!R.IsBlack()) {
+            Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, _eta);
+            if (isSpecular) {
+                si->bsdf->add(ARENA_ALLOC(arena, SpecularReflection)(R, fresnel));
+            } else {
+                si->bsdf->add(ARENA_ALLOC(arena, MicrofacetReflection)(R, distrib, fresnel));
+            }
+        }
+        if (!T.IsBlack()) {
+            if (isSpecular) {
+                si->bsdf->add(ARENA_ALLOC(arena, SpecularTransmission)(T, 1.f, _eta, mode));
+            } else {
+                si->bsdf->add(ARENA_ALLOC(arena, MicrofacetTransmission)(T, distrib, 1.f, _eta, mode));
+            }
+        }
+    }
+    
+    Spectrum sigma_a, sigma_s;
+    if (_reflectance) {
+        Spectrum mfp = tex.get(_mfpReg);
+        Spectrum rhoEff = tex.get(_reflectanceReg).clamp();
+        subsurfaceFromDiffuse(*_table, rhoEff, mfp, &sigma_a, &sigma_s);
+    } else {
+        sigma_a = _scale * tex.get(_sigma_aReg).clamp();
+        sigma_s = _scale * tex.get(_sigma_sReg).clamp();
+    }
+    si->bssrdf = ARENA_ALLOC(arena, TabulatedBSSRDF)(*si, this, mode, _eta,
+                                                     sigma_a, sigma_s, *_table);
+}
+
+//"param" : {
+//    "scale" : 1,
+//    "eta" : 1.33,
+//    "g" : 0,
+//    "sigma_a" : [0.0011, 0.0024, 0.014],
+//    "sigma_s" : [2.55, 3.21, 3.77],
+//    "reflectance" : [0.8, 0.5, 0.4],
+//    "mfp" : [1, 1, 1],
+//    "Kr" : [1, 1, 1],
+//    "Kt" : [1, 1, 1],
+//    "uRough" : 0,
+//    "vRough" : 0,
+//    "remapRough" : true
+//}
+// 指定了reflectance时，忽略sigma_a与sigma_s，mfp为平均自由程
+CObject_ptr createSubsurface(const nloJson &param, const Arguments &lst) {
+    Float scale = param.value("scale", 1.f);
+    Float eta = param.value("eta", 1.33f);
+    Float g = param.value("g", 0.f);
+    
+    nloJson _sigma_a = param.value("sigma_a", nloJson::array({.0011f, .0024f, .014f}));
+    auto sigma_a = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_sigma_a));
+    
+    nloJson _sigma_s = param.value("sigma_s", nloJson::array({2.55f, 3.21f, 3.77f}));
+    auto sigma_s = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_sigma_s));
+    
+    nloJson _reflectance = param.value("reflectance", nloJson());
+    auto reflectance = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_reflectance));
+    
+    nloJson _mfp = param.value("mfp", nloJson::array({1.f, 1.f, 1.f}));
+    auto mfp = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_mfp));
+    
+    nloJson _Kr = param.value("Kr", nloJson::array({1.f, 1.f, 1.f}));
+    auto Kr = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_Kr));
+    
+    nloJson _Kt = param.value("Kt", nloJson::array({1.f, 1.f, 1.f}));
+    auto Kt = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_Kt));
+    
+    nloJson _uRough = param.value("uRough", nloJson(0.f));
+    auto uRough = shared_ptr<Texture<Float>>(createFloatTexture(_uRough));
+    
+    nloJson _vRough = param.value("vRough", nloJson(0.f));
+    auto vRough = shared_ptr<Texture<Float>>(createFloatTexture(_vRough));
+    
+    nloJson _normalMap = param.value("normalMap", nloJson());
+    auto normalMap = shared_ptr<Texture<Spectrum>>(createSpectrumTexture(_normalMap));
+    
+    nloJson _bumpMap = param.value("bumpMap", nloJson());
+    auto bumpMap = shared_ptr<Texture<Float>>(createFloatTexture(_bumpMap));
+    
+    bool remap = param.value("remapRough", true);
+    
+    auto ret = new SubsurfaceMaterial(scale, Kr, Kt, sigma_a, sigma_s,
+                                      reflectance, mfp, g, eta, uRough, vRough,
+                                      normalMap, bumpMap, remap);
+    return ret;
+}
+
+REGISTER("subsurface", createSubsurface)
 
 PALADIN_END
@@ -9,10 +9,69 @@
 #define subsurface_hpp
 
 #include "core/header.h"
+#include "core/material.hpp"
 
 PALADIN_BEGIN
 
+struct BSSRDFTable;
 
+/**
+ * 次表面散射材质，用于皮肤，蜡烛，玉石，牛奶等半透明物体
+ * 表面为光滑或粗糙的电介质界面，折射进入物体内部的光由TabulatedBSSRDF描述
+ *
+ * 散射系数有两种指定方式
+ *     1.直接指定吸收系数σa与散射系数σs，scale用于单位换算，
+ *       例如σa，σs的单位为mm^-1，场景的单位为m时，scale为1000
+ *     2.指定有效反射率reflectance与平均自由程mfp，更直观，
+ *       由subsurfaceFromDiffuse反推σa，σs
+ *
+ * BSSRDFTable只与g以及eta有关，g，eta相同的材质共享同一个表格
+ */
+class SubsurfaceMaterial : public Material {
+    
+public:
+    SubsurfaceMaterial(Float scale,
+                       const std::shared_ptr<Texture<Spectrum>> &Kr,
+                       const std::shared_ptr<Texture<Spectrum>> &Kt,
+                       const std::shared_ptr<Texture<Spectrum>> &sigma_a,
+                       const std::shared_ptr<Texture<Spectrum>> &sigma_s,
+                       const std::shared_ptr<Texture<Spectrum>> &reflectance,
+                       const std::shared_ptr<Texture<Spectrum>> &mfp,
+                       Float g, Float eta,
+                       const std::shared_ptr<Texture<Float>> &uRoughness,
+                       const std::shared_ptr<Texture<Float>> &vRoughness,
+                       const std::shared_ptr<Texture<Spectrum>> &normalMap,
+                       const std::shared_ptr<Texture<Float>> &bumpMap,
+                       bool remapRoughness);
+    
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+    
+    virtual bool hasSubsurface() const override {
+        return true;
+    }
+    
+    virtual void computeScatteringFunctions(SurfaceInteraction *si,
+                                            MemoryArena &arena,
+                                            TransportMode mode,
+                                            bool allowMultipleLobes) const override;
+    
+private:
+    const Float _scale;
+    std::shared_ptr<Texture<Spectrum>> _Kr, _Kt;
+    std::shared_ptr<Texture<Spectrum>> _sigma_a, _sigma_s;
+    // 不为空时用有效反射率以及平均自由程计算散射系数
+    std::shared_ptr<Texture<Spectrum>> _reflectance, _mfp;
+    std::shared_ptr<Texture<Float>> _uRoughness, _vRoughness;
+    TextureReg<Spectrum> _KrReg, _KtReg, _sigma_aReg, _sigma_sReg, _reflectanceReg, _mfpReg;
+    TextureReg<Float> _uRoughnessReg, _vRoughnessReg;
+    const Float _eta;
+    bool _remapRoughness;
+    shared_ptr<const BSSRDFTable> _table;
+};
+
+CObject_ptr createSubsurface(const nloJson &param, const Arguments &lst);
 
 PALADIN_END
 
@@ -22,9 +22,10 @@ void UnityMaterial::computeScatteringFunctions(SurfaceInteraction *si, MemoryAre
     processNormal(si);
     si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
     
-    Float metallic = _metallic->evaluate(*si);
-    Float alpha = _roughness->evaluate(*si);
-    auto albedo = _albedo->evaluate(*si);
+    TextureValues tex = _textures.execute(*si, arena);
+    Float metallic = tex.get(_metallicReg);
+    Float alpha = tex.get(_roughnessReg);
+    Spectrum albedo = tex.get(_albedoReg);
     Fresnel * fresnel = ARENA_ALLOC(arena, FresnelSchlick)(albedo);
     
     BxDF * diffuse = nullptr;
@@ -31,7 +31,9 @@ public:
     _roughness(roughness),
     _F0(F0),
     _remapRoughness(remapRoughness) {
-        
+        _albedoReg = _textures.add(shared_ptr<Texture<Spectrum>>(_albedo));
+        _metallicReg = _textures.add(_metallic);
+        _roughnessReg = _textures.add(_roughness);
     }
     
     virtual nloJson toJson() const override {
@@ -48,6 +50,8 @@ private:
     std::shared_ptr<Texture<Float>> _roughness;
     std::shared_ptr<Texture<Spectrum>> _opacity;
     shared_ptr<Texture<Spectrum>> _F0;
+    TextureReg<Spectrum> _albedoReg;
+    TextureReg<Float> _metallicReg, _roughnessReg;
     bool _remapRoughness;
 };
 
@@ -229,7 +229,27 @@ public:
     const Transform & getEndTransform() const {
         return * (_endTransform.get());
     }
-    
+
+    bool isAnimated() const {
+        return _actuallyAnimated;
+    }
+
+    /**
+     * 不含旋转时，点的轨迹是t的线性函数，
+     * 包围盒在任意时刻都不会超出起止两个包围盒的线性插值
+     */
+    bool hasRotation() const {
+        return _actuallyAnimated && _hasRotation;
+    }
+
+    Float getStartTime() const {
+        return _startTime;
+    }
+
+    Float getEndTime() const {
+        return _endTime;
+    }
+
     /**
      * 获取一个包围盒对象，返回运动过程中包围盒扫过的范围的包围盒
      */
@@ -6,6 +6,7 @@
 //
 
 #include "interpolation.hpp"
+#include "math/simd.h"
 
 PALADIN_BEGIN
 
@@ -440,12 +441,51 @@ Float InvertCatmullRom(int n, const Float *x, const Float *values, Float u)  {
 
 
 // cos((k + 1) φ) = (2 cos φ) cos(kφ) − cos((k − 1)φ)
+// 阶数较高时每次处理4项，用步长为4的递推
+// cos((k + 4) φ) = (2 cos 4φ) cos(kφ) − cos((k − 4)φ)
+// 递推仍然用double计算，与标量版本的精度一致，剩余不足4项的部分用标量递推
 Float Fourier(const Float *a, int m, double cosPhi) {
     double value = 0.0;
     double cosKMinusOnePhi = cosPhi;
     // 当k=0，cos(kφ) 为1
     double cosKPhi = 1;
-    for (int k = 0; k < m; ++k) {
+    int k = 0;
+#ifdef PALADIN_SIMD_SSE
+    if (m >= 8) {
+        double cos2Phi = 2 * cosPhi * cosPhi - 1;
+        double cos3Phi = 2 * cosPhi * cos2Phi - cosPhi;
+        double cos4Phi = 2 * cos2Phi * cos2Phi - 1;
+        // lo为cos(kφ),cos((k+1)φ)，hi为cos((k+2)φ),cos((k+3)φ)
+        __m128d curLo = _mm_set_pd(cosPhi, 1);
+        __m128d curHi = _mm_set_pd(cos3Phi, cos2Phi);
+        // k = 0时，前一组为cos(-4φ) ~ cos(-φ)
+        __m128d prevLo = _mm_set_pd(cos3Phi, cos4Phi);
+        __m128d prevHi = _mm_set_pd(cosPhi, cos2Phi);
+        __m128d twoCos4Phi = _mm_set1_pd(2 * cos4Phi);
+        __m128d sumLo = _mm_setzero_pd();
+        __m128d sumHi = _mm_setzero_pd();
+        for (; k + 4 <= m; k += 4) {
+            __m128 a4 = _mm_loadu_ps(a + k);
+            sumLo = _mm_add_pd(sumLo, _mm_mul_pd(_mm_cvtps_pd(a4), curLo));
+            sumHi = _mm_add_pd(sumHi, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(a4, a4)), curHi));
+            __m128d nextLo = _mm_sub_pd(_mm_mul_pd(twoCos4Phi, curLo), prevLo);
+            __m128d nextHi = _mm_sub_pd(_mm_mul_pd(twoCos4Phi, curHi), prevHi);
+            prevLo = curLo;
+            prevHi = curHi;
+            curLo = nextLo;
+            curHi = nextHi;
+        }
+        double sum[2];
+        _mm_storeu_pd(sum, _mm_add_pd(sumLo, sumHi));
+        value = sum[0] + sum[1];
+        double cur[2], prev[2];
+        _mm_storeu_pd(cur, curLo);
+        _mm_storeu_pd(prev, prevHi);
+        cosKPhi = cur[0];
+        cosKMinusOnePhi = prev[1];
+    }
+#endif
+    for (; k < m; ++k) {
         value += a[k] * cosKPhi;
         double cosKPlusOnePhi = 2 * cosPhi * cosKPhi - cosKMinusOnePhi;
         cosKMinusOnePhi = cosKPhi;
@@ -454,4 +494,68 @@ Float Fourier(const Float *a, int m, double cosPhi) {
     return value;
 }
 
+/**
+ * 采样傅里叶级数表示的方位角分布，返回该方位角的函数值
+ * 分布关于φ = π对称，所以只在[0, π]上求解，u大于0.5时取对称的方位角
+ *
+ * 累积分布函数的积分形式为
+ *
+ *                   m-1  ak
+ *     F(φ) = a0 φ +  ∑  ---- sin(kφ)
+ *                   k=1   k
+ *
+ * 用牛顿迭代法求解 F(φ) = u a0 π，迭代点越界时退化为二分法
+ * sin(kφ)同样用递推 sin((k + 1) φ) = (2 cos φ) sin(kφ) − sin((k − 1)φ)
+ *
+ * recip为预先计算好的 1/k
+ */
+Float SampleFourier(const Float *ak, const Float *recip, int m, Float u,
+                    Float *pdf, Float *phiPtr) {
+    bool flip = (u >= 0.5f);
+    if (flip) {
+        u = 1 - 2 * (u - .5f);
+    } else {
+        u *= 2;
+    }
+    double a = 0, b = Pi, phi = 0.5 * Pi;
+    double F, f;
+    while (true) {
+        double cosPhi = std::cos(phi);
+        double sinPhi = std::sqrt(std::max((double)0, 1 - cosPhi * cosPhi));
+        double cosPhiPrev = cosPhi, cosPhiCur = 1;
+        double sinPhiPrev = -sinPhi, sinPhiCur = 0;
+        F = ak[0] * phi;
+        f = ak[0];
+        for (int k = 1; k < m; ++k) {
+            double sinPhiNext = 2 * cosPhi * sinPhiCur - sinPhiPrev;
+            double cosPhiNext = 2 * cosPhi * cosPhiCur - cosPhiPrev;
+            sinPhiPrev = sinPhiCur;
+            sinPhiCur = sinPhiNext;
+            cosPhiPrev = cosPhiCur;
+            cosPhiCur = cosPhiNext;
+            F += ak[k] * recip[k] * sinPhiNext;
+            f += ak[k] * cosPhiNext;
+        }
+        F -= u * ak[0] * Pi;
+        if (F > 0) {
+            b = phi;
+        } else {
+            a = phi;
+        }
+        if (std::abs(F) < 1e-6f || b - a < 1e-6f) {
+            break;
+        }
+        phi -= F / f;
+        if (!(phi > a && phi < b)) {
+            phi = 0.5f * (a + b);
+        }
+    }
+    if (flip) {
+        phi = 2 * Pi - phi;
+    }
+    *pdf = (Float)(Inv2Pi * f / ak[0]);
+    *phiPtr = (Float)phi;
+    return f;
+}
+
 PALADIN_END
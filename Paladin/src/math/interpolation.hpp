@@ -181,6 +181,19 @@ Float InvertCatmullRom(int n, const Float *x, const Float *values, Float u);
  */
 Float Fourier(const Float *a, int m, double cosPhi);
 
+/**
+ * 按照傅里叶级数表示的方位角分布采样φ
+ * @param  ak     系数列表
+ * @param  recip  1/k列表
+ * @param  m      阶数
+ * @param  u      均匀随机变量
+ * @param  pdf    返回φ的概率密度
+ * @param  phiPtr 返回采样的φ
+ * @return        φ处的函数值
+ */
+Float SampleFourier(const Float *ak, const Float *recip, int m, Float u,
+                    Float *pdf, Float *phiPtr);
+
 PALADIN_END
 
 #endif /* interpolation_hpp */
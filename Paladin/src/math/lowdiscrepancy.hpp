@@ -83,6 +83,73 @@ inline uint64_t ReverseBits64(uint64_t n) {
     return (n0 << 32) | n1;
 }
 
+/**
+ * 64位整数的哈希，用于生成扰乱(scramble)的种子
+ * 参考 http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
+ */
+inline uint64_t MixBits(uint64_t v) {
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= (v >> 33);
+    return v;
+}
+
+// sobol序列生成矩阵的维度数
+static CONSTEXPR int NSobolDimensions = 4;
+
+// sobol序列前4个维度的生成矩阵，每个维度32列
+// 第0维为van der Corput序列，之后3个维度来自Joe & Kuo的方向数
+extern const uint32_t SobolMatrices32[NSobolDimensions][32];
+
+// 由生成矩阵展开的查找表，[维度][半字节位置][半字节的值]
+// 每一项是矩阵中对应的4列按半字节的值异或的结果
+extern const uint32_t (&SobolNibbleTables)[NSobolDimensions][8][16];
+
+/**
+ * sobol序列第a个样本的第dim个维度，返回32位定点数
+ * 把a看作二进制列向量，样本值为生成矩阵与a的模2乘积，
+ * 也就是把a中为1的位所对应的矩阵列异或起来，32个输出位同时计算
+ *
+ * 扰乱之后的索引每一位都是随机的，逐位判断会导致大量的分支预测失败，
+ * 所以按半字节查表，每个维度只需要8次查表与异或
+ */
+inline uint32_t SobolSample32(uint32_t a, int dim) {
+    DCHECK(dim >= 0 && dim < NSobolDimensions);
+    const uint32_t (*table)[16] = SobolNibbleTables[dim];
+    return table[0][a & 0xf] ^ table[1][(a >> 4) & 0xf]
+         ^ table[2][(a >> 8) & 0xf] ^ table[3][(a >> 12) & 0xf]
+         ^ table[4][(a >> 16) & 0xf] ^ table[5][(a >> 20) & 0xf]
+         ^ table[6][(a >> 24) & 0xf] ^ table[7][a >> 28];
+}
+
+/**
+ * Laine-Karras置换，对x的每一位做的翻转只取决于比它低的位，
+ * 相当于对x的位反转做Owen扰乱
+ * 参考 Burley. Practical Hash-based Owen Scrambling (2020)
+ */
+inline uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+/**
+ * 基于哈希的Owen扰乱(nested uniform scramble)
+ * 对[0,1)区间递归地随机交换左右两半，x的每一位的翻转取决于比它高的所有位
+ * 扰乱之后sobol序列的分层性质不变，并且估计是无偏的
+ */
+inline uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+    x = ReverseBits32(x);
+    x = LaineKarrasPermutation(x, seed);
+    x = ReverseBits32(x);
+    return x;
+}
+
 PALADIN_END
 
 #endif /* lowdiscrepancy_hpp */
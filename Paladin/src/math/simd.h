@@ -0,0 +1,258 @@
+//
+//  simd.h
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/4.
+//
+
+#ifndef simd_h
+#define simd_h
+
+#include "core/header.h"
+
+/**
+ * 光谱运算的SIMD内核，编译期根据指令集选择实现
+ *
+ *     PALADIN_SIMD_SSE  4路float，x86-64默认开启
+ *     PALADIN_SIMD_AVX  8路float，需要编译时开启-mavx2(或者-mavx)
+ *
+ * Float为double时(FLOAT_AS_DOUBLE)，或者定义了PALADIN_NO_SIMD时，退化为标量循环
+ *
+ * 所有内核的长度n都是编译期常量，并且是SimdFloatWidth的整数倍，
+ * 编译器会把循环完全展开，60个分量的SampledSpectrum在AVX下为7次8路运算加1次4路运算
+ */
+#if !defined(PALADIN_NO_SIMD) && !defined(FLOAT_AS_DOUBLE) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define PALADIN_SIMD_SSE
+    #if defined(__AVX2__) || defined(__AVX__)
+        #define PALADIN_SIMD_AVX
+        #include <immintrin.h>
+    #else
+        #include <emmintrin.h>
+    #endif
+#endif
+
+PALADIN_BEGIN
+
+#ifdef PALADIN_SIMD_SSE
+    // 光谱的分量数补齐到该宽度的整数倍
+    static CONSTEXPR int SimdFloatWidth = 4;
+    #define PALADIN_SIMD_ALIGN alignas(16)
+#else
+    static CONSTEXPR int SimdFloatWidth = 1;
+    #define PALADIN_SIMD_ALIGN
+#endif
+
+/**
+ * n个分量补齐之后的长度，补齐的分量恒为0
+ */
+template <int n>
+inline CONSTEXPR int simdPadded() {
+    return (n + SimdFloatWidth - 1) / SimdFloatWidth * SimdFloatWidth;
+}
+
+namespace simd {
+
+#ifdef PALADIN_SIMD_SSE
+
+// 以下宏对[0, n)逐段执行，先用8路，再用4路处理剩余的部分
+#ifdef PALADIN_SIMD_AVX
+    #define PALADIN_SIMD_LOOP(n, op8, op4)                \
+        int i = 0;                                         \
+        for (; i + 8 <= n; i += 8) { op8; }                \
+        for (; i + 4 <= n; i += 4) { op4; }
+#else
+    #define PALADIN_SIMD_LOOP(n, op8, op4)                \
+        int i = 0;                                         \
+        for (; i + 4 <= n; i += 4) { op4; }
+#endif
+
+#define PALADIN_SIMD_BINARY(name, avx, sse)                                            \
+    template <int n>                                                                    \
+    inline void name(Float *r, const Float *a, const Float *b) {                        \
+        PALADIN_SIMD_LOOP(n,                                                            \
+            _mm256_storeu_ps(r + i, avx(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))), \
+            _mm_storeu_ps(r + i, sse(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))))        \
+    }
+
+PALADIN_SIMD_BINARY(add, _mm256_add_ps, _mm_add_ps)
+PALADIN_SIMD_BINARY(sub, _mm256_sub_ps, _mm_sub_ps)
+PALADIN_SIMD_BINARY(mul, _mm256_mul_ps, _mm_mul_ps)
+PALADIN_SIMD_BINARY(div, _mm256_div_ps, _mm_div_ps)
+
+#undef PALADIN_SIMD_BINARY
+
+template <int n>
+inline void scale(Float *r, const Float *a, Float s) {
+#ifdef PALADIN_SIMD_AVX
+    __m256 s8 = _mm256_set1_ps(s);
+#endif
+    __m128 s4 = _mm_set1_ps(s);
+    PALADIN_SIMD_LOOP(n,
+        _mm256_storeu_ps(r + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), s8)),
+        _mm_storeu_ps(r + i, _mm_mul_ps(_mm_loadu_ps(a + i), s4)))
+}
+
+template <int n>
+inline void sqrt(Float *r, const Float *a) {
+    PALADIN_SIMD_LOOP(n,
+        _mm256_storeu_ps(r + i, _mm256_sqrt_ps(_mm256_loadu_ps(a + i))),
+        _mm_storeu_ps(r + i, _mm_sqrt_ps(_mm_loadu_ps(a + i))))
+}
+
+template <int n>
+inline void clamp(Float *r, const Float *a, Float low, Float high) {
+#ifdef PALADIN_SIMD_AVX
+    __m256 lo8 = _mm256_set1_ps(low), hi8 = _mm256_set1_ps(high);
+#endif
+    __m128 lo4 = _mm_set1_ps(low), hi4 = _mm_set1_ps(high);
+    PALADIN_SIMD_LOOP(n,
+        _mm256_storeu_ps(r + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(a + i), lo8), hi8)),
+        _mm_storeu_ps(r + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(a + i), lo4), hi4)))
+}
+
+/**
+ * 所有分量是否都为0，NaN视为非0，与标量版本的 c[i] != 0 一致
+ */
+template <int n>
+inline bool allZero(const Float *a) {
+#ifdef PALADIN_SIMD_AVX
+    __m256 zero8 = _mm256_setzero_ps();
+#endif
+    __m128 zero4 = _mm_setzero_ps();
+    PALADIN_SIMD_LOOP(n,
+        if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(a + i), zero8, _CMP_NEQ_UQ))) return false,
+        if (_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(a + i), zero4))) return false)
+    return true;
+}
+
+/**
+ * 前n个分量中的最大值，n不要求是4的整数倍，不会读取补齐的分量
+ */
+template <int n>
+inline Float maxValue(const Float *a) {
+    CONSTEXPR int nVec = n / 4 * 4;
+    Float m = a[0];
+    if (nVec > 0) {
+        __m128 m4 = _mm_loadu_ps(a);
+        for (int i = 4; i < nVec; i += 4) {
+            m4 = _mm_max_ps(m4, _mm_loadu_ps(a + i));
+        }
+        m4 = _mm_max_ps(m4, _mm_shuffle_ps(m4, m4, _MM_SHUFFLE(2, 3, 0, 1)));
+        m4 = _mm_max_ps(m4, _mm_shuffle_ps(m4, m4, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm_cvtss_f32(m4);
+    }
+    for (int i = nVec; i < n; ++i) {
+        m = std::max(m, a[i]);
+    }
+    return m;
+}
+
+/**
+ * 前n个分量的点积，n为4的整数倍
+ */
+template <int n>
+inline Float dot(const Float *a, const Float *b) {
+    __m128 sum4 = _mm_setzero_ps();
+#ifdef PALADIN_SIMD_AVX
+    __m256 sum8 = _mm256_setzero_ps();
+#endif
+    PALADIN_SIMD_LOOP(n,
+        sum8 = _mm256_add_ps(sum8, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))),
+        sum4 = _mm_add_ps(sum4, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))))
+#ifdef PALADIN_SIMD_AVX
+    sum4 = _mm_add_ps(sum4, _mm_add_ps(_mm256_castps256_ps128(sum8),
+                                       _mm256_extractf128_ps(sum8, 1)));
+#endif
+    sum4 = _mm_add_ps(sum4, _mm_shuffle_ps(sum4, sum4, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum4 = _mm_add_ps(sum4, _mm_shuffle_ps(sum4, sum4, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(sum4);
+}
+
+/**
+ * r += a * s，长度n在运行期确定，需要是SimdFloatWidth的整数倍
+ * 用于长度不固定的系数数组，例如傅里叶BSDF的系数插值
+ */
+inline void addScaled(Float *r, const Float *a, Float s, int n) {
+#ifdef PALADIN_SIMD_AVX
+    __m256 s8 = _mm256_set1_ps(s);
+#endif
+    __m128 s4 = _mm_set1_ps(s);
+    PALADIN_SIMD_LOOP(n,
+        _mm256_storeu_ps(r + i, _mm256_add_ps(_mm256_loadu_ps(r + i),
+                                              _mm256_mul_ps(_mm256_loadu_ps(a + i), s8))),
+        _mm_storeu_ps(r + i, _mm_add_ps(_mm_loadu_ps(r + i),
+                                        _mm_mul_ps(_mm_loadu_ps(a + i), s4))))
+}
+
+#undef PALADIN_SIMD_LOOP
+
+#else
+
+template <int n>
+inline void add(Float *r, const Float *a, const Float *b) {
+    for (int i = 0; i < n; ++i) r[i] = a[i] + b[i];
+}
+
+template <int n>
+inline void sub(Float *r, const Float *a, const Float *b) {
+    for (int i = 0; i < n; ++i) r[i] = a[i] - b[i];
+}
+
+template <int n>
+inline void mul(Float *r, const Float *a, const Float *b) {
+    for (int i = 0; i < n; ++i) r[i] = a[i] * b[i];
+}
+
+template <int n>
+inline void div(Float *r, const Float *a, const Float *b) {
+    for (int i = 0; i < n; ++i) r[i] = a[i] / b[i];
+}
+
+template <int n>
+inline void scale(Float *r, const Float *a, Float s) {
+    for (int i = 0; i < n; ++i) r[i] = a[i] * s;
+}
+
+template <int n>
+inline void sqrt(Float *r, const Float *a) {
+    for (int i = 0; i < n; ++i) r[i] = std::sqrt(a[i]);
+}
+
+template <int n>
+inline void clamp(Float *r, const Float *a, Float low, Float high) {
+    for (int i = 0; i < n; ++i) r[i] = paladin::clamp(a[i], low, high);
+}
+
+template <int n>
+inline bool allZero(const Float *a) {
+    for (int i = 0; i < n; ++i)
+        if (a[i] != 0.) return false;
+    return true;
+}
+
+template <int n>
+inline Float maxValue(const Float *a) {
+    Float m = a[0];
+    for (int i = 1; i < n; ++i) m = std::max(m, a[i]);
+    return m;
+}
+
+template <int n>
+inline Float dot(const Float *a, const Float *b) {
+    Float sum = 0;
+    for (int i = 0; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+inline void addScaled(Float *r, const Float *a, Float s, int n) {
+    for (int i = 0; i < n; ++i) r[i] += a[i] * s;
+}
+
+#endif
+
+} // namespace simd
+
+PALADIN_END
+
+#endif /* simd_h */
@@ -0,0 +1,406 @@
+//
+//  grid.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/2/28.
+//
+
+#include "grid.hpp"
+#include "core/sampler.hpp"
+#include "core/interaction.hpp"
+#include "core/paladin.hpp"
+#include <fstream>
+
+PALADIN_BEGIN
+
+// SparseDensityGrid
+SparseDensityGrid::SparseDensityGrid(int nx, int ny, int nz, const Float *density)
+: _nx(nx),
+_ny(ny),
+_nz(nz),
+_bx((nx + BrickSize - 1) >> BrickBits),
+_by((ny + BrickSize - 1) >> BrickBits),
+_bz((nz + BrickSize - 1) >> BrickBits) {
+    int nBricks = _bx * _by * _bz;
+    _brickIndex.assign(nBricks, -1);
+    _majorants.assign(nBricks, 0);
+
+    // 只为含有非零体素的砖块分配内存
+    for (int bz = 0; bz < _bz; ++bz) {
+        for (int by = 0; by < _by; ++by) {
+            for (int bx = 0; bx < _bx; ++bx) {
+                int x0 = bx * BrickSize, y0 = by * BrickSize, z0 = bz * BrickSize;
+                int x1 = std::min(x0 + BrickSize, nx);
+                int y1 = std::min(y0 + BrickSize, ny);
+                int z1 = std::min(z0 + BrickSize, nz);
+                bool empty = true;
+                for (int z = z0; z < z1 && empty; ++z) {
+                    for (int y = y0; y < y1 && empty; ++y) {
+                        for (int x = x0; x < x1; ++x) {
+                            if (density[(z * ny + y) * nx + x] != 0) {
+                                empty = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+                if (empty) {
+                    continue;
+                }
+                int index = (int)(_brickData.size() / BrickVoxels);
+                _brickIndex[brickOffset(bx, by, bz)] = index;
+                _brickData.resize(_brickData.size() + BrickVoxels, 0);
+                Float *brick = &_brickData[index * BrickVoxels];
+                for (int z = z0; z < z1; ++z) {
+                    for (int y = y0; y < y1; ++y) {
+                        for (int x = x0; x < x1; ++x) {
+                            int local = ((z - z0) * BrickSize + (y - y0)) * BrickSize + (x - x0);
+                            brick[local] = density[(z * ny + y) * nx + x];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // 计算每个砖块的密度上界
+    // 三线性插值时，砖块范围内的点会用到相邻的一圈体素，
+    // 所以要在砖块的基础上向外扩展一个体素
+    for (int bz = 0; bz < _bz; ++bz) {
+        for (int by = 0; by < _by; ++by) {
+            for (int bx = 0; bx < _bx; ++bx) {
+                Float maxDensity = 0;
+                int x0 = bx * BrickSize - 1, y0 = by * BrickSize - 1, z0 = bz * BrickSize - 1;
+                for (int z = z0; z <= z0 + BrickSize + 1; ++z) {
+                    for (int y = y0; y <= y0 + BrickSize + 1; ++y) {
+                        for (int x = x0; x <= x0 + BrickSize + 1; ++x) {
+                            maxDensity = std::max(maxDensity, voxel(x, y, z));
+                        }
+                    }
+                }
+                _majorants[brickOffset(bx, by, bz)] = maxDensity;
+            }
+        }
+    }
+}
+
+Float SparseDensityGrid::density(const Point3f &p) const {
+    // 体素值位于体素中心，所以要偏移半个体素
+    Float px = p.x * _nx - .5f;
+    Float py = p.y * _ny - .5f;
+    Float pz = p.z * _nz - .5f;
+    int ix = (int)std::floor(px);
+    int iy = (int)std::floor(py);
+    int iz = (int)std::floor(pz);
+    Float dx = px - ix, dy = py - iy, dz = pz - iz;
+
+    Float d00 = lerp(dx, voxel(ix, iy, iz), voxel(ix + 1, iy, iz));
+    Float d10 = lerp(dx, voxel(ix, iy + 1, iz), voxel(ix + 1, iy + 1, iz));
+    Float d01 = lerp(dx, voxel(ix, iy, iz + 1), voxel(ix + 1, iy, iz + 1));
+    Float d11 = lerp(dx, voxel(ix, iy + 1, iz + 1), voxel(ix + 1, iy + 1, iz + 1));
+    Float d0 = lerp(dy, d00, d10);
+    Float d1 = lerp(dy, d01, d11);
+    return lerp(dz, d0, d1);
+}
+
+// MajorantIterator
+MajorantIterator::MajorantIterator(const SparseDensityGrid *grid, const Point3f &ori,
+                                   const Vector3f &dir, Float tMin, Float tMax)
+: _grid(grid),
+_tMin(tMin),
+_tMax(tMax) {
+    Point3i res = grid->brickResolution();
+    Point3f pStart = ori + dir * tMin;
+    for (int axis = 0; axis < 3; ++axis) {
+        _voxel[axis] = clamp((int)std::floor(pStart[axis]), 0, res[axis] - 1);
+        if (dir[axis] > 0) {
+            _deltaT[axis] = 1 / dir[axis];
+            _nextCrossingT[axis] = tMin + (_voxel[axis] + 1 - pStart[axis]) / dir[axis];
+            _step[axis] = 1;
+            _voxelLimit[axis] = res[axis];
+        } else if (dir[axis] < 0) {
+            _deltaT[axis] = -1 / dir[axis];
+            _nextCrossingT[axis] = tMin + (_voxel[axis] - pStart[axis]) / dir[axis];
+            _step[axis] = -1;
+            _voxelLimit[axis] = -1;
+        } else {
+            // 与该轴向平行，永远不会穿过该轴向上的平面
+            _deltaT[axis] = 0;
+            _nextCrossingT[axis] = Infinity;
+            _step[axis] = 0;
+            _voxelLimit[axis] = -1;
+        }
+    }
+}
+
+bool MajorantIterator::next(MajorantSegment *seg) {
+    if (_tMin >= _tMax) {
+        return false;
+    }
+    // 找到最先穿过的平面
+    int axis = 0;
+    if (_nextCrossingT[1] < _nextCrossingT[axis]) {
+        axis = 1;
+    }
+    if (_nextCrossingT[2] < _nextCrossingT[axis]) {
+        axis = 2;
+    }
+    Float tEnd = std::min(_tMax, _nextCrossingT[axis]);
+    seg->tMin = _tMin;
+    seg->tMax = tEnd;
+    seg->maxDensity = _grid->majorant(_voxel[0], _voxel[1], _voxel[2]);
+
+    _tMin = tEnd;
+    _voxel[axis] += _step[axis];
+    if (_voxel[axis] == _voxelLimit[axis]) {
+        _tMin = _tMax;
+    }
+    _nextCrossingT[axis] += _deltaT[axis];
+    return true;
+}
+
+// GridMedium
+GridMedium::GridMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
+                       const Transform &mediumToWorld, const AABB3f &bounds,
+                       SparseDensityGrid grid)
+: _sigma_a(sigma_a),
+_sigma_s(sigma_s),
+_sigma_t(sigma_a + sigma_s),
+_sigma_tMax((sigma_a + sigma_s).MaxComponentValue()),
+_g(g),
+_worldToMedium(mediumToWorld.getInverse()),
+_bounds(bounds),
+_grid(std::move(grid)) {
+
+}
+
+bool GridMedium::traverse(const Ray &rWorld, Ray *ray, Float *tMin, Float *tMax) const {
+    // 方向归一化之后，光线参数t就是世界空间中的距离，可以直接与σt相乘
+    *ray = _worldToMedium.exec(Ray(rWorld.ori, normalize(rWorld.dir),
+                                   rWorld.tMax * rWorld.dir.length()));
+    return _bounds.intersectP(*ray, tMin, tMax);
+}
+
+MajorantIterator GridMedium::majorantIterator(const Ray &ray, Float tMin, Float tMax) const {
+    // 把光线转换到以砖块为单位的坐标系中
+    Point3i res = _grid.resolution();
+    Vector3f diag = _bounds.diagonal();
+    Vector3f o = _bounds.offset(ray.ori);
+    Float sx = (Float)res.x / SparseDensityGrid::BrickSize;
+    Float sy = (Float)res.y / SparseDensityGrid::BrickSize;
+    Float sz = (Float)res.z / SparseDensityGrid::BrickSize;
+    Point3f oBrick(o.x * sx, o.y * sy, o.z * sz);
+    Vector3f dBrick(ray.dir.x * sx / diag.x,
+                    ray.dir.y * sy / diag.y,
+                    ray.dir.z * sz / diag.z);
+    return MajorantIterator(&_grid, oBrick, dBrick, tMin, tMax);
+}
+
+/**
+ * ratio tracking估计透射率
+ *
+ *     Tr ≈ ∏ (1 - σt(pi) / σ̄)
+ *
+ * 透射率很小的时候，继续追踪的意义不大，用俄罗斯轮盘赌提前结束
+ */
+Spectrum GridMedium::Tr(const Ray &rWorld, Sampler &sampler) const {
+    Ray ray;
+    Float tMin, tMax;
+    if (!traverse(rWorld, &ray, &tMin, &tMax)) {
+        return Spectrum(1.f);
+    }
+    MajorantIterator iter = majorantIterator(ray, tMin, tMax);
+    Spectrum Tr(1.f);
+    MajorantSegment seg;
+    while (iter.next(&seg)) {
+        Float sigmaMaj = seg.maxDensity * _sigma_tMax;
+        // 空砖块，直接跳过
+        if (sigmaMaj == 0) {
+            continue;
+        }
+        Float t = seg.tMin;
+        while (true) {
+            t -= std::log(1 - sampler.get1D()) / sigmaMaj;
+            if (t >= seg.tMax) {
+                break;
+            }
+            // 插值的浮点误差可能使密度略大于上界
+            Float d = std::min(density(ray.at(t)), seg.maxDensity);
+            Tr *= Spectrum(1.f) - d * _sigma_t / sigmaMaj;
+
+            Float trMax = Tr.MaxComponentValue();
+            if (trMax < .1f) {
+                Float q = std::max((Float).05f, 1 - trMax);
+                if (sampler.get1D() < q) {
+                    return Spectrum(0.f);
+                }
+                Tr /= 1 - q;
+            }
+        }
+    }
+    return Tr;
+}
+
+/**
+ * delta tracking采样介质中的散射点
+ *
+ * 设σ̄ = 砖块最大密度 * 最大通道的σt，每次碰撞时
+ *     以 P = d σtMax / σ̄ 的概率为真实碰撞，β *= (d σs / σ̄) / P = σs / σtMax
+ *     以 1 - P 的概率为空碰撞，β *= ((σ̄ - d σt) / σ̄) / (1 - P)
+ *
+ * σt为灰度时，空碰撞的权重为1，真实碰撞的权重为反照率σs / σt，
+ * 与pbrt中GridDensityMedium的结果一致
+ */
+Spectrum GridMedium::sample(const Ray &rWorld, Sampler &sampler, MemoryArena &arena,
+                            MediumInteraction *mi) const {
+    Ray ray;
+    Float tMin, tMax;
+    if (!traverse(rWorld, &ray, &tMin, &tMax)) {
+        return Spectrum(1.f);
+    }
+    MajorantIterator iter = majorantIterator(ray, tMin, tMax);
+    Spectrum beta(1.f);
+    MajorantSegment seg;
+    while (iter.next(&seg)) {
+        Float sigmaMaj = seg.maxDensity * _sigma_tMax;
+        if (sigmaMaj == 0) {
+            continue;
+        }
+        Float t = seg.tMin;
+        while (true) {
+            t -= std::log(1 - sampler.get1D()) / sigmaMaj;
+            if (t >= seg.tMax) {
+                break;
+            }
+            Float d = std::min(density(ray.at(t)), seg.maxDensity);
+            Float pReal = d * _sigma_tMax / sigmaMaj;
+            if (sampler.get1D() < pReal) {
+                // ray的参数为世界空间的距离，需要换算回rWorld的参数
+                *mi = MediumInteraction(rWorld.at(t / rWorld.dir.length()), -rWorld.dir,
+                                        rWorld.time, this,
+                                        ARENA_ALLOC(arena, HenyeyGreenstein)(_g));
+                return beta * _sigma_s / _sigma_tMax;
+            }
+            beta *= (Spectrum(sigmaMaj) - d * _sigma_t) / (sigmaMaj - d * _sigma_tMax);
+        }
+    }
+    return beta;
+}
+
+/**
+ * 逐个砖块采样候选碰撞点，每个砖块的majorant为 砖块最大密度 * σt
+ * 空砖块不产生碰撞点，只累积majorant透射率(为1)
+ */
+Spectrum GridMedium::sampleTmaj(const Ray &rWorld, int channel, RNG &rng,
+                                const std::function<bool(const MajorantSample &)> &callback) const {
+    Ray ray;
+    Float tMin, tMax;
+    if (!traverse(rWorld, &ray, &tMin, &tMax)) {
+        return Spectrum(1.f);
+    }
+    Float length = rWorld.dir.length();
+    MajorantIterator iter = majorantIterator(ray, tMin, tMax);
+    Spectrum T_maj(1.f);
+    MajorantSegment seg;
+    while (iter.next(&seg)) {
+        Spectrum sigma_maj = seg.maxDensity * _sigma_t;
+        if (sigma_maj[channel] == 0) {
+            T_maj *= Exp(-sigma_maj * (seg.tMax - seg.tMin));
+            continue;
+        }
+        Float t0 = seg.tMin;
+        while (true) {
+            Float t = t0 - std::log(1 - rng.uniformFloat()) / sigma_maj[channel];
+            if (t >= seg.tMax) {
+                T_maj *= Exp(-sigma_maj * (seg.tMax - t0));
+                break;
+            }
+            T_maj *= Exp(-sigma_maj * (t - t0));
+            Float d = std::min(density(ray.at(t)), seg.maxDensity);
+            MajorantSample ms;
+            ms.pos = rWorld.at(t / length);
+            ms.sigma_a = d * _sigma_a;
+            ms.sigma_s = d * _sigma_s;
+            ms.sigma_maj = sigma_maj;
+            ms.T_maj = T_maj;
+            ms.g = _g;
+            if (!callback(ms)) {
+                return Spectrum(1.f);
+            }
+            T_maj = Spectrum(1.f);
+            t0 = t;
+        }
+    }
+    return T_maj;
+}
+
+//"param" : {
+//    "g" : 0,
+//    "sigma_a" : [0.f, 0.f, 0.f],
+//    "sigma_s" : [1.f, 1.f, 1.f],
+//    "transform" : null,
+//    "pMin" : [0, 0, 0],
+//    "pMax" : [1, 1, 1],
+//    "resolution" : [nx, ny, nz],
+//    // 密度数据，下标为 (z * ny + y) * nx + x
+//    "density" : [...],
+//    // 如果没有density字段，则从文件读取，文件内容为nx * ny * nz个32位浮点数
+//    "fileName" : "smoke.raw"
+//}
+CObject_ptr createGridMedium(const nloJson &param, const Arguments &lst) {
+    Float g = param.value("g", 0.f);
+    nloJson sig_a_data = param.value("sigma_a", nloJson::array({0.f, 0.f, 0.f}));
+    Spectrum sigma_a = Spectrum::FromJsonRGB(sig_a_data);
+    nloJson sig_s_data = param.value("sigma_s", nloJson::array({1.f, 1.f, 1.f}));
+    Spectrum sigma_s = Spectrum::FromJsonRGB(sig_s_data);
+
+    nloJson transformData = param.value("transform", nloJson());
+    std::unique_ptr<Transform> mediumToWorld(createTransform(transformData));
+
+    Vector3f pMin = Vector3f::fromJsonArray(param.value("pMin", nloJson::array({0, 0, 0})));
+    Vector3f pMax = Vector3f::fromJsonArray(param.value("pMax", nloJson::array({1, 1, 1})));
+    AABB3f bounds(Point3f(pMin.x, pMin.y, pMin.z), Point3f(pMax.x, pMax.y, pMax.z));
+
+    nloJson res = param.value("resolution", nloJson::array({1, 1, 1}));
+    int nx = res.at(0), ny = res.at(1), nz = res.at(2);
+    size_t nVoxels = (size_t)nx * ny * nz;
+    std::vector<Float> density(nVoxels, 0);
+
+    if (param.count("density")) {
+        nloJson data = param["density"];
+        CHECK_EQ(data.size(), nVoxels);
+        for (size_t i = 0; i < nVoxels; ++i) {
+            density[i] = data[i];
+        }
+    } else {
+        string fn = Paladin::getInstance()->getBasePath() + param.value("fileName", "");
+        std::ifstream fs(fn, std::ios::binary);
+        if (!fs) {
+            COUT << "grid medium file " << fn << " not found";
+            return nullptr;
+        }
+        std::vector<float> buffer(nVoxels);
+        fs.read((char *)buffer.data(), nVoxels * sizeof(float));
+        if ((size_t)fs.gcount() != nVoxels * sizeof(float)) {
+            COUT << StringPrintf("grid medium file %s is truncated, %lld of %lld bytes read",
+                                 fn.c_str(), (long long)fs.gcount(),
+                                 (long long)(nVoxels * sizeof(float)));
+            return nullptr;
+        }
+        for (size_t i = 0; i < nVoxels; ++i) {
+            density[i] = buffer[i];
+        }
+    }
+
+    SparseDensityGrid grid(nx, ny, nz, density.data());
+    int nBricks = grid.brickResolution().x * grid.brickResolution().y * grid.brickResolution().z;
+    COUT << StringPrintf("grid medium %d x %d x %d, %d of %d bricks allocated",
+                         nx, ny, nz, (int)grid.allocatedBricks(), nBricks);
+
+    auto ret = new GridMedium(sigma_a, sigma_s, g, *mediumToWorld, bounds, std::move(grid));
+    return ret;
+}
+
+REGISTER("grid", createGridMedium);
+
+PALADIN_END
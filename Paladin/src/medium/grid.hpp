@@ -0,0 +1,242 @@
+//
+//  grid.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/2/28.
+//
+
+#ifndef grid_hpp
+#define grid_hpp
+
+#include "core/medium.hpp"
+#include "core/spectrum.hpp"
+#include "math/transform.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * 稀疏的体素密度网格，思路类似于OpenVDB的叶子节点
+ *
+ * 烟雾，云朵这类数据通常大部分区域都是空的，
+ * 如果用稠密数组储存，空区域也要占用内存
+ * 这里把整个网格划分为若干个 8x8x8 的砖块(brick)，
+ * 全为0的砖块不分配内存，只在砖块索引表中记录为-1
+ *
+ * 每个砖块同时也是一个超体素(supervoxel)，记录砖块内密度的最大值，
+ * 作为delta tracking与ratio tracking的局部上界(majorant)
+ */
+class SparseDensityGrid {
+
+public:
+
+    static CONSTEXPR int BrickBits = 3;
+
+    static CONSTEXPR int BrickSize = 1 << BrickBits;
+
+    static CONSTEXPR int BrickVoxels = BrickSize * BrickSize * BrickSize;
+
+    SparseDensityGrid() {
+
+    }
+
+    /**
+     * 由稠密数组构造，density的下标为 (z * ny + y) * nx + x
+     */
+    SparseDensityGrid(int nx, int ny, int nz, const Float *density);
+
+    /**
+     * 整数坐标处的体素值，超出范围的体素值为0
+     */
+    Float voxel(int x, int y, int z) const {
+        if (x < 0 || x >= _nx || y < 0 || y >= _ny || z < 0 || z >= _nz) {
+            return 0;
+        }
+        int index = _brickIndex[brickOffset(x >> BrickBits, y >> BrickBits, z >> BrickBits)];
+        if (index < 0) {
+            return 0;
+        }
+        int local = ((z & (BrickSize - 1)) * BrickSize + (y & (BrickSize - 1))) * BrickSize
+                    + (x & (BrickSize - 1));
+        return _brickData[index * BrickVoxels + local];
+    }
+
+    /**
+     * 三线性插值，p为[0,1]^3中的点
+     */
+    Float density(const Point3f &p) const;
+
+    /**
+     * 砖块(bx, by, bz)范围内密度的上界
+     */
+    Float majorant(int bx, int by, int bz) const {
+        return _majorants[brickOffset(bx, by, bz)];
+    }
+
+    Point3i brickResolution() const {
+        return Point3i(_bx, _by, _bz);
+    }
+
+    Point3i resolution() const {
+        return Point3i(_nx, _ny, _nz);
+    }
+
+    /**
+     * 实际分配了内存的砖块数量
+     */
+    size_t allocatedBricks() const {
+        return _brickData.size() / BrickVoxels;
+    }
+
+private:
+
+    int brickOffset(int bx, int by, int bz) const {
+        return (bz * _by + by) * _bx + bx;
+    }
+
+    // 体素分辨率
+    int _nx = 0, _ny = 0, _nz = 0;
+    // 砖块分辨率
+    int _bx = 0, _by = 0, _bz = 0;
+    // 砖块索引表，-1表示空砖块
+    std::vector<int> _brickIndex;
+    // 所有非空砖块的数据，连续储存
+    std::vector<Float> _brickData;
+    // 每个砖块的密度上界
+    std::vector<Float> _majorants;
+};
+
+/**
+ * 沿着光线遍历majorant网格的迭代器，3D-DDA(Amanatides & Woo)
+ * 每次返回光线与一个砖块相交的区间，以及该砖块的密度上界
+ */
+struct MajorantSegment {
+    Float tMin, tMax;
+    Float maxDensity;
+};
+
+class MajorantIterator {
+
+public:
+
+    /**
+     * @param grid 密度网格
+     * @param ori  光线起点，单位为砖块
+     * @param dir  光线方向，单位为砖块
+     * @param tMin 光线参数的起点
+     * @param tMax 光线参数的终点
+     */
+    MajorantIterator(const SparseDensityGrid *grid, const Point3f &ori,
+                     const Vector3f &dir, Float tMin, Float tMax);
+
+    bool next(MajorantSegment *seg);
+
+private:
+
+    const SparseDensityGrid * _grid;
+
+    Float _tMin, _tMax;
+
+    // 当前所在的砖块
+    int _voxel[3];
+
+    int _step[3];
+
+    // 越界时的砖块坐标
+    int _voxelLimit[3];
+
+    // 下一次穿过各个轴向的平面时的光线参数
+    Float _nextCrossingT[3];
+
+    // 各个轴向上，穿过一个砖块的光线参数增量
+    Float _deltaT[3];
+};
+
+/**
+ * 非均匀网格介质
+ *
+ * 介质的消光系数为 σt(p) = d(p) * σt，d(p)为网格中的密度
+ * 此时透射率为
+ *
+ *     Tr(p0->p1) = e^(-∫[0,t] σt(p0 + t'ω) dt')
+ *
+ * 积分没有解析解，只能用随机方法估计
+ *
+ * delta tracking(也叫Woodcock tracking)：
+ * 假想在介质中添加一种"空粒子"(null particle)，使得总消光系数处处等于一个常数σ̄(majorant)
+ *
+ *     σn(p) = σ̄ - σt(p)
+ *
+ * 这样就可以按照均匀介质的方式采样距离，每次碰撞之后，
+ * 以 σt(p) / σ̄ 的概率为真实碰撞，否则为空碰撞，继续往前追踪
+ * 空粒子不改变光线的方向，也不吸收能量，所以结果是无偏的
+ *
+ * ratio tracking：
+ * 估计透射率的时候，不随机决定碰撞类型，而是把每次碰撞时空碰撞的概率乘起来
+ *
+ *     Tr ≈ ∏ (1 - σt(pi) / σ̄)
+ *
+ * 方差比delta tracking返回0或1的估计低得多
+ *
+ * 以上两种方法的效率都取决于σ̄与σt(p)的接近程度，
+ * 如果整个介质用一个全局的σ̄，稀薄区域会产生大量空碰撞
+ * 所以这里对每个砖块计算一个局部的σ̄，用3D-DDA逐个砖块地追踪，
+ * 空砖块σ̄为0，直接跳过，不消耗任何追踪步数
+ *
+ * 如果σt各个通道的值不同，用最大的通道计算σ̄，
+ * 真实碰撞与空碰撞的概率都按照最大通道计算，再用权重修正其他通道(spectral tracking)，
+ * σt为灰度时，权重恒为1，退化为普通的delta tracking
+ *
+ * 参考资料
+ * http://www.pbr-book.org/3ed-2018/Light_Transport_II_Volume_Rendering/Sampling_Volume_Scattering.html#HeterogeneousMedia
+ * Novák et al. Residual ratio tracking for estimating attenuation in participating media
+ * Kutz et al. Spectral and decomposition tracking for rendering heterogeneous volumes
+ */
+class GridMedium : public Medium {
+
+public:
+
+    GridMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
+               const Transform &mediumToWorld, const AABB3f &bounds,
+               SparseDensityGrid grid);
+
+    virtual Spectrum Tr(const Ray &ray, Sampler &sampler) const override;
+
+    virtual Spectrum sample(const Ray &ray, Sampler &sampler, MemoryArena &arena,
+                            MediumInteraction *mi) const override;
+
+    virtual Spectrum sampleTmaj(const Ray &ray, int channel, RNG &rng,
+                                const std::function<bool(const MajorantSample &)> &callback) const override;
+
+private:
+
+    /**
+     * 把世界空间的光线转换到介质空间，光线方向为单位向量，tMax为世界空间的距离
+     * 如果光线与网格包围盒相交，返回true，并返回交点区间
+     */
+    bool traverse(const Ray &rWorld, Ray *ray, Float *tMin, Float *tMax) const;
+
+    MajorantIterator majorantIterator(const Ray &ray, Float tMin, Float tMax) const;
+
+    Float density(const Point3f &p) const {
+        Vector3f pGrid = _bounds.offset(p);
+        return _grid.density(Point3f(pGrid.x, pGrid.y, pGrid.z));
+    }
+
+    const Spectrum _sigma_a, _sigma_s, _sigma_t;
+    // 所有通道中最大的σt，用于计算majorant
+    const Float _sigma_tMax;
+
+    const Float _g;
+
+    const Transform _worldToMedium;
+    // 介质空间中网格的范围
+    const AABB3f _bounds;
+
+    const SparseDensityGrid _grid;
+};
+
+CObject_ptr createGridMedium(const nloJson &param, const Arguments &lst);
+
+PALADIN_END
+
+#endif /* grid_hpp */
@@ -75,6 +75,37 @@ Spectrum HomogeneousMedium::sample(const Ray &ray, Sampler &sampler, MemoryArena
     return sampledMedium ? (Tr * _sigma_s / pdf) : (Tr / pdf);
 }
 
+/**
+ * 均匀介质的majorant就是σt本身，整条光线只有一个区间
+ * 空碰撞系数σn为0，所有候选碰撞点都是真实碰撞
+ */
+Spectrum HomogeneousMedium::sampleTmaj(const Ray &ray, int channel, RNG &rng,
+                                       const std::function<bool(const MajorantSample &)> &callback) const {
+    Float length = ray.dir.length();
+    Float tMax = std::min(ray.tMax * length, MaxFloat);
+    Float sigmaMaj = _sigma_t[channel];
+    if (sigmaMaj == 0) {
+        return Exp(-_sigma_t * tMax);
+    }
+    Float tMin = 0;
+    while (true) {
+        Float t = tMin - std::log(1 - rng.uniformFloat()) / sigmaMaj;
+        if (t >= tMax) {
+            return Exp(-_sigma_t * (tMax - tMin));
+        }
+        MajorantSample ms;
+        ms.pos = ray.at(t / length);
+        ms.sigma_a = _sigma_a;
+        ms.sigma_s = _sigma_s;
+        ms.sigma_maj = _sigma_t;
+        ms.T_maj = Exp(-_sigma_t * (t - tMin));
+        ms.g = _g;
+        if (!callback(ms)) {
+            return Spectrum(1.f);
+        }
+        tMin = t;
+    }
+}
 
 //"param" : {
 //    "g" : 0,
@@ -174,6 +174,9 @@ public:
 	virtual Spectrum sample(const Ray &ray, Sampler &sampler, MemoryArena &arena,
 						MediumInteraction *mi) const override;
 
+    virtual Spectrum sampleTmaj(const Ray &ray, int channel, RNG &rng,
+                                const std::function<bool(const MajorantSample &)> &callback) const override;
+
 private:
 	// 散射系数
 	const Spectrum _sigma_s;
@@ -16,6 +16,8 @@
 #include "core/light.hpp"
 #include "lights/diffuse.hpp"
 #include "shapes/trianglemesh.hpp"
+#include "accelerators/curvebvh.hpp"
+#include "shapes/subdivision.hpp"
 #include "tools/parallel.hpp"
 #include "core/medium.hpp"
 #include "materials/matte.hpp"
@@ -75,7 +77,7 @@ void SceneParser::parse(const nloJson &data) {
     nloJson acceleratorData = data.value("accelerator", nloJson::object());
     _aggregate = parseAccelerator(acceleratorData);
     
-    auto scene = new Scene(_aggregate, _lights);
+    auto scene = new Scene(_aggregate, _lights, _primitives);
     _scene.reset(scene);
     
     _integrator->render(*scene);
@@ -231,6 +233,8 @@ void SceneParser::parseShapes(const nloJson &shapeDataList) {
             parseTriMesh(shapeData);
         } else if (type == "clonal") {
             parseClonal(shapeData);
+        } else if (type == "curves") {
+            parseCurves(shapeData);
         } else {
             parseSimpleShape(shapeData, type);
         }
@@ -252,10 +256,20 @@ void SceneParser::parseShapes(const nloJson &shapeDataList) {
 //            "param" : [0.35,-0.7,-0.4]
 //        }
 //    ],
+//    "transformEnd" : [
+//        {
+//            "type" : "translate",
+//            "param" : [0.35,-0.5,-0.4]
+//        }
+//    ],
+//    "startTime" : 0,
+//    "endTime" : 1,
 //    "mediumInterface" : [null, "fog"],
 //    "from" : "cube1",
 //    "material" : "glass"
 //},
+// transformEnd为可选项，有则为运动的实例，
+// 在startTime到endTime之间从transform插值到transformEnd
 void SceneParser::parseClonal(const nloJson &data) {
     // paladin的实例化暂时不支持光源
     nloJson param = data.value("param", nloJson::object());
@@ -270,6 +284,19 @@ void SceneParser::parseClonal(const nloJson &data) {
     vector<shared_ptr<Primitive>> tPrims;
     auto l2w = createTransform(data.value("transform", nloJson()));
     shared_ptr<Transform> o2w(l2w);
+    nloJson transformEnd = data.value("transformEnd", nloJson());
+    if (!transformEnd.is_null()) {
+        shared_ptr<Transform> o2wEnd(createTransform(transformEnd));
+        Float startTime = data.value("startTime", 0.f);
+        Float endTime = data.value("endTime", 1.f);
+        for (auto iter = prims.cbegin(); iter != prims.cend(); ++iter) {
+            auto aPrim = AnimatedPrimitive::create(*iter, o2w, startTime,
+                                                   o2wEnd, endTime,
+                                                   mat, mediumInterface);
+            _primitives.push_back(aPrim);
+        }
+        return;
+    }
     for (auto iter = prims.cbegin(); iter != prims.cend(); ++iter) {
         auto tPrim = TransformedPrimitive::create(*iter, o2w, mat, mediumInterface);
         _primitives.push_back(tPrim);
@@ -364,6 +391,9 @@ void SceneParser::parseTriMesh(const nloJson &data) {
     } else if (subType == "mesh") {
         MeshParser mp;
         prims = mp.getPrimitiveLst(data, _lights);
+    } else if (subType == "subdivision") {
+        // 参数格式参见createSubdivPrimitive
+        prims = createSubdivPrimitive(data, mat, mediumInterface);
     }
     if (data.value("clone", false)) {
         string name = data.value("name", "");
@@ -374,6 +404,18 @@ void SceneParser::parseTriMesh(const nloJson &data) {
 
 
 
+// 参数格式参见createCurvesPrimitive
+// 曲线自带一个BVH，整组曲线作为一个图元放入场景中
+void SceneParser::parseCurves(const nloJson &data) {
+    nloJson medIntfceData = data.value("mediumInterface", nloJson());
+    MediumInterface mediumInterface = getMediumIntetface(medIntfceData);
+    shared_ptr<const Material> mat = getMaterial(data.value("material", nloJson()));
+    auto prim = createCurvesPrimitive(data, mat, mediumInterface);
+    if (prim) {
+        _primitives.push_back(prim);
+    }
+}
+
 //"data" : {
 //    "type" : "bvh",
 //    "param" : {
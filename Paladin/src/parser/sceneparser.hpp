@@ -61,6 +61,9 @@ public:
     // 解析clone物体，注意，clone物体暂不支持quad,cube
     void parseClonal(const nloJson &data);
     
+    // 解析曲线，头发，草等
+    void parseCurves(const nloJson &data);
+    
     void parseTransformMap(const nloJson &dict);
     
     shared_ptr<Aggregate> parseAccelerator(const nloJson &);
@@ -39,6 +39,7 @@ static uint64_t multiplicativeInverse(int64_t a, int64_t n) {
 HaltonSampler::HaltonSampler(int samplesPerPixel, const AABB2i &sampleBounds,
                              bool sampleAtPixelCenter)
 : GlobalSampler(samplesPerPixel),
+_sampleBounds(sampleBounds),
 _sampleAtPixelCenter(sampleAtPixelCenter) {
     // 生成质数进制随机重排表
     if (_radicalInversePermutations.empty()) {
@@ -200,6 +201,13 @@ std::unique_ptr<Sampler> HaltonSampler::clone(int seed) {
     return std::unique_ptr<Sampler>(new HaltonSampler(*this));
 }
 
+std::unique_ptr<Sampler> HaltonSampler::clonePass(int64_t firstSample, int64_t nSamples) {
+    HaltonSampler *sampler = new HaltonSampler(nSamples, _sampleBounds, _sampleAtPixelCenter);
+    sampler->_firstSample = firstSample;
+    sampler->copyArrayRequests(*this);
+    return std::unique_ptr<Sampler>(sampler);
+}
+
 /**
  * param : {
  *     "spp" : 8,
@@ -80,6 +80,8 @@ public:
     
     virtual std::unique_ptr<Sampler> clone(int seed) override;
     
+    virtual std::unique_ptr<Sampler> clonePass(int64_t firstSample, int64_t nSamples) override;
+    
     virtual nloJson toJson() const override;
     
 private:
@@ -112,6 +114,9 @@ private:
     // 用于储存第一个落在该像素上的样本点的全局样本索引
     mutable int64_t _offsetForCurrentPixel;
     
+    // 采样范围，clonePass时重新构造需要用到
+    AABB2i _sampleBounds;
+    
     // 是否强制采样像素中心，如果为true，
     // 则生成的高维变量的前两个维度为0.5，采样像素中心
     bool _sampleAtPixelCenter;
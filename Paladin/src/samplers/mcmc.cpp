@@ -6,3 +6,91 @@
 //
 
 #include "mcmc.hpp"
+
+PALADIN_BEGIN
+
+Float MLTSampler::get1D() {
+    int index = getNextIndex();
+    ensureReady(index);
+    return _X[index].value;
+}
+
+Point2f MLTSampler::get2D() {
+    // 注意求值顺序，先x后y
+    Float x = get1D();
+    Float y = get1D();
+    return Point2f(x, y);
+}
+
+std::unique_ptr<Sampler> MLTSampler::clone(int seed) {
+    // 复制主样本空间的状态，随机数序列换成seed对应的序列，
+    // 克隆出来的链从相同的状态出发，之后的变异互相独立
+    MLTSampler *sampler = new MLTSampler(*this);
+    sampler->_rng.setSequence(seed);
+    return std::unique_ptr<Sampler>(sampler);
+}
+
+std::unique_ptr<Sampler> MLTSampler::clonePass(int64_t firstSample, int64_t nSamples) {
+    // 马尔可夫链的状态依赖之前所有的迭代，不能按轮次拆分，
+    // 只能以firstSample为随机数序列重新开始一条链
+    return std::unique_ptr<Sampler>(new MLTSampler((int)nSamples, (int)firstSample, _sigma,
+                                                   _largeStepProbability, _streamCount));
+}
+
+void MLTSampler::startIteration() {
+    _currentIteration++;
+    _largeStep = _rng.uniformFloat() < _largeStepProbability;
+}
+
+void MLTSampler::accept() {
+    if (_largeStep) {
+        _lastLargeStepIteration = _currentIteration;
+    }
+}
+
+void MLTSampler::reject() {
+    for (auto &Xi : _X) {
+        if (Xi.lastModificationIteration == _currentIteration) {
+            Xi.restore();
+        }
+    }
+    --_currentIteration;
+}
+
+void MLTSampler::startStream(int index) {
+    CHECK_LT(index, _streamCount);
+    _streamIndex = index;
+    _sampleIndex = 0;
+}
+
+void MLTSampler::ensureReady(int index) {
+    // 维度不够则扩展，新的维度的初始值视为在第0次迭代时均匀采样
+    if (index >= (int)_X.size()) {
+        _X.resize(index + 1);
+    }
+    PrimarySample &Xi = _X[index];
+
+    // 如果在最后一次大变异之前没有修改过，则先补一次大变异，也就是重新均匀采样
+    if (Xi.lastModificationIteration < _lastLargeStepIteration) {
+        Xi.value = _rng.uniformFloat();
+        Xi.lastModificationIteration = _lastLargeStepIteration;
+    }
+
+    // 修改之前备份，拒绝时恢复
+    Xi.backup();
+    if (_largeStep) {
+        Xi.value = _rng.uniformFloat();
+    } else {
+        int64_t nSmall = _currentIteration - Xi.lastModificationIteration;
+        // n次小变异的叠加等价于一次标准差为 σ√n 的正态扰动
+        // 用逆误差函数把均匀分布转换为正态分布
+        Float normalSample = Sqrt2 * ErfInv(2 * _rng.uniformFloat() - 1);
+        Float effSigma = _sigma * std::sqrt((Float)nSmall);
+        Xi.value += normalSample * effSigma;
+        // 把值卷回[0,1)
+        Xi.value -= std::floor(Xi.value);
+    }
+    Xi.lastModificationIteration = _currentIteration;
+}
+
+PALADIN_END
@@ -9,11 +9,138 @@
 #define mcmc_hpp
 
 #include "core/sampler.hpp"
+#include "math/rng.h"
 
 PALADIN_BEGIN
 
 //马尔科夫链蒙特卡洛采样
 
+/**
+ * 主样本空间(primary sample space)的MLT采样器
+ *
+ * 一条光路可以由一个无限维的随机数向量 X = (ξ1, ξ2, ξ3 ...) 完全确定，
+ * 这个随机数向量所在的[0,1)^∞空间称为主样本空间
+ * 路径生成函数(例如双向方法中的generateCameraSubpath等)是把X映射到路径空间的确定性函数
+ * 所以只要在主样本空间中对X做变异(mutation)，就可以间接地在路径空间中做变异，
+ * 并且完全不需要关心路径的具体结构
+ *
+ * 变异分两种
+ *     1.大变异(large step)：所有维度重新均匀采样，保证马尔可夫链的遍历性
+ *     2.小变异(small step)：每个维度加上一个正态分布的扰动，用于探索当前路径附近的路径
+ *
+ * 由于路径长度不固定，X的维度事先未知，所以采用惰性变异的策略
+ * 每个维度记录上次修改时的迭代序号，只有在被访问到时才把欠下的变异补上
+ * 连续n次小变异的叠加等价于一次标准差为 σ√n 的正态扰动，可以一次性补齐
+ *
+ * 如果提议的状态被拒绝，需要把被修改过的维度恢复原值，所以每个维度都保存一份备份
+ *
+ * 双向方法一次采样需要相机子路径，光源子路径，以及连接三组随机数
+ * 如果共用一个流，相机子路径长度变化会导致光源子路径的随机数错位，小变异就不再"小"了
+ * 所以把X交错地分成若干个流(stream)，第i个流使用 i, i+n, i+2n ... 这些维度
+ */
+class MLTSampler : public Sampler {
+
+public:
+
+    MLTSampler(int mutationsPerPixel, int rngSequenceIndex, Float sigma,
+               Float largeStepProbability, int streamCount)
+    : Sampler(mutationsPerPixel),
+    _rng(rngSequenceIndex),
+    _sigma(sigma),
+    _largeStepProbability(largeStepProbability),
+    _streamCount(streamCount) {
+
+    }
+
+    virtual Float get1D() override;
+
+    virtual Point2f get2D() override;
+
+    virtual std::unique_ptr<Sampler> clone(int seed) override;
+
+    virtual std::unique_ptr<Sampler> clonePass(int64_t firstSample, int64_t nSamples) override;
+
+    /**
+     * 开始一次新的变异，以_largeStepProbability的概率选择大变异
+     */
+    void startIteration();
+
+    /**
+     * 接受提议的状态，记录最后一次大变异的迭代序号
+     */
+    void accept();
+
+    /**
+     * 拒绝提议的状态，把本次迭代修改过的维度恢复为备份值
+     */
+    void reject();
+
+    /**
+     * 切换到第index个流，维度从头开始计数
+     */
+    void startStream(int index);
+
+    /**
+     * 返回当前流中下一个维度在X中的全局索引
+     */
+    int getNextIndex() {
+        return _streamIndex + _streamCount * _sampleIndex++;
+    }
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
+private:
+
+    /**
+     * 主样本空间中的一个维度
+     */
+    struct PrimarySample {
+        /**
+         * 修改之前先备份
+         */
+        void backup() {
+            valueBackup = value;
+            modifyBackup = lastModificationIteration;
+        }
+
+        void restore() {
+            value = valueBackup;
+            lastModificationIteration = modifyBackup;
+        }
+
+        Float value = 0;
+        // 该维度最后一次被修改时的迭代序号
+        int64_t lastModificationIteration = 0;
+        Float valueBackup = 0;
+        int64_t modifyBackup = 0;
+    };
+
+    /**
+     * 把第index个维度的变异补齐到当前迭代
+     */
+    void ensureReady(int index);
+
+    RNG _rng;
+    // 小变异的正态分布标准差
+    const Float _sigma;
+    // 选择大变异的概率
+    const Float _largeStepProbability;
+    // 流的数量
+    const int _streamCount;
+    // 主样本空间向量
+    std::vector<PrimarySample> _X;
+    // 当前迭代序号
+    int64_t _currentIteration = 0;
+    // 当前迭代是否为大变异
+    bool _largeStep = true;
+    // 最后一次被接受的大变异的迭代序号
+    int64_t _lastLargeStepIteration = 0;
+    // 当前流的索引，以及当前流中的维度序号
+    int _streamIndex;
+    int _sampleIndex;
+};
 
 PALADIN_END
 
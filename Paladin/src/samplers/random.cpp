@@ -21,20 +21,40 @@ Point2f RandomSampler::get2D() {
 }
 
 std::unique_ptr<Sampler> RandomSampler::clone(int seed) {
-    RandomSampler *rs = new RandomSampler(*this);
-    rs->_rng.setSequence(seed);
-    return std::unique_ptr<Sampler>(rs);
+    return std::unique_ptr<Sampler>(new RandomSampler(*this));
+}
+
+std::unique_ptr<Sampler> RandomSampler::clonePass(int64_t firstSample, int64_t nSamples) {
+    RandomSampler *sampler = new RandomSampler(nSamples, _seed);
+    sampler->_firstSample = firstSample;
+    sampler->copyArrayRequests(*this);
+    return std::unique_ptr<Sampler>(sampler);
 }
 
 void RandomSampler::startPixel(const Point2i &p) {
+    Sampler::startPixel(p);
+    // 样本数组使用单独的序列，只取决于像素
+    RNG arrayRng(MixBits(pixelHash(p, _seed) ^ 0x9e3779b97f4a7c15ULL) ^ passHash());
     for (size_t i = 0; i < _sampleArray1D.size(); ++i)
         for (size_t j = 0; j < _sampleArray1D[i].size(); ++j)
-            _sampleArray1D[i][j] = _rng.uniformFloat();
+            _sampleArray1D[i][j] = arrayRng.uniformFloat();
     
     for (size_t i = 0; i < _sampleArray2D.size(); ++i)
         for (size_t j = 0; j < _sampleArray2D[i].size(); ++j)
-            _sampleArray2D[i][j] = {_rng.uniformFloat(), _rng.uniformFloat()};
-    Sampler::startPixel(p);
+            _sampleArray2D[i][j] = {arrayRng.uniformFloat(), arrayRng.uniformFloat()};
+    seekSample();
+}
+
+bool RandomSampler::startNextSample() {
+    bool ret = Sampler::startNextSample();
+    seekSample();
+    return ret;
+}
+
+bool RandomSampler::setSampleIndex(int64_t sampleNum) {
+    bool ret = Sampler::setSampleIndex(sampleNum);
+    seekSample();
+    return ret;
 }
 
 nloJson RandomSampler::toJson() const {
@@ -43,12 +63,14 @@ nloJson RandomSampler::toJson() const {
 
 /**
  * param : {
- *     "spp" : 8
+ *     "spp" : 8,
+ *     "seed" : 0
  * }
  */
 CObject_ptr createRandomSampler(const nloJson &param) {
     int spp = param.value("spp", 8);
-    return new RandomSampler(spp);
+    int seed = param.value("seed", 0);
+    return new RandomSampler(spp, seed);
 }
 
 REGISTER("random", createRandomSampler);
@@ -14,26 +14,49 @@
 
 PALADIN_BEGIN
 
+/**
+ * 随机采样器
+ * 使用计数器RNG：每个(像素，样本索引)对应PCG32的一段固定的子序列，
+ * 切换样本时用advance直接跳到对应的位置，
+ * 所以样本只取决于(像素，样本索引，维度)，与采样的先后顺序无关
+ */
 class RandomSampler : public Sampler {
 public:
     RandomSampler(int ns, int seed = 0)
     : Sampler(ns),
-    _rng(seed) {
-        
+    _seed(seed) {
+        // 不调用startPixel直接取样时(如vcm的光子路径)，序列由seed决定
+        seekSample();
     }
     
     virtual void startPixel(const Point2i &) override;
     
+    virtual bool startNextSample() override;
+    
+    virtual bool setSampleIndex(int64_t sampleNum) override;
+    
     virtual Float get1D() override;
     
     virtual Point2f get2D() override;
     
     virtual nloJson toJson() const override;
     
+    // 忽略tile的种子，随机数序列只由像素、样本索引与构造时的种子决定
     virtual std::unique_ptr<Sampler> clone(int seed) override;
     
+    virtual std::unique_ptr<Sampler> clonePass(int64_t firstSample, int64_t nSamples) override;
+    
 private:
+    
+    // 把_rng定位到当前像素当前样本的子序列
+    void seekSample() {
+        _rng.setSequence(pixelHash(_currentPixel, _seed));
+        _rng.advance((_firstSample + _currentPixelSampleIndex) * MaxRandomPerSample);
+    }
+    
     RNG _rng;
+    
+    const int _seed;
 };
 
 USING_STD
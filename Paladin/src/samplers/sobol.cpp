@@ -0,0 +1,83 @@
+//
+//  sobol.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/7.
+//
+
+#include "sobol.hpp"
+
+PALADIN_BEGIN
+
+SobolSampler::SobolSampler(int spp, uint32_t seed, bool sampleAtPixelCenter)
+: GlobalSampler(spp),
+_seed(seed),
+_pixelHash(0),
+_sampleAtPixelCenter(sampleAtPixelCenter) {
+    
+}
+
+void SobolSampler::startPixel(const Point2i &p) {
+    // 需要在GlobalSampler::startPixel生成样本数组之前计算
+    uint64_t key = (uint64_t(uint32_t(p.x)) << 32) | uint32_t(p.y);
+    _pixelHash = MixBits(key ^ MixBits(_seed));
+    _cachedBlock = -1;
+    GlobalSampler::startPixel(p);
+}
+
+uint32_t SobolSampler::sampleBits(int64_t index, int dim) const {
+    int block = dim / NSobolDimensions;
+    int component = dim % NSobolDimensions;
+    if (index != _cachedIndex || block != _cachedBlock) {
+        // 同一个块内的所有维度使用相同的索引扰乱，保持块内的分层性质
+        uint64_t blockHash = MixBits(_pixelHash ^ (uint64_t(block) * 0x9e3779b97f4a7c15ULL));
+        _cachedScrambledIndex = NestedUniformScramble(uint32_t(index), uint32_t(blockHash));
+        for (int i = 0; i < NSobolDimensions; ++i) {
+            _cachedDimSeeds[i] = uint32_t(MixBits(blockHash + uint64_t(i) + 1));
+        }
+        _cachedIndex = index;
+        _cachedBlock = block;
+    }
+    uint32_t v = SobolSample32(_cachedScrambledIndex, component);
+    return NestedUniformScramble(v, _cachedDimSeeds[component]);
+}
+
+Float SobolSampler::sampleDimension(int64_t index, int dim) const {
+    if (_sampleAtPixelCenter && (dim == 0 || dim == 1)) {
+        return 0.5f;
+    }
+    return bitsToFloat(sampleBits(index, dim));
+}
+
+nloJson SobolSampler::toJson() const {
+    return nloJson();
+}
+
+std::unique_ptr<Sampler> SobolSampler::clone(int seed) {
+    return std::unique_ptr<Sampler>(new SobolSampler(*this));
+}
+
+std::unique_ptr<Sampler> SobolSampler::clonePass(int64_t firstSample, int64_t nSamples) {
+    SobolSampler *sampler = new SobolSampler(nSamples, _seed, _sampleAtPixelCenter);
+    sampler->_firstSample = firstSample;
+    sampler->copyArrayRequests(*this);
+    return std::unique_ptr<Sampler>(sampler);
+}
+
+/**
+ * param : {
+ *     "spp" : 8,
+ *     "seed" : 0,
+ *     "sampleAtPixelCenter" : false
+ * }
+ */
+CObject_ptr createSobolSampler(const nloJson &param, const Arguments &lst) {
+    bool sampleAtPixelCenter = param.value("sampleAtPixelCenter", false);
+    int spp = param.value("spp", 8);
+    uint32_t seed = param.value("seed", 0u);
+    return new SobolSampler(spp, seed, sampleAtPixelCenter);
+}
+
+REGISTER("sobol", createSobolSampler);
+
+PALADIN_END
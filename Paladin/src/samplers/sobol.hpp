@@ -0,0 +1,97 @@
+//
+//  sobol.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/7.
+//
+
+#ifndef sobol_hpp
+#define sobol_hpp
+
+#include "core/header.h"
+#include "core/sampler.hpp"
+#include "math/lowdiscrepancy.hpp"
+#include "tools/classfactory.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * sobol采样器，继承GlobalSampler
+ *
+ * sobol序列是以2为基底的低差异序列，第i个维度由一个32x32的二进制生成矩阵Ci决定
+ * 把样本索引a看作二进制列向量，样本值为 x(a) = Ci * a (模2运算)
+ * 模2的矩阵乘法就是把a中为1的位所对应的矩阵列异或起来，32个输出位同时计算
+ * 见SobolSample32
+ *
+ * 前2^m个样本在任意两个维度的投影上都满足(0,m,2)网格的分层性质(部分维度组合为(1,m,2))
+ * 样本数为2的幂时效果最好
+ *
+ * 这里没有使用全局的sobol序列(那需要像halton一样根据像素反推样本索引)，
+ * 而是每个像素使用一个独立的序列，索引就是像素内的样本索引，getIndexForSample没有任何开销
+ *
+ * 像素之间的去相关与高维度的扩展都用Owen扰乱实现，参考
+ * Burley. Practical Hash-based Owen Scrambling (2020)
+ *
+ *     1.把维度分成若干个4维的块(padding)，每个块使用sobol序列的前4个维度
+ *     2.每个块先对样本索引做一次Owen扰乱，打乱样本的顺序，块与块之间互不相关
+ *       扰乱保留了索引的高位结构，所以前2^m个样本依然是同一个网格
+ *     3.对每个维度的样本值再做一次Owen扰乱，像素之间互不相关，估计无偏
+ *
+ * 扰乱的种子由(像素，随机种子，块，维度)哈希得到，没有任何预计算的表，
+ * 所以采样结果只取决于(像素，样本索引，维度)，与tile的划分和线程调度无关
+ */
+class SobolSampler : public GlobalSampler {
+    
+public:
+    
+    SobolSampler(int spp, uint32_t seed = 0, bool sampleAtPixelCenter = false);
+    
+    virtual void startPixel(const Point2i &p) override;
+    
+    virtual int64_t getIndexForSample(int64_t sampleNum) const override {
+        return sampleNum;
+    }
+    
+    virtual Float sampleDimension(int64_t index, int dimension) const override;
+    
+    // 扰乱只取决于像素与构造时的种子，忽略tile的种子，保证结果与tile划分无关
+    virtual std::unique_ptr<Sampler> clone(int seed) override;
+    
+    virtual std::unique_ptr<Sampler> clonePass(int64_t firstSample, int64_t nSamples) override;
+    
+    virtual nloJson toJson() const override;
+    
+protected:
+    
+    /**
+     * 扰乱之后的样本值，32位定点数
+     */
+    uint32_t sampleBits(int64_t index, int dimension) const;
+    
+    // 乘以2^-32转换为[0,1)的浮点数
+    static Float bitsToFloat(uint32_t v) {
+        return std::min(v * Float(2.3283064365386963e-10), OneMinusEpsilon);
+    }
+    
+    // 用户指定的随机种子，不同的种子得到不同的扰乱
+    uint32_t _seed;
+    
+    // 当前像素的哈希值，每个像素只计算一次
+    uint64_t _pixelHash;
+    
+    // 同一个样本连续取多个维度时，块的索引扰乱与块内各维度的种子只计算一次
+    // 与ZSobolSampler的缓存类似，startPixel时失效
+    mutable int64_t _cachedIndex = -1;
+    mutable int _cachedBlock = -1;
+    mutable uint32_t _cachedScrambledIndex = 0;
+    mutable uint32_t _cachedDimSeeds[NSobolDimensions];
+    
+    // 是否强制采样像素中心
+    bool _sampleAtPixelCenter;
+};
+
+CObject_ptr createSobolSampler(const nloJson &param, const Arguments &lst);
+
+PALADIN_END
+
+#endif /* sobol_hpp */
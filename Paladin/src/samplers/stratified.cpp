@@ -11,8 +11,10 @@
 PALADIN_BEGIN
 
 void StratifiedSampler::startPixel(const Point2i &p) {
+    // 随机数序列只取决于像素，与之前采样过哪些像素无关
+    seedPixel(p);
     // 为每个像素生成一系列单独的样本，然后乱序
-    size_t count = _xPixelSamples * _xPixelSamples;
+    size_t count = _xPixelSamples * _yPixelSamples;
     for (size_t i = 0; i < _samples1D.size(); ++i) {
         stratifiedSample1D(&_samples1D[i][0], count, _rng, _jitterSamples);
         // 下标i代表维度
@@ -45,9 +47,22 @@ nloJson StratifiedSampler::toJson() const {
 }
 
 std::unique_ptr<Sampler> StratifiedSampler::clone(int seed) {
-    StratifiedSampler * ret = new StratifiedSampler(*this);
-    ret->_rng.setSequence(seed);
-    return std::unique_ptr<Sampler>(ret);
+    // 随机数序列在startPixel中由像素重新设置，不需要tile的种子
+    return std::unique_ptr<Sampler>(new StratifiedSampler(*this));
+}
+
+std::unique_ptr<Sampler> StratifiedSampler::clonePass(int64_t firstSample, int64_t nSamples) {
+    // 把nSamples分解为尽量接近正方形的xy分层
+    int xSamples = (int)std::sqrt((Float)nSamples);
+    while (nSamples % xSamples != 0) {
+        --xSamples;
+    }
+    int ySamples = (int)(nSamples / xSamples);
+    StratifiedSampler *sampler = new StratifiedSampler(xSamples, ySamples, _jitterSamples,
+                                                       (int)_samples1D.size(), _seed);
+    sampler->_firstSample = firstSample;
+    sampler->copyArrayRequests(*this);
+    return std::unique_ptr<Sampler>(sampler);
 }
 
 /**
@@ -55,7 +70,8 @@ std::unique_ptr<Sampler> StratifiedSampler::clone(int seed) {
  *     "jitter" : true,
  *     "xsamples" : 3,
  *     "xsamples" : 3,
- *     "dimesions" : 6
+ *     "dimesions" : 6,
+ *     "seed" : 0
  * }
  */
 CObject_ptr createStratifiedSampler(const nloJson &param) {
@@ -64,7 +80,8 @@ CObject_ptr createStratifiedSampler(const nloJson &param) {
     int ysamp = param.value("ySamples", 0);
     ysamp = ysamp == 0 ? xsamp : ysamp;
     int sd = param.value("dimensions", 6);
-    return new StratifiedSampler(xsamp, ysamp, jitter, sd);
+    int seed = param.value("seed", 0);
+    return new StratifiedSampler(xsamp, ysamp, jitter, sd, seed);
 }
 
 REGISTER("stratified", createStratifiedSampler);
@@ -29,8 +29,8 @@ class StratifiedSampler : public PixelSampler {
     
 public:
     StratifiedSampler(int xPixelSamples, int yPixelSamples, bool jitterSamples,
-                      int nSampledDimensions)
-    : PixelSampler(xPixelSamples * yPixelSamples, nSampledDimensions),
+                      int nSampledDimensions, int seed = 0)
+    : PixelSampler(xPixelSamples * yPixelSamples, nSampledDimensions, seed),
     _xPixelSamples(xPixelSamples),
     _yPixelSamples(yPixelSamples),
     _jitterSamples(jitterSamples) {
@@ -43,6 +43,8 @@ public:
     
     virtual std::unique_ptr<Sampler> clone(int seed) override;
     
+    virtual std::unique_ptr<Sampler> clonePass(int64_t firstSample, int64_t nSamples) override;
+    
 private:
 
     const int _xPixelSamples, _yPixelSamples;
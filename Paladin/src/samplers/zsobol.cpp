@@ -0,0 +1,144 @@
+//
+//  zsobol.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/7.
+//
+
+#include "zsobol.hpp"
+#include "core/film.hpp"
+
+PALADIN_BEGIN
+
+// 4个元素的全部24种排列
+static const uint8_t kPermutations[24][4] = {
+    {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1},
+    {0, 3, 2, 1}, {0, 3, 1, 2}, {1, 0, 2, 3}, {1, 0, 3, 2},
+    {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+    {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1},
+    {2, 3, 0, 1}, {2, 3, 1, 0}, {3, 1, 2, 0}, {3, 1, 0, 2},
+    {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+};
+
+// 把16位整数的每一位之间插入一个0
+static inline uint32_t spreadBits(uint32_t x) {
+    x &= 0x0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+static inline int log2Ceil(int64_t v) {
+    int ret = 0;
+    while ((int64_t(1) << ret) < v) {
+        ++ret;
+    }
+    return ret;
+}
+
+ZSobolSampler::ZSobolSampler(int spp, const AABB2i &sampleBounds, uint32_t seed,
+                             bool sampleAtPixelCenter)
+: SobolSampler(spp, seed, sampleAtPixelCenter),
+_sampleBounds(sampleBounds),
+_pixelMin(sampleBounds.pMin) {
+    Vector2i res = sampleBounds.pMax - sampleBounds.pMin;
+    _log2spp = log2Ceil(spp);
+    CHECK_LE(_log2spp, 30);
+    _log2Res = std::min(log2Ceil(std::max(res.x, res.y)), (32 - _log2spp) / 2);
+    _nBase4Digits = _log2Res + (_log2spp + 1) / 2;
+    _seedHash = MixBits(MixBits(_seed) ^ 0x5bd1e995ULL);
+}
+
+uint32_t ZSobolSampler::getSampleIndex(int64_t index, int dim) const {
+    // clonePass出来的采样器，样本索引可以超过spp，
+    // 超出的部分作为轮次参与哈希，每一轮都是一组新的蓝噪声样本
+    uint64_t round = uint64_t(index) >> _log2spp;
+    index &= (int64_t(1) << _log2spp) - 1;
+    uint32_t mask = (uint32_t(1) << _log2Res) - 1;
+    uint32_t px = uint32_t(_currentPixel.x - _pixelMin.x);
+    uint32_t py = uint32_t(_currentPixel.y - _pixelMin.y);
+    uint64_t mortonIndex = (uint64_t(spreadBits(px & mask) | (spreadBits(py & mask) << 1)) << _log2spp)
+                            | uint64_t(index);
+    // 超出周期的部分参与哈希，平铺的块之间使用不同的置换
+    uint64_t tileHash = MixBits(((uint64_t(px >> _log2Res) << 32) | (py >> _log2Res))
+                                ^ _seedHash ^ (uint64_t(dim) * 0x9e3779b97f4a7c15ULL)
+                                ^ (round * 0xd6e8feb86659fd93ULL));
+    
+    // spp为2的奇数次幂时，最低位是单独的一个二进制位
+    bool oddBit = _log2spp & 1;
+    int lastDigit = oddBit ? 1 : 0;
+    uint32_t sampleIndex = 0;
+    for (int i = _nBase4Digits - 1; i >= lastDigit; --i) {
+        int digitShift = 2 * i - lastDigit;
+        int digit = (mortonIndex >> digitShift) & 3;
+        uint64_t higherDigits = mortonIndex >> (digitShift + 2);
+        // 用乘法代替取模，把哈希的高32位映射到[0,24)
+        int p = int(((MixBits(higherDigits ^ tileHash) >> 32) * 24) >> 32);
+        sampleIndex |= uint32_t(kPermutations[p][digit]) << digitShift;
+    }
+    if (oddBit) {
+        uint32_t digit = mortonIndex & 1;
+        digit ^= MixBits((mortonIndex >> 1) ^ tileHash) & 1;
+        sampleIndex |= digit;
+    }
+    return sampleIndex;
+}
+
+Float ZSobolSampler::sampleDimension(int64_t index, int dim) const {
+    if (_sampleAtPixelCenter && (dim == 0 || dim == 1)) {
+        return 0.5f;
+    }
+    if (dim >= _arrayStartDim && dim < _arrayEndDim) {
+        return SobolSampler::sampleDimension(index, dim);
+    }
+    // 每两个维度共用一个样本索引
+    int pairDim = dim & ~1;
+    int component = dim & 1;
+    // get2D会连续取同一组的两个维度，缓存置换之后的索引
+    if (index != _cachedIndex || pairDim != _cachedDim || _currentPixel != _cachedPixel) {
+        _cachedSampleIndex = getSampleIndex(index, pairDim);
+        _cachedIndex = index;
+        _cachedDim = pairDim;
+        _cachedPixel = _currentPixel;
+    }
+    uint32_t a = _cachedSampleIndex;
+    uint64_t h = MixBits(_seedHash ^ (uint64_t(pairDim + 1) * 0xbf58476d1ce4e5b9ULL));
+    uint32_t v = SobolSample32(a, component);
+    v = NestedUniformScramble(v, component == 0 ? uint32_t(h) : uint32_t(h >> 32));
+    return bitsToFloat(v);
+}
+
+std::unique_ptr<Sampler> ZSobolSampler::clone(int seed) {
+    // 与SobolSampler一样忽略tile的种子
+    return std::unique_ptr<Sampler>(new ZSobolSampler(*this));
+}
+
+std::unique_ptr<Sampler> ZSobolSampler::clonePass(int64_t firstSample, int64_t nSamples) {
+    ZSobolSampler *sampler = new ZSobolSampler(nSamples, _sampleBounds, _seed, _sampleAtPixelCenter);
+    sampler->_firstSample = firstSample;
+    sampler->copyArrayRequests(*this);
+    return std::unique_ptr<Sampler>(sampler);
+}
+
+/**
+ * param : {
+ *     "spp" : 4,
+ *     "seed" : 0,
+ *     "sampleAtPixelCenter" : false
+ * }
+ */
+CObject_ptr createZSobolSampler(const nloJson &param, const Arguments &lst) {
+    bool sampleAtPixelCenter = param.value("sampleAtPixelCenter", false);
+    int spp = param.value("spp", 4);
+    uint32_t seed = param.value("seed", 0u);
+    auto iter = lst.begin();
+    Film * film = dynamic_cast<Film *>(*iter);
+    AABB2i bound = film->getSampleBounds();
+    return new ZSobolSampler(spp, bound, seed, sampleAtPixelCenter);
+}
+
+REGISTER("zsobol", createZSobolSampler);
+
+PALADIN_END
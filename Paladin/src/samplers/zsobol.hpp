@@ -0,0 +1,94 @@
+//
+//  zsobol.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/7.
+//
+
+#ifndef zsobol_hpp
+#define zsobol_hpp
+
+#include "samplers/sobol.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * 误差呈蓝噪声分布的sobol采样器，用于低spp(1~16)的预览
+ *
+ * 参考 Ahmed & Wonka. Screen-Space Blue-Noise Diffusion of Monte Carlo Sampling Error
+ * via Hierarchical Ordering of Pixels (2020)
+ *
+ * 普通的采样器每个像素的扰乱互不相关，相邻像素的误差也互不相关，误差的频谱是白噪声
+ * 人眼对低频的误差很敏感，白噪声看起来是一团一团的斑点
+ * 如果相邻像素的误差是负相关的，误差集中在高频(蓝噪声)，看起来会干净很多
+ *
+ * 做法是让整张图片共用同一个Owen扰乱的sobol序列，按照像素的morton码(Z曲线)顺序分配样本
+ *
+ *     mortonIndex = (morton(x, y) << log2(spp)) | sampleIndex
+ *
+ * 像素(x,y)使用序列中的第[morton*spp, (morton+1)*spp)个样本
+ * sobol序列的任意2^k个连续对齐的样本都是一个网格，所以
+ *     每个像素的spp个样本本身是分层的，像素内的收敛速度与SobolSampler相同
+ *     相邻的4个像素(Z曲线上的一个四叉树节点)的样本合起来也是分层的，
+ *     一个像素的样本落在某些层，相邻像素的样本就落在其他的层，误差互相抵消
+ *     这个性质在四叉树的每一层都成立，误差的频谱就是蓝噪声
+ *
+ * 直接用morton码会导致规则的图案，所以从高位到低位，对索引的每一个4进制位做随机的置换，
+ * 置换只取决于更高的位与维度，保持了四叉树的结构，不同维度之间互不相关
+ *
+ * 每两个维度为一组，共用同一个样本索引，分别使用sobol序列的前两个维度
+ * 样本数组(get1DArray/get2DArray)的索引超出了spp，使用SobolSampler的逐像素扰乱
+ *
+ * 样本只取决于(像素，样本索引，维度)，与tile的划分无关
+ */
+class ZSobolSampler : public SobolSampler {
+    
+public:
+    
+    ZSobolSampler(int spp, const AABB2i &sampleBounds, uint32_t seed = 0,
+                  bool sampleAtPixelCenter = false);
+    
+    virtual Float sampleDimension(int64_t index, int dimension) const override;
+    
+    virtual std::unique_ptr<Sampler> clone(int seed) override;
+    
+    virtual std::unique_ptr<Sampler> clonePass(int64_t firstSample, int64_t nSamples) override;
+    
+private:
+    
+    /**
+     * 对morton索引的4进制位逐位置换，返回置换之后的sobol样本索引
+     */
+    uint32_t getSampleIndex(int64_t index, int dimension) const;
+    
+    // 采样范围，clonePass时重新构造需要用到
+    AABB2i _sampleBounds;
+    
+    // 采样范围的起点，像素坐标减去起点之后再计算morton码
+    Point2i _pixelMin;
+    
+    // spp向上取整到2的幂之后的指数
+    int _log2spp;
+    
+    // morton码中每个坐标的位数
+    // sobol索引只有32位，分辨率太大的时候按2^_log2Res为周期平铺
+    int _log2Res;
+    
+    // 置换的4进制位的位数
+    int _nBase4Digits;
+    
+    // 与像素无关的种子哈希
+    uint64_t _seedHash;
+    
+    // 上一次计算的样本索引，与HaltonSampler的_offsetForCurrentPixel类似
+    mutable Point2i _cachedPixel;
+    mutable int64_t _cachedIndex = -1;
+    mutable int _cachedDim = -1;
+    mutable uint32_t _cachedSampleIndex = 0;
+};
+
+CObject_ptr createZSobolSampler(const nloJson &param, const Arguments &lst);
+
+PALADIN_END
+
+#endif /* zsobol_hpp */
@@ -7,3 +7,311 @@
 //
 
 #include "curve.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * 三次贝塞尔曲线的开花(blossom)函数p(u0,u1,u2)
+ * p(u,u,u)为曲线上的点，p(a,a,a) p(a,a,b) p(a,b,b) p(b,b,b)
+ * 为曲线在[a,b]区间上那一段的四个控制点
+ */
+inline Point3f blossomBezier(const Point3f p[4], Float u0, Float u1, Float u2) {
+    Point3f a[3] = {lerp(u0, p[0], p[1]),
+                    lerp(u0, p[1], p[2]),
+                    lerp(u0, p[2], p[3])};
+    Point3f b[2] = {lerp(u1, a[0], a[1]), lerp(u1, a[1], a[2])};
+    return lerp(u2, b[0], b[1]);
+}
+
+/**
+ * 在中点处把曲线分成两段，cpSplit[0-3]为前半段，cpSplit[3-6]为后半段
+ */
+inline void subdivideBezier(const Point3f cp[4], Point3f cpSplit[7]) {
+    cpSplit[0] = cp[0];
+    cpSplit[1] = (cp[0] + cp[1]) / 2;
+    cpSplit[2] = (cp[0] + 2 * cp[1] + cp[2]) / 4;
+    cpSplit[3] = (cp[0] + 3 * cp[1] + 3 * cp[2] + cp[3]) / 8;
+    cpSplit[4] = (cp[1] + 2 * cp[2] + cp[3]) / 4;
+    cpSplit[5] = (cp[2] + cp[3]) / 2;
+    cpSplit[6] = cp[3];
+}
+
+/**
+ * de Casteljau算法求曲线上的点以及导数
+ */
+inline Point3f evalBezier(const Point3f cp[4], Float u, Vector3f *deriv = nullptr) {
+    Point3f cp1[3] = {lerp(u, cp[0], cp[1]),
+                      lerp(u, cp[1], cp[2]),
+                      lerp(u, cp[2], cp[3])};
+    Point3f cp2[2] = {lerp(u, cp1[0], cp1[1]), lerp(u, cp1[1], cp1[2])};
+    if (deriv) {
+        if ((cp2[1] - cp2[0]).lengthSquared() > 0) {
+            *deriv = 3 * (cp2[1] - cp2[0]);
+        } else {
+            // 首尾控制点重合时导数为零，用控制点的差值代替
+            *deriv = cp[3] - cp[0];
+        }
+    }
+    return lerp(u, cp2[0], cp2[1]);
+}
+
+void CurveSet::addStrand(const vector<Point3f> &cp, const vector<Float> &widths,
+                         const vector<Normal3f> &normals) {
+    int nSeg = ((int)cp.size() - 1) / 3;
+    CHECK_GE(nSeg, 1);
+    CHECK_EQ(widths.size(), nSeg + 1);
+    if (type == CurveType::Ribbon) {
+        CHECK_EQ(normals.size(), nSeg + 1);
+    }
+    int first = (int)cpX.size();
+    for (int i = 0; i < 3 * nSeg + 1; ++i) {
+        cpX.push_back(cp[i].x);
+        cpY.push_back(cp[i].y);
+        cpZ.push_back(cp[i].z);
+    }
+    for (int i = 0; i < nSeg; ++i) {
+        segmentOffsets.push_back(first + 3 * i);
+        width0.push_back(widths[i]);
+        width1.push_back(widths[i + 1]);
+        if (type == CurveType::Ribbon) {
+            normal0.push_back(normalize(normals[i]));
+            normal1.push_back(normalize(normals[i + 1]));
+        }
+    }
+}
+
+void CurveSet::getControlPoints(int seg, Float uMin, Float uMax, Point3f cp[4]) const {
+    int offset = segmentOffsets[seg];
+    Point3f cpFull[4] = {controlPoint(offset), controlPoint(offset + 1),
+                         controlPoint(offset + 2), controlPoint(offset + 3)};
+    if (uMin == 0 && uMax == 1) {
+        for (int i = 0; i < 4; ++i) {
+            cp[i] = cpFull[i];
+        }
+        return;
+    }
+    cp[0] = blossomBezier(cpFull, uMin, uMin, uMin);
+    cp[1] = blossomBezier(cpFull, uMin, uMin, uMax);
+    cp[2] = blossomBezier(cpFull, uMin, uMax, uMax);
+    cp[3] = blossomBezier(cpFull, uMax, uMax, uMax);
+}
+
+AABB3f CurveSet::bound(int seg, Float uMin, Float uMax) const {
+    Point3f cp[4];
+    getControlPoints(seg, uMin, uMax, cp);
+    AABB3f b = unionSet(AABB3f(cp[0], cp[1]), AABB3f(cp[2], cp[3]));
+    Float width = std::max(getWidth(seg, uMin), getWidth(seg, uMax));
+    return expand(b, width * 0.5f);
+}
+
+/**
+ * 基本思路(参照pbrt)
+ * 1.把曲线控制点变换到光线空间，光线起点为原点，方向为+z轴
+ *   此时只需要判断曲线到z轴的距离是否小于半个宽度
+ * 2.根据曲线的弯曲程度估计出细分的深度，细分到足够平直时把曲线当做线段处理
+ * 3.递归细分，每一段都先用光线空间中的包围盒剔除
+ *
+ * 光线空间用正交基直接计算，而不是像pbrt一样用lookAt构造4x4矩阵再求逆，
+ * 每次求交都要做，省掉矩阵求逆对头发这种数量级的图元很有意义
+ */
+bool CurveSet::intersect(int seg, Float uMin, Float uMax, const Ray &r,
+                         Float *tHit, SurfaceInteraction *isect) const {
+    Point3f cpWorld[4];
+    getControlPoints(seg, uMin, uMax, cpWorld);
+
+    // 构造光线空间的正交基，x轴尽量与曲线垂直
+    Vector3f dir = normalize(r.dir);
+    Vector3f dx = cross(r.dir, cpWorld[3] - cpWorld[0]);
+    if (dx.lengthSquared() == 0) {
+        Vector3f dy;
+        coordinateSystem(r.dir, &dx, &dy);
+    }
+    Vector3f right = cross(normalize(dx), dir);
+    if (right.lengthSquared() == 0) {
+        return false;
+    }
+    right = normalize(right);
+    Vector3f up = cross(dir, right);
+    Vector3f rayToWorld[3] = {right, up, dir};
+
+    Point3f cp[4];
+    for (int i = 0; i < 4; ++i) {
+        Vector3f v = cpWorld[i] - r.ori;
+        cp[i] = Point3f(dot(v, right), dot(v, up), dot(v, dir));
+    }
+
+    // 光线空间中光线是z轴上[0, zMax]的线段
+    Float maxWidth = std::max(getWidth(seg, uMin), getWidth(seg, uMax));
+    AABB3f curveBounds = unionSet(AABB3f(cp[0], cp[1]), AABB3f(cp[2], cp[3]));
+    curveBounds = expand(curveBounds, 0.5f * maxWidth);
+    Float rayLength = r.dir.length();
+    Float zMax = rayLength * r.tMax;
+    AABB3f rayBounds(Point3f(0, 0, 0), Point3f(0, 0, zMax));
+    if (!overlaps(curveBounds, rayBounds)) {
+        return false;
+    }
+
+    // 细分深度，参见pbrt
+    // L0为控制多边形二阶差分的最大值，反映曲线的弯曲程度
+    // 细分到曲线与线段的距离小于宽度的5%为止
+    Float L0 = 0;
+    for (int i = 0; i < 2; ++i) {
+        L0 = std::max(L0, std::max(std::max(std::abs(cp[i].x - 2 * cp[i + 1].x + cp[i + 2].x),
+                                            std::abs(cp[i].y - 2 * cp[i + 1].y + cp[i + 2].y)),
+                                   std::abs(cp[i].z - 2 * cp[i + 1].z + cp[i + 2].z)));
+    }
+    Float eps = std::max(width0[seg], width1[seg]) * .05f;
+    auto log2 = [](float v) -> int {
+        if (v < 1) {
+            return 0;
+        }
+        uint32_t bits = floatToBits(v);
+        // 取指数部分，尾数最高位为1时向上取整
+        return (bits >> 23) - 127 + (bits & (1 << 22) ? 1 : 0);
+    };
+    int r0 = log2(1.41421356237f * 6.f * L0 / (8.f * eps)) / 2;
+    int maxDepth = clamp(r0, 0, 10);
+
+    Ray ray = r;
+    return recursiveIntersect(seg, ray, rayLength, tHit, isect, cp,
+                              rayToWorld, uMin, uMax, maxDepth);
+}
+
+bool CurveSet::recursiveIntersect(int seg, Ray &ray, Float rayLength, Float *tHit,
+                                  SurfaceInteraction *isect, const Point3f cp[4],
+                                  const Vector3f rayToWorld[3], Float u0, Float u1,
+                                  int depth) const {
+    if (depth > 0) {
+        Point3f cpSplit[7];
+        subdivideBezier(cp, cpSplit);
+        bool hit = false;
+        Float u[3] = {u0, (u0 + u1) / 2, u1};
+        const Point3f *cps = cpSplit;
+        for (int i = 0; i < 2; ++i, cps += 3) {
+            Float maxWidth = std::max(getWidth(seg, u[i]), getWidth(seg, u[i + 1]));
+            Float halfWidth = 0.5f * maxWidth;
+            // 子曲线的包围盒与光线不相交则跳过
+            if (std::max(std::max(cps[0].y, cps[1].y), std::max(cps[2].y, cps[3].y)) + halfWidth < 0 ||
+                std::min(std::min(cps[0].y, cps[1].y), std::min(cps[2].y, cps[3].y)) - halfWidth > 0) {
+                continue;
+            }
+            if (std::max(std::max(cps[0].x, cps[1].x), std::max(cps[2].x, cps[3].x)) + halfWidth < 0 ||
+                std::min(std::min(cps[0].x, cps[1].x), std::min(cps[2].x, cps[3].x)) - halfWidth > 0) {
+                continue;
+            }
+            // 每次命中都会缩短ray.tMax，后面的子曲线只会找到更近的交点
+            Float zMax = rayLength * ray.tMax;
+            if (std::max(std::max(cps[0].z, cps[1].z), std::max(cps[2].z, cps[3].z)) + halfWidth < 0 ||
+                std::min(std::min(cps[0].z, cps[1].z), std::min(cps[2].z, cps[3].z)) - halfWidth > zMax) {
+                continue;
+            }
+            hit |= recursiveIntersect(seg, ray, rayLength, tHit, isect, cps,
+                                      rayToWorld, u[i], u[i + 1], depth - 1);
+            if (hit && !tHit) {
+                return true;
+            }
+        }
+        return hit;
+    }
+
+    // 已经足够平直，把曲线当做线段处理
+    // 先判断原点是否在线段两个端点处的垂直平面之间
+    // 只在整段曲线的两端做这个测试，细分产生的端点不做，
+    // 因为相邻两小段的切线方向不同，凸的一侧会漏掉一个楔形区域，
+    // 不做测试时端点处相当于一个半径为半个宽度的圆，刚好补上这个缝隙
+    if (u0 == 0) {
+        Float edge = (cp[1].y - cp[0].y) * -cp[0].y + cp[0].x * (cp[0].x - cp[1].x);
+        if (edge < 0) {
+            return false;
+        }
+    }
+    if (u1 == 1) {
+        Float edge = (cp[2].y - cp[3].y) * -cp[3].y + cp[3].x * (cp[3].x - cp[2].x);
+        if (edge < 0) {
+            return false;
+        }
+    }
+
+    // 求出线段上距离原点最近的点的参数w
+    Vector2f segmentDirection = Point2f(cp[3].x, cp[3].y) - Point2f(cp[0].x, cp[0].y);
+    Float denom = segmentDirection.lengthSquared();
+    if (denom == 0) {
+        return false;
+    }
+    Float w = dot(-Vector2f(cp[0].x, cp[0].y), segmentDirection) / denom;
+
+    Float u = clamp(lerp(w, u0, u1), u0, u1);
+    Float hitWidth = getWidth(seg, u);
+    Normal3f nHit;
+    if (type == CurveType::Ribbon) {
+        // 两端法线球面插值，宽度按照朝向光线的程度缩小
+        Float cosAngle = clamp(dot(normal0[seg], normal1[seg]), -1, 1);
+        Float angle = std::acos(cosAngle);
+        if (angle < 1e-4f) {
+            nHit = normal0[seg];
+        } else {
+            Float invSinAngle = 1 / std::sin(angle);
+            Float sin0 = std::sin((1 - u) * angle) * invSinAngle;
+            Float sin1 = std::sin(u * angle) * invSinAngle;
+            nHit = sin0 * normal0[seg] + sin1 * normal1[seg];
+        }
+        hitWidth *= absDot(nHit, ray.dir) / rayLength;
+    }
+
+    // 判断交点到曲线的距离是否在宽度之内
+    Vector3f dpcdw;
+    Point3f pc = evalBezier(cp, clamp(w, 0, 1), &dpcdw);
+    Float ptCurveDist2 = pc.x * pc.x + pc.y * pc.y;
+    if (ptCurveDist2 > hitWidth * hitWidth * .25f) {
+        return false;
+    }
+    Float zMax = rayLength * ray.tMax;
+    if (pc.z < 0 || pc.z > zMax) {
+        return false;
+    }
+
+    if (tHit == nullptr) {
+        return true;
+    }
+
+    // v为交点在宽度方向上的位置，曲线中心为0.5
+    Float ptCurveDist = std::sqrt(ptCurveDist2);
+    Float edgeFunc = dpcdw.x * -pc.y + pc.x * dpcdw.y;
+    Float v = (edgeFunc > 0)
+            ? 0.5f + ptCurveDist / hitWidth
+            : 0.5f - ptCurveDist / hitWidth;
+
+    *tHit = pc.z / rayLength;
+    ray.tMax = *tHit;
+
+    Point3f cpFull[4];
+    getControlPoints(seg, 0, 1, cpFull);
+    Vector3f dpdu, dpdv;
+    evalBezier(cpFull, u, &dpdu);
+    if (type == CurveType::Ribbon) {
+        dpdv = normalize(cross(Vector3f(nHit), dpdu)) * hitWidth;
+    } else {
+        // 在光线空间中，dpdv垂直于dpdu以及光线方向，所以法线始终朝向光线
+        Vector3f dpduPlane(dot(dpdu, rayToWorld[0]),
+                           dot(dpdu, rayToWorld[1]),
+                           dot(dpdu, rayToWorld[2]));
+        Vector3f dpdvPlane = normalize(Vector3f(-dpduPlane.y, dpduPlane.x, 0)) * hitWidth;
+        if (type == CurveType::Cylinder) {
+            // 绕dpdu旋转dpdv，使法线从曲线的一侧到另一侧转过180度，看起来像圆柱
+            // dpdvPlane与dpduPlane垂直，罗德里格斯公式简化为 v' = v cosθ + (k × v) sinθ
+            Float theta = degree2radian(lerp(v, 90.f, -90.f));
+            Vector3f k = normalize(dpduPlane);
+            dpdvPlane = dpdvPlane * std::cos(theta) + cross(k, dpdvPlane) * std::sin(theta);
+        }
+        dpdv = rayToWorld[0] * dpdvPlane.x
+                + rayToWorld[1] * dpdvPlane.y
+                + rayToWorld[2] * dpdvPlane.z;
+    }
+    Vector3f pError(2 * hitWidth, 2 * hitWidth, 2 * hitWidth);
+    *isect = SurfaceInteraction(ray.at(*tHit), pError, Point2f(u, v), -ray.dir,
+                                dpdu, dpdv, Normal3f(0, 0, 0), Normal3f(0, 0, 0),
+                                ray.time, nullptr);
+    return true;
+}
+
+PALADIN_END
@@ -9,6 +9,89 @@
 #ifndef curve_hpp
 #define curve_hpp
 
-#include <stdio.h>
+#include "core/header.h"
+#include "core/interaction.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * Flat : 始终朝向光线的带状曲线，适合远处的头发
+ * Cylinder : 求交与Flat相同，但法线沿宽度方向旋转，看起来像圆柱
+ * Ribbon : 由两端法线确定朝向的带状曲线，适合草叶
+ */
+enum class CurveType { Flat, Cylinder, Ribbon };
+
+/**
+ * 一组三次贝塞尔曲线，用于头发，草等细长的物体
+ * 与TriangleMesh相同，所有数据都在世界空间中
+ * 控制点以SoA形式储存，同一条曲线上相邻的两段共享端点控制点
+ * 每段曲线只额外保存一个控制点索引以及两端宽度，
+ * 比三角化之后的网格小一到两个数量级
+ */
+struct CurveSet {
+
+    CurveSet(CurveType type) : type(type) {
+
+    }
+
+    /**
+     * 添加一条曲线
+     * cp为3n+1个控制点，构成n段三次贝塞尔曲线
+     * widths为n+1个段端点处的宽度
+     * normals为n+1个段端点处的法线，只有Ribbon类型需要
+     */
+    void addStrand(const vector<Point3f> &cp, const vector<Float> &widths,
+                   const vector<Normal3f> &normals = vector<Normal3f>());
+
+    int nSegments() const {
+        return (int)segmentOffsets.size();
+    }
+
+    Point3f controlPoint(int idx) const {
+        return Point3f(cpX[idx], cpY[idx], cpZ[idx]);
+    }
+
+    /**
+     * 取出第seg段曲线在[uMin,uMax]区间上的4个控制点
+     */
+    void getControlPoints(int seg, Float uMin, Float uMax, Point3f cp[4]) const;
+
+    Float getWidth(int seg, Float u) const {
+        return lerp(u, width0[seg], width1[seg]);
+    }
+
+    /**
+     * 第seg段曲线在[uMin,uMax]区间上的包围盒
+     * 贝塞尔曲线在控制点的凸包之内，所以控制点的包围盒扩展半个宽度即可
+     */
+    AABB3f bound(int seg, Float uMin, Float uMax) const;
+
+    /**
+     * 光线与第seg段曲线在[uMin,uMax]区间上的部分求交
+     * tHit为空时只判断是否相交
+     * 返回的SurfaceInteraction中shape为空，由调用方设置primitive
+     */
+    bool intersect(int seg, Float uMin, Float uMax, const Ray &ray,
+                   Float *tHit, SurfaceInteraction *isect) const;
+
+    const CurveType type;
+    // 控制点坐标，SoA
+    vector<Float> cpX, cpY, cpZ;
+    // 每段曲线第一个控制点的索引
+    vector<int> segmentOffsets;
+    // 每段曲线两端的宽度
+    vector<Float> width0, width1;
+    // 每段曲线两端的法线，只有Ribbon类型才有
+    vector<Normal3f> normal0, normal1;
+
+private:
+
+    bool recursiveIntersect(int seg, Ray &ray, Float rayLength, Float *tHit,
+                            SurfaceInteraction *isect, const Point3f cp[4],
+                            const Vector3f rayToWorld[3], Float u0, Float u1,
+                            int depth) const;
+};
+
+PALADIN_END
 
 #endif /* curve_hpp */
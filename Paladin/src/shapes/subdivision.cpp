@@ -0,0 +1,1070 @@
+//
+//  subdivision.cpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/8.
+//
+
+#include "shapes/subdivision.hpp"
+#include "core/material.hpp"
+#include "core/paladin.hpp"
+#include "tools/fileio.hpp"
+#include <unordered_map>
+
+PALADIN_BEGIN
+
+/**
+ * 细分过程中使用的局部网格，前nCentral个面为中心面(要输出的patch部分)
+ * 其余的面为中心面的1-ring
+ */
+struct SubdivLocalMesh {
+    vector<Point3f> points;
+    vector<Point2f> uvs;
+    vector<int> offsets;
+    vector<int> indices;
+    int nCentral = 0;
+
+    SubdivLocalMesh() {
+        offsets.push_back(0);
+    }
+
+    int nFaces() const {
+        return (int)offsets.size() - 1;
+    }
+
+    int faceSize(int f) const {
+        return offsets[f + 1] - offsets[f];
+    }
+
+    void addFace(const int *verts, int n) {
+        indices.insert(indices.end(), verts, verts + n);
+        offsets.push_back((int)indices.size());
+    }
+};
+
+/**
+ * 局部网格的邻接信息
+ * faceEdges与indices一一对应，为面的第i个顶点到第i+1个顶点的边
+ */
+struct SubdivTopology {
+    vector<int> edgeV0, edgeV1;
+    vector<int> edgeFaceCount, edgeFace0, edgeFace1;
+    vector<int> faceEdges;
+    vector<int> vertexEdgeOffsets, vertexEdges;
+    vector<int> vertexFaceOffsets, vertexFaces;
+
+    int nEdges() const {
+        return (int)edgeV0.size();
+    }
+
+    int otherVertex(int e, int v) const {
+        return edgeV0[e] == v ? edgeV1[e] : edgeV0[e];
+    }
+
+    int valence(int v) const {
+        return vertexEdgeOffsets[v + 1] - vertexEdgeOffsets[v];
+    }
+
+    /**
+     * 返回顶点所在的边界边数量，并取出前两条边界边另一端的顶点
+     * 只有一个面的边为边界边，边界边数量为2的顶点为普通边界点，
+     * 其他非零值为角点或者非流形顶点，细分时保持不动
+     */
+    int boundaryNeighbors(int v, int nb[2]) const {
+        int count = 0;
+        for (int i = vertexEdgeOffsets[v]; i < vertexEdgeOffsets[v + 1]; ++i) {
+            int e = vertexEdges[i];
+            if (edgeFaceCount[e] == 1) {
+                if (count < 2) {
+                    nb[count] = otherVertex(e, v);
+                }
+                ++count;
+            }
+        }
+        return count;
+    }
+};
+
+static void buildTopology(const SubdivLocalMesh &mesh, SubdivTopology *topo) {
+    int nVerts = (int)mesh.points.size();
+    std::unordered_map<uint64_t, int> edgeMap;
+    topo->faceEdges.resize(mesh.indices.size());
+    for (int f = 0; f < mesh.nFaces(); ++f) {
+        int offset = mesh.offsets[f];
+        int n = mesh.faceSize(f);
+        for (int i = 0; i < n; ++i) {
+            int v0 = mesh.indices[offset + i];
+            int v1 = mesh.indices[offset + (i + 1) % n];
+            uint64_t key = ((uint64_t)std::min(v0, v1) << 32) | (uint32_t)std::max(v0, v1);
+            auto iter = edgeMap.find(key);
+            int e;
+            if (iter == edgeMap.end()) {
+                e = topo->nEdges();
+                edgeMap[key] = e;
+                topo->edgeV0.push_back(v0);
+                topo->edgeV1.push_back(v1);
+                topo->edgeFaceCount.push_back(0);
+                topo->edgeFace0.push_back(f);
+                topo->edgeFace1.push_back(-1);
+            } else {
+                e = iter->second;
+                topo->edgeFace1[e] = f;
+            }
+            ++topo->edgeFaceCount[e];
+            topo->faceEdges[offset + i] = e;
+        }
+    }
+
+    // 顶点相邻的边以及面，CSR格式
+    topo->vertexEdgeOffsets.assign(nVerts + 1, 0);
+    for (int e = 0; e < topo->nEdges(); ++e) {
+        ++topo->vertexEdgeOffsets[topo->edgeV0[e] + 1];
+        ++topo->vertexEdgeOffsets[topo->edgeV1[e] + 1];
+    }
+    for (int v = 0; v < nVerts; ++v) {
+        topo->vertexEdgeOffsets[v + 1] += topo->vertexEdgeOffsets[v];
+    }
+    topo->vertexEdges.resize(topo->vertexEdgeOffsets[nVerts]);
+    vector<int> fill(topo->vertexEdgeOffsets.begin(), topo->vertexEdgeOffsets.end() - 1);
+    for (int e = 0; e < topo->nEdges(); ++e) {
+        topo->vertexEdges[fill[topo->edgeV0[e]]++] = e;
+        topo->vertexEdges[fill[topo->edgeV1[e]]++] = e;
+    }
+
+    topo->vertexFaceOffsets.assign(nVerts + 1, 0);
+    for (int idx : mesh.indices) {
+        ++topo->vertexFaceOffsets[idx + 1];
+    }
+    for (int v = 0; v < nVerts; ++v) {
+        topo->vertexFaceOffsets[v + 1] += topo->vertexFaceOffsets[v];
+    }
+    topo->vertexFaces.resize(mesh.indices.size());
+    fill.assign(topo->vertexFaceOffsets.begin(), topo->vertexFaceOffsets.end() - 1);
+    for (int f = 0; f < mesh.nFaces(); ++f) {
+        for (int i = mesh.offsets[f]; i < mesh.offsets[f + 1]; ++i) {
+            topo->vertexFaces[fill[mesh.indices[i]]++] = f;
+        }
+    }
+}
+
+/**
+ * 细分规则中边界点与角点的处理，Loop与Catmull-Clark相同
+ * 边界按照三次B样条曲线细分，边界点为 3/4 * v + 1/8 * (b0 + b1)
+ * 返回false表示是内部点
+ */
+static bool subdivideBoundaryVertex(const SubdivLocalMesh &in, const SubdivTopology &topo,
+                                    int v, Point3f *p) {
+    int nb[2];
+    int nBoundary = topo.boundaryNeighbors(v, nb);
+    if (nBoundary == 0) {
+        return false;
+    }
+    if (nBoundary == 2) {
+        *p = in.points[v] * 0.75f + (in.points[nb[0]] + in.points[nb[1]]) * 0.125f;
+    } else {
+        *p = in.points[v];
+    }
+    return true;
+}
+
+/**
+ * Loop细分，一个三角形(a,b,c)变为4个
+ * (a, e_ab, e_ca), (e_ab, b, e_bc), (e_ca, e_bc, c), (e_ab, e_bc, e_ca)
+ * 新的顶点列表为 [原顶点的新位置, 边点]
+ *
+ * 内部顶点 : (1 - nβ) * v + β * Σ邻点，β = n == 3 ? 3/16 : 3/(8n)
+ * 内部边点 : 3/8 * (v0 + v1) + 1/8 * (两侧三角形的对角点)
+ * 边界边点 : 中点
+ */
+static void loopSubdivide(const SubdivLocalMesh &in, const SubdivTopology &topo,
+                          SubdivLocalMesh *out) {
+    int nVerts = (int)in.points.size();
+    int nEdges = topo.nEdges();
+    bool hasUV = !in.uvs.empty();
+    out->points.resize(nVerts + nEdges);
+    if (hasUV) {
+        out->uvs.resize(nVerts + nEdges);
+    }
+    for (int v = 0; v < nVerts; ++v) {
+        if (hasUV) {
+            out->uvs[v] = in.uvs[v];
+        }
+        if (subdivideBoundaryVertex(in, topo, v, &out->points[v])) {
+            continue;
+        }
+        int n = topo.valence(v);
+        if (n == 0) {
+            out->points[v] = in.points[v];
+            continue;
+        }
+        Float beta = n == 3 ? 3.f / 16.f : 3.f / (8.f * n);
+        Point3f sum(0, 0, 0);
+        for (int i = topo.vertexEdgeOffsets[v]; i < topo.vertexEdgeOffsets[v + 1]; ++i) {
+            sum += in.points[topo.otherVertex(topo.vertexEdges[i], v)];
+        }
+        out->points[v] = in.points[v] * (1 - n * beta) + sum * beta;
+    }
+
+    auto oppositeVertex = [&](int f, int v0, int v1) {
+        for (int i = in.offsets[f]; i < in.offsets[f + 1]; ++i) {
+            int v = in.indices[i];
+            if (v != v0 && v != v1) {
+                return v;
+            }
+        }
+        return v0;
+    };
+
+    for (int e = 0; e < nEdges; ++e) {
+        int v0 = topo.edgeV0[e];
+        int v1 = topo.edgeV1[e];
+        Point3f &p = out->points[nVerts + e];
+        if (topo.edgeFaceCount[e] == 2) {
+            int a = oppositeVertex(topo.edgeFace0[e], v0, v1);
+            int b = oppositeVertex(topo.edgeFace1[e], v0, v1);
+            p = (in.points[v0] + in.points[v1]) * 0.375f
+                + (in.points[a] + in.points[b]) * 0.125f;
+        } else {
+            p = (in.points[v0] + in.points[v1]) * 0.5f;
+        }
+        if (hasUV) {
+            out->uvs[nVerts + e] = (in.uvs[v0] + in.uvs[v1]) * 0.5f;
+        }
+    }
+
+    for (int f = 0; f < in.nFaces(); ++f) {
+        int offset = in.offsets[f];
+        int a = in.indices[offset];
+        int b = in.indices[offset + 1];
+        int c = in.indices[offset + 2];
+        int eab = nVerts + topo.faceEdges[offset];
+        int ebc = nVerts + topo.faceEdges[offset + 1];
+        int eca = nVerts + topo.faceEdges[offset + 2];
+        int children[4][3] = {
+            {a, eab, eca},
+            {eab, b, ebc},
+            {eca, ebc, c},
+            {eab, ebc, eca}
+        };
+        for (int i = 0; i < 4; ++i) {
+            out->addFace(children[i], 3);
+        }
+    }
+    out->nCentral = in.nCentral * 4;
+}
+
+/**
+ * Catmull-Clark细分，n边形变为n个四边形
+ * 第i个子面为 (v_i, e_i, F, e_(i-1))，e_i为v_i到v_(i+1)的边点
+ * 新的顶点列表为 [原顶点的新位置, 边点, 面点]
+ *
+ * 面点 : 面上顶点的平均值
+ * 内部边点 : (v0 + v1 + 两侧面点) / 4
+ * 内部顶点 : (Q + 2R + (n - 3)v) / n，Q为相邻面点的平均值，R为相邻边中点的平均值
+ */
+static void catmullClarkSubdivide(const SubdivLocalMesh &in, const SubdivTopology &topo,
+                                  SubdivLocalMesh *out) {
+    int nVerts = (int)in.points.size();
+    int nEdges = topo.nEdges();
+    int nFaces = in.nFaces();
+    int faceBase = nVerts + nEdges;
+    bool hasUV = !in.uvs.empty();
+    out->points.resize(faceBase + nFaces);
+    if (hasUV) {
+        out->uvs.resize(faceBase + nFaces);
+    }
+
+    for (int f = 0; f < nFaces; ++f) {
+        Point3f sum(0, 0, 0);
+        Point2f uvSum(0, 0);
+        for (int i = in.offsets[f]; i < in.offsets[f + 1]; ++i) {
+            sum += in.points[in.indices[i]];
+            if (hasUV) {
+                uvSum += in.uvs[in.indices[i]];
+            }
+        }
+        Float invN = 1.f / in.faceSize(f);
+        out->points[faceBase + f] = sum * invN;
+        if (hasUV) {
+            out->uvs[faceBase + f] = uvSum * invN;
+        }
+    }
+
+    for (int e = 0; e < nEdges; ++e) {
+        int v0 = topo.edgeV0[e];
+        int v1 = topo.edgeV1[e];
+        Point3f &p = out->points[nVerts + e];
+        if (topo.edgeFaceCount[e] == 2) {
+            p = (in.points[v0] + in.points[v1]
+                 + out->points[faceBase + topo.edgeFace0[e]]
+                 + out->points[faceBase + topo.edgeFace1[e]]) * 0.25f;
+        } else {
+            p = (in.points[v0] + in.points[v1]) * 0.5f;
+        }
+        if (hasUV) {
+            out->uvs[nVerts + e] = (in.uvs[v0] + in.uvs[v1]) * 0.5f;
+        }
+    }
+
+    for (int v = 0; v < nVerts; ++v) {
+        if (hasUV) {
+            out->uvs[v] = in.uvs[v];
+        }
+        if (subdivideBoundaryVertex(in, topo, v, &out->points[v])) {
+            continue;
+        }
+        int n = topo.vertexFaceOffsets[v + 1] - topo.vertexFaceOffsets[v];
+        if (n < 3 || n != topo.valence(v)) {
+            out->points[v] = in.points[v];
+            continue;
+        }
+        Point3f Q(0, 0, 0), R(0, 0, 0);
+        for (int i = topo.vertexFaceOffsets[v]; i < topo.vertexFaceOffsets[v + 1]; ++i) {
+            Q += out->points[faceBase + topo.vertexFaces[i]];
+        }
+        for (int i = topo.vertexEdgeOffsets[v]; i < topo.vertexEdgeOffsets[v + 1]; ++i) {
+            int e = topo.vertexEdges[i];
+            R += (in.points[topo.edgeV0[e]] + in.points[topo.edgeV1[e]]) * 0.5f;
+        }
+        Float invN = 1.f / n;
+        out->points[v] = (Q * invN + R * (2 * invN) + in.points[v] * (n - 3)) * invN;
+    }
+
+    int nCentral = 0;
+    for (int f = 0; f < nFaces; ++f) {
+        int offset = in.offsets[f];
+        int n = in.faceSize(f);
+        for (int i = 0; i < n; ++i) {
+            int child[4] = {
+                in.indices[offset + i],
+                nVerts + topo.faceEdges[offset + i],
+                faceBase + f,
+                nVerts + topo.faceEdges[offset + (i + n - 1) % n]
+            };
+            out->addFace(child, 4);
+        }
+        if (f < in.nCentral) {
+            nCentral += n;
+        }
+    }
+    out->nCentral = nCentral;
+}
+
+/**
+ * 只保留中心面以及与中心面共享顶点的面，并压缩顶点列表
+ * 细分之后中心面的子面排在最前面，依然是中心面
+ */
+static void cropToCentral(SubdivLocalMesh *mesh) {
+    int nVerts = (int)mesh->points.size();
+    vector<char> centralVertex(nVerts, 0);
+    for (int i = 0; i < mesh->offsets[mesh->nCentral]; ++i) {
+        centralVertex[mesh->indices[i]] = 1;
+    }
+    bool hasUV = !mesh->uvs.empty();
+    vector<int> remap(nVerts, -1);
+    SubdivLocalMesh out;
+    out.nCentral = mesh->nCentral;
+    int face[64];
+    for (int f = 0; f < mesh->nFaces(); ++f) {
+        int begin = mesh->offsets[f];
+        int end = mesh->offsets[f + 1];
+        bool keep = f < mesh->nCentral;
+        for (int i = begin; i < end && !keep; ++i) {
+            keep = centralVertex[mesh->indices[i]];
+        }
+        if (!keep) {
+            continue;
+        }
+        for (int i = begin; i < end; ++i) {
+            int v = mesh->indices[i];
+            if (remap[v] < 0) {
+                remap[v] = (int)out.points.size();
+                out.points.push_back(mesh->points[v]);
+                if (hasUV) {
+                    out.uvs.push_back(mesh->uvs[v]);
+                }
+            }
+            face[i - begin] = remap[v];
+        }
+        out.addFace(face, end - begin);
+    }
+    std::swap(*mesh, out);
+}
+
+/**
+ * 把中心面上的顶点推到极限曲面上
+ * Loop : 内部点 (1 - nβ') * v + β' * Σ邻点，β' = 1 / (n + 3 / (8β))，边界点 (b0 + 3v + b1) / 5
+ * Catmull-Clark : 内部点 (n^2 * v + 4 * Σ邻点 + Σ对角点) / (n(n + 5))，边界点 (b0 + 4v + b1) / 6
+ * 计算极限位置需要完整的1-ring，中心面上的顶点都满足这个条件
+ */
+static Point3f limitPosition(const SubdivLocalMesh &mesh, const SubdivTopology &topo,
+                             SubdivScheme scheme, int v) {
+    const Point3f &p = mesh.points[v];
+    int nb[2];
+    int nBoundary = topo.boundaryNeighbors(v, nb);
+    if (nBoundary == 2) {
+        if (scheme == SubdivScheme::Loop) {
+            return p * 0.6f + (mesh.points[nb[0]] + mesh.points[nb[1]]) * 0.2f;
+        }
+        return (p * 4.f + mesh.points[nb[0]] + mesh.points[nb[1]]) / 6.f;
+    } else if (nBoundary != 0) {
+        return p;
+    }
+    int n = topo.valence(v);
+    if (n == 0) {
+        return p;
+    }
+    Point3f ring(0, 0, 0);
+    for (int i = topo.vertexEdgeOffsets[v]; i < topo.vertexEdgeOffsets[v + 1]; ++i) {
+        ring += mesh.points[topo.otherVertex(topo.vertexEdges[i], v)];
+    }
+    if (scheme == SubdivScheme::Loop) {
+        Float beta = n == 3 ? 3.f / 16.f : 3.f / (8.f * n);
+        Float limitBeta = 1.f / (n + 3.f / (8.f * beta));
+        return p * (1 - n * limitBeta) + ring * limitBeta;
+    }
+    Point3f diagonal(0, 0, 0);
+    for (int i = topo.vertexFaceOffsets[v]; i < topo.vertexFaceOffsets[v + 1]; ++i) {
+        int f = topo.vertexFaces[i];
+        if (mesh.faceSize(f) != 4) {
+            return p;
+        }
+        int offset = mesh.offsets[f];
+        for (int k = 0; k < 4; ++k) {
+            if (mesh.indices[offset + k] == v) {
+                diagonal += mesh.points[mesh.indices[offset + (k + 2) % 4]];
+                break;
+            }
+        }
+    }
+    return (p * Float(n * n) + ring * 4.f + diagonal) / Float(n * (n + 5));
+}
+
+/**
+ * 平移微三角形求交，与Triangle::classicIntersect相同的方法
+ */
+static bool intersectMicroTriangle(const Ray &ray, const Point3f &p0, const Point3f &p1,
+                                   const Point3f &p2, Float *tHit, Float *b1, Float *b2) {
+    Vector3f E1 = p1 - p0;
+    Vector3f E2 = p2 - p0;
+    Vector3f P = cross(ray.dir, E2);
+    Float det = dot(P, E1);
+    if (det == 0) {
+        return false;
+    }
+    Float invDet = 1 / det;
+    Vector3f T = ray.ori - p0;
+    Float u = dot(P, T) * invDet;
+    if (u < 0 || u > 1) {
+        return false;
+    }
+    Vector3f Q = cross(T, E1);
+    Float v = dot(Q, ray.dir) * invDet;
+    if (v < 0 || u + v > 1) {
+        return false;
+    }
+    Float t = dot(Q, E2) * invDet;
+    if (t <= 0 || t >= ray.tMax) {
+        return false;
+    }
+    *tHit = t;
+    *b1 = u;
+    *b2 = v;
+    return true;
+}
+
+size_t TessellatedPatch::memoryUsage() const {
+    return sizeof(*this)
+        + points.capacity() * sizeof(Point3f)
+        + normals.capacity() * sizeof(Normal3f)
+        + uvs.capacity() * sizeof(Point2f)
+        + (indices.capacity() + levelOffsets.capacity() + branching.capacity()) * sizeof(int)
+        + bounds.capacity() * sizeof(AABB3f);
+}
+
+bool TessellatedPatch::intersect(const Ray &ray, Float *tHit, int *triIndex,
+                                 Float *b1, Float *b2) const {
+    Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int depth = (int)branching.size();
+    // 每层最多压入branching - 1个兄弟节点，面的边数不超过64，128足够
+    int stackLevel[128], stackNode[128];
+    int stackSize = 0;
+    stackLevel[stackSize] = 0;
+    stackNode[stackSize++] = 0;
+    bool hit = false;
+    while (stackSize > 0) {
+        --stackSize;
+        int level = stackLevel[stackSize];
+        int node = stackNode[stackSize];
+        if (!bounds[levelOffsets[level] + node].intersectP(ray, invDir, dirIsNeg)) {
+            continue;
+        }
+        if (level == depth) {
+            for (int tri = node * trisPerLeaf; tri < (node + 1) * trisPerLeaf; ++tri) {
+                const Point3f &p0 = points[indices[3 * tri]];
+                const Point3f &p1 = points[indices[3 * tri + 1]];
+                const Point3f &p2 = points[indices[3 * tri + 2]];
+                if (intersectMicroTriangle(ray, p0, p1, p2, tHit, b1, b2)) {
+                    ray.tMax = *tHit;
+                    *triIndex = tri;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+        int b = branching[level];
+        for (int i = b - 1; i >= 0; --i) {
+            stackLevel[stackSize] = level + 1;
+            stackNode[stackSize++] = node * b + i;
+        }
+    }
+    return hit;
+}
+
+bool TessellatedPatch::intersectP(const Ray &ray) const {
+    Vector3f invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int depth = (int)branching.size();
+    int stackLevel[128], stackNode[128];
+    int stackSize = 0;
+    stackLevel[stackSize] = 0;
+    stackNode[stackSize++] = 0;
+    while (stackSize > 0) {
+        --stackSize;
+        int level = stackLevel[stackSize];
+        int node = stackNode[stackSize];
+        if (!bounds[levelOffsets[level] + node].intersectP(ray, invDir, dirIsNeg)) {
+            continue;
+        }
+        if (level == depth) {
+            for (int tri = node * trisPerLeaf; tri < (node + 1) * trisPerLeaf; ++tri) {
+                Float t, b1, b2;
+                if (intersectMicroTriangle(ray, points[indices[3 * tri]],
+                                           points[indices[3 * tri + 1]],
+                                           points[indices[3 * tri + 2]], &t, &b1, &b2)) {
+                    return true;
+                }
+            }
+            continue;
+        }
+        int b = branching[level];
+        for (int i = b - 1; i >= 0; --i) {
+            stackLevel[stackSize] = level + 1;
+            stackNode[stackSize++] = node * b + i;
+        }
+    }
+    return false;
+}
+
+static std::atomic<int> s_subdivMeshId(0);
+
+SubdivMesh::SubdivMesh(SubdivScheme scheme, int levels,
+                       const vector<Point3f> &points, const vector<Point2f> &uvs,
+                       const vector<int> &faceVertexCounts, const vector<int> &indices,
+                       const shared_ptr<const Texture<Float>> &displacement,
+                       Float displacementScale, Float displacementBound)
+: _scheme(scheme),
+_levels(levels),
+_points(points),
+_uvs(uvs),
+_indices(indices),
+_displacement(displacement),
+_displacementScale(displacementScale),
+_displacementBound(displacement ? std::abs(displacementBound) : 0),
+_id(s_subdivMeshId++) {
+    _faceOffsets.push_back(0);
+    for (int n : faceVertexCounts) {
+        _faceOffsets.push_back(_faceOffsets.back() + n);
+    }
+    CHECK_EQ(_faceOffsets.back(), (int)_indices.size());
+    int nVerts = (int)_points.size();
+    _vertexFaceOffsets.assign(nVerts + 1, 0);
+    for (int idx : _indices) {
+        ++_vertexFaceOffsets[idx + 1];
+    }
+    for (int v = 0; v < nVerts; ++v) {
+        _vertexFaceOffsets[v + 1] += _vertexFaceOffsets[v];
+    }
+    _vertexFaces.resize(_indices.size());
+    vector<int> fill(_vertexFaceOffsets.begin(), _vertexFaceOffsets.end() - 1);
+    for (int f = 0; f < nFaces(); ++f) {
+        for (int i = _faceOffsets[f]; i < _faceOffsets[f + 1]; ++i) {
+            _vertexFaces[fill[_indices[i]]++] = f;
+        }
+    }
+}
+
+void SubdivMesh::gatherNeighborhood(int f, vector<int> *faces) const {
+    faces->push_back(f);
+    for (int i = _faceOffsets[f]; i < _faceOffsets[f + 1]; ++i) {
+        int v = _indices[i];
+        for (int j = _vertexFaceOffsets[v]; j < _vertexFaceOffsets[v + 1]; ++j) {
+            int nf = _vertexFaces[j];
+            if (std::find(faces->begin(), faces->end(), nf) == faces->end()) {
+                faces->push_back(nf);
+            }
+        }
+    }
+}
+
+AABB3f SubdivMesh::patchBound(int f) const {
+    vector<int> faces;
+    if (_levels == 0) {
+        faces.push_back(f);
+    } else {
+        gatherNeighborhood(f, &faces);
+    }
+    AABB3f ret;
+    for (int nf : faces) {
+        for (int i = _faceOffsets[nf]; i < _faceOffsets[nf + 1]; ++i) {
+            ret = unionSet(ret, _points[_indices[i]]);
+        }
+    }
+    return expand(ret, _displacementBound);
+}
+
+shared_ptr<TessellatedPatch> SubdivMesh::tessellate(int f) const {
+    // 取出1-ring邻域作为局部网格，patch本身为第一个面
+    vector<int> faces;
+    gatherNeighborhood(f, &faces);
+    SubdivLocalMesh mesh;
+    mesh.nCentral = 1;
+    std::unordered_map<int, int> remap;
+    int face[64];
+    bool hasUV = !_uvs.empty();
+    for (int nf : faces) {
+        int n = _faceOffsets[nf + 1] - _faceOffsets[nf];
+        for (int i = 0; i < n; ++i) {
+            int v = _indices[_faceOffsets[nf] + i];
+            auto iter = remap.find(v);
+            if (iter == remap.end()) {
+                iter = remap.insert(std::make_pair(v, (int)mesh.points.size())).first;
+                mesh.points.push_back(_points[v]);
+                if (hasUV) {
+                    mesh.uvs.push_back(_uvs[v]);
+                }
+            }
+            face[i] = iter->second;
+        }
+        mesh.addFace(face, n);
+    }
+
+    auto ret = make_shared<TessellatedPatch>();
+    int n0 = mesh.faceSize(0);
+    for (int level = 0; level < _levels; ++level) {
+        SubdivTopology topo;
+        buildTopology(mesh, &topo);
+        SubdivLocalMesh refined;
+        if (_scheme == SubdivScheme::Loop) {
+            loopSubdivide(mesh, topo, &refined);
+            ret->branching.push_back(4);
+        } else {
+            catmullClarkSubdivide(mesh, topo, &refined);
+            ret->branching.push_back(level == 0 ? n0 : 4);
+        }
+        cropToCentral(&refined);
+        std::swap(mesh, refined);
+    }
+
+    SubdivTopology topo;
+    buildTopology(mesh, &topo);
+
+    // 中心面上的顶点重新编号，作为输出的顶点
+    int nVerts = (int)mesh.points.size();
+    vector<int> outIndex(nVerts, -1);
+    vector<int> outVerts;
+    for (int i = 0; i < mesh.offsets[mesh.nCentral]; ++i) {
+        int v = mesh.indices[i];
+        if (outIndex[v] < 0) {
+            outIndex[v] = (int)outVerts.size();
+            outVerts.push_back(v);
+        }
+    }
+    int nOut = (int)outVerts.size();
+    ret->points.resize(nOut);
+    ret->normals.resize(nOut);
+    if (hasUV) {
+        ret->uvs.resize(nOut);
+    }
+
+    bool displace = _displacement && _displacementScale != 0 && hasUV;
+    for (int k = 0; k < nOut; ++k) {
+        int v = outVerts[k];
+        // 用细分之后(推到极限之前)的位置计算法线与偏导数，
+        // 这些数据在中心面顶点的1-ring中都是正确的，相邻patch算出的结果一致
+        Vector3f nSum(0, 0, 0), dpduSum(0, 0, 0), dpdvSum(0, 0, 0);
+        Float uvLength = 0;
+        int nUV = 0;
+        for (int i = topo.vertexFaceOffsets[v]; i < topo.vertexFaceOffsets[v + 1]; ++i) {
+            int nf = topo.vertexFaces[i];
+            int offset = mesh.offsets[nf];
+            int n = mesh.faceSize(nf);
+            int corner = 0;
+            while (mesh.indices[offset + corner] != v) {
+                ++corner;
+            }
+            int next = mesh.indices[offset + (corner + 1) % n];
+            int prev = mesh.indices[offset + (corner + n - 1) % n];
+            Vector3f dp1 = mesh.points[next] - mesh.points[v];
+            Vector3f dp2 = mesh.points[prev] - mesh.points[v];
+            nSum += cross(dp1, dp2);
+            if (!displace) {
+                continue;
+            }
+            Vector2f duv1 = mesh.uvs[next] - mesh.uvs[v];
+            Vector2f duv2 = mesh.uvs[prev] - mesh.uvs[v];
+            uvLength += duv1.length();
+            ++nUV;
+            Float det = duv1[0] * duv2[1] - duv1[1] * duv2[0];
+            if (std::abs(det) < 1e-12f) {
+                continue;
+            }
+            Float invDet = 1 / det;
+            dpduSum += (duv2[1] * dp1 - duv1[1] * dp2) * invDet;
+            dpdvSum += (-duv2[0] * dp1 + duv1[0] * dp2) * invDet;
+        }
+        Normal3f normal = nSum.lengthSquared() > 0 ? Normal3f(normalize(nSum)) : Normal3f(0, 0, 1);
+        Point3f p = _levels > 0 ? limitPosition(mesh, topo, _scheme, v) : mesh.points[v];
+
+        if (displace) {
+            const Point2f &uv = mesh.uvs[v];
+            SurfaceInteraction si;
+            si.pos = p;
+            si.normal = si.shading.normal = normal;
+            auto evalDisplacement = [&](const Point2f &st) {
+                si.uv = st;
+                Float d = _displacementScale * _displacement->evaluate(si);
+                return clamp(d, -_displacementBound, _displacementBound);
+            };
+            Float d = evalDisplacement(uv);
+            // 与凹凸贴图相同，dp'/du = dp/du + dD/du * n，忽略D * dn/du项
+            // 差分步长取微面边长在纹理空间中的一半
+            Float delta = nUV > 0 ? 0.5f * uvLength / nUV : 0;
+            if (delta > 0 && dpduSum.lengthSquared() > 0 && dpdvSum.lengthSquared() > 0) {
+                Float dDdu = (evalDisplacement(uv + Vector2f(delta, 0)) - d) / delta;
+                Float dDdv = (evalDisplacement(uv + Vector2f(0, delta)) - d) / delta;
+                Vector3f n(normal);
+                Vector3f displacedNormal = cross(dpduSum + dDdu * n, dpdvSum + dDdv * n);
+                if (displacedNormal.lengthSquared() > 0) {
+                    normal = faceforward(Normal3f(normalize(displacedNormal)), normal);
+                }
+            }
+            // 沿位移之前的法线方向移动
+            p += Vector3f(si.normal) * d;
+        }
+        ret->points[k] = p;
+        ret->normals[k] = normal;
+        if (hasUV) {
+            ret->uvs[k] = mesh.uvs[v];
+        }
+    }
+
+    // 四边形拆成两个三角形，n边形(细分0次时)拆成扇形
+    int nLeaves = mesh.nCentral;
+    for (int nf = 0; nf < nLeaves; ++nf) {
+        int offset = mesh.offsets[nf];
+        int n = mesh.faceSize(nf);
+        for (int i = 1; i + 1 < n; ++i) {
+            ret->indices.push_back(outIndex[mesh.indices[offset]]);
+            ret->indices.push_back(outIndex[mesh.indices[offset + i]]);
+            ret->indices.push_back(outIndex[mesh.indices[offset + i + 1]]);
+        }
+    }
+    ret->trisPerLeaf = ret->nTriangles() / nLeaves;
+
+    // 自底向上合并包围盒
+    int depth = (int)ret->branching.size();
+    vector<int> levelSize(depth + 1, 1);
+    for (int l = 0; l < depth; ++l) {
+        levelSize[l + 1] = levelSize[l] * ret->branching[l];
+    }
+    CHECK_EQ(levelSize[depth], nLeaves);
+    ret->levelOffsets.resize(depth + 1);
+    int total = 0;
+    for (int l = 0; l <= depth; ++l) {
+        ret->levelOffsets[l] = total;
+        total += levelSize[l];
+    }
+    ret->bounds.resize(total);
+    for (int leaf = 0; leaf < nLeaves; ++leaf) {
+        AABB3f &b = ret->bounds[ret->levelOffsets[depth] + leaf];
+        for (int tri = leaf * ret->trisPerLeaf; tri < (leaf + 1) * ret->trisPerLeaf; ++tri) {
+            for (int i = 0; i < 3; ++i) {
+                b = unionSet(b, ret->points[ret->indices[3 * tri + i]]);
+            }
+        }
+    }
+    for (int l = depth - 1; l >= 0; --l) {
+        int b = ret->branching[l];
+        for (int node = 0; node < levelSize[l]; ++node) {
+            AABB3f &bound = ret->bounds[ret->levelOffsets[l] + node];
+            for (int i = 0; i < b; ++i) {
+                bound = unionSet(bound, ret->bounds[ret->levelOffsets[l + 1] + node * b + i]);
+            }
+        }
+    }
+    return ret;
+}
+
+SubdivPatch::SubdivPatch(const shared_ptr<const SubdivMesh> &mesh, int face,
+                         const shared_ptr<const Material> &material,
+                         const MediumInterface &mediumInterface)
+: _mesh(mesh),
+_face(face),
+_bounds(mesh->patchBound(face)),
+_material(material),
+_mediumInterface(mediumInterface),
+_id(allocatePrimitiveId()) {
+
+}
+
+SubdivPatch::Cache &SubdivPatch::getCache() {
+    // 默认256MB
+    static Cache cache((size_t)256 << 20);
+    return cache;
+}
+
+shared_ptr<const TessellatedPatch> SubdivPatch::getTessellation() const {
+    uint64_t key = ((uint64_t)_mesh->getId() << 32) | (uint32_t)_face;
+    Cache &cache = getCache();
+    shared_ptr<const TessellatedPatch> ret = cache.get(key);
+    if (!ret) {
+        // 在锁外细分，不阻塞访问同一分片的其他线程
+        shared_ptr<TessellatedPatch> patch = _mesh->tessellate(_face);
+        ret = cache.insert(key, patch, patch->memoryUsage());
+    }
+    return ret;
+}
+
+bool SubdivPatch::intersect(const Ray &ray, SurfaceInteraction *isect) const {
+    shared_ptr<const TessellatedPatch> patch = getTessellation();
+    Float tHit, b1, b2;
+    int tri;
+    if (!patch->intersect(ray, &tHit, &tri, &b1, &b2)) {
+        return false;
+    }
+    Float b0 = 1 - b1 - b2;
+    int i0 = patch->indices[3 * tri];
+    int i1 = patch->indices[3 * tri + 1];
+    int i2 = patch->indices[3 * tri + 2];
+    const Point3f &p0 = patch->points[i0];
+    const Point3f &p1 = patch->points[i1];
+    const Point3f &p2 = patch->points[i2];
+
+    Point2f uv[3];
+    if (patch->uvs.empty()) {
+        uv[0] = Point2f(0, 0);
+        uv[1] = Point2f(1, 0);
+        uv[2] = Point2f(1, 1);
+    } else {
+        uv[0] = patch->uvs[i0];
+        uv[1] = patch->uvs[i1];
+        uv[2] = patch->uvs[i2];
+    }
+
+    Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
+    Vector3f dp02 = p0 - p2, dp12 = p1 - p2;
+    Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
+    bool degenerateUV = std::abs(determinant) < 1e-8;
+    Vector3f dpdu, dpdv;
+    if (!degenerateUV) {
+        Float invdet = 1 / determinant;
+        dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
+        dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
+    }
+    Vector3f ng = cross(dp02, dp12);
+    if (ng.lengthSquared() == 0) {
+        return false;
+    }
+    if (degenerateUV || cross(dpdu, dpdv).lengthSquared() == 0) {
+        coordinateSystem(normalize(ng), &dpdu, &dpdv);
+    }
+
+    Float xAbsSum = (std::abs(b0 * p0.x) + std::abs(b1 * p1.x) + std::abs(b2 * p2.x));
+    Float yAbsSum = (std::abs(b0 * p0.y) + std::abs(b1 * p1.y) + std::abs(b2 * p2.y));
+    Float zAbsSum = (std::abs(b0 * p0.z) + std::abs(b1 * p1.z) + std::abs(b2 * p2.z));
+    Vector3f pError = gamma(7) * Vector3f(xAbsSum, yAbsSum, zAbsSum);
+    Point3f pHit = b0 * p0 + b1 * p1 + b2 * p2;
+    Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
+
+    *isect = SurfaceInteraction(pHit, pError, uvHit, -ray.dir, dpdu, dpdv,
+                                Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time,
+                                nullptr, _face);
+    isect->normal = isect->shading.normal = Normal3f(normalize(ng));
+
+    // 插值顶点法线作为着色法线
+    const Normal3f &n0 = patch->normals[i0];
+    const Normal3f &n1 = patch->normals[i1];
+    const Normal3f &n2 = patch->normals[i2];
+    Normal3f ns = b0 * n0 + b1 * n1 + b2 * n2;
+    ns = ns.lengthSquared() > 0 ? normalize(ns) : isect->normal;
+    Vector3f ss = normalize(isect->dpdu);
+    Vector3f ts = cross(Vector3f(ns), ss);
+    if (ts.lengthSquared() > 0.f) {
+        ts = normalize(ts);
+        ss = cross(ts, Vector3f(ns));
+    } else {
+        coordinateSystem((Vector3f)ns, &ss, &ts);
+    }
+    Normal3f dndu(0, 0, 0), dndv(0, 0, 0);
+    if (!degenerateUV) {
+        Float invDet = 1 / determinant;
+        Normal3f dn1 = n0 - n2;
+        Normal3f dn2 = n1 - n2;
+        dndu = (duv12[1] * dn1 - duv02[1] * dn2) * invDet;
+        dndv = (-duv12[0] * dn1 + duv02[0] * dn2) * invDet;
+    }
+    isect->setShadingGeometry(ss, ts, dndu, dndv, true);
+
+    isect->primitive = this;
+    if (_mediumInterface.isMediumTransition()){
+        isect->mediumInterface = _mediumInterface;
+    } else {
+        isect->mediumInterface = MediumInterface(ray.medium);
+    }
+    return true;
+}
+
+bool SubdivPatch::intersectP(const Ray &ray) const {
+    return getTessellation()->intersectP(ray);
+}
+
+void SubdivPatch::computeScatteringFunctions(SurfaceInteraction *isect,
+                                             MemoryArena &arena, TransportMode mode,
+                                             bool allowMultipleLobes) const {
+    if (_material) {
+        _material->computeScatteringFunctions(isect, arena, mode,
+                                              allowMultipleLobes);
+    }
+    CHECK_GE(dot(isect->normal, isect->shading.normal), 0.);
+}
+
+//data : {
+//    "type" : "triMesh",
+//    "subType" : "subdivision",
+//    "param" : {
+//        "transform" : [
+//            {
+//                "type" : "translate",
+//                "param" : [0,-0.5,0]
+//            }
+//        ],
+//        "scheme" : "catmullClark",
+//        "levels" : 4,
+//        "verts" : [
+//            -0.5,0,-0.5,
+//            0.5,0,-0.5,
+//            0.5,0,0.5,
+//            -0.5,0,0.5
+//        ],
+//        "UVs" : [
+//            0,0,
+//            1,0,
+//            1,1,
+//            0,1
+//        ],
+//        "faceSizes" : [4],
+//        "indexes" : [0,3,2,1],
+//        "displacement" : {
+//            "type" : "image",
+//            "param" : {
+//                "fileName" : "res/height.png",
+//                "fromBasePath" : true
+//            }
+//        },
+//        "displacementScale" : 0.05,
+//        "displacementBound" : 0.05,
+//        "cacheSize" : 256
+//    },
+//    "material" : "matte1"
+//}
+// scheme为"loop"或"catmullClark"，loop要求全部为三角形，faceSizes缺省时认为全部为三角形
+// displacementBound为位移的最大绝对值，缺省时假设纹理的值在[0,1]之间，取|displacementScale|
+// 位移需要网格带有UV，cacheSize为所有细分曲面共享的缓存大小(MB)
+// param也可以是一个json文件名，相对于场景文件所在目录
+vector<shared_ptr<Primitive>> createSubdivPrimitive(const nloJson &data,
+                                                    const shared_ptr<const Material> &mat,
+                                                    const MediumInterface &mediumInterface) {
+    vector<shared_ptr<Primitive>> ret;
+    nloJson param = data.value("param", nloJson::object());
+    if (param.is_string()) {
+        string fn = param;
+        param = createJsonFromFile(Paladin::getInstance()->getBasePath() + fn);
+    }
+    unique_ptr<Transform> o2w(createTransform(param.value("transform", nloJson())));
+
+    nloJson vertData = param.value("verts", nloJson::array());
+    vector<Point3f> points(vertData.size() / 3);
+    for (size_t i = 0; i < points.size(); ++i) {
+        Point3f p(vertData[3 * i], vertData[3 * i + 1], vertData[3 * i + 2]);
+        points[i] = o2w->exec(p);
+    }
+    nloJson uvData = param.value("UVs", nloJson::array());
+    vector<Point2f> uvs;
+    if (uvData.size() == 2 * points.size()) {
+        uvs.resize(points.size());
+        for (size_t i = 0; i < uvs.size(); ++i) {
+            uvs[i] = Point2f(uvData[2 * i], uvData[2 * i + 1]);
+        }
+    }
+    vector<int> indices = param.value("indexes", vector<int>());
+    vector<int> faceSizes = param.value("faceSizes", vector<int>());
+    if (faceSizes.empty()) {
+        faceSizes.assign(indices.size() / 3, 3);
+    }
+    int total = 0;
+    for (int n : faceSizes) {
+        if (n < 3 || n > 64) {
+            COUT << "subdivision face must have 3 to 64 vertices";
+            return ret;
+        }
+        total += n;
+    }
+    if (total != (int)indices.size() || points.empty()) {
+        COUT << "subdivision mesh index count mismatch";
+        return ret;
+    }
+    for (int idx : indices) {
+        if (idx < 0 || idx >= (int)points.size()) {
+            COUT << "subdivision mesh index out of range";
+            return ret;
+        }
+    }
+
+    string schemeStr = param.value("scheme", "catmullClark");
+    SubdivScheme scheme = schemeStr == "loop" ? SubdivScheme::Loop : SubdivScheme::CatmullClark;
+    if (scheme == SubdivScheme::Loop) {
+        for (int n : faceSizes) {
+            if (n != 3) {
+                COUT << "loop subdivision needs a triangle mesh, use catmullClark instead";
+                scheme = SubdivScheme::CatmullClark;
+                break;
+            }
+        }
+    }
+    // 8次细分之后一个三角形变为65536个
+    int levels = clamp(param.value("levels", 3), 0, 8);
+
+    shared_ptr<const Texture<Float>> displacement(createFloatTexture(param.value("displacement", nloJson())));
+    Float displacementScale = param.value("displacementScale", 1.f);
+    Float displacementBound = param.value("displacementBound", std::abs(displacementScale));
+    if (displacement && uvs.empty()) {
+        COUT << "subdivision displacement needs UVs, ignored";
+        displacement = nullptr;
+    }
+
+    if (param.count("cacheSize")) {
+        size_t megaBytes = param.value("cacheSize", 256);
+        SubdivPatch::getCache().setCapacity(megaBytes << 20);
+    }
+
+    auto mesh = make_shared<SubdivMesh>(scheme, levels, points, uvs, faceSizes, indices,
+                                        displacement, displacementScale, displacementBound);
+    for (int f = 0; f < mesh->nFaces(); ++f) {
+        ret.push_back(make_shared<SubdivPatch>(mesh, f, mat, mediumInterface));
+    }
+    return ret;
+}
+
+PALADIN_END
@@ -0,0 +1,181 @@
+//
+//  subdivision.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/8.
+//
+
+#ifndef subdivision_hpp
+#define subdivision_hpp
+
+#include "core/header.h"
+#include "core/primitive.hpp"
+#include "core/texture.hpp"
+#include "tools/lrucache.hpp"
+
+PALADIN_BEGIN
+
+/**
+ * Loop : 只适用于三角形网格，每次细分一个三角形变为4个
+ * CatmullClark : 适用于任意多边形网格，第一次细分n边形变为n个四边形，之后每次一个四边形变为4个
+ */
+enum class SubdivScheme { Loop, CatmullClark };
+
+/**
+ * 一个patch细分之后的微三角形以及它们的层次包围盒
+ * 这是缓存中的数据，patch第一次被光线击中时才会创建
+ *
+ * 细分时子面总是紧接着父面的顺序排列，所以微面天然构成一颗隐式的树，
+ * 第l层的第j个节点的子节点为第l+1层的[j * b, (j + 1) * b)，b为该层的分支数，
+ * 不需要额外构建BVH，只需要自底向上合并包围盒
+ * 最底层的每个节点(微面)包含trisPerLeaf个三角形
+ */
+struct TessellatedPatch {
+    // 所有数据都在世界空间中
+    vector<Point3f> points;
+    vector<Normal3f> normals;
+    vector<Point2f> uvs;
+    vector<int> indices;
+    // 每层节点在bounds中的偏移量，以及每层的分支数
+    vector<int> levelOffsets;
+    vector<int> branching;
+    vector<AABB3f> bounds;
+    int trisPerLeaf;
+
+    int nTriangles() const {
+        return (int)indices.size() / 3;
+    }
+
+    // 占用的字节数，作为缓存的容量计算依据
+    size_t memoryUsage() const;
+
+    /**
+     * 找到最近的交点，返回三角形编号以及重心坐标
+     */
+    bool intersect(const Ray &ray, Float *tHit, int *triIndex,
+                   Float *b1, Float *b2) const;
+
+    bool intersectP(const Ray &ray) const;
+};
+
+/**
+ * 细分曲面的控制网格，所有数据都在世界空间中
+ * 控制网格的每个面为一个patch，只有patch被光线击中时才进行细分，
+ * 细分结果保存在全局的LRU缓存中，缓存容量固定，
+ * 所以无论相机看到多少细节，内存占用都不会超过上限
+ *
+ * 细分一个patch时，只需要它的1-ring邻域(与它共享顶点的面)，
+ * 每细分一次，只保留中心面的子面以及它们的1-ring，
+ * 邻域外侧的点虽然算得不对，但每次只向内传播半个环，不会影响到中心面
+ */
+class SubdivMesh {
+public:
+    SubdivMesh(SubdivScheme scheme, int levels,
+               const vector<Point3f> &points, const vector<Point2f> &uvs,
+               const vector<int> &faceVertexCounts, const vector<int> &indices,
+               const shared_ptr<const Texture<Float>> &displacement,
+               Float displacementScale, Float displacementBound);
+
+    int nFaces() const {
+        return (int)_faceOffsets.size() - 1;
+    }
+
+    /**
+     * 第f个patch的包围盒
+     * 极限曲面上的点都是1-ring控制点的凸组合(权重非负)，
+     * 所以1-ring控制点的包围盒扩展最大位移距离，一定能包住细分并位移之后的patch
+     */
+    AABB3f patchBound(int f) const;
+
+    /**
+     * 细分第f个patch，在这之后将顶点推到极限位置，并沿法线方向位移
+     */
+    shared_ptr<TessellatedPatch> tessellate(int f) const;
+
+    int getId() const {
+        return _id;
+    }
+
+private:
+
+    void gatherNeighborhood(int f, vector<int> *faces) const;
+
+    const SubdivScheme _scheme;
+    const int _levels;
+    vector<Point3f> _points;
+    vector<Point2f> _uvs;
+    vector<int> _faceOffsets;
+    vector<int> _indices;
+    // 顶点相邻的面，CSR格式
+    vector<int> _vertexFaceOffsets;
+    vector<int> _vertexFaces;
+    shared_ptr<const Texture<Float>> _displacement;
+    const Float _displacementScale;
+    // 位移的最大绝对值，用于计算包围盒
+    const Float _displacementBound;
+    const int _id;
+};
+
+/**
+ * 细分曲面的一个patch，作为一个图元放入场景的BVH中
+ * 本身只保存一个面的编号以及保守的包围盒，求交时从缓存中取出细分结果
+ */
+class SubdivPatch : public Primitive {
+public:
+    SubdivPatch(const shared_ptr<const SubdivMesh> &mesh, int face,
+                const shared_ptr<const Material> &material,
+                const MediumInterface &mediumInterface);
+
+    virtual AABB3f worldBound() const override {
+        return _bounds;
+    }
+
+    virtual bool intersect(const Ray &r, SurfaceInteraction *isect) const override;
+
+    virtual bool intersectP(const Ray &r) const override;
+
+    // 暂时不支持发光的细分曲面
+    virtual const AreaLight *getAreaLight() const override {
+        return nullptr;
+    }
+
+    virtual const Material *getMaterial() const override {
+        return _material.get();
+    }
+
+    virtual int getId() const override {
+        return _id;
+    }
+
+    virtual void computeScatteringFunctions(SurfaceInteraction *isect,
+                                            MemoryArena &arena, TransportMode mode,
+                                            bool allowMultipleLobes) const override;
+
+    virtual nloJson toJson() const override {
+        return nloJson();
+    }
+
+    // 所有细分曲面共享的缓存，key为网格id与面编号的组合
+    typedef LRUCache<uint64_t, TessellatedPatch> Cache;
+
+    static Cache &getCache();
+
+private:
+
+    shared_ptr<const TessellatedPatch> getTessellation() const;
+
+    shared_ptr<const SubdivMesh> _mesh;
+    const int _face;
+    const AABB3f _bounds;
+    shared_ptr<const Material> _material;
+    MediumInterface _mediumInterface;
+    const int _id;
+};
+
+vector<shared_ptr<Primitive>> createSubdivPrimitive(const nloJson &data,
+                                                    const shared_ptr<const Material> &mat,
+                                                    const MediumInterface &mediumInterface);
+
+PALADIN_END
+
+#endif /* subdivision_hpp */
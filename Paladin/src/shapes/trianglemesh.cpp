@@ -136,6 +136,21 @@ AABB3f Triangle::objectBound() const {
 
 bool Triangle::watertightIntersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                          bool testAlphaTexture) const {
+    Float t, b1, b2;
+    if (!intersectHit(ray, &t, &b1, &b2, testAlphaTexture)) {
+        return false;
+    }
+    computeInteraction(ray, t, b1, b2, isect);
+    *tHit = t;
+    return true;
+}
+
+/**
+ * 只计算交点的t值以及重心坐标，BVH遍历时每个候选三角形都会调用，
+ * 大部分候选交点之后都会被更近的交点覆盖，所以SurfaceInteraction留到最后再构造
+ */
+bool Triangle::intersectHit(const Ray &ray, Float *tHit, Float *u, Float *v,
+                            bool testAlphaTexture) const {
     const Point3f &p0 = _mesh->points[_vertexIdx[0].pos];
     const Point3f &p1 = _mesh->points[_vertexIdx[1].pos];
     const Point3f &p2 = _mesh->points[_vertexIdx[2].pos];
@@ -202,7 +217,6 @@ bool Triangle::watertightIntersect(const Ray &ray, Float *tHit, SurfaceInteracti
 
      // Compute barycentric coordinates and $t$ value for triangle intersection
     Float invDet = 1 / det;
-    Float b0 = e0 * invDet;
     Float b1 = e1 * invDet;
     Float b2 = e2 * invDet;
     Float t = tScaled * invDet;
@@ -230,6 +244,28 @@ bool Triangle::watertightIntersect(const Ray &ray, Float *tHit, SurfaceInteracti
                 std::abs(invDet);
     if (t <= deltaT) return false;
 
+    // 退化的三角形，交点无效
+    if (cross(p2 - p0, p1 - p0).lengthSquared() == 0) return false;
+
+    // Test intersection against alpha texture, if present
+    if (testAlphaTexture && _mesh->alphaMask) {
+        SurfaceInteraction isectLocal;
+        computeInteraction(ray, t, b1, b2, &isectLocal);
+        if (_mesh->alphaMask->evaluate(isectLocal) == 0) return false;
+    }
+    *tHit = t;
+    *u = b1;
+    *v = b2;
+    return true;
+}
+
+void Triangle::computeInteraction(const Ray &ray, Float tHit, Float b1, Float b2,
+                                  SurfaceInteraction *isect) const {
+    const Point3f &p0 = _mesh->points[_vertexIdx[0].pos];
+    const Point3f &p1 = _mesh->points[_vertexIdx[1].pos];
+    const Point3f &p2 = _mesh->points[_vertexIdx[2].pos];
+    Float b0 = 1 - b1 - b2;
+
     // Compute triangle partial derivatives
     Vector3f dpdu, dpdv;
     Point2f uv[3];
@@ -247,12 +283,8 @@ bool Triangle::watertightIntersect(const Ray &ray, Float *tHit, SurfaceInteracti
     }
     if (degenerateUV || cross(dpdu, dpdv).lengthSquared() == 0) {
         // Handle zero determinant for triangle partial derivative matrix
+        // 退化的三角形已经在intersectHit中排除
         Vector3f ng = cross(p2 - p0, p1 - p0);
-        if (ng.lengthSquared() == 0)
-            // The triangle is actually degenerate; the intersection is
-            // bogus.
-            return false;
-
         coordinateSystem(normalize(ng), &dpdu, &dpdv);
     }
 
@@ -269,14 +301,6 @@ bool Triangle::watertightIntersect(const Ray &ray, Float *tHit, SurfaceInteracti
     Point3f pHit = b0 * p0 + b1 * p1 + b2 * p2;
     Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
 
-    // Test intersection against alpha texture, if present
-    if (testAlphaTexture && _mesh->alphaMask) {
-        SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.dir,
-                                       dpdu, dpdv, Normal3f(0, 0, 0),
-                                       Normal3f(0, 0, 0), ray.time, this);
-        if (_mesh->alphaMask->evaluate(isectLocal) == 0) return false;
-    }
-
      // Fill in _SurfaceInteraction_ from triangle hit
     *isect = SurfaceInteraction(pHit, pError, uvHit, -ray.dir, dpdu, dpdv,
                                  Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time,
@@ -359,8 +383,6 @@ bool Triangle::watertightIntersect(const Ray &ray, Float *tHit, SurfaceInteracti
         isect->normal = faceforward(isect->normal, isect->shading.normal);
     else if (reverseOrientation ^ transformSwapsHandedness)
         isect->normal = isect->shading.normal = -isect->normal;
-    *tHit = t;
-    return true;
 }
 
 /**
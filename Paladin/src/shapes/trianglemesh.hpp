@@ -132,6 +132,17 @@ public:
     
     bool watertightIntersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                              bool testAlphaTexture = true) const;
+
+    virtual bool supportsDeferredHit() const override {
+        return true;
+    }
+
+    // u,v为p1,p2的重心坐标
+    virtual bool intersectHit(const Ray &ray, Float *tHit, Float *u, Float *v,
+                              bool testAlphaTexture = true) const override;
+
+    virtual void computeInteraction(const Ray &ray, Float tHit, Float u, Float v,
+                                    SurfaceInteraction *isect) const override;
     
     bool classicIntersectP(const Ray &ray, bool testAlphaTexture) const;
     
@@ -32,6 +32,12 @@ public:
                 + (st[0]) * (st[1]) * _v11;
     }
     
+    virtual TextureReg<T> compile(TextureProgram *program) const override {
+        return program->bilerp(program->mapping(_mapping.get()),
+                               program->constant(_v00), program->constant(_v01),
+                               program->constant(_v10), program->constant(_v11));
+    }
+    
     virtual nloJson toJson() const override {
         return nloJson();
     }
@@ -25,6 +25,10 @@ public:
         return _value;
     }
     
+    virtual TextureReg<T> compile(TextureProgram *program) const override {
+        return program->constant(_value);
+    }
+    
     virtual nloJson toJson() const override {
         return nloJson();
     }
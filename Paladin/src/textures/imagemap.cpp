@@ -14,23 +14,23 @@ template <typename Tmemory, typename Treturn>
 std::map<TexInfo, std::unique_ptr<MIPMap<Tmemory>>>
     ImageTexture<Tmemory, Treturn>::_imageCache;
 
-shared_ptr<ImageTexture<RGBSpectrum, Spectrum>> createImageMap(const string &filename, bool gamma, bool doTri,
+shared_ptr<ImageTexture<RGBSpectrum, Spectrum>> createImageMap(const string &filename, bool gamma, MIPFilter filter,
                                                                     Float maxAniso, ImageWrap wm, Float scale,
                                                                     bool doFilter,
                                                                     unique_ptr<TextureMapping2D> mapping) {
     return make_shared<ImageTexture<RGBSpectrum, Spectrum>>(move(mapping),
                                                             filename,
-                                                            doTri, maxAniso,
+                                                            filter, maxAniso,
                                                             wm, scale, gamma,doFilter);
 }
 
-shared_ptr<ImageTexture<Float, Float>> createFloatMap(const string &filename, bool gamma, bool doTri,
+shared_ptr<ImageTexture<Float, Float>> createFloatMap(const string &filename, bool gamma, MIPFilter filter,
                                                             Float maxAniso, ImageWrap wm, Float scale,
                                                             bool doFilter,
                                                             unique_ptr<TextureMapping2D> mapping) {
     return make_shared<ImageTexture<Float, Float>>(move(mapping),
                                                             filename,
-                                                            doTri, maxAniso,
+                                                            filter, maxAniso,
                                                             wm, scale, gamma,doFilter);
 }
 
@@ -38,6 +38,7 @@ template class ImageTexture<RGBSpectrum, Spectrum>;
 //"param" : {
 //    "fileName" : "res/planet_Quom1200.png",
 //    "doTri" : true,
+//    "filter" : 0,
 //    "maxAniso" : 8,
 //    "wrapMode" : 0,
 //    "scale" : 1,
@@ -53,13 +54,15 @@ CObject_ptr createImageMap(const nloJson &param, const Arguments &lst) {
         fn = basePath + fn;
     }
     bool doTri = param.value("doTri", true);
+    // 0:三线性，1:EWA，2:沿长轴多次三线性采样，未指定时由doTri决定
+    MIPFilter filter = (MIPFilter)param.value("filter", doTri ? 0 : 1);
     Float maxAniso = param.value("maxAniso", 8.f);
     int wrapMode = param.value("wrapMode", 0);
     Float scale = param.value("scale", 1.f);
     bool gamma = param.value("gamma", false);
     bool doFilter = param.value("doFilter", true);
     auto ret = new ImageTexture<RGBSpectrum, Spectrum>(move(mapping), fn,
-                                                       doTri, maxAniso,
+                                                       filter, maxAniso,
                                                        (ImageWrap)wrapMode,
                                                        scale, gamma, doFilter);
     return ret;
@@ -68,6 +71,7 @@ CObject_ptr createImageMap(const nloJson &param, const Arguments &lst) {
 //"param" : {
 //    "fileName" : "res/planet_Quom1200.png",
 //    "doTri" : true,
+//    "filter" : 0,
 //    "maxAniso" : 8,
 //    "wrapMode" : 0,
 //    "scale" : 1,
@@ -82,13 +86,15 @@ CObject_ptr createFloatMap(const nloJson &param, const Arguments &lst) {
         fn = basePath + fn;
     }
     bool doTri = param.value("doTri", true);
+    // 0:三线性，1:EWA，2:沿长轴多次三线性采样，未指定时由doTri决定
+    MIPFilter filter = (MIPFilter)param.value("filter", doTri ? 0 : 1);
     Float maxAniso = param.value("maxAniso", 8.f);
     int wrapMode = param.value("wrapMode", 0);
     Float scale = param.value("scale", 1.f);
     bool gamma = param.value("gamma", false);
     bool doFilter = param.value("doFilter", true);
     auto ret = new ImageTexture<Float, Float>(move(mapping), fn,
-                                                       doTri, maxAniso,
+                                                       filter, maxAniso,
                                                        (ImageWrap)wrapMode,
                                                        scale, gamma, doFilter);
     return ret;
@@ -17,12 +17,12 @@ PALADIN_BEGIN
 /**
  * 纹理信息
  * todo，这里可以进行内存方面的优化
- * 如果仅仅是doTrilinear，或maxAniso这类属性方面的差异，是可以复用的，不需要再创建
+ * 如果仅仅是filter，或maxAniso这类属性方面的差异，是可以复用的，不需要再创建
  */
 struct TexInfo {
-    TexInfo(const std::string &f, bool dt, Float ma, ImageWrap wm, Float sc, bool gamma)
+    TexInfo(const std::string &f, MIPFilter ft, Float ma, ImageWrap wm, Float sc, bool gamma)
     : filename(f),
-	doTrilinear(dt),
+	filter(ft),
 	maxAniso(ma),
 	wrapMode(wm),
 	scale(sc),
@@ -31,8 +31,8 @@ struct TexInfo {
 	}
 	// 文件名
     std::string filename;
-    // 是否进行三角过滤
-    bool doTrilinear;
+    // 过滤方式
+    MIPFilter filter;
     // 各向异性最大比例
     Float maxAniso;
     // 环绕模式
@@ -44,8 +44,8 @@ struct TexInfo {
     bool operator<(const TexInfo &t2) const {
         if (filename != t2.filename) 
         	return filename < t2.filename;
-        if (doTrilinear != t2.doTrilinear) 
-        	return doTrilinear < t2.doTrilinear;
+        if (filter != t2.filter) 
+        	return filter < t2.filter;
         if (maxAniso != t2.maxAniso) 
         	return maxAniso < t2.maxAniso;
         if (scale != t2.scale) 
@@ -68,11 +68,11 @@ class ImageTexture : public Texture<Treturn> {
 
 public:
 	ImageTexture(std::unique_ptr<TextureMapping2D> mapping,
-	            const std::string &filename, bool doTri, Float maxAniso,
+	            const std::string &filename, MIPFilter filter, Float maxAniso,
 	            ImageWrap wm, Float scale, bool gamma, bool doFilter = true)
 	: _mapping(std::move(mapping)) {
         _doFilter = doFilter;
-		_mipmap = getTexture(filename, doTri, maxAniso, wm, scale, gamma);
+		_mipmap = getTexture(filename, filter, maxAniso, wm, scale, gamma);
 	}
 
 	static void clearCache() {
@@ -92,18 +92,23 @@ public:
 	    convertOut(mem, &ret);
 	    return ret;
 	}
+    
+    // 使用相同映射的贴图共用一次映射的计算
+    virtual TextureReg<Treturn> compile(TextureProgram *program) const override {
+        return program->image(_mipmap, program->mapping(_mapping.get()), _doFilter);
+    }
             
     virtual nloJson toJson() const override {
         return nloJson();
     }
             
     static MIPMap<Tmemory> *getTexture(const std::string &filename,
-                                       bool doTrilinear,
+                                       MIPFilter filter,
                                        Float maxAniso,
                                        ImageWrap wm,
                                        Float scale,
                                        bool gamma) {
-        TexInfo textInfo(filename, doTrilinear, maxAniso, wm, scale, gamma);
+        TexInfo textInfo(filename, filter, maxAniso, wm, scale, gamma);
         // 先从纹理缓存中查找，如果找得到，直接返回对应mipmap指针
         if (_imageCache.find(textInfo) != _imageCache.end()) {
             return _imageCache[textInfo].get();
@@ -134,7 +139,7 @@ public:
             convertIn(texels[i], &convertedTexels[i], scale, gamma);
         }
         mipmap = new MIPMap<Tmemory>(resolution, convertedTexels.get(),
-                                     doTrilinear, maxAniso, wm);
+                                     filter, maxAniso, wm);
         _imageCache[textInfo].reset(mipmap);
         return mipmap;
     }
@@ -172,13 +177,13 @@ private:
 };
 
 
-shared_ptr<ImageTexture<RGBSpectrum, Spectrum>> createImageMap(const string &filename, bool gamma = false, bool doTri = true,
+shared_ptr<ImageTexture<RGBSpectrum, Spectrum>> createImageMap(const string &filename, bool gamma = false, MIPFilter filter = MIPFilter::Trilinear,
                                         Float maxAniso = 8, ImageWrap wm = ImageWrap::Repeat,
                                         Float scale = 1, bool doFilter = true,
                                         unique_ptr<TextureMapping2D> mapping = unique_ptr<TextureMapping2D>(new UVMapping2D()));
             
 shared_ptr<ImageTexture<Float, Float>> createFloatMap(const string &filename,
-                                        bool gamma = false, bool doTri = true,
+                                        bool gamma = false, MIPFilter filter = MIPFilter::Trilinear,
                                         Float maxAniso = 8, ImageWrap wm = ImageWrap::Repeat,
                                         Float scale = 1, bool doFilter = true,
                                         unique_ptr<TextureMapping2D> mapping = unique_ptr<TextureMapping2D>(new UVMapping2D()));
@@ -29,6 +29,11 @@ public:
         return (1 - amt) * t1 + amt * t2;
     }
     
+    virtual TextureReg<T> compile(TextureProgram *program) const override {
+        return program->mix(_tex1->compile(program), _tex2->compile(program),
+                            _amount->compile(program));
+    }
+    
     virtual nloJson toJson() const override {
         return nloJson();
     }
@@ -27,6 +27,11 @@ public:
         return _tex1->evaluate(si) * _tex2->evaluate(si);
     }
     
+    // 任意一个因子为常量0或1时可以折叠
+    virtual TextureReg<T2> compile(TextureProgram *program) const override {
+        return program->mul(_tex1->compile(program), _tex2->compile(program));
+    }
+    
     virtual nloJson toJson() const override {
         return nloJson();
     }
@@ -19,6 +19,10 @@
 
 #include <ImfRgba.h>
 #include <ImfRgbaFile.h>
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfHeader.h>
 #include "core/mipmap.h"
 
 
@@ -85,6 +89,58 @@ static void _writeImageEXR(const std::string &name, const Float *pixels,
     delete[] hrgba;
 }
 
+/**
+ * 多图层exr，所有通道都以32位float储存，深度，ID之类的数据用half精度不够
+ */
+static void _writeImageLayersEXR(const std::string &name, const std::vector<ImageLayer> &layers,
+                                 int xRes, int yRes, int totalXRes, int totalYRes,
+                                 int xOffset, int yOffset) {
+    using namespace Imf;
+    using namespace Imath;
+    
+    Box2i displayWindow(V2i(0, 0), V2i(totalXRes - 1, totalYRes - 1));
+    Box2i dataWindow(V2i(xOffset, yOffset),
+                     V2i(xOffset + xRes - 1, yOffset + yRes - 1));
+    Header header(displayWindow, dataWindow);
+    
+    size_t nChannels = 0;
+    for (const ImageLayer &layer : layers) {
+        nChannels += layer.channels.size();
+    }
+    // 先分配好所有缓冲区，之后再插入FrameBuffer，避免vector扩容导致指针失效
+    std::vector<std::vector<float>> buffers(nChannels, std::vector<float>(xRes * yRes));
+    std::vector<std::string> channelNames;
+    size_t index = 0;
+    for (const ImageLayer &layer : layers) {
+        int nc = layer.channels.size();
+        for (int c = 0; c < nc; ++c, ++index) {
+            std::string chName = layer.name.empty() ?
+                                layer.channels[c] :
+                                layer.name + "." + layer.channels[c];
+            channelNames.push_back(chName);
+            header.channels().insert(chName.c_str(), Channel(FLOAT));
+            std::vector<float> &buf = buffers[index];
+            for (int i = 0; i < xRes * yRes; ++i) {
+                buf[i] = layer.data[nc * i + c];
+            }
+        }
+    }
+    
+    FrameBuffer frameBuffer;
+    for (size_t i = 0; i < nChannels; ++i) {
+        char *base = (char *)(buffers[i].data() - xOffset - yOffset * xRes);
+        frameBuffer.insert(channelNames[i].c_str(),
+                           Slice(FLOAT, base, sizeof(float), sizeof(float) * xRes));
+    }
+    
+    try {
+        OutputFile file(name.c_str(), header);
+        file.setFrameBuffer(frameBuffer);
+        file.writePixels(yRes);
+    } catch (const std::exception &exc) {
+        LOG(ERROR) << StringPrintf("Error writing \"%s\": %s", name.c_str(), exc.what());
+    }
+}
 
 static RGBSpectrum * _readImageEXR(const std::string &name, int *width,
                           int *height, AABB2i *dataWindow = nullptr,
@@ -330,4 +386,85 @@ void writeImage(const std::string &name,
     }
 }
 
+void writeImageLayers(const std::string &name, const std::vector<ImageLayer> &layers,
+                      const AABB2i &outputBounds, const Point2i &totalResolution) {
+    CHECK(!layers.empty());
+    if (hasExtension(name, "exr") && layers.size() > 1) {
+        Vector2i resolution = outputBounds.diagonal();
+        _writeImageLayersEXR(name, layers, resolution.x, resolution.y,
+                             totalResolution.x, totalResolution.y,
+                             outputBounds.pMin.x, outputBounds.pMin.y);
+        return;
+    }
+    // 其他格式只输出beauty图层
+    CHECK_EQ(layers[0].channels.size(), 3);
+    writeImage(name, layers[0].data.data(), outputBounds, totalResolution);
+}
+
+AsyncImageWriter * AsyncImageWriter::getInstance() {
+    // 局部静态变量，程序退出时析构，保证所有任务都已经写完
+    static AsyncImageWriter writer;
+    return &writer;
+}
+
+AsyncImageWriter::AsyncImageWriter() {
+    _thread = std::thread(&AsyncImageWriter::workerLoop, this);
+}
+
+AsyncImageWriter::~AsyncImageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _exit = true;
+    }
+    _taskCondition.notify_all();
+    _thread.join();
+}
+
+void AsyncImageWriter::submit(const std::vector<std::string> &fileNames,
+                              std::vector<ImageLayer> layers,
+                              const AABB2i &outputBounds, const Point2i &totalResolution) {
+    Task task;
+    task.fileNames = fileNames;
+    task.layers = std::move(layers);
+    task.outputBounds = outputBounds;
+    task.totalResolution = totalResolution;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+    _taskCondition.notify_one();
+}
+
+void AsyncImageWriter::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idleCondition.wait(lock, [this]() {
+        return _tasks.empty() && _running == 0;
+    });
+}
+
+void AsyncImageWriter::workerLoop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _taskCondition.wait(lock, [this]() {
+            return _exit || !_tasks.empty();
+        });
+        if (_tasks.empty()) {
+            // 退出时队列已经清空
+            break;
+        }
+        Task task = std::move(_tasks.front());
+        _tasks.pop_front();
+        ++_running;
+        lock.unlock();
+        for (const std::string &fileName : task.fileNames) {
+            writeImageLayers(fileName, task.layers, task.outputBounds, task.totalResolution);
+        }
+        lock.lock();
+        --_running;
+        if (_tasks.empty() && _running == 0) {
+            _idleCondition.notify_all();
+        }
+    }
+}
+
 PALADIN_END
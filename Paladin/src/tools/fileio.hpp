@@ -11,6 +11,8 @@
 
 #include "core/header.h"
 #include <fstream>
+#include <deque>
+#include <thread>
 
 PALADIN_BEGIN
 
@@ -19,6 +21,94 @@ std::unique_ptr<RGBSpectrum[]> readImage(const std::string &name, Point2i *resol
 void writeImage(const std::string &name, const Float *rgb,
                 const AABB2i &outputBounds, const Point2i &totalResolution);
 
+/**
+ * 图像的一个图层，例如beauty，albedo，normal，depth
+ * data中按像素依次储存各个通道的值，长度为 channels.size() * 像素数
+ */
+struct ImageLayer {
+    // 图层名，beauty图层为空
+    std::string name;
+    // 通道名，例如 {"R", "G", "B"}，{"Z"}
+    std::vector<std::string> channels;
+    
+    std::vector<Float> data;
+    
+    ImageLayer() {
+        
+    }
+    
+    ImageLayer(const std::string &name, const std::vector<std::string> &channels, size_t nPixels)
+    : name(name),
+    channels(channels),
+    data(channels.size() * nPixels, 0.f) {
+        
+    }
+};
+
+/**
+ * 输出多个图层
+ * exr格式把所有图层写入同一个文件，通道名为 "图层名.通道名"，beauty图层的通道名不加前缀
+ * 其他格式不支持多图层，只输出第一个图层(beauty)
+ */
+void writeImageLayers(const std::string &name, const std::vector<ImageLayer> &layers,
+                      const AABB2i &outputBounds, const Point2i &totalResolution);
+
+/**
+ * 后台编码图片的线程
+ * 图片编码(尤其是png的压缩)与写文件比较慢，如果在渲染线程中同步执行，
+ * 渲染完一帧之后要等编码结束才能开始下一帧
+ * 这里用一个后台线程按照提交的顺序执行写文件的任务，渲染线程提交之后立即返回
+ * 同一个文件的多次写入(例如渐进式渲染的快照)按提交顺序执行，最后一次提交的结果不会被覆盖
+ * 程序退出时析构函数会执行完所有未完成的任务
+ */
+class AsyncImageWriter {
+    
+public:
+    
+    static AsyncImageWriter * getInstance();
+    
+    ~AsyncImageWriter();
+    
+    /**
+     * 提交一个写文件的任务，layers的所有权转移给任务
+     */
+    void submit(const std::vector<std::string> &fileNames,
+                std::vector<ImageLayer> layers,
+                const AABB2i &outputBounds, const Point2i &totalResolution);
+    
+    /**
+     * 阻塞直到所有已提交的任务执行完毕
+     */
+    void wait();
+    
+private:
+    
+    AsyncImageWriter();
+    
+    void workerLoop();
+    
+    struct Task {
+        std::vector<std::string> fileNames;
+        std::vector<ImageLayer> layers;
+        AABB2i outputBounds;
+        Point2i totalResolution;
+    };
+    
+    std::deque<Task> _tasks;
+    // 正在执行的任务数
+    int _running = 0;
+    
+    bool _exit = false;
+    
+    std::mutex _mutex;
+    
+    std::condition_variable _taskCondition;
+    
+    std::condition_variable _idleCondition;
+    
+    std::thread _thread;
+};
+
 inline nloJson createJsonFromFile(const std::string &fn) {
     std::ifstream fst;
     fst.open(fn.c_str());
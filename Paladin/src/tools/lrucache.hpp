@@ -0,0 +1,146 @@
+//
+//  lrucache.hpp
+//  Paladin
+//
+//  Created by SATAN_Z on 2020/3/8.
+//
+
+#ifndef lrucache_hpp
+#define lrucache_hpp
+
+#include "core/header.h"
+#include <list>
+#include <unordered_map>
+
+PALADIN_BEGIN
+
+/**
+ * 线程安全的LRU缓存，容量以字节为单位
+ *
+ * 渲染时每条光线都可能访问缓存，只用一把锁的话竞争会很严重
+ * 所以按照key的哈希值分成若干个分片，每个分片有自己的锁，链表以及容量，
+ * 不同线程访问不同分片时互不影响
+ *
+ * value以shared_ptr<const Value>的形式返回，
+ * 某个条目被淘汰时，正在使用它的线程仍然持有引用，不会被提前释放
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LRUCache {
+
+public:
+    typedef shared_ptr<const Value> ValuePtr;
+
+    LRUCache(size_t capacity, int nShards = 64)
+    : _nShards(std::max(1, nShards)),
+    _shards(new Shard[std::max(1, nShards)]) {
+        setCapacity(capacity);
+    }
+
+    /**
+     * 查找key对应的值，找到时将条目移到链表头部，找不到返回空指针
+     */
+    ValuePtr get(const Key &key) {
+        Shard &shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto iter = shard.map.find(key);
+        if (iter == shard.map.end()) {
+            return nullptr;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+        return iter->second->value;
+    }
+
+    /**
+     * 插入一个条目，cost为该条目占用的字节数
+     * 两个线程可能同时对同一个key未命中并各自创建了value，
+     * 这时保留先插入的那个，并返回它，保证所有线程看到的是同一份数据
+     * 插入之后从链表尾部淘汰条目，直到分片占用不超过容量，刚插入的条目不会被淘汰
+     */
+    ValuePtr insert(const Key &key, const ValuePtr &value, size_t cost) {
+        Shard &shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto iter = shard.map.find(key);
+        if (iter != shard.map.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+            return iter->second->value;
+        }
+        shard.lru.push_front(Entry(key, value, cost));
+        shard.map[key] = shard.lru.begin();
+        shard.cost += cost;
+        size_t capacity = _shardCapacity;
+        while (shard.cost > capacity && shard.lru.size() > 1) {
+            const Entry &last = shard.lru.back();
+            shard.cost -= last.cost;
+            shard.map.erase(last.key);
+            shard.lru.pop_back();
+        }
+        return value;
+    }
+
+    /**
+     * 容量平均分配到每个分片，缩小容量时，多出来的条目在下一次插入时淘汰
+     */
+    void setCapacity(size_t capacity) {
+        _shardCapacity = std::max(capacity / _nShards, (size_t)1);
+    }
+
+    size_t getCapacity() const {
+        return _shardCapacity * _nShards;
+    }
+
+    // 当前占用的总字节数
+    size_t memoryUsage() const {
+        size_t ret = 0;
+        for (int i = 0; i < _nShards; ++i) {
+            std::lock_guard<std::mutex> lock(_shards[i].mutex);
+            ret += _shards[i].cost;
+        }
+        return ret;
+    }
+
+    void clear() {
+        for (int i = 0; i < _nShards; ++i) {
+            std::lock_guard<std::mutex> lock(_shards[i].mutex);
+            _shards[i].map.clear();
+            _shards[i].lru.clear();
+            _shards[i].cost = 0;
+        }
+    }
+
+private:
+
+    struct Entry {
+        Entry(const Key &key, const ValuePtr &value, size_t cost)
+        : key(key), value(value), cost(cost) {
+
+        }
+        Key key;
+        ValuePtr value;
+        size_t cost;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        // 链表头部为最近使用的条目
+        std::list<Entry> lru;
+        std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> map;
+        size_t cost = 0;
+    };
+
+    Shard &getShard(const Key &key) {
+        // 哈希值可能是key本身(整数)，先混合一下再取模，避免相邻的key集中在少数分片
+        uint64_t h = (uint64_t)Hash()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return _shards[h % _nShards];
+    }
+
+    const int _nShards;
+    std::unique_ptr<Shard[]> _shards;
+    std::atomic<size_t> _shardCapacity;
+};
+
+PALADIN_END
+
+#endif /* lrucache_hpp */
@@ -307,6 +307,25 @@ public:
         return offset;
     }
 
+    /**
+     * getTotalOffset(u, v) = rowOffset(v) + columnOffset(u)
+     * 拆开之后同一行的多个像素只需要计算一次rowOffset，
+     * columnOffset只有移位与按位与，可以对多个u同时计算
+     */
+    inline int rowOffset(int v) const {
+        return blockSize() * blockSize() * _uBlocks * block(v) + blockSize() * offset(v);
+    }
+
+    inline int columnOffset(int u) const {
+        return (block(u) << (2 * logBlockSize)) + offset(u);
+    }
+
+    static CONSTEXPR int LogBlockSize = logBlockSize;
+
+    const T *data() const {
+        return _data;
+    }
+
     T &operator()(int u, int v) {
         int offset = getTotalOffset(u, v);
         return _data[offset];